@@ -324,14 +324,20 @@ namespace spades {
 						Vector3 pos = {v3[0], v3[1], v3[2]};
 						ALCheckErrorPrecise();
 						Vector3 checkPos;
-						for (int x = -1; x <= 1; x++)
-						for (int y = -1; y <= 1; y++)
-						for (int z = -1; z <= 1; z++) {
-							IntVector3 hitPos;
+						client::GameMap::RayPacket packet;
+						client::GameMap::RayPacketResult packetResult;
+						for (int i = 0; i < 27 && enableObstruction; i++) {
+							int x = i / 9 - 1, y = i / 3 % 3 - 1, z = i % 3 - 1;
 							checkPos = pos + MakeVector3((float)x, (float)y, (float)z) * 0.2F;
-							if (!map->CastRay(eye, (checkPos - eye).Normalize(),
-								(checkPos - eye).GetLength(), hitPos))
-								enableObstruction = false;
+							packet.Add(eye, (checkPos - eye).Normalize(), (checkPos - eye).GetLength());
+
+							if (packet.IsFull() || i == 26) {
+								map->CastRayPacket(packet, packetResult);
+								for (int k = 0; k < packet.numRays; k++)
+									if (!packetResult.hit[k])
+										enableObstruction = false;
+								packet.numRays = 0;
+							}
 						}
 					} else {
 						enableObstruction = false;
@@ -629,15 +635,23 @@ namespace spades {
 						Vector3 rayFrom = eye;
 						Vector3 rayTo;
 
+						// Each ray and its opposite are cast together
+						client::GameMap::RayPacket packet;
+						client::GameMap::RayPacketResult packetResult;
 						for (int rays = 0; rays < 4; rays++) {
 							rayTo = RandomAxis().Normalize();
+							packet.Add(rayFrom, rayTo, maxDistance);
+							packet.Add(rayFrom, -rayTo, maxDistance);
+						}
+						map->CastRayPacket(packet, packetResult);
 
-							IntVector3 hitPos;
-							if (map->CastRay(rayFrom, rayTo, maxDistance, hitPos)) {
+						for (int rays = 0; rays < 4; rays++) {
+							if (packetResult.hit[rays * 2]) {
+								IntVector3 hitPos = packetResult.GetHitBlock(rays * 2);
 								roomHistory[roomHistoryPos] =
 								  (MakeVector3(hitPos) - rayFrom).GetLength();
 								roomFeedbackHistory[roomHistoryPos] =
-								  map->CastRay(rayFrom, -rayTo, maxDistance, hitPos) ? 1.0F : 0.0F;
+								  packetResult.hit[rays * 2 + 1] ? 1.0F : 0.0F;
 							} else {
 								roomHistory[roomHistoryPos] = maxDistance * 2.0F;
 							}
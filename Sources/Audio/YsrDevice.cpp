@@ -397,14 +397,20 @@ namespace spades {
 				Vector3 pos = origin;
 				Vector3 checkPos;
 				result.directGain = 0.4F;
-				for (int x = -1; x <= 1; x++)
-				for (int y = -1; y <= 1; y++)
-				for (int z = -1; z <= 1; z++) {
-					IntVector3 hitPos;
+				client::GameMap::RayPacket packet;
+				client::GameMap::RayPacketResult packetResult;
+				for (int i = 0; i < 27 && result.directGain < 1.0F; i++) {
+					int x = i / 9 - 1, y = i / 3 % 3 - 1, z = i % 3 - 1;
 					checkPos = pos + MakeVector3((float)x, (float)y, (float)z) * 0.2F;
-					if (!gameMap->CastRay(eye, (checkPos - eye).Normalize(),
-						(checkPos - eye).GetLength(), hitPos))
-						result.directGain = 1.0F;
+					packet.Add(eye, (checkPos - eye).Normalize(), (checkPos - eye).GetLength());
+
+					if (packet.IsFull() || i == 26) {
+						gameMap->CastRayPacket(packet, packetResult);
+						for (int k = 0; k < packet.numRays; k++)
+							if (!packetResult.hit[k])
+								result.directGain = 1.0F;
+						packet.numRays = 0;
+					}
 				}
 			} else {
 				result.directGain = 1.0F;
@@ -484,11 +490,19 @@ namespace spades {
 				Vector3 rayFrom = eye;
 				Vector3 rayTo;
 
+				// Each ray and its opposite are cast together
+				client::GameMap::RayPacket packet;
+				client::GameMap::RayPacketResult packetResult;
 				for (int rays = 0; rays < 4; rays++) {
 					rayTo = RandomAxis().Normalize();
+					packet.Add(rayFrom, rayTo, maxDistance);
+					packet.Add(rayFrom, -rayTo, maxDistance);
+				}
+				map->CastRayPacket(packet, packetResult);
 
-					IntVector3 hitPos;
-					bool hit = map->CastRay(rayFrom, rayTo, maxDistance, hitPos);
+				for (int rays = 0; rays < 4; rays++) {
+					IntVector3 hitPos = packetResult.GetHitBlock(rays * 2);
+					bool hit = packetResult.hit[rays * 2];
 					if (hit) {
 						Vector3 hitPosf = {(float)hitPos.x, (float)hitPos.y, (float)hitPos.z};
 						roomHistory[roomHistoryPos] = (hitPosf - rayFrom).GetLength();
@@ -497,7 +511,7 @@ namespace spades {
 					}
 
 					if (hit) {
-						bool hit2 = map->CastRay(rayFrom, -rayTo, maxDistance, hitPos);
+						bool hit2 = packetResult.hit[rays * 2 + 1];
 						if (hit2)
 							roomFeedbackHistory[roomHistoryPos] = 1.0F;
 						else
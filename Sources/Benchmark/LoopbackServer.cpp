@@ -0,0 +1,616 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "LoopbackServer.h"
+#include <Client/GameMap.h>
+#include <Client/GameProperties.h>
+#include <Client/IGameMode.h>
+#include <Core/Debug.h>
+#include <Core/DeflateStream.h>
+#include <Core/DynamicMemoryStream.h>
+#include <Core/Exception.h>
+#include <Core/MemoryStream.h>
+#include <Core/TMPUtils.h>
+#include <Core/Thread.h>
+
+namespace spades {
+	namespace client {
+		namespace {
+			enum PacketType {
+				PacketTypeWorldUpdate = 2,
+				PacketTypeExistingPlayer = 9,
+				PacketTypeCreatePlayer = 12,
+				PacketTypeBlockAction = 13,
+				PacketTypeStateData = 15,
+				PacketTypeKillAction = 16,
+				PacketTypeMapStart = 18,
+				PacketTypeMapChunk = 19,
+				PacketTypeMapCached = 31,
+				PacketTypeHandShakeInit = 31,
+				PacketTypeHandShakeReturn = 32,
+				PacketTypeVersionGet = 33,
+			};
+
+			/** The disconnect reasons understood by `NetClient::DisconnectReasonString`. */
+			enum DisconnectReason {
+				DisconnectReasonUndefined = 0,
+				DisconnectReasonProtocolVersion = 3,
+				DisconnectReasonServerFull = 4,
+			};
+
+			constexpr int ServiceTimeout = 1;
+			/** The time before a killed bot respawns, in seconds. */
+			constexpr int RespawnTime = 3;
+			constexpr float BotWalkSpeed = 4.0F;
+			constexpr float BotWalkRadius = 6.0F;
+
+			const IntVector3 TeamColors[2] = {{0, 0, 255}, {0, 255, 0}};
+
+			class PacketWriter {
+				std::vector<char> data;
+
+			public:
+				PacketWriter(PacketType type) { WriteByte(type); }
+
+				void WriteByte(int v) { data.push_back(static_cast<char>(v)); }
+				void WriteInt(std::uint32_t v) {
+					for (int i = 0; i < 4; i++)
+						WriteByte(static_cast<int>((v >> (i * 8)) & 0xff));
+				}
+				void WriteFloat(float v) {
+					std::uint32_t i;
+					std::memcpy(&i, &v, 4);
+					WriteInt(i);
+				}
+				void WriteVector3(Vector3 v) {
+					WriteFloat(v.x);
+					WriteFloat(v.y);
+					WriteFloat(v.z);
+				}
+				void WriteColor(IntVector3 v) {
+					WriteByte(v.z); // B
+					WriteByte(v.y); // G
+					WriteByte(v.x); // R
+				}
+				void WriteString(const std::string& str) {
+					data.insert(data.end(), str.begin(), str.end());
+				}
+				void WriteString(const std::string& str, std::size_t fillLen) {
+					WriteString(str.substr(0, fillLen));
+					for (std::size_t i = str.size(); i < fillLen; i++)
+						WriteByte(0);
+				}
+				void WriteData(const char* bytes, std::size_t size) {
+					data.insert(data.end(), bytes, bytes + size);
+				}
+
+				std::vector<char>& GetData() { return data; }
+			};
+
+			std::uint32_t ReadInt(const ENetPacket& packet, std::size_t offset) {
+				std::uint32_t v = 0;
+				for (int i = 0; i < 4; i++)
+					v |= static_cast<std::uint32_t>(packet.data[offset + i]) << (i * 8);
+				return v;
+			}
+
+			std::string GetBotName(int id) { return "Bot" + std::to_string(id); }
+		} // namespace
+
+		LoopbackServer::LoopbackServer(const Options& options, const std::string& vxlData)
+		    : options(options), random(options.seed) {
+			SPADES_MARK_FUNCTION();
+
+			if (options.protocolVersion != 3 && options.protocolVersion != 4)
+				SPRaise("Invalid protocol version: %d", options.protocolVersion);
+			maxNumPlayers =
+			  GameProperties{static_cast<ProtocolVersion>(options.protocolVersion)}
+			    .GetMaxNumPlayerSlots();
+			if (options.numBots < 0 || options.numBots >= maxNumPlayers)
+				SPRaise("The number of bots must be between 0 and %d", maxNumPlayers - 1);
+
+			// Servers send the map compressed with zlib, and advertise the compressed size
+			DynamicMemoryStream compressed;
+			{
+				DeflateStream deflate(&compressed, CompressModeCompress);
+				deflate.Write(vxlData.data(), vxlData.size());
+				deflate.DeflateEnd();
+			}
+			compressed.SetPosition(0);
+			std::string bytes = compressed.ReadAllBytes();
+			compressedMap.assign(bytes.begin(), bytes.end());
+
+			mapChecksum = (std::uint32_t)crc32(0L, Z_NULL, 0);
+			mapChecksum = (std::uint32_t)crc32(
+			  mapChecksum, reinterpret_cast<const Bytef*>(compressedMap.data()),
+			  (uInt)compressedMap.size());
+
+			MemoryStream vxlStream(vxlData.data(), vxlData.size());
+			map.Set(GameMap::Load(&vxlStream), false);
+
+			for (int i = 0; i < options.numBots; i++) {
+				Bot bot;
+				bot.center = FindSpawnPoint();
+				bot.phase = std::uniform_real_distribution<float>(0.0F, 6.28F)(random);
+				bot.team = i % 2;
+				bot.position = bot.center;
+				bot.front = MakeVector3(1, 0, 0);
+				bots.push_back(bot);
+			}
+		}
+
+		LoopbackServer::~LoopbackServer() { Stop(); }
+
+		void LoopbackServer::Start() {
+			SPADES_MARK_FUNCTION();
+			SPAssert(!thread);
+
+			enet_initialize();
+
+			ENetAddress address;
+			address.host = ENET_HOST_ANY;
+			address.port = options.port;
+			host = enet_host_create(&address, maxNumPlayers, 1, 0, 0);
+			if (!host)
+				SPRaise("Failed to create the server's ENet host on port %d", (int)options.port);
+			if (enet_host_compress_with_range_coder(host) < 0)
+				SPRaise("Failed to enable ENet Range coder.");
+
+			stopwatch.Reset();
+			stopRequested = false;
+			thread = stmp::make_unique<Thread>(this);
+			thread->Start();
+		}
+
+		void LoopbackServer::Stop() {
+			SPADES_MARK_FUNCTION();
+
+			if (!thread)
+				return;
+
+			stopRequested = true;
+			thread->Join();
+			thread.reset();
+
+			for (ClientInfo& client : clients)
+				enet_peer_reset(client.peer);
+			clients.clear();
+
+			enet_host_destroy(host);
+			host = nullptr;
+		}
+
+		LoopbackServer::Stats LoopbackServer::GetStats() {
+			return {numPacketsSent, numBytesSent, numJoinedClients};
+		}
+
+		void LoopbackServer::Run() {
+			SPADES_MARK_FUNCTION();
+
+			double lastTime = 0.0;
+			double nextWorldUpdate = 0.0;
+			double nextBlockAction = 0.0;
+			double nextKillAction = 0.0;
+
+			// Counts the periods elapsed since `next`. Doesn't try to catch up after a stall.
+			auto countDue = [&](double time, double& next, float rate) {
+				if (rate <= 0.0F || !trafficEnabled) {
+					next = time;
+					return 0;
+				}
+				if (time - next > 1.0)
+					next = time;
+				int count = 0;
+				for (; next <= time; next += 1.0 / rate)
+					count++;
+				return count;
+			};
+
+			while (!stopRequested) {
+				ENetEvent event;
+				int result = enet_host_service(host, &event, ServiceTimeout);
+				while (result > 0) {
+					switch (event.type) {
+						case ENET_EVENT_TYPE_CONNECT:
+							HandleConnect(*event.peer, event.data);
+							break;
+						case ENET_EVENT_TYPE_DISCONNECT: HandleDisconnect(*event.peer); break;
+						case ENET_EVENT_TYPE_RECEIVE:
+							if (ClientInfo* client = FindClient(event.peer))
+								HandleReceive(*client, *event.packet);
+							enet_packet_destroy(event.packet);
+							break;
+						default: break;
+					}
+					result = enet_host_check_events(host, &event);
+				}
+
+				double time = stopwatch.GetTime();
+				UpdateBots(time, static_cast<float>(time - lastTime));
+				lastTime = time;
+
+				for (int n = countDue(time, nextWorldUpdate, options.worldUpdateRate); n > 0; n--)
+					Broadcast(MakeWorldUpdate(), ClientState::MapStart);
+				for (int n = countDue(time, nextBlockAction, options.blockActionRate); n > 0; n--)
+					BroadcastBlockAction();
+				for (int n = countDue(time, nextKillAction, options.killActionRate); n > 0; n--)
+					BroadcastKillAction(time);
+
+				enet_host_flush(host);
+			}
+		}
+
+		LoopbackServer::ClientInfo* LoopbackServer::FindClient(ENetPeer* peer) {
+			for (ClientInfo& client : clients) {
+				if (client.peer == peer)
+					return &client;
+			}
+			return nullptr;
+		}
+
+		void LoopbackServer::HandleConnect(ENetPeer& peer, std::uint32_t data) {
+			SPADES_MARK_FUNCTION();
+
+			if (data != static_cast<std::uint32_t>(options.protocolVersion)) {
+				enet_peer_disconnect(&peer, DisconnectReasonProtocolVersion);
+				return;
+			}
+
+			// Find a slot not taken by the bots or the other clients
+			int playerId = -1;
+			for (int i = options.numBots; i < maxNumPlayers && playerId < 0; i++) {
+				bool taken = std::any_of(clients.begin(), clients.end(),
+				                         [&](const ClientInfo& c) { return c.playerId == i; });
+				if (!taken)
+					playerId = i;
+			}
+			if (playerId < 0) {
+				enet_peer_disconnect(&peer, DisconnectReasonServerFull);
+				return;
+			}
+
+			ClientInfo client;
+			client.peer = &peer;
+			client.challenge = static_cast<std::uint32_t>(random());
+			client.playerId = playerId;
+			clients.push_back(client);
+
+			PacketWriter handshake{PacketTypeHandShakeInit};
+			handshake.WriteInt(client.challenge);
+			Send(clients.back(), handshake.GetData());
+
+			Send(clients.back(), PacketWriter{PacketTypeVersionGet}.GetData());
+		}
+
+		void LoopbackServer::HandleDisconnect(ENetPeer& peer) {
+			clients.erase(std::remove_if(clients.begin(), clients.end(),
+			                             [&](const ClientInfo& c) { return c.peer == &peer; }),
+			              clients.end());
+		}
+
+		void LoopbackServer::HandleReceive(ClientInfo& client, const ENetPacket& packet) {
+			SPADES_MARK_FUNCTION();
+
+			if (packet.dataLength < 1)
+				return;
+
+			switch (packet.data[0]) {
+				case PacketTypeHandShakeReturn: {
+					if (client.state != ClientState::Handshake)
+						break;
+					if (packet.dataLength < 5 || ReadInt(packet, 1) != client.challenge) {
+						enet_peer_disconnect(client.peer, DisconnectReasonUndefined);
+						break;
+					}
+
+					PacketWriter w{PacketTypeMapStart};
+					w.WriteInt(static_cast<std::uint32_t>(compressedMap.size()));
+					if (options.protocolVersion == 4) {
+						// Wait for `MapCached`
+						w.WriteInt(mapChecksum);
+						Send(client, w.GetData());
+						client.state = ClientState::MapStart;
+					} else {
+						Send(client, w.GetData());
+						SendMap(client);
+						SendGameState(client);
+					}
+				} break;
+				case PacketTypeMapCached: {
+					if (client.state != ClientState::MapStart)
+						break;
+					bool cached = packet.dataLength >= 2 && packet.data[1] != 0;
+					if (!cached)
+						SendMap(client);
+					SendGameState(client);
+				} break;
+				case PacketTypeExistingPlayer: {
+					// The client chose the team and the weapon
+					if (client.state != ClientState::Spectating || packet.dataLength < 12)
+						break;
+					int team = packet.data[2] & 1;
+					int weapon = std::min<int>(packet.data[3], 2);
+					std::string name(reinterpret_cast<const char*>(packet.data) + 12,
+					                 packet.dataLength - 12);
+					name = name.substr(0, name.find('\0'));
+
+					std::vector<char> createPlayer =
+					  MakeCreatePlayer(client.playerId, team, FindSpawnPoint(), name);
+					createPlayer[2] = static_cast<char>(weapon);
+					Send(client, createPlayer);
+
+					client.state = ClientState::Playing;
+					numJoinedClients++;
+				} break;
+				default:
+					// Ignore everything else, including `VersionSend`
+					break;
+			}
+		}
+
+		void LoopbackServer::SendMap(ClientInfo& client) {
+			SPADES_MARK_FUNCTION();
+
+			client.state = ClientState::ReceivingMap;
+
+			for (std::size_t offset = 0; offset < compressedMap.size();
+			     offset += options.mapChunkSize) {
+				std::size_t size = std::min(options.mapChunkSize, compressedMap.size() - offset);
+				PacketWriter w{PacketTypeMapChunk};
+				w.WriteData(compressedMap.data() + offset, size);
+				Send(client, w.GetData());
+			}
+		}
+
+		void LoopbackServer::SendGameState(ClientInfo& client) {
+			SPADES_MARK_FUNCTION();
+
+			// `ExistingPlayer` places the player where the last `WorldUpdate` did
+			Send(client, MakeWorldUpdate());
+
+			for (int i = 0; i < options.numBots; i++) {
+				const Bot& bot = bots[i];
+				if (!bot.alive)
+					continue;
+
+				PacketWriter w{PacketTypeExistingPlayer};
+				w.WriteByte(i);
+				w.WriteByte(bot.team);
+				w.WriteByte(i % 3); // Weapon
+				w.WriteByte(2);     // Tool
+				w.WriteInt(0);      // Score
+				w.WriteColor(TeamColors[bot.team]);
+				w.WriteString(GetBotName(i));
+				Send(client, w.GetData());
+			}
+
+			PacketWriter w{PacketTypeStateData};
+			w.WriteByte(client.playerId);
+			w.WriteColor(MakeIntVector3(128, 232, 255)); // Fog
+			w.WriteColor(TeamColors[0]);
+			w.WriteColor(TeamColors[1]);
+			w.WriteString("Blue", 10);
+			w.WriteString("Green", 10);
+
+			// CTF with the intels and the bases at the both ends of the map
+			float groundZ = (float)GetGroundZ(GameMap::DefaultWidth / 8, GameMap::DefaultHeight / 2);
+			Vector3 base1 = MakeVector3(GameMap::DefaultWidth / 8, GameMap::DefaultHeight / 2,
+			                            groundZ);
+			Vector3 base2 = MakeVector3(GameMap::DefaultWidth * 7 / 8,
+			                            GameMap::DefaultHeight / 2, groundZ);
+			w.WriteByte(IGameMode::m_CTF);
+			w.WriteByte(0);  // Team 1 score
+			w.WriteByte(0);  // Team 2 score
+			w.WriteByte(10); // Capture limit
+			w.WriteByte(0);  // Nobody has the intels
+			w.WriteVector3(base1);
+			w.WriteVector3(base2);
+			w.WriteVector3(base1);
+			w.WriteVector3(base2);
+			Send(client, w.GetData());
+
+			client.state = ClientState::Spectating;
+		}
+
+		void LoopbackServer::UpdateBots(double time, float dt) {
+			for (int i = 0; i < options.numBots; i++) {
+				Bot& bot = bots[i];
+				if (!bot.alive) {
+					if (time < bot.respawnTime || !trafficEnabled)
+						continue;
+
+					bot.alive = true;
+					bot.center = FindSpawnPoint();
+					bot.position = bot.center;
+					std::vector<char> createPlayer =
+					  MakeCreatePlayer(i, bot.team, bot.position, GetBotName(i));
+					createPlayer[2] = static_cast<char>(i % 3);
+					Broadcast(createPlayer, ClientState::Spectating);
+				}
+
+				// Walk in circles on the ground
+				bot.phase += dt * BotWalkSpeed / BotWalkRadius;
+				float c = std::cos(bot.phase), s = std::sin(bot.phase);
+				Vector3 pos = bot.center + MakeVector3(c, s, 0.0F) * BotWalkRadius;
+				int z = GetGroundZ((int)pos.x, (int)pos.y);
+				pos.z = (z < 0 ? bot.center.z : (float)z - 2.4F);
+				bot.position = pos;
+				bot.front = MakeVector3(-s, c, 0.0F);
+			}
+		}
+
+		std::vector<char> LoopbackServer::MakeWorldUpdate() {
+			PacketWriter w{PacketTypeWorldUpdate};
+			if (options.protocolVersion == 4) {
+				// Only the players in the game, with their IDs
+				for (int i = 0; i < options.numBots; i++) {
+					if (!bots[i].alive)
+						continue;
+					w.WriteByte(i);
+					w.WriteVector3(bots[i].position);
+					w.WriteVector3(bots[i].front);
+				}
+			} else {
+				// Every player slot
+				for (int i = 0; i < maxNumPlayers; i++) {
+					if (i < options.numBots) {
+						w.WriteVector3(bots[i].position);
+						w.WriteVector3(bots[i].front);
+					} else {
+						w.WriteVector3(MakeVector3(0, 0, 0));
+						w.WriteVector3(MakeVector3(0, 0, 0));
+					}
+				}
+			}
+			return std::move(w.GetData());
+		}
+
+		void LoopbackServer::BroadcastBlockAction() {
+			std::vector<int> candidates;
+			for (int i = 0; i < options.numBots; i++) {
+				if (bots[i].alive)
+					candidates.push_back(i);
+			}
+			if (candidates.empty())
+				return;
+
+			std::uniform_int_distribution<int> offset(-4, 4);
+			int playerId = candidates[random() % candidates.size()];
+			const Bot& bot = bots[playerId];
+			int x = std::max(0, std::min((int)bot.position.x + offset(random),
+			                             GameMap::DefaultWidth - 1));
+			int y = std::max(0, std::min((int)bot.position.y + offset(random),
+			                             GameMap::DefaultHeight - 1));
+			int z = GetGroundZ(x, y);
+			if (z < 0)
+				return;
+
+			// Build on the ground or dig it, keeping the map roughly the same. The bottom
+			// layers are indestructible.
+			bool create = (random() & 1) || z >= GameMap::DefaultDepth - 2;
+			int action;
+			if (create && z > 1) {
+				action = 0; // BlockActionCreate
+				z--;
+				map->Set(x, y, z, true, 0xff7f7f7fU);
+			} else if (!create) {
+				action = 1; // BlockActionTool
+				map->Set(x, y, z, false, 0);
+			} else {
+				return;
+			}
+
+			PacketWriter w{PacketTypeBlockAction};
+			w.WriteByte(playerId);
+			w.WriteByte(action);
+			w.WriteInt(static_cast<std::uint32_t>(x));
+			w.WriteInt(static_cast<std::uint32_t>(y));
+			w.WriteInt(static_cast<std::uint32_t>(z));
+			Broadcast(w.GetData(), ClientState::MapStart);
+		}
+
+		void LoopbackServer::BroadcastKillAction(double time) {
+			std::vector<int> candidates;
+			for (int i = 0; i < options.numBots; i++) {
+				if (bots[i].alive)
+					candidates.push_back(i);
+			}
+			if (candidates.size() < 2)
+				return;
+
+			std::shuffle(candidates.begin(), candidates.end(), random);
+			int victimId = candidates[0], killerId = candidates[1];
+
+			Bot& victim = bots[victimId];
+			victim.alive = false;
+			victim.respawnTime = time + RespawnTime;
+
+			PacketWriter w{PacketTypeKillAction};
+			w.WriteByte(victimId);
+			w.WriteByte(killerId);
+			w.WriteByte(0); // KillTypeWeapon
+			w.WriteByte(RespawnTime);
+			Broadcast(w.GetData(), ClientState::Spectating);
+		}
+
+		int LoopbackServer::GetGroundZ(int x, int y) {
+			x = std::max(0, std::min(x, GameMap::DefaultWidth - 1));
+			y = std::max(0, std::min(y, GameMap::DefaultHeight - 1));
+			for (int z = 0; z < GameMap::DefaultDepth; z++) {
+				if (map->IsSolid(x, y, z))
+					return z;
+			}
+			return -1;
+		}
+
+		Vector3 LoopbackServer::FindSpawnPoint() {
+			std::uniform_int_distribution<int> coord(64, GameMap::DefaultWidth - 64);
+			int x = coord(random), y = coord(random);
+			int z = std::max(GetGroundZ(x, y), 0);
+			return MakeVector3((float)x + 0.5F, (float)y + 0.5F, (float)z - 2.4F);
+		}
+
+		std::vector<char> LoopbackServer::MakeCreatePlayer(int playerId, int team,
+		                                                   Vector3 position,
+		                                                   const std::string& name) {
+			PacketWriter w{PacketTypeCreatePlayer};
+			w.WriteByte(playerId);
+			w.WriteByte(0); // Weapon
+			w.WriteByte(team);
+			// `NetClient` subtracts the eye height
+			w.WriteVector3(position + MakeVector3(0.0F, 0.0F, 2.4F));
+			w.WriteString(name);
+			return std::move(w.GetData());
+		}
+
+		void LoopbackServer::Send(ClientInfo& client, const std::vector<char>& data) {
+			ENetPacket* packet =
+			  enet_packet_create(data.data(), data.size(), ENET_PACKET_FLAG_RELIABLE);
+			if (enet_peer_send(client.peer, 0, packet) < 0) {
+				enet_packet_destroy(packet);
+				return;
+			}
+			numPacketsSent++;
+			numBytesSent += data.size();
+		}
+
+		void LoopbackServer::Broadcast(const std::vector<char>& data, ClientState minState) {
+			ENetPacket* packet =
+			  enet_packet_create(data.data(), data.size(), ENET_PACKET_FLAG_RELIABLE);
+			for (ClientInfo& client : clients) {
+				if (client.state < minState)
+					continue;
+				if (enet_peer_send(client.peer, 0, packet) == 0) {
+					numPacketsSent++;
+					numBytesSent += data.size();
+				}
+			}
+			if (packet->referenceCount == 0)
+				enet_packet_destroy(packet);
+		}
+	} // namespace client
+} // namespace spades
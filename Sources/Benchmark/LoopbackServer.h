@@ -0,0 +1,177 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <enet/enet.h>
+
+#include <Core/IRunnable.h>
+#include <Core/Math.h>
+#include <Core/RefCountedObject.h>
+#include <Core/Stopwatch.h>
+
+namespace spades {
+	class Thread;
+
+	namespace client {
+		class GameMap;
+
+		/**
+		 * An in-process stand-in for a game server, used by the network benchmark. Speaks
+		 * the subset of the 0.75/0.76 protocol that `NetClient` needs to join a game: the
+		 * handshake, the map transfer, and the initial game state. After that, it broadcasts
+		 * synthetic `WorldUpdate`, `BlockAction`, and `KillAction` traffic from scripted bots
+		 * at fixed rates.
+		 *
+		 * The bots occupy the first player slots, and each client gets one of the rest.
+		 * Clients don't see each other, and nothing they send after joining has any effect.
+		 *
+		 * Runs its own ENet host on a dedicated thread.
+		 */
+		class LoopbackServer : public IRunnable {
+		public:
+			struct Options {
+				/** 3 for 0.75, 4 for 0.76. */
+				int protocolVersion = 3;
+				std::uint16_t port = 32887;
+				int numBots = 16;
+				/** The number of `WorldUpdate` packets sent to each client per second. */
+				float worldUpdateRate = 10.0F;
+				/** The number of `BlockAction` packets sent to each client per second. */
+				float blockActionRate = 20.0F;
+				/** The number of `KillAction` packets sent to each client per second. */
+				float killActionRate = 1.0F;
+				/** The size of `MapChunk` packets. */
+				std::size_t mapChunkSize = 8192;
+				unsigned int seed = 1;
+			};
+
+			struct Stats {
+				/** The number of packets sent to all clients. */
+				std::uint64_t numPacketsSent;
+				std::uint64_t numBytesSent;
+				/** The number of clients that requested to spawn. */
+				int numJoinedClients;
+			};
+
+			/** @param vxlData The map in the VXL format, as sent to the clients. */
+			LoopbackServer(const Options&, const std::string& vxlData);
+			~LoopbackServer();
+
+			void Start();
+			void Stop();
+
+			/**
+			 * Stops or resumes the synthetic traffic. Clients still can join while it's
+			 * stopped.
+			 */
+			void SetTrafficEnabled(bool enabled) { trafficEnabled = enabled; }
+
+			Stats GetStats();
+
+		private:
+			enum class ClientState {
+				/** Waiting for `HandShakeReturn`. */
+				Handshake,
+				/** Waiting for `MapCached` (0.76 only). */
+				MapStart,
+				/** Receiving the map. Only `WorldUpdate` and `BlockAction` are sent. */
+				ReceivingMap,
+				/** Received `StateData`. Waiting for the client to join. */
+				Spectating,
+				/** The client's player was created. */
+				Playing
+			};
+
+			struct ClientInfo {
+				ENetPeer* peer;
+				ClientState state = ClientState::Handshake;
+				std::uint32_t challenge = 0;
+				int playerId;
+			};
+
+			struct Bot {
+				Vector3 center;
+				float phase;
+				int team;
+				bool alive = true;
+				double respawnTime = 0.0;
+				Vector3 position;
+				Vector3 front;
+			};
+
+			Options options;
+			int maxNumPlayers;
+
+			std::vector<char> compressedMap;
+			std::uint32_t mapChecksum;
+			/** Used to place the bots and the blocks on the ground. */
+			Handle<GameMap> map;
+
+			std::mt19937 random;
+			ENetHost* host = nullptr;
+			std::vector<ClientInfo> clients;
+			std::vector<Bot> bots;
+
+			std::unique_ptr<Thread> thread;
+			Stopwatch stopwatch;
+			std::atomic<bool> stopRequested{false};
+			std::atomic<bool> trafficEnabled{true};
+
+			std::atomic<std::uint64_t> numPacketsSent{0};
+			std::atomic<std::uint64_t> numBytesSent{0};
+			std::atomic<int> numJoinedClients{0};
+
+			void Run() override;
+
+			ClientInfo* FindClient(ENetPeer*);
+			void HandleConnect(ENetPeer&, std::uint32_t data);
+			void HandleDisconnect(ENetPeer&);
+			void HandleReceive(ClientInfo&, const ENetPacket&);
+
+			void SendMap(ClientInfo&);
+			void SendGameState(ClientInfo&);
+
+			void UpdateBots(double time, float dt);
+			std::vector<char> MakeWorldUpdate();
+			void BroadcastBlockAction();
+			void BroadcastKillAction(double time);
+
+			/** Returns the height of the ground, or -1 if there's no solid voxel. */
+			int GetGroundZ(int x, int y);
+			Vector3 FindSpawnPoint();
+			std::vector<char> MakeCreatePlayer(int playerId, int team, Vector3 position,
+			                                   const std::string& name);
+
+			/** Sends a packet to one client. */
+			void Send(ClientInfo&, const std::vector<char>&);
+			/** Sends a packet to every client in the state `minState` or later. */
+			void Broadcast(const std::vector<char>&, ClientState minState);
+		};
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,332 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+// A benchmark of the client's network code. Runs a loopback server that streams a map and
+// synthetic game traffic, and connects headless `NetClient`s to it over ENet. Measures how
+// long it takes to join the game and how fast the clients handle the packets.
+//
+// Usage: openspades-netbenchmark MAP.vxl [-clients N] [-bots N] [-protocol 75|76]
+//        [-seconds N] [-updates N] [-blocks N] [-kills N] [-port N] [-seed N]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "LoopbackServer.h"
+#include <Client/GameMap.h>
+#include <Client/INetClientListener.h>
+#include <Client/NetClient.h>
+#include <Client/World.h>
+#include <Core/Debug.h>
+#include <Core/Exception.h>
+#include <Core/ServerAddress.h>
+#include <Core/Settings.h>
+#include <Core/StdStream.h>
+#include <Core/Stopwatch.h>
+#include <Core/TMPUtils.h>
+#include <Imports/SDL.h>
+
+SPADES_SETTING(cg_mapCache);
+
+namespace spades {
+	namespace client {
+		namespace {
+			constexpr float TickTime = 1.0F / 60.0F;
+
+			/** How long the clients may take to join, in seconds. */
+			constexpr double JoinTimeout = 60.0;
+
+			/** How long the clients are given to handle the last packets, in seconds. */
+			constexpr double DrainTime = 1.0;
+
+			struct Options {
+				std::string mapPath;
+				int numClients = 4;
+				double duration = 10.0;
+				LoopbackServer::Options server;
+			};
+
+			/** Joins the game as soon as possible, and otherwise only runs the world. */
+			class HeadlessClient : public INetClientListener {
+				std::string name;
+				int team;
+				Stopwatch stopwatch;
+				std::unique_ptr<World> world;
+
+			public:
+				NetClient net;
+
+				/** The time from `Connect` to receiving the game state, in seconds. */
+				stmp::optional<double> joinTime;
+				bool spawned = false;
+				std::uint64_t numWorldUpdates = 0;
+
+				HeadlessClient(std::string name, int team) : name(name), team(team), net(this) {}
+
+				void Connect(const ServerAddress& address) {
+					stopwatch.Reset();
+					net.Connect(address);
+				}
+
+				void SetWorld(World* w) override { world.reset(w); }
+				World* GetWorld() const override { return world.get(); }
+
+				void MarkWorldUpdate() override { numWorldUpdates++; }
+
+				void PlayerSentChatMessage(Player&, bool, const std::string&) override {}
+				void ServerSentMessage(bool, const std::string&) override {}
+
+				void PlayerCapturedIntel(Player&) override {}
+				void PlayerPickedIntel(Player&) override {}
+				void PlayerDropIntel(Player&) override {}
+				void TeamCapturedTerritory(int, int) override {}
+				void TeamWon(int) override {}
+				void JoinedGame() override {
+					joinTime = stopwatch.GetTime();
+					net.SendJoin(team, RIFLE_WEAPON, name, 0);
+				}
+				void LocalPlayerCreated() override { spawned = true; }
+				void RegisterPlacedBlocks(int) override {}
+				void PlayerCreatedBlock(Player&) override {}
+				void PlayerDestroyedBlockWithWeaponOrTool(IntVector3) override {}
+				void PlayerDiggedBlock(IntVector3) override {}
+				void GrenadeDestroyedBlock(IntVector3) override {}
+				void PlayerLeaving(Player&) override {}
+				void PlayerJoinedTeam(Player&) override {}
+				void PlayerSpawned(Player&) override {}
+			};
+
+			/** Stands in for the game loop. Each call to `RunFrame` is one frame. */
+			class FrameLoop {
+				std::vector<std::unique_ptr<HeadlessClient>>& clients;
+				Stopwatch clock;
+				double nextTick = 0.0;
+
+			public:
+				double handlingTime = 0.0;
+				double simulationTime = 0.0;
+				int numTicks = 0;
+
+				FrameLoop(std::vector<std::unique_ptr<HeadlessClient>>& clients)
+				    : clients(clients) {}
+
+				double GetTime() { return clock.GetTime(); }
+
+				void ResetTimings() {
+					handlingTime = 0.0;
+					simulationTime = 0.0;
+					numTicks = 0;
+				}
+
+				void RunFrame() {
+					Stopwatch sw;
+					for (auto& client : clients)
+						client->net.DoEvents(0);
+					handlingTime += sw.GetTime();
+
+					// Advance the worlds at a fixed rate
+					sw.Reset();
+					double time = clock.GetTime();
+					for (; nextTick <= time; nextTick += TickTime) {
+						for (auto& client : clients) {
+							if (World* world = client->GetWorld())
+								world->Advance(TickTime);
+						}
+						numTicks++;
+					}
+					simulationTime += sw.GetTime();
+
+					SDL_Delay(1);
+				}
+			};
+
+			Options ParseOptions(int argc, char** argv) {
+				Options opts;
+				int protocol = 75;
+				for (int i = 1; i < argc; i++) {
+					std::string arg = argv[i];
+					auto value = [&]() -> const char* {
+						if (i + 1 >= argc)
+							SPRaise("Option '%s' requires a value", arg.c_str());
+						return argv[++i];
+					};
+					if (arg == "-clients")
+						opts.numClients = std::atoi(value());
+					else if (arg == "-bots")
+						opts.server.numBots = std::atoi(value());
+					else if (arg == "-protocol")
+						protocol = std::atoi(value());
+					else if (arg == "-seconds")
+						opts.duration = std::atof(value());
+					else if (arg == "-updates")
+						opts.server.worldUpdateRate = (float)std::atof(value());
+					else if (arg == "-blocks")
+						opts.server.blockActionRate = (float)std::atof(value());
+					else if (arg == "-kills")
+						opts.server.killActionRate = (float)std::atof(value());
+					else if (arg == "-port")
+						opts.server.port = (std::uint16_t)std::atoi(value());
+					else if (arg == "-seed")
+						opts.server.seed = (unsigned int)std::strtoul(value(), nullptr, 10);
+					else if (!arg.empty() && arg[0] == '-')
+						SPRaise("Unknown option: %s", arg.c_str());
+					else
+						opts.mapPath = arg;
+				}
+
+				if (opts.mapPath.empty())
+					SPRaise("Usage: %s MAP.vxl [-clients N] [-bots N] [-protocol 75|76] "
+					        "[-seconds N] [-updates N] [-blocks N] [-kills N] [-port N] "
+					        "[-seed N]",
+					        argv[0]);
+				if (protocol == 75)
+					opts.server.protocolVersion = 3;
+				else if (protocol == 76)
+					opts.server.protocolVersion = 4;
+				else
+					SPRaise("Unknown protocol: %d", protocol);
+				if (opts.server.numBots < 0 || opts.numClients < 1 ||
+				    opts.server.numBots + opts.numClients > 32)
+					SPRaise("There must be at least one client, and at most 32 players");
+				return opts;
+			}
+
+			std::string ReadFile(const std::string& path) {
+				FILE* f = std::fopen(path.c_str(), "rb");
+				if (!f)
+					SPRaise("Failed to open %s", path.c_str());
+				StdStream stream(f, true);
+				return stream.ReadAllBytes();
+			}
+
+			int Run(const Options& opts) {
+				// Transfer the map every time
+				cg_mapCache = 0;
+
+				LoopbackServer server{opts.server, ReadFile(opts.mapPath)};
+				server.Start();
+
+				std::printf("Map: %s\nClients: %d, bots: %d, protocol: 0.%d, seconds: %.1f\n",
+				            opts.mapPath.c_str(), opts.numClients, opts.server.numBots,
+				            opts.server.protocolVersion == 4 ? 76 : 75, opts.duration);
+				std::printf("Per client: %.1f WorldUpdate/s, %.1f BlockAction/s, "
+				            "%.1f KillAction/s\n",
+				            opts.server.worldUpdateRate, opts.server.blockActionRate,
+				            opts.server.killActionRate);
+
+				ServerAddress address{"127.0.0.1:" + std::to_string(opts.server.port),
+				                      static_cast<ProtocolVersion>(opts.server.protocolVersion)};
+
+				std::vector<std::unique_ptr<HeadlessClient>> clients;
+				for (int i = 0; i < opts.numClients; i++) {
+					clients.push_back(
+					  stmp::make_unique<HeadlessClient>("Client" + std::to_string(i), i % 2));
+					clients.back()->Connect(address);
+				}
+
+				FrameLoop loop{clients};
+
+				// Join the game. The synthetic traffic is already running.
+				auto allSpawned = [&] {
+					return std::all_of(clients.begin(), clients.end(),
+					                   [](const std::unique_ptr<HeadlessClient>& c) {
+						                   return c->spawned;
+					                   });
+				};
+				while (!allSpawned()) {
+					if (loop.GetTime() > JoinTimeout)
+						SPRaise("The clients didn't join in %.0f seconds", JoinTimeout);
+					loop.RunFrame();
+				}
+
+				double minJoinTime = JoinTimeout, maxJoinTime = 0.0, sumJoinTime = 0.0;
+				for (auto& client : clients) {
+					double t = client->joinTime.value();
+					minJoinTime = std::min(minJoinTime, t);
+					maxJoinTime = std::max(maxJoinTime, t);
+					sumJoinTime += t;
+				}
+
+				// Measure the steady state, then give the clients time to handle the rest
+				loop.ResetTimings();
+				std::uint64_t startPackets = server.GetStats().numPacketsSent;
+				std::uint64_t startBytes = server.GetStats().numBytesSent;
+				double startTime = loop.GetTime();
+
+				while (loop.GetTime() - startTime < opts.duration)
+					loop.RunFrame();
+
+				server.SetTrafficEnabled(false);
+				double drainStartTime = loop.GetTime();
+				while (loop.GetTime() - drainStartTime < DrainTime)
+					loop.RunFrame();
+
+				LoopbackServer::Stats stats = server.GetStats();
+				std::uint64_t numPackets = stats.numPacketsSent - startPackets;
+				std::uint64_t numBytes = stats.numBytesSent - startBytes;
+				std::uint64_t numWorldUpdates = 0;
+				for (auto& client : clients)
+					numWorldUpdates += client->numWorldUpdates;
+
+				std::printf("\nMap join: min %.1f ms, avg %.1f ms, max %.1f ms\n",
+				            minJoinTime * 1000.0, sumJoinTime * 1000.0 / opts.numClients,
+				            maxJoinTime * 1000.0);
+
+				std::printf("\nPackets: %llu (%.1f/s per client), %llu bytes\n",
+				            (unsigned long long)numPackets,
+				            numPackets / opts.duration / opts.numClients,
+				            (unsigned long long)numBytes);
+				std::printf("DoEvents: %.3f ms total, %.3f us/packet, %.0f packets/s\n",
+				            loop.handlingTime * 1000.0,
+				            numPackets ? loop.handlingTime * 1.0e6 / numPackets : 0.0,
+				            loop.handlingTime > 0.0 ? numPackets / loop.handlingTime : 0.0);
+				std::printf("World::Advance: %.3f ms total, %.3f us/tick per client\n",
+				            loop.simulationTime * 1000.0,
+				            loop.numTicks ? loop.simulationTime * 1.0e6 / loop.numTicks /
+				                              opts.numClients
+				                          : 0.0);
+				std::printf("World updates received: %llu\n",
+				            (unsigned long long)numWorldUpdates);
+
+				for (auto& client : clients)
+					client->net.Disconnect();
+				server.Stop();
+				return 0;
+			}
+		} // namespace
+	} // namespace client
+} // namespace spades
+
+int main(int argc, char** argv) {
+	try {
+		spades::reflection::Backtrace::StartBacktrace();
+		SPADES_MARK_FUNCTION();
+
+		return spades::client::Run(spades::client::ParseOptions(argc, argv));
+	} catch (const std::exception& ex) {
+		std::fprintf(stderr, "%s\n", ex.what());
+		return 1;
+	}
+}
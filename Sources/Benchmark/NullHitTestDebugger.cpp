@@ -0,0 +1,41 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+// The real `HitTestDebugger` draws with the software renderer, which the headless benchmark
+// doesn't link. This one does nothing, so `cg_debugHitTest` has no effect there.
+
+#include <Client/HitTestDebugger.h>
+#include <Client/IRenderer.h>
+#include <Core/Bitmap.h>
+
+namespace spades {
+	namespace client {
+		class HitTestDebugger::Port : public RefCountedObject {};
+
+		HitTestDebugger::HitTestDebugger(World* world) : world(world) {}
+
+		HitTestDebugger::~HitTestDebugger() {}
+
+		void HitTestDebugger::SaveImage(const std::map<int, PlayerHit>&,
+		                                const std::vector<Vector3>&) {}
+
+		Handle<Bitmap> HitTestDebugger::GetBitmap() { return {}; }
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,177 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+// A headless benchmark of the voxel ray casting. Compares `GameMap::CastRay2` with
+// `GameMap::CastRay2Packet` on rays resembling the ones cast by the game: ones fired at
+// the eye level over the terrain and ones fired upward, which spend most of their steps in
+// empty space.
+//
+// Usage: openspades-raycastbenchmark MAP.vxl [-rays N] [-seed N]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Client/GameMap.h>
+#include <Core/Debug.h>
+#include <Core/Exception.h>
+#include <Core/StdStream.h>
+#include <Core/Stopwatch.h>
+
+namespace spades {
+	namespace client {
+		namespace {
+			struct Options {
+				std::string mapPath;
+				int numRays = 100000;
+				unsigned int seed = 1;
+			};
+
+			struct Ray {
+				Vector3 start, dir;
+			};
+
+			Options ParseOptions(int argc, char** argv) {
+				Options opts;
+				for (int i = 1; i < argc; i++) {
+					std::string arg = argv[i];
+					auto value = [&]() -> const char* {
+						if (i + 1 >= argc)
+							SPRaise("Option '%s' requires a value", arg.c_str());
+						return argv[++i];
+					};
+					if (arg == "-rays")
+						opts.numRays = std::atoi(value());
+					else if (arg == "-seed")
+						opts.seed = (unsigned int)std::strtoul(value(), nullptr, 10);
+					else if (!arg.empty() && arg[0] == '-')
+						SPRaise("Unknown option: %s", arg.c_str());
+					else
+						opts.mapPath = arg;
+				}
+
+				if (opts.mapPath.empty())
+					SPRaise("Usage: %s MAP.vxl [-rays N] [-seed N]", argv[0]);
+				if (opts.numRays < 1)
+					SPRaise("The number of rays must be positive");
+				return opts;
+			}
+
+			Handle<GameMap> LoadMap(const std::string& path) {
+				FILE* f = std::fopen(path.c_str(), "rb");
+				if (!f)
+					SPRaise("Failed to open %s", path.c_str());
+				StdStream stream(f, true);
+				return {GameMap::Load(&stream), false};
+			}
+
+			bool IsSameRayCastResult(const GameMap::RayCastResult& a,
+			                         const GameMap::RayCastResult& b) {
+				return a.hit == b.hit && a.startSolid == b.startSolid && a.hitPos == b.hitPos &&
+				       a.hitBlock == b.hitBlock && a.normal == b.normal;
+			}
+
+			void Measure(const GameMap& map, const char* name, const std::vector<Ray>& rays,
+			             int maxSteps) {
+				std::vector<GameMap::RayCastResult> results;
+				results.reserve(rays.size());
+
+				Stopwatch sw;
+				for (const Ray& ray : rays)
+					results.push_back(map.CastRay2(ray.start, ray.dir, maxSteps));
+				double time = sw.GetTime();
+
+				int numMismatches = 0;
+				GameMap::RayPacket packet;
+				GameMap::RayPacketResult packetResult;
+				sw.Reset();
+				for (std::size_t i = 0; i < rays.size(); i++) {
+					packet.Add(rays[i].start, rays[i].dir);
+					if (!packet.IsFull() && i + 1 < rays.size())
+						continue;
+
+					map.CastRay2Packet(packet, maxSteps, packetResult);
+					std::size_t first = i + 1 - packet.numRays;
+					for (int k = 0; k < packet.numRays; k++) {
+						if (!IsSameRayCastResult(packetResult.Get(k), results[first + k]))
+							numMismatches++;
+					}
+					packet.numRays = 0;
+				}
+				double packetTime = sw.GetTime();
+
+				std::printf("  %-10s %4d steps  %10.1f ns/ray  %10.1f ns/ray  %d\n", name, maxSteps,
+				            time * 1.0e9 / rays.size(), packetTime * 1.0e9 / rays.size(),
+				            numMismatches);
+			}
+
+			int Run(const Options& opts) {
+				Handle<GameMap> map = LoadMap(opts.mapPath);
+
+				std::mt19937 random(opts.seed);
+				std::uniform_real_distribution<float> unit(0.0F, 1.0F);
+				std::vector<Ray> eyeLevelRays, upwardRays;
+				for (int i = 0; i < opts.numRays; i++) {
+					int x = (int)(unit(random) * map->Width()) % map->Width();
+					int y = (int)(unit(random) * map->Height()) % map->Height();
+					int z = 0;
+					while (z < map->Depth() - 1 && !map->IsSolid(x, y, z))
+						z++;
+
+					Ray ray;
+					ray.start = MakeVector3(x + unit(random), y + unit(random),
+					                        std::max((float)z - 2.5F, 0.5F));
+					ray.dir = MakeVector3(unit(random) - 0.5F, unit(random) - 0.5F,
+					                      (unit(random) - 0.5F) * 0.05F);
+					eyeLevelRays.push_back(ray);
+
+					ray.dir.z = unit(random) * -0.5F;
+					upwardRays.push_back(ray);
+				}
+
+				std::printf("Map: %s\nRays: %d, seed: %u\n\n", opts.mapPath.c_str(),
+				            opts.numRays, opts.seed);
+				std::printf("  %-10s %10s  %17s  %17s  %s\n", "Rays", "", "CastRay2",
+				            "CastRay2Packet", "Mismatches");
+				for (int maxSteps : {8, 32, 128, 256}) {
+					Measure(*map, "Eye-level", eyeLevelRays, maxSteps);
+					Measure(*map, "Upward", upwardRays, maxSteps);
+				}
+				return 0;
+			}
+		} // namespace
+	} // namespace client
+} // namespace spades
+
+int main(int argc, char** argv) {
+	try {
+		spades::reflection::Backtrace::StartBacktrace();
+		SPADES_MARK_FUNCTION();
+
+		return spades::client::Run(spades::client::ParseOptions(argc, argv));
+	} catch (const std::exception& ex) {
+		std::fprintf(stderr, "%s\n", ex.what());
+		return 1;
+	}
+}
@@ -0,0 +1,398 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+// A headless benchmark of the world simulation. Loads a map, spawns scripted bots, and runs
+// `World::Advance` as fast as possible. Nothing is rendered or played back, so it can run on
+// machines without a GPU or an audio device.
+//
+// Usage: openspades-benchmark MAP.vxl [-players N] [-ticks N] [-seed N] [-mode ctf|tc]
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Client/CTFGameMode.h>
+#include <Client/GameMap.h>
+#include <Client/GameProperties.h>
+#include <Client/Grenade.h>
+#include <Client/IWorldListener.h>
+#include <Client/Player.h>
+#include <Client/TCGameMode.h>
+#include <Client/Weapon.h>
+#include <Client/World.h>
+#include <Core/Debug.h>
+#include <Core/Exception.h>
+#include <Core/StdStream.h>
+#include <Core/Stopwatch.h>
+
+namespace {
+	std::atomic<std::uint64_t> numAllocations{0};
+	std::atomic<std::uint64_t> numAllocatedBytes{0};
+} // namespace
+
+void* operator new(std::size_t size) {
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+	numAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+
+namespace spades {
+	namespace client {
+		namespace {
+			constexpr float TickTime = 1.0F / 60.0F;
+
+			/** The number of bullet hits that destroy a block. */
+			constexpr int BlockHealth = 3;
+
+			struct Options {
+				std::string mapPath;
+				int numPlayers = 32;
+				int numTicks = 60 * 60;
+				unsigned int seed = 1;
+				std::string mode = "ctf";
+			};
+
+			/** Does what the server would do in response to the world's events. */
+			class BenchmarkListener : public IWorldListener {
+				World& world;
+				std::unordered_map<IntVector3, int> blockDamage;
+
+			public:
+				std::uint64_t numShots = 0;
+				std::uint64_t numPlayerHits = 0;
+				std::uint64_t numBlockHits = 0;
+				std::uint64_t numDestroyedBlocks = 0;
+				std::uint64_t numFallenBlocks = 0;
+				std::uint64_t numGrenades = 0;
+
+				BenchmarkListener(World& world) : world(world) {}
+
+				void DestroyBlock(IntVector3 pos) {
+					std::vector<IntVector3> blocks{pos};
+					world.DestroyBlock(blocks);
+					numDestroyedBlocks++;
+				}
+
+				void PlayerObjectSet(int) override {}
+				void PlayerMadeFootstep(Player&) override {}
+				void PlayerJumped(Player&) override {}
+				void PlayerLanded(Player&, bool) override {}
+				void PlayerFiredWeapon(Player&) override { numShots++; }
+				void PlayerEjectedBrass(Player&) override {}
+				void PlayerDryFiredWeapon(Player&) override {}
+				void PlayerReloadingWeapon(Player&) override {}
+				void PlayerReloadedWeapon(Player&) override {}
+				void PlayerChangedTool(Player&) override {}
+				void PlayerPulledGrenadePin(Player&) override {}
+				void PlayerThrewGrenade(Player& p, stmp::optional<const Grenade&> g) override {
+					if (g)
+						return;
+
+					// Remote players don't spawn grenades by themselves. See `ThrowGrenade`
+					Vector3 dir = p.GetFront();
+					float fuse = 3.0F - p.GetGrenadeCookTime();
+					world.AddGrenade(stmp::make_unique<Grenade>(
+					  world, p.GetEye() + dir * 0.1F, dir + p.GetVelocity(), fuse));
+					numGrenades++;
+				}
+				void PlayerMissedSpade(Player&) override {}
+				void PlayerHitBlockWithSpade(Player&, Vector3, IntVector3, IntVector3) override {}
+				void PlayerKilledPlayer(Player&, Player&, KillType) override {}
+				void PlayerRestocked(Player&) override {}
+
+				void BulletHitPlayer(Player&, HitType, Vector3, Player&,
+				                     std::unique_ptr<IBulletHitScanState>&) override {
+					numPlayerHits++;
+				}
+				void BulletHitBlock(Vector3, IntVector3 blockPos, IntVector3) override {
+					numBlockHits++;
+					if (++blockDamage[blockPos] >= BlockHealth) {
+						blockDamage.erase(blockPos);
+						DestroyBlock(blockPos);
+					}
+				}
+				void AddBulletTracer(Player&, Vector3, Vector3) override {}
+
+				void GrenadeExploded(const Grenade& g) override {
+					IntVector3 center = g.GetPosition().Floor();
+					for (int x = -1; x <= 1; x++)
+						for (int y = -1; y <= 1; y++)
+							for (int z = -1; z <= 1; z++)
+								DestroyBlock(center + MakeIntVector3(x, y, z));
+				}
+				void GrenadeBounced(const Grenade&) override {}
+				void GrenadeDroppedIntoWater(const Grenade&) override {}
+
+				void BlocksFell(std::vector<IntVector3> blocks) override {
+					numFallenBlocks += blocks.size();
+				}
+
+				void LocalPlayerBlockAction(IntVector3, BlockActionType) override {}
+				void LocalPlayerCreatedLineBlock(IntVector3, IntVector3) override {}
+				void LocalPlayerHurt(HurtType, Vector3) override {}
+				void LocalPlayerBuildError(BuildFailureReason) override {}
+			};
+
+			/** Generates a deterministic input stream for a player. */
+			class Bot {
+				std::mt19937 random;
+				int playerId;
+				int targetId = -1;
+
+				PlayerInput input;
+				WeaponInput weaponInput;
+				Vector3 aimJitter = MakeVector3(0, 0, 0);
+
+				/** The remaining ticks until the next change of each decision. */
+				int moveTicks = 0;
+				int targetTicks = 0;
+				int fireTicks = 0;
+				int grenadeTicks = 0;
+
+				int RandomTicks(int min, int max) {
+					return std::uniform_int_distribution<int>(min, max)(random);
+				}
+				float RandomFloat() { return std::uniform_real_distribution<float>(-1, 1)(random); }
+				bool RandomChance(int oneIn) { return RandomTicks(1, oneIn) == 1; }
+
+			public:
+				Bot(int playerId, unsigned int seed)
+				    : random(seed * 7919U + (unsigned int)playerId), playerId(playerId) {
+					grenadeTicks = RandomTicks(60 * 5, 60 * 20);
+				}
+
+				void Update(World& world, int numPlayers) {
+					Player& p = world.GetPlayer(playerId).value();
+
+					if (--moveTicks <= 0) {
+						moveTicks = RandomTicks(20, 120);
+						input = PlayerInput();
+						input.moveForward = RandomChance(2);
+						input.moveBackward = !input.moveForward && RandomChance(4);
+						input.moveLeft = RandomChance(3);
+						input.moveRight = !input.moveLeft && RandomChance(3);
+						input.jump = RandomChance(4);
+						input.crouch = RandomChance(6);
+						input.sprint = !input.crouch && RandomChance(4);
+						input.sneak = RandomChance(8);
+					} else {
+						// Jump only once for each decision
+						input.jump = false;
+					}
+
+					if (--targetTicks <= 0) {
+						targetTicks = RandomTicks(60, 240);
+						targetId = RandomTicks(0, numPlayers - 1);
+						aimJitter = MakeVector3(RandomFloat(), RandomFloat(), RandomFloat()) * 0.05F;
+					}
+
+					Vector3 target = world.GetPlayer(targetId).value().GetEye();
+					Vector3 dir = target - p.GetEye();
+					if (targetId == playerId || dir.GetSquaredLength() < 0.01F)
+						dir = MakeVector3(1, 0, 0);
+					p.SetOrientation((dir.Normalize() + aimJitter).Normalize());
+
+					// Fire in bursts, and throw a grenade sometimes
+					if (p.GetTool() == Player::ToolGrenade) {
+						if (--grenadeTicks <= 0) {
+							weaponInput.primary = false;
+							p.SetWeaponInput(weaponInput);
+							p.SetTool(Player::ToolWeapon);
+							grenadeTicks = RandomTicks(60 * 5, 60 * 20);
+						}
+					} else if (--grenadeTicks <= 0) {
+						p.SetTool(Player::ToolGrenade);
+						weaponInput = WeaponInput();
+						weaponInput.primary = true;
+						grenadeTicks = RandomTicks(20, 60);
+					} else if (--fireTicks <= 0) {
+						fireTicks = RandomTicks(10, 90);
+						weaponInput.primary = !weaponInput.primary;
+						weaponInput.secondary = RandomChance(3);
+					}
+
+					if (p.IsToolWeapon() && p.GetWeapon().GetAmmo() == 0)
+						p.Reload();
+
+					p.SetInput(input);
+					p.SetWeaponInput(weaponInput);
+				}
+			};
+
+			Options ParseOptions(int argc, char** argv) {
+				Options opts;
+				for (int i = 1; i < argc; i++) {
+					std::string arg = argv[i];
+					auto value = [&]() -> const char* {
+						if (i + 1 >= argc)
+							SPRaise("Option '%s' requires a value", arg.c_str());
+						return argv[++i];
+					};
+					if (arg == "-players")
+						opts.numPlayers = std::atoi(value());
+					else if (arg == "-ticks")
+						opts.numTicks = std::atoi(value());
+					else if (arg == "-seed")
+						opts.seed = (unsigned int)std::strtoul(value(), nullptr, 10);
+					else if (arg == "-mode")
+						opts.mode = value();
+					else if (!arg.empty() && arg[0] == '-')
+						SPRaise("Unknown option: %s", arg.c_str());
+					else
+						opts.mapPath = arg;
+				}
+
+				if (opts.mapPath.empty())
+					SPRaise("Usage: %s MAP.vxl [-players N] [-ticks N] [-seed N] [-mode ctf|tc]",
+					        argv[0]);
+				if (opts.numPlayers < 1 || opts.numPlayers > (int)NumPlayerSlots)
+					SPRaise("The number of players must be between 1 and %d", (int)NumPlayerSlots);
+				if (opts.mode != "ctf" && opts.mode != "tc")
+					SPRaise("Unknown game mode: %s", opts.mode.c_str());
+				return opts;
+			}
+
+			Handle<GameMap> LoadMap(const std::string& path) {
+				FILE* f = std::fopen(path.c_str(), "rb");
+				if (!f)
+					SPRaise("Failed to open %s", path.c_str());
+				StdStream stream(f, true);
+				return {GameMap::Load(&stream), false};
+			}
+
+			/** Finds a spawn point on the ground. */
+			Vector3 FindSpawnPoint(GameMap& map, std::mt19937& random) {
+				std::uniform_int_distribution<int> coord(64, GameMap::DefaultWidth - 64);
+				int x = coord(random), y = coord(random);
+				int z = 0;
+				while (z < GameMap::DefaultDepth - 1 && !map.IsSolid(x, y, z))
+					z++;
+				return MakeVector3((float)x + 0.5F, (float)y + 0.5F, (float)z - 2.4F);
+			}
+
+			void PrintPhase(const char* name, double seconds, int numTicks) {
+				std::printf("  %-20s %10.3f ms  %8.3f us/tick\n", name, seconds * 1000.0,
+				            seconds * 1.0e6 / numTicks);
+			}
+
+			int Run(const Options& opts) {
+				// Weapon spreads and such use the global random number generator
+				SeedRandom(opts.seed);
+
+				auto props = std::make_shared<GameProperties>(ProtocolVersion::v075);
+				World world(props);
+				world.SetMap(LoadMap(opts.mapPath));
+
+				BenchmarkListener listener(world);
+				world.SetListener(&listener);
+
+				if (opts.mode == "tc")
+					world.SetMode(stmp::make_unique<TCGameMode>(world));
+				else
+					world.SetMode(stmp::make_unique<CTFGameMode>());
+
+				std::mt19937 random(opts.seed);
+				const WeaponType weapons[] = {RIFLE_WEAPON, SMG_WEAPON, SHOTGUN_WEAPON};
+				std::vector<Bot> bots;
+				for (int i = 0; i < opts.numPlayers; i++) {
+					Vector3 pos = FindSpawnPoint(*world.GetMap(), random);
+					world.SetPlayer(i, stmp::make_unique<Player>(world, i, weapons[i % 3], i % 2,
+					                                             pos, MakeIntVector3(127, 127, 127)));
+					bots.emplace_back(i, opts.seed);
+				}
+
+				std::printf("Map: %s\nPlayers: %d, ticks: %d, seed: %u, mode: %s\n",
+				            opts.mapPath.c_str(), opts.numPlayers, opts.numTicks, opts.seed,
+				            opts.mode.c_str());
+
+				World::AdvanceTimings timings;
+				world.SetAdvanceTimings(&timings);
+				double inputTime = 0.0;
+
+				std::uint64_t startAllocations = numAllocations;
+				std::uint64_t startAllocatedBytes = numAllocatedBytes;
+				Stopwatch total;
+
+				for (int tick = 0; tick < opts.numTicks; tick++) {
+					Stopwatch sw;
+					for (Bot& bot : bots)
+						bot.Update(world, opts.numPlayers);
+					inputTime += sw.GetTime();
+
+					world.Advance(TickTime);
+				}
+
+				double totalTime = total.GetTime();
+				std::uint64_t allocations = numAllocations - startAllocations;
+				std::uint64_t allocatedBytes = numAllocatedBytes - startAllocatedBytes;
+
+				std::printf("\nTicks/s: %.1f (%.3f s total)\n\nPhases:\n",
+				            opts.numTicks / totalTime, totalTime);
+				PrintPhase("input", inputTime, opts.numTicks);
+				PrintPhase("block actions", timings.blockActions, opts.numTicks);
+				PrintPhase("player grid", timings.playerGrid, opts.numTicks);
+				PrintPhase("players", timings.players, opts.numTicks);
+				PrintPhase("block regeneration", timings.blockRegeneration, opts.numTicks);
+				PrintPhase("grenades", timings.grenades, opts.numTicks);
+
+				std::printf("\nAllocations: %llu (%.1f/tick), %llu bytes (%.1f/tick)\n",
+				            (unsigned long long)allocations, (double)allocations / opts.numTicks,
+				            (unsigned long long)allocatedBytes,
+				            (double)allocatedBytes / opts.numTicks);
+				std::printf("Shots: %llu, player hits: %llu, block hits: %llu, grenades: %llu\n",
+				            (unsigned long long)listener.numShots,
+				            (unsigned long long)listener.numPlayerHits,
+				            (unsigned long long)listener.numBlockHits,
+				            (unsigned long long)listener.numGrenades);
+				std::printf("Destroyed blocks: %llu, fallen blocks: %llu\n",
+				            (unsigned long long)listener.numDestroyedBlocks,
+				            (unsigned long long)listener.numFallenBlocks);
+
+				world.SetAdvanceTimings(nullptr);
+				world.SetListener(nullptr);
+				return 0;
+			}
+		} // namespace
+	} // namespace client
+} // namespace spades
+
+int main(int argc, char** argv) {
+	try {
+		spades::reflection::Backtrace::StartBacktrace();
+		SPADES_MARK_FUNCTION();
+
+		return spades::client::Run(spades::client::ParseOptions(argc, argv));
+	} catch (const std::exception& ex) {
+		std::fprintf(stderr, "%s\n", ex.what());
+		return 1;
+	}
+}
@@ -0,0 +1,167 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "BlockRegenerationWheel.h"
+#include <Core/Debug.h>
+
+namespace spades {
+	namespace client {
+		namespace {
+			constexpr std::uint32_t NullNode = 0xffffffff;
+
+			std::int64_t TickOf(float time) {
+				return static_cast<std::int64_t>(
+				  std::floor(time * BlockRegenerationWheel::SlotsPerSecond));
+			}
+		} // namespace
+
+		BlockRegenerationWheel::BlockRegenerationWheel() { Clear(); }
+
+		void BlockRegenerationWheel::Clear() {
+			nodes.clear();
+			freeNodes = NullNode;
+			numEntries = 0;
+			slots.assign(NumSlots, NullNode);
+			hashTable.assign(256, NullNode);
+			nextTick = 0;
+		}
+
+		std::uint32_t BlockRegenerationWheel::HashOf(const IntVector3& pos) const {
+			return static_cast<std::uint32_t>(std::hash<IntVector3>{}(pos) &
+			                                  (hashTable.size() - 1));
+		}
+
+		std::uint32_t BlockRegenerationWheel::Find(const IntVector3& pos,
+		                                           std::uint32_t& hashPrev) const {
+			hashPrev = NullNode;
+			for (std::uint32_t i = hashTable[HashOf(pos)]; i != NullNode;
+			     i = nodes[i].hashNext) {
+				if (nodes[i].pos == pos)
+					return i;
+				hashPrev = i;
+			}
+			return NullNode;
+		}
+
+		void BlockRegenerationWheel::Schedule(const IntVector3& pos, float time) {
+			Cancel(pos);
+
+			if (numEntries >= hashTable.size())
+				Rehash(hashTable.size() * 2);
+
+			std::uint32_t index;
+			if (freeNodes != NullNode) {
+				index = freeNodes;
+				freeNodes = nodes[index].next;
+			} else {
+				index = static_cast<std::uint32_t>(nodes.size());
+				nodes.emplace_back();
+			}
+
+			// An entry in a tick that was already passed would never be visited
+			std::int64_t tick = std::max(TickOf(time), nextTick);
+
+			Node& node = nodes[index];
+			node.pos = pos;
+			node.time = time;
+			node.slot = static_cast<std::uint32_t>(tick & (NumSlots - 1));
+
+			node.prev = NullNode;
+			node.next = slots[node.slot];
+			if (node.next != NullNode)
+				nodes[node.next].prev = index;
+			slots[node.slot] = index;
+
+			std::uint32_t &bucket = hashTable[HashOf(pos)];
+			node.hashNext = bucket;
+			bucket = index;
+
+			numEntries++;
+		}
+
+		void BlockRegenerationWheel::Cancel(const IntVector3& pos) {
+			std::uint32_t hashPrev;
+			std::uint32_t index = Find(pos, hashPrev);
+			if (index != NullNode)
+				Remove(index, hashPrev);
+		}
+
+		void BlockRegenerationWheel::Remove(std::uint32_t index, std::uint32_t hashPrev) {
+			Node& node = nodes[index];
+
+			if (node.prev != NullNode)
+				nodes[node.prev].next = node.next;
+			else
+				slots[node.slot] = node.next;
+			if (node.next != NullNode)
+				nodes[node.next].prev = node.prev;
+
+			if (hashPrev != NullNode)
+				nodes[hashPrev].hashNext = node.hashNext;
+			else
+				hashTable[HashOf(node.pos)] = node.hashNext;
+
+			node.next = freeNodes;
+			freeNodes = index;
+			numEntries--;
+		}
+
+		void BlockRegenerationWheel::Rehash(std::size_t size) {
+			SPAssert((size & (size - 1)) == 0);
+
+			hashTable.assign(size, NullNode);
+			for (std::uint32_t head : slots) {
+				for (std::uint32_t i = head; i != NullNode; i = nodes[i].next) {
+					std::uint32_t &bucket = hashTable[HashOf(nodes[i].pos)];
+					nodes[i].hashNext = bucket;
+					bucket = i;
+				}
+			}
+		}
+
+		void BlockRegenerationWheel::PopExpired(float now, std::vector<IntVector3>& expired) {
+			std::int64_t currentTick = TickOf(now);
+			if (currentTick < nextTick)
+				return;
+
+			// Entries more than one revolution ahead share slots with the current ones, so
+			// the expiration times are checked individually. The current tick is visited
+			// again by the next call since it may still have unexpired entries.
+			std::int64_t numTicks = std::min<std::int64_t>(currentTick - nextTick + 1, NumSlots);
+			for (std::int64_t tick = nextTick; tick < nextTick + numTicks; tick++) {
+				std::uint32_t i = slots[tick & (NumSlots - 1)];
+				while (i != NullNode) {
+					std::uint32_t next = nodes[i].next;
+					if (nodes[i].time <= now) {
+						expired.push_back(nodes[i].pos);
+						Cancel(nodes[i].pos);
+					}
+					i = next;
+				}
+			}
+			nextTick = currentTick;
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,95 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Core/Math.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * Schedules the regeneration of damaged blocks.
+		 *
+		 * This is a hashed timing wheel: each entry is linked into the slot of the tick
+		 * (`1 / SlotsPerSecond` seconds long) it expires in, and into a hash table keyed
+		 * by its position. The nodes are pooled, so scheduling, cancelling, and expiring an
+		 * entry take constant time and don't allocate memory once the pool has grown to
+		 * the peak number of entries.
+		 */
+		class BlockRegenerationWheel {
+		public:
+			enum {
+				SlotsPerSecond = 16,
+				/** The wheel spans 16 seconds, longer than the regeneration delay. */
+				NumSlots = 256
+			};
+
+			BlockRegenerationWheel();
+
+			/** Schedules `pos` to expire at `time`, replacing the existing entry of `pos`. */
+			void Schedule(const IntVector3& pos, float time);
+
+			/** Removes the entry of `pos` if there is one. */
+			void Cancel(const IntVector3& pos);
+
+			/**
+			 * Removes all entries that expire at or before `now` and appends their
+			 * positions to `expired`. `now` must not decrease between calls.
+			 */
+			void PopExpired(float now, std::vector<IntVector3>& expired);
+
+			void Clear();
+
+			std::size_t GetNumEntries() const { return numEntries; }
+
+		private:
+			struct Node {
+				IntVector3 pos;
+				float time;
+				/** The neighbors in the slot's list. `next` links the free list instead. */
+				std::uint32_t prev, next;
+				/** The next node in the same hash table bucket. */
+				std::uint32_t hashNext;
+				std::uint32_t slot;
+			};
+
+			std::vector<Node> nodes;
+			std::uint32_t freeNodes;
+			std::size_t numEntries = 0;
+
+			/** The first node of each slot's list. */
+			std::vector<std::uint32_t> slots;
+			/** The first node of each bucket. The size is a power of two. */
+			std::vector<std::uint32_t> hashTable;
+
+			/** The earliest tick that might still have unexpired entries. */
+			std::int64_t nextTick = 0;
+
+			std::uint32_t HashOf(const IntVector3&) const;
+			std::uint32_t Find(const IntVector3&, std::uint32_t& hashPrev) const;
+			void Remove(std::uint32_t index, std::uint32_t hashPrev);
+			void Rehash(std::size_t size);
+		};
+	} // namespace client
+} // namespace spades
@@ -46,12 +46,14 @@
 
 #include "BloodMarks.h"
 #include "Corpse.h"
+#include "ParticleSystem.h"
 #include "SmokeSpriteEntity.h"
 
 #include "GameMap.h"
 #include "Weapon.h"
 #include "World.h"
 
+#include "DemoPlayer.h"
 #include "NetClient.h"
 
 DEFINE_SPADES_SETTING(cg_chatBeep, "1");
@@ -62,6 +64,7 @@ DEFINE_SPADES_SETTING(cg_skipDeadPlayersWhenDead, "1");
 DEFINE_SPADES_SETTING(cg_ignorePrivateMessages, "0");
 DEFINE_SPADES_SETTING(cg_ignoreChatMessages, "0");
 DEFINE_SPADES_SETTING(cg_smallFont, "0");
+DEFINE_SPADES_SETTING(cg_demoRecord, "0");
 
 SPADES_SETTING(cg_playerName);
 
@@ -69,10 +72,12 @@ namespace spades {
 	namespace client {
 
 		Client::Client(Handle<IRenderer> r, Handle<IAudioDevice> audioDev,
-		               const ServerAddress& host, Handle<FontManager> fontManager)
+		               const ServerAddress& host, Handle<FontManager> fontManager,
+		               const std::string& demoFileName)
 		    : playerName(cg_playerName.operator std::string().substr(0, 15)),
 		      logStream(nullptr),
 		      hostname(host),
+		      demoFileName(demoFileName),
 		      renderer(r),
 		      audioDevice(audioDev),
 
@@ -142,6 +147,7 @@ namespace spades {
 				audioDev.GetPointerOrNull(), fontManager.GetPointerOrNull(), this);
 
 			bloodMarks = stmp::make_unique<BloodMarks>(*this);
+			particles = stmp::make_unique<ParticleSystem>(*this);
 
 			renderer->SetGameMap(nullptr);
 		}
@@ -365,9 +371,15 @@ namespace spades {
 			mumbleLink.SetContext(hostname.ToString(false));
 			mumbleLink.SetIdentity(playerName);
 
-			SPLog("Started connecting to '%s'", hostname.ToString().c_str());
 			net = stmp::make_unique<NetClient>(this);
-			net->Connect(hostname);
+			if (!demoFileName.empty()) {
+				SPLog("Started playing the demo '%s'", demoFileName.c_str());
+				net->PlayDemo(stmp::make_unique<DemoPlayer>(
+				  FileManager::OpenForReading(demoFileName.c_str())));
+			} else {
+				SPLog("Started connecting to '%s'", hostname.ToString().c_str());
+				net->Connect(hostname);
+			}
 
 			// get host/time string
 			std::string fn = hostname.ToString(false);
@@ -397,6 +409,16 @@ namespace spades {
 			} catch (const std::exception& ex) {
 				SPLog("Failed to open netlog file '%s' (%s)", logFn.c_str(), ex.what());
 			}
+
+			if (cg_demoRecord && !net->IsPlayingDemo()) {
+				const std::string demoFn = "Demos/" + fn2 + ".demo";
+				try {
+					net->StartRecording(FileManager::OpenForWriting(demoFn.c_str()));
+					SPLog("Demo recording started at '%s'", demoFn.c_str());
+				} catch (const std::exception& ex) {
+					SPLog("Failed to open demo file '%s' (%s)", demoFn.c_str(), ex.what());
+				}
+			}
 		}
 
 		void Client::RunFrame(float dt) {
@@ -416,6 +438,9 @@ namespace spades {
 				}
 			}
 
+			// A demo is played at its own speed
+			dt = net->AdvanceDemoClock(dt);
+
 			timeSinceInit += std::min(dt, 0.03F);
 
 			// update network
@@ -463,6 +488,14 @@ namespace spades {
 				else
 					mapReceivingProgressSmoothed =
 					  Mix(mapReceivingProgressSmoothed, progress, 1.0F - powf(0.05F, dt));
+
+				// Let the renderer prepare the terrain while the rest is still being
+				// downloaded. It's replaced by the same map when the world is created.
+				if (!world) {
+					Handle<GameMap> receivingMap = net->GetReceivingGameMap();
+					if (receivingMap)
+						renderer->SetGameMap(receivingMap);
+				}
 			} else {
 				mapReceivingProgressSmoothed = 0.0F;
 			}
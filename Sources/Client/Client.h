@@ -25,9 +25,11 @@
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "ClientCameraMode.h"
 #include "ILocalEntity.h"
+#include "INetClientListener.h"
 #include "IRenderer.h"
 #include "IWorldListener.h"
 #include "MumbleLink.h"
@@ -66,9 +68,10 @@ namespace spades {
 		class TCProgressView;
 		class ClientPlayer;
 		class BloodMarks;
+		class ParticleSystem;
 		class ClientUI;
 
-		class Client : public IWorldListener, public gui::View {
+		class Client : public IWorldListener, public INetClientListener, public gui::View {
 			friend class ScoreboardView;
 			friend class LimboView;
 			friend class MapView;
@@ -107,6 +110,8 @@ namespace spades {
 			Handle<ClientUI> scriptedUI;
 
 			ServerAddress hostname;
+			/** The demo to play instead of connecting to `hostname`, if not empty. */
+			std::string demoFileName;
 
 			std::unique_ptr<World> world;
 			Handle<GameMap> map;
@@ -350,7 +355,8 @@ namespace spades {
 			float mapReceivingProgressSmoothed = 0.0F;
 
 			std::list<std::unique_ptr<ILocalEntity>> localEntities;
-			std::list<std::unique_ptr<Corpse>> corpses;
+			/** Indexed by the corpse update tasks. The oldest corpse comes first. */
+			std::vector<std::unique_ptr<Corpse>> corpses;
 			Corpse* lastLocalCorpse;
 			unsigned int corpseSoftLimit;
 			unsigned int corpseHardLimit;
@@ -360,6 +366,7 @@ namespace spades {
 			void RemoveCorpseForPlayer(int playerId);
 
 			std::unique_ptr<BloodMarks> bloodMarks;
+			std::unique_ptr<ParticleSystem> particles;
 
 			int nextScreenShotIndex;
 			int nextMapShotIndex;
@@ -446,7 +453,8 @@ namespace spades {
 
 		public:
 			Client(Handle<IRenderer>, Handle<IAudioDevice>,
-				const ServerAddress& host, Handle<FontManager>);
+				const ServerAddress& host, Handle<FontManager>,
+				const std::string& demoFileName = std::string());
 
 			void RunFrame(float dt) override;
 			void RunFrameLate(float dt) override;
@@ -464,13 +472,15 @@ namespace spades {
 			Handle<gui::ConsoleCommandCandidateIterator>
 			AutocompleteCommandName(const std::string& name) override;
 
-			void SetWorld(World*);
-			World* GetWorld() const { return world.get(); }
+			void SetWorld(World*) override;
+			World* GetWorld() const override { return world.get(); }
 			void AddLocalEntity(std::unique_ptr<ILocalEntity>&& ent) {
 				localEntities.emplace_back(std::move(ent));
 			}
 
-			void MarkWorldUpdate();
+			ParticleSystem& GetParticleSystem() { return *particles; }
+
+			void MarkWorldUpdate() override;
 
 			IRenderer& GetRenderer() { return *renderer; }
 			SceneDefinition GetLastSceneDef() { return lastSceneDef; }
@@ -481,25 +491,28 @@ namespace spades {
 			bool WantsToBeClosed() override;
 			bool IsMuted();
 
-			void PlayerSentChatMessage(Player&, bool global, const std::string&);
-			void ServerSentMessage(bool system, const std::string&);
-
-			void PlayerCapturedIntel(Player&);
-			void PlayerPickedIntel(Player&);
-			void PlayerDropIntel(Player&);
-			void TeamCapturedTerritory(int teamId, int territoryId);
-			void TeamWon(int);
-			void JoinedGame();
-			void LocalPlayerCreated();
-			void RegisterPlacedBlocks(int c) { placedBlocks += c; };
-			void PlayerCreatedBlock(Player&);
+			// INetClientListener begin
+			void PlayerSentChatMessage(Player&, bool global, const std::string&) override;
+			void ServerSentMessage(bool system, const std::string&) override;
+
+			void PlayerCapturedIntel(Player&) override;
+			void PlayerPickedIntel(Player&) override;
+			void PlayerDropIntel(Player&) override;
+			void TeamCapturedTerritory(int teamId, int territoryId) override;
+			void TeamWon(int) override;
+			void JoinedGame() override;
+			void LocalPlayerCreated() override;
+			void RegisterPlacedBlocks(int c) override { placedBlocks += c; };
+			void PlayerCreatedBlock(Player&) override;
+			void PlayerDestroyedBlockWithWeaponOrTool(IntVector3) override;
+			void PlayerDiggedBlock(IntVector3) override;
+			void GrenadeDestroyedBlock(IntVector3) override;
+			void PlayerLeaving(Player&) override;
+			void PlayerJoinedTeam(Player&) override;
+			void PlayerSpawned(Player&) override;
+			// INetClientListener end
+
 			void PlayBlockDestroySound(Vector3);
-			void PlayerDestroyedBlockWithWeaponOrTool(IntVector3);
-			void PlayerDiggedBlock(IntVector3);
-			void GrenadeDestroyedBlock(IntVector3);
-			void PlayerLeaving(Player&);
-			void PlayerJoinedTeam(Player&);
-			void PlayerSpawned(Player&);
 
 			// IWorldListener begin
 			void PlayerObjectSet(int) override;
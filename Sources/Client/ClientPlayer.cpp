@@ -111,6 +111,9 @@ namespace spades {
 
 			Handle<IImage> CreateImage(Bitmap& bmp) { return base->CreateImage(bmp); }
 			Handle<IModel> CreateModel(VoxelModel& m) { return base->CreateModel(m); }
+			std::function<Handle<IModel>()> PrepareModel(VoxelModel& m) {
+				return base->PrepareModel(m);
+			}
 
 			void SetGameMap(stmp::optional<GameMap&>) { OnProhibitedAction(); }
 
@@ -18,6 +18,7 @@
  */
 
 #include "Client.h"
+#include "NetClient.h"
 
 #include <Gui/ConsoleCommand.h>
 
@@ -26,10 +27,12 @@ namespace spades {
 		namespace {
 			constexpr const char* CMD_SAVEMAP = "savemap";
 			constexpr const char* CMD_SETBLOCKCOLOR = "setblockcolor";
+			constexpr const char* CMD_DEMOSEEK = "demoseek";
 
 			std::map<std::string, std::string> const g_clientCommands{
 			  {CMD_SAVEMAP, ": Save the current state of the map to the disk"},
 			  {CMD_SETBLOCKCOLOR, ": Set the block color (all values 0-255)"},
+			  {CMD_DEMOSEEK, " <seconds>: Jump to the specified time of the demo being played"},
 			};
 		} // namespace
 
@@ -53,6 +56,17 @@ namespace spades {
 					return true;
 				}
 				return true;
+			} else if (cmd->GetName() == CMD_DEMOSEEK) {
+				if (cmd->GetNumArguments() != 1) {
+					SPLog("Usage: %s <seconds>", CMD_DEMOSEEK);
+					return true;
+				}
+				if (!net || !net->IsPlayingDemo()) {
+					SPLog("No demo is being played");
+					return true;
+				}
+				net->SeekDemo(std::stod(cmd->GetArgument(0)));
+				return true;
 			} else {
 				return false;
 			}
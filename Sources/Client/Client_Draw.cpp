@@ -46,6 +46,7 @@
 #include "LimboView.h"
 #include "MapView.h"
 #include "PaletteView.h"
+#include "PlayerSnapshotBuffer.h"
 #include "ScoreboardView.h"
 #include "TCProgressView.h"
 
@@ -1244,6 +1245,14 @@ namespace spades {
 				sprintf(buf, ", ping: %dms", ping);
 				str += buf;
 
+				if (world) {
+					// Display the jitter buffer of the remote players
+					auto snapshots = world->GetPlayerSnapshots().GetStats();
+					sprintf(buf, ", interp: %dms/%.1f/%d", (int)(snapshots.playoutDelay * 1000.0F),
+					        snapshots.bufferDepth, (int)snapshots.underruns);
+					str += buf;
+				}
+
 				auto upbps = net->GetUplinkBps() / 1000;
 				auto downbps = net->GetDownlinkBps() / 1000;
 				sprintf(buf, ", up/down: %.02f/%.02fkbps", upbps, downbps);
@@ -444,7 +444,7 @@ namespace spades {
 							corpses.emplace_back(std::move(corp));
 
 							if (corpses.size() > corpseHardLimit)
-								corpses.pop_front();
+								corpses.erase(corpses.begin());
 							else if (corpses.size() > corpseSoftLimit)
 								RemoveInvisibleCorpses();
 						}
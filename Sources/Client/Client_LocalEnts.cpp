@@ -19,6 +19,7 @@
 
  */
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <iterator>
@@ -35,8 +36,7 @@
 #include "BloodMarks.h"
 #include "Corpse.h"
 #include "ILocalEntity.h"
-#include "ParticleSpriteEntity.h"
-#include "SmokeSpriteEntity.h"
+#include "ParticleSystem.h"
 
 #include "GameMap.h"
 #include "Weapon.h"
@@ -69,41 +69,38 @@ namespace spades {
 			damageIndicators.clear();
 			localEntities.clear();
 			bloodMarks->Clear();
+			particles->Clear();
 		}
 
 		void Client::RemoveInvisibleCorpses() {
 			SPADES_MARK_FUNCTION();
 
-			decltype(corpses)::iterator it;
-			std::vector<decltype(it)> its;
 			int cnt = (int)corpses.size() - corpseSoftLimit;
-			for (it = corpses.begin(); it != corpses.end(); it++) {
+			auto isRemoved = [&](const std::unique_ptr<Corpse>& c) {
 				if (cnt <= 0)
-					break;
-
-				auto& c = *it;
-				if (!c->IsVisibleFrom(lastSceneDef.viewOrigin)) {
-					if (c.get() == lastLocalCorpse)
-						lastLocalCorpse = nullptr;
-					its.push_back(it);
-				}
-
+					return false;
 				cnt--;
-			}
 
-			for (const auto& it : its)
-				corpses.erase(it);
+				if (c->IsVisibleFrom(lastSceneDef.viewOrigin))
+					return false;
+				if (c.get() == lastLocalCorpse)
+					lastLocalCorpse = nullptr;
+				return true;
+			};
+			corpses.erase(std::remove_if(corpses.begin(), corpses.end(), isRemoved),
+			              corpses.end());
 		}
 
 		void Client::RemoveCorpseForPlayer(int playerId) {
-			for (auto it = corpses.begin(); it != corpses.end();) {
-				auto cur = it;
-				++it;
-
-				auto& c = *cur;
-				if (c->GetPlayerId() == playerId)
-					corpses.erase(cur);
-			}
+			auto isRemoved = [&](const std::unique_ptr<Corpse>& c) {
+				if (c->GetPlayerId() != playerId)
+					return false;
+				if (c.get() == lastLocalCorpse)
+					lastLocalCorpse = nullptr;
+				return true;
+			};
+			corpses.erase(std::remove_if(corpses.begin(), corpses.end(), isRemoved),
+			              corpses.end());
 		}
 
 		stmp::optional<std::tuple<Player&, hitTag_t>> Client::HotTrackedPlayer() {
@@ -159,13 +156,13 @@ namespace spades {
 			Vector4 color = ConvertColorRGBA(IntVectorFromColor(col));
 
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 8.0F);
-				ent->SetRadius(0.4F);
-				ent->SetLifeTime(3.0F, 0.0F, 1.0F);
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 8.0F);
+				particle.SetRadius(0.4F);
+				particle.SetLifeTime(3.0F, 0.0F, 1.0F);
 				if (distSqr < 16.0F * 16.0F)
-					ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-				localEntities.emplace_back(std::move(ent));
+					particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+				particles->AddSprite(*img, particle);
 			}
 
 			if ((int)cg_particles < 2)
@@ -173,25 +170,24 @@ namespace spades {
 
 			color = MakeVector4(0.7F, 0.35F, 0.37F, 0.6F);
 			for (int i = 0; i < 2; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 100.0F,
-					SmokeSpriteEntity::Type::Explosion);
-				ent->SetTrajectory(pos, RandomAxis() * 0.7F, 0.8F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.5F + SampleRandomFloat() * SampleRandomFloat() * 0.2F, 2.0F);
-				ent->SetLifeTime(0.2F + SampleRandomFloat() * 0.2F, 0.06F, 0.2F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, RandomAxis() * 0.7F, 0.8F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.5F + SampleRandomFloat() * SampleRandomFloat() * 0.2F, 2.0F);
+				particle.SetLifeTime(0.2F + SampleRandomFloat() * 0.2F, 0.06F, 0.2F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Explosion, 100.0F, particle);
 			}
 
 			color.w *= 0.1F;
 			{
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 40.0F);
-				ent->SetTrajectory(pos, RandomAxis() * 0.7F, 0.8F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.7F + SampleRandomFloat() * SampleRandomFloat() * 0.2F, 2.0F, 0.1F);
-				ent->SetLifeTime(0.8F + SampleRandomFloat() * 0.4F, 0.06F, 1.0F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, RandomAxis() * 0.7F, 0.8F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.7F + SampleRandomFloat() * SampleRandomFloat() * 0.2F, 2.0F, 0.1F);
+				particle.SetLifeTime(0.8F + SampleRandomFloat() * 0.4F, 0.06F, 1.0F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Steady, 40.0F, particle);
 			}
 		}
 
@@ -229,14 +225,14 @@ namespace spades {
 			Vector4 color = ConvertColorRGBA(col);
 
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
+				ParticleSystem::Particle particle(color);
 				Vector3 dir = RandomAxis() + velBias * 0.5F;
-				ent->SetTrajectory(pos + dir * 0.2F, dir * 8.0F);
-				ent->SetRadius(0.4F);
-				ent->SetLifeTime(3.0F, 0.0F, 1.0F);
+				particle.SetTrajectory(pos + dir * 0.2F, dir * 8.0F);
+				particle.SetRadius(0.4F);
+				particle.SetLifeTime(3.0F, 0.0F, 1.0F);
 				if (distSqr < 16.0F * 16.0F)
-					ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-				localEntities.emplace_back(std::move(ent));
+					particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+				particles->AddSprite(*img, particle);
 			}
 
 			if ((int)cg_particles < 2)
@@ -244,27 +240,27 @@ namespace spades {
 
 			if (distSqr < 32.0F * 32.0F) {
 				for (int i = 0; i < 8; i++) {
-					auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-					ent->SetTrajectory(pos, RandomAxis() * 12.0F, 1.0F, 0.9F);
-					ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-					ent->SetRadius(0.2F + SampleRandomFloat() * SampleRandomFloat() * 0.25F);
-					ent->SetLifeTime(3.0F, 0.0F, 1.0F);
+					ParticleSystem::Particle particle(color);
+					particle.SetTrajectory(pos, RandomAxis() * 12.0F, 1.0F, 0.9F);
+					particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+					particle.SetRadius(0.2F + SampleRandomFloat() * SampleRandomFloat() * 0.25F);
+					particle.SetLifeTime(3.0F, 0.0F, 1.0F);
 					if (distSqr < 16.0F * 16.0F)
-						ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-					localEntities.emplace_back(std::move(ent));
+						particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+					particles->AddSprite(*img, particle);
 				}
 			}
 
 			color += (MakeVector4(1, 1, 1, 1) - color) * 0.2F;
 			color.w *= 0.2F;
 			for (int i = 0; i < 2; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 100.0F);
-				ent->SetTrajectory(pos, RandomAxis() * 0.7F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.2F, 0.8F);
-				ent->SetLifeTime(0.3F + SampleRandomFloat() * 0.3F, 0.06F, 0.4F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, RandomAxis() * 0.7F, 1.0F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.2F, 0.8F);
+				particle.SetLifeTime(0.3F + SampleRandomFloat() * 0.3F, 0.06F, 0.4F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Steady, 100.0F, particle);
 			}
 		}
 
@@ -289,13 +285,13 @@ namespace spades {
 			Vector4 color = ConvertColorRGBA(IntVectorFromColor(col));
 
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(origin, RandomAxis() * 8.0F);
-				ent->SetRadius(0.4F);
-				ent->SetLifeTime(3.0F, 0.0F, 1.0F);
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(origin, RandomAxis() * 8.0F);
+				particle.SetRadius(0.4F);
+				particle.SetLifeTime(3.0F, 0.0F, 1.0F);
 				if (distSqr < 16.0F * 16.0F)
-					ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-				localEntities.emplace_back(std::move(ent));
+					particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+				particles->AddSprite(*img, particle);
 			}
 		}
 
@@ -323,27 +319,25 @@ namespace spades {
 
 			// rapid smoke
 			for (int i = 0; i < 2; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 120.0F,
-					SmokeSpriteEntity::Type::Explosion);
-				ent->SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 0.3F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.4F, 3.0F, 0.0000005F);
-				ent->SetLifeTime(0.2F + SampleRandomFloat() * 0.1F, 0.0F, 0.3F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 0.3F, 1.0F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.4F, 3.0F, 0.0000005F);
+				particle.SetLifeTime(0.2F + SampleRandomFloat() * 0.1F, 0.0F, 0.3F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Explosion, 120.0F, particle);
 			}
 
 			// fire smoke
 			color = MakeVector4(1.0F, 0.6F, 0.4F, 0.2F) * 5.0F;
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 120.0F,
-					SmokeSpriteEntity::Type::Explosion);
-				ent->SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 0.3F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.2F + SampleRandomFloat() * SampleRandomFloat() * 0.3F, 3.0F, 0.0000005F);
-				ent->SetLifeTime(0.01F + SampleRandomFloat() * 0.02F, 0.0F, 0.01F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 0.3F, 1.0F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.2F + SampleRandomFloat() * SampleRandomFloat() * 0.3F, 3.0F, 0.0000005F);
+				particle.SetLifeTime(0.01F + SampleRandomFloat() * 0.02F, 0.0F, 0.01F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Explosion, 120.0F, particle);
 			}
 		}
 
@@ -396,15 +390,15 @@ namespace spades {
 			Vector4 color = ConvertColorRGBA(IntVectorFromColor(col));
 
 			for (int i = 0; i < 64; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
+				ParticleSystem::Particle particle(color);
 				Vector3 dir = RandomAxis() + velBias * 0.5F;
 				float radius = 0.3F + SampleRandomFloat() * SampleRandomFloat() * 0.3F;
-				ent->SetTrajectory(pos + dir * 0.2F, dir * 20.0F, 0.1F + radius * 3.0F);
-				ent->SetRadius(radius);
-				ent->SetLifeTime(3.5F + SampleRandomFloat() * 2.0F, 0.0F, 1.0F);
+				particle.SetTrajectory(pos + dir * 0.2F, dir * 20.0F, 0.1F + radius * 3.0F);
+				particle.SetRadius(radius);
+				particle.SetLifeTime(3.5F + SampleRandomFloat() * 2.0F, 0.0F, 1.0F);
 				if (distSqr < 16.0F * 16.0F)
-					ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-				localEntities.emplace_back(std::move(ent));
+					particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+				particles->AddSprite(*img, particle);
 			}
 
 			if ((int)cg_particles < 2)
@@ -412,46 +406,44 @@ namespace spades {
 
 			// rapid smoke
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 60.0F,
-					SmokeSpriteEntity::Type::Explosion);
-				ent->SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 2.0F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 2.0F, 0.2F);
-				ent->SetLifeTime(1.8F + SampleRandomFloat() * 0.1F, 0.0F, 0.2F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 2.0F, 1.0F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 2.0F, 0.2F);
+				particle.SetLifeTime(1.8F + SampleRandomFloat() * 0.1F, 0.0F, 0.2F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Explosion, 60.0F, particle);
 			}
 
 			// slow smoke
 			color.w = 0.25F;
 			for (int i = 0; i < 8; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 30.0F);
-				ent->SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
 				               SampleRandomFloat() - SampleRandomFloat(),
 				               (SampleRandomFloat() - SampleRandomFloat()) * 0.2F)) * 2.0F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(1.5F + SampleRandomFloat() * SampleRandomFloat() * 0.8F, 0.2F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(1.5F + SampleRandomFloat() * SampleRandomFloat() * 0.8F, 0.2F);
 				switch ((int)cg_particles) {
-					case 1: ent->SetLifeTime(0.8F + SampleRandomFloat() * 1.0F, 0.1F, 8.0F); break;
-					case 2: ent->SetLifeTime(1.5F + SampleRandomFloat() * 2.0F, 0.1F, 8.0F); break;
+					case 1: particle.SetLifeTime(0.8F + SampleRandomFloat() * 1.0F, 0.1F, 8.0F); break;
+					case 2: particle.SetLifeTime(1.5F + SampleRandomFloat() * 2.0F, 0.1F, 8.0F); break;
 					case 3:
-					default: ent->SetLifeTime(2.0F + SampleRandomFloat() * 5.0F, 0.1F, 8.0F); break;
+					default: particle.SetLifeTime(2.0F + SampleRandomFloat() * 5.0F, 0.1F, 8.0F); break;
 				}
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Steady, 30.0F, particle);
 			}
 
 			// fire smoke
 			color = MakeVector4(1, 0.7F, 0.4F, 0.2F) * 5.0F;
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 120.0F,
-					SmokeSpriteEntity::Type::Explosion);
-				ent->SetTrajectory(pos, (RandomAxis() + velBias) * 6.0F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.3F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 3.0F, 0.1F);
-				ent->SetLifeTime(0.18F + SampleRandomFloat() * 0.03F, 0.0F, 0.1F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (RandomAxis() + velBias) * 6.0F, 1.0F, 0.0F);
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.3F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 3.0F, 0.1F);
+				particle.SetLifeTime(0.18F + SampleRandomFloat() * 0.03F, 0.0F, 0.1F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Explosion, 120.0F, particle);
 			}
 		}
 
@@ -479,15 +471,15 @@ namespace spades {
 			Vector4 color = ConvertColorRGBA(IntVectorFromColor(col));
 
 			for (int i = 0; i < 64; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
+				ParticleSystem::Particle particle(color);
 				Vector3 dir = RandomAxis() + velBias * 0.5F;
 				float radius = 0.3F + SampleRandomFloat() * SampleRandomFloat() * 0.3F;
-				ent->SetTrajectory(pos + dir * 0.2F, dir * 16.0F, 0.1F + radius * 3.0F);
-				ent->SetRadius(radius);
-				ent->SetLifeTime(3.5F + SampleRandomFloat() * 2.0F, 0.0F, 1.0F);
+				particle.SetTrajectory(pos + dir * 0.2F, dir * 16.0F, 0.1F + radius * 3.0F);
+				particle.SetRadius(radius);
+				particle.SetLifeTime(3.5F + SampleRandomFloat() * 2.0F, 0.0F, 1.0F);
 				if (distSqr < 16.0F * 16.0F)
-					ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-				localEntities.emplace_back(std::move(ent));
+					particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+				particles->AddSprite(*img, particle);
 			}
 
 			if ((int)cg_particles < 2)
@@ -497,41 +489,41 @@ namespace spades {
 			img = renderer->RegisterImage("Textures/WaterExpl.png");
 			color = MakeVector4(0.95F, 0.95F, 0.95F, 0.6F);
 			for (int i = 0; i < 7; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(pos, (MakeVector3(0.0F, 0.0F, -SampleRandomFloat() * 7.0F)) * 2.5F, 0.3F);
-				ent->SetRadius(1.2F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 0.6F);
-				ent->SetLifeTime(2.0F + SampleRandomFloat() * 0.3F, 0.1F, 0.2F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (MakeVector3(0.0F, 0.0F, -SampleRandomFloat() * 7.0F)) * 2.5F, 0.3F);
+				particle.SetRadius(1.2F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 0.6F);
+				particle.SetLifeTime(2.0F + SampleRandomFloat() * 0.3F, 0.1F, 0.2F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSprite(*img, particle);
 			}
 
 			// water2
 			img = renderer->RegisterImage("Textures/Fluid.png");
 			color.w = 0.9F;
 			for (int i = 0; i < 16; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
 				                                     SampleRandomFloat() - SampleRandomFloat(),
 				                                     -SampleRandomFloat() * 7.0F)) * 3.5F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.3F, 0.5F);
-				ent->SetLifeTime(2.0F + SampleRandomFloat() * 0.3F, 0.1F, 0.2F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.3F, 0.5F);
+				particle.SetLifeTime(2.0F + SampleRandomFloat() * 0.3F, 0.1F, 0.2F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSprite(*img, particle);
 			}
 
 			// slow smoke
 			color.w = 0.3F;
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<SmokeSpriteEntity>(*this, color, 10.0F);
-				ent->SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
 				               SampleRandomFloat() - SampleRandomFloat(),
 				               (SampleRandomFloat() - SampleRandomFloat()) * 0.2F)) * 2.0F, 1.0F, 0.0F);
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(1.5F + SampleRandomFloat() * SampleRandomFloat() * 0.6F, 0.2F);
-				ent->SetLifeTime(2.0F + SampleRandomFloat() * 0.3F, 0.2F, 1.5F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				localEntities.emplace_back(std::move(ent));
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(1.5F + SampleRandomFloat() * SampleRandomFloat() * 0.6F, 0.2F);
+				particle.SetLifeTime(2.0F + SampleRandomFloat() * 0.3F, 0.2F, 1.5F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particles->AddSmoke(SmokeSpriteEntity::Type::Steady, 10.0F, particle);
 			}
 
 			// TODO: wave?
@@ -554,13 +546,13 @@ namespace spades {
 			Vector4 color = ConvertColorRGBA(col);
 
 			for (int i = 0; i < 4; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 8.0F);
-				ent->SetRadius(0.4F);
-				ent->SetLifeTime(3.0F, 0.0F, 1.0F);
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (RandomAxis() + velBias * 0.5F) * 8.0F);
+				particle.SetRadius(0.4F);
+				particle.SetLifeTime(3.0F, 0.0F, 1.0F);
 				if (distSqr < 16.0F * 16.0F)
-					ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-				localEntities.emplace_back(std::move(ent));
+					particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+				particles->AddSprite(*img, particle);
 			}
 
 			if ((int)cg_particles < 2)
@@ -572,29 +564,29 @@ namespace spades {
 			img = renderer->RegisterImage("Textures/WaterExpl.png");
 			color = MakeVector4(0.95F, 0.95F, 0.95F, 0.3F);
 			for (int i = 0; i < 2; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
 				                                SampleRandomFloat() - SampleRandomFloat(),
 				                                -SampleRandomFloat() * 7.0F)), 0.3F, 0.6F);
-				ent->SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 0.7F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				ent->SetLifeTime(3.0F + SampleRandomFloat() * 0.3F, 0.1F, 0.6F);
-				localEntities.emplace_back(std::move(ent));
+				particle.SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.4F, 0.7F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particle.SetLifeTime(3.0F + SampleRandomFloat() * 0.3F, 0.1F, 0.6F);
+				particles->AddSprite(*img, particle);
 			}
 
 			// water2
 			img = renderer->RegisterImage("Textures/Fluid.png");
 			color.w = 0.9F;
 			for (int i = 0; i < 6; i++) {
-				auto ent = stmp::make_unique<ParticleSpriteEntity>(*this, img, color);
-				ent->SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
+				ParticleSystem::Particle particle(color);
+				particle.SetTrajectory(pos, (MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
 				                                SampleRandomFloat() - SampleRandomFloat(),
 				                                -SampleRandomFloat() * 16.0F)));
-				ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-				ent->SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.6F, 0.6F);
-				ent->SetBlockHitAction(BlockHitAction::Ignore);
-				ent->SetLifeTime(3.0F + SampleRandomFloat() * 0.3F, SampleRandomFloat() * 0.3F, 0.6F);
-				localEntities.emplace_back(std::move(ent));
+				particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+				particle.SetRadius(0.6F + SampleRandomFloat() * SampleRandomFloat() * 0.6F, 0.6F);
+				particle.SetBlockHitAction(BlockHitAction::Ignore);
+				particle.SetLifeTime(3.0F + SampleRandomFloat() * 0.3F, SampleRandomFloat() * 0.3F, 0.6F);
+				particles->AddSprite(*img, particle);
 			}
 
 			// TODO: wave?
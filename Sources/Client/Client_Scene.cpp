@@ -29,6 +29,7 @@
 #include "CTFGameMode.h"
 #include "Corpse.h"
 #include "IGameMode.h"
+#include "ParticleSystem.h"
 #include "Player.h"
 #include "TCGameMode.h"
 
@@ -597,6 +598,7 @@ namespace spades {
 					ent->Render3D();
 
 				bloodMarks->Draw();
+				particles->Draw();
 
 				// Draw block cursor
 				if (p && p->IsAlive()) {
@@ -19,6 +19,10 @@
 
  */
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "Client.h"
 
 #include <Core/ConcurrentDispatch.h>
@@ -38,6 +42,7 @@
 #include "HurtRingView.h"
 #include "ILocalEntity.h"
 #include "MapView.h"
+#include "ParticleSystem.h"
 #include "Tracer.h"
 
 #include "GameMap.h"
@@ -256,22 +261,30 @@ namespace spades {
 			}
 
 			// corpse never accesses audio nor renderer, so
-			// we can do it in the separate thread
-			class CorpseUpdateDispatch : public ConcurrentDispatch {
-				Client& client;
-				float dt;
-
-			public:
-				CorpseUpdateDispatch(Client& c, float dt) : client{c}, dt{dt} {}
-				void Run() override {
-					for (const auto& c : client.corpses) {
-						for (int i = 0; i < 4; i++)
-							c->Update(dt / 4.0F);
-					}
+			// we can do it in the separate threads. Each corpse is taken by whichever thread
+			// gets to it first, including this one once it's done with the local entities.
+			std::atomic<std::size_t> nextCorpse{0};
+			auto updateCorpses = [this, dt, &nextCorpse] {
+				for (;;) {
+					std::size_t index = nextCorpse.fetch_add(1);
+					if (index >= corpses.size())
+						break;
+
+					Corpse& c = *corpses[index];
+					for (int i = 0; i < 4; i++)
+						c.Update(dt / 4.0F);
 				}
 			};
-			CorpseUpdateDispatch corpseDispatch{*this, dt};
-			corpseDispatch.Start();
+
+			std::size_t numCorpseDispatches =
+			  std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U),
+			                        corpses.size());
+			std::vector<std::unique_ptr<ConcurrentDispatch>> corpseDispatches;
+			for (std::size_t i = 0; i < numCorpseDispatches; i++) {
+				corpseDispatches.emplace_back(
+				  new FunctionDispatch<decltype(updateCorpses)>(updateCorpses));
+				corpseDispatches.back()->Start();
+			}
 
 			// local entities should be done in the client thread
 			{
@@ -286,7 +299,11 @@ namespace spades {
 			}
 
 			bloodMarks->Update(dt);
-			corpseDispatch.Join();
+			particles->Update(dt);
+
+			updateCorpses();
+			for (const auto& dispatch : corpseDispatches)
+				dispatch->Join();
 
 			if (grenadeVibration > 0.0F) {
 				grenadeVibration -= dt;
@@ -889,7 +906,7 @@ namespace spades {
 				corpses.emplace_back(std::move(corp));
 
 				if (corpses.size() > corpseHardLimit)
-					corpses.pop_front();
+					corpses.erase(corpses.begin());
 				else if (corpses.size() > corpseSoftLimit)
 					RemoveInvisibleCorpses();
 			}
@@ -0,0 +1,84 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <cstring>
+
+#include "DeferredPacketQueue.h"
+
+namespace spades {
+	namespace client {
+		DeferredPacketQueue::DeferredPacketQueue() {}
+
+		DeferredPacketQueue::~DeferredPacketQueue() {}
+
+		char* DeferredPacketQueue::Allocate(std::size_t size) {
+			if (size > blockRemaining) {
+				if (size > BlockSize) {
+					// Too large to share a block. Insert it before the current block so the
+					// current block's free space can still be used.
+					std::unique_ptr<char[]> block{new char[size]};
+					char* p = block.get();
+					blocks.insert(blocks.empty() ? blocks.end() : blocks.end() - 1,
+					              std::move(block));
+					return p;
+				}
+
+				blocks.emplace_back(new char[BlockSize]);
+				blockCursor = blocks.back().get();
+				blockRemaining = BlockSize;
+			}
+
+			char* p = blockCursor;
+			blockCursor += size;
+			blockRemaining -= size;
+			return p;
+		}
+
+		void DeferredPacketQueue::Add(const char* data, std::size_t size,
+		                              stmp::optional<std::uint32_t> key) {
+			char* p = Allocate(size);
+			std::memcpy(p, data, size);
+
+			if (key) {
+				auto it = latestByKey.find(*key);
+				if (it != latestByKey.end()) {
+					records[it->second].superseded = true;
+					numSuperseded++;
+					it->second = records.size();
+				} else {
+					latestByKey.emplace(*key, records.size());
+				}
+			}
+
+			records.push_back(Record{p, size, false});
+		}
+
+		void DeferredPacketQueue::Clear() {
+			records.clear();
+			latestByKey.clear();
+			numSuperseded = 0;
+
+			blocks.clear();
+			blockCursor = nullptr;
+			blockRemaining = 0;
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,83 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <Core/TMPUtils.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * Stores the game packets received during the map transfer, to be processed after
+		 * the world was created.
+		 *
+		 * The packets are copied into a bump arena of large blocks, which `Clear` releases
+		 * in one step. A packet added with a coalescing key supersedes the previous one with
+		 * the same key, which is skipped when replaying. Use a key only for a packet that
+		 * completely overrides the state set by the previous one.
+		 */
+		class DeferredPacketQueue {
+		public:
+			/** A stored packet, including the type byte. */
+			struct Record {
+				const char* data;
+				std::size_t size;
+				bool superseded;
+			};
+
+			DeferredPacketQueue();
+			~DeferredPacketQueue();
+
+			void Add(const char* data, std::size_t size, stmp::optional<std::uint32_t> key = {});
+
+			/** Removes all packets and releases the arena. */
+			void Clear();
+
+			bool IsEmpty() const { return records.empty(); }
+			/** Returns the number of packets not superseded. */
+			std::size_t GetNumPackets() const { return records.size() - numSuperseded; }
+			std::size_t GetNumSupersededPackets() const { return numSuperseded; }
+
+			/** Returns all records in the order they were added, including superseded ones. */
+			const std::vector<Record>& GetRecords() const { return records; }
+
+		private:
+			enum { BlockSize = 64 * 1024 };
+
+			std::vector<std::unique_ptr<char[]>> blocks;
+			/** The free space in the last block. */
+			char* blockCursor = nullptr;
+			std::size_t blockRemaining = 0;
+
+			std::vector<Record> records;
+			std::size_t numSuperseded = 0;
+			/** The record index of the latest packet of each coalescing key. */
+			std::unordered_map<std::uint32_t, std::size_t> latestByKey;
+
+			char* Allocate(std::size_t size);
+		};
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,202 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <algorithm>
+
+#include "DemoPlayer.h"
+#include "DemoRecorder.h"
+#include <Core/Debug.h>
+#include <Core/Exception.h>
+#include <Core/IStream.h>
+
+namespace spades {
+	namespace client {
+		namespace {
+			/** Reads the bounds-checked fields of a demo file. */
+			class DemoReader {
+				const char* data;
+				std::size_t size;
+				std::size_t position;
+
+			public:
+				DemoReader(const char* data, std::size_t size, std::size_t position = 0)
+				    : data(data), size(size), position(position) {}
+
+				std::size_t GetPosition() const { return position; }
+				bool IsEnd() const { return position >= size; }
+
+				const char* Consume(std::size_t numBytes) {
+					if (numBytes > size - position)
+						SPRaise("Invalid demo file: truncated at offset %d", (int)position);
+					const char* p = data + position;
+					position += numBytes;
+					return p;
+				}
+
+				std::uint32_t ReadUInt(int numBytes) {
+					const char* p = Consume(numBytes);
+					std::uint32_t value = 0;
+					for (int i = 0; i < numBytes; i++)
+						value |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[i]))
+						         << (i * 8);
+					return value;
+				}
+
+				std::uint64_t ReadVarUInt() {
+					std::uint64_t value = 0;
+					for (int shift = 0; shift < 64; shift += 7) {
+						auto byte = static_cast<std::uint8_t>(*Consume(1));
+						value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+						if (!(byte & 0x80))
+							return value;
+					}
+					SPRaise("Invalid demo file: malformed number at offset %d", (int)position);
+				}
+			};
+		} // namespace
+
+		constexpr float DemoPlayer::FixedTimeStep;
+
+		DemoPlayer::DemoPlayer(std::unique_ptr<IStream> stream) {
+			SPADES_MARK_FUNCTION();
+
+			data = stream->ReadAllBytes();
+			stream.reset();
+
+			DemoReader reader{data.data(), data.size()};
+			if (std::string(reader.Consume(4), 4) != "SPDM")
+				SPRaise("Not a demo file");
+
+			int formatVersion = reader.ReadUInt(1);
+			if (formatVersion != DemoRecorder::FormatVersion)
+				SPRaise("Unsupported demo format version: %d", formatVersion);
+
+			protocolVersion = reader.ReadUInt(1);
+			if (protocolVersion != 3 && protocolVersion != 4)
+				SPRaise("Unsupported protocol version: %d", protocolVersion);
+
+			std::uint64_t timeMs = 0;
+			while (!reader.IsEnd()) {
+				auto kind = static_cast<DemoRecorder::RecordKind>(reader.ReadUInt(1));
+				if (kind != DemoRecorder::RecordKind::Packet &&
+				    kind != DemoRecorder::RecordKind::Keyframe)
+					SPRaise("Invalid demo file: unknown record kind %d", (int)kind);
+
+				timeMs += reader.ReadVarUInt();
+				auto size = static_cast<std::size_t>(reader.ReadVarUInt());
+
+				Record record;
+				record.time = static_cast<double>(timeMs) / 1000.0;
+				record.offset = reader.GetPosition();
+				record.size = size;
+				record.keyframe = kind == DemoRecorder::RecordKind::Keyframe;
+				reader.Consume(size);
+
+				if (record.keyframe)
+					keyframes.push_back(records.size());
+				records.push_back(record);
+			}
+
+			SPLog("Demo loaded: %d records, %d keyframes, %.1f seconds", (int)records.size(),
+			      (int)keyframes.size(), GetDuration());
+		}
+
+		DemoPlayer::~DemoPlayer() {}
+
+		double DemoPlayer::GetDuration() const {
+			return records.empty() ? 0.0 : records.back().time;
+		}
+
+		float DemoPlayer::Advance(float dt, float speed) {
+			float step = speed > 0.0F ? dt * speed : FixedTimeStep;
+			time += step;
+			return step;
+		}
+
+		stmp::optional<DemoPlayer::Packet> DemoPlayer::ReadPacket() {
+			while (nextRecord < records.size()) {
+				const Record& record = records[nextRecord];
+				if (record.time > time)
+					return {};
+
+				nextRecord++;
+				if (!record.keyframe)
+					return Packet{data.data() + record.offset, record.size, record.time};
+			}
+			return {};
+		}
+
+		DemoPlayer::Packet DemoPlayer::GetPacket(std::size_t index) const {
+			const Record& record = records.at(index);
+			SPAssert(!record.keyframe);
+			return Packet{data.data() + record.offset, record.size, record.time};
+		}
+
+		stmp::optional<DemoPlayer::Keyframe> DemoPlayer::Seek(double newTime) {
+			SPADES_MARK_FUNCTION();
+
+			time = std::max(newTime, 0.0);
+
+			auto it = std::upper_bound(
+			  keyframes.begin(), keyframes.end(), time,
+			  [&](double t, std::size_t index) { return t < records[index].time; });
+			if (it == keyframes.begin()) {
+				nextRecord = 0;
+				return {};
+			}
+
+			std::size_t index = *(it - 1);
+			nextRecord = index + 1;
+			return DecodeKeyframe(records[index]);
+		}
+
+		DemoPlayer::Keyframe DemoPlayer::DecodeKeyframe(const Record& record) const {
+			DemoReader reader{data.data(), record.offset + record.size, record.offset};
+
+			Keyframe keyframe;
+			keyframe.time = record.time;
+			keyframe.mapStartRecord = static_cast<std::size_t>(reader.ReadVarUInt());
+			if (keyframe.mapStartRecord >= records.size() ||
+			    records[keyframe.mapStartRecord].keyframe)
+				SPRaise("Invalid demo file: keyframe refers to an invalid map start");
+
+			auto numVoxels = static_cast<std::size_t>(reader.ReadVarUInt());
+			keyframe.voxels.reserve(std::min<std::size_t>(numVoxels, record.size / 6));
+			for (std::size_t i = 0; i < numVoxels; i++) {
+				VoxelChange change;
+				change.position.x = static_cast<int>(reader.ReadUInt(2));
+				change.position.y = static_cast<int>(reader.ReadUInt(2));
+				change.position.z = static_cast<int>(reader.ReadUInt(1));
+				change.solid = reader.ReadUInt(1) != 0;
+				change.color = change.solid ? reader.ReadUInt(4) : 0;
+				keyframe.voxels.push_back(change);
+			}
+
+			auto numPackets = static_cast<std::size_t>(reader.ReadVarUInt());
+			for (std::size_t i = 0; i < numPackets; i++) {
+				auto size = static_cast<std::size_t>(reader.ReadVarUInt());
+				keyframe.packets.push_back(Packet{reader.Consume(size), size, record.time});
+			}
+
+			return keyframe;
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,123 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Core/Math.h>
+#include <Core/TMPUtils.h>
+
+namespace spades {
+	class IStream;
+
+	namespace client {
+		/**
+		 * Reads a demo file written by `DemoRecorder` and releases its packets as the playback
+		 * clock reaches the times they were received at.
+		 *
+		 * The whole file is loaded into memory, and the records are indexed so that `Seek`
+		 * only has to look at the latest keyframe before the target time.
+		 */
+		class DemoPlayer {
+		public:
+			/** The game time covered by each `Advance` when playing as fast as possible. */
+			static constexpr float FixedTimeStep = 1.0F / 60.0F;
+
+			/** A received payload, including the type byte. */
+			struct Packet {
+				const char* data;
+				std::size_t size;
+				/** The time it was received at, in seconds since the start of the demo. */
+				double time;
+			};
+
+			struct VoxelChange {
+				IntVector3 position;
+				bool solid;
+				std::uint32_t color;
+			};
+
+			struct Keyframe {
+				double time;
+				/** The index of the record that started the current map. */
+				std::size_t mapStartRecord;
+				/** The voxels modified since the map was received. */
+				std::vector<VoxelChange> voxels;
+				/** The packets that recreate the world on top of the map. */
+				std::vector<Packet> packets;
+			};
+
+			DemoPlayer(std::unique_ptr<IStream>);
+			~DemoPlayer();
+
+			int GetProtocolVersion() const { return protocolVersion; }
+
+			/** Returns the playback clock, in seconds since the start of the demo. */
+			double GetTime() const { return time; }
+			double GetDuration() const;
+			bool IsFinished() const { return nextRecord >= records.size(); }
+
+			/**
+			 * Advances the playback clock by the real time `dt` and returns the game time that
+			 * passed. A `speed` of zero plays as fast as possible: each call covers
+			 * `FixedTimeStep` however long the frame took, which makes the workload the same
+			 * on every run.
+			 */
+			float Advance(float dt, float speed);
+
+			/** Returns the next packet received before the playback clock. */
+			stmp::optional<Packet> ReadPacket();
+
+			std::size_t GetNumRecords() const { return records.size(); }
+			/** Returns the specified record, which must be a packet record. */
+			Packet GetPacket(std::size_t index) const;
+
+			/**
+			 * Moves the playback clock to `time` and returns the latest keyframe before it.
+			 * `ReadPacket` continues after the keyframe, or from the start if there is none.
+			 */
+			stmp::optional<Keyframe> Seek(double time);
+
+		private:
+			struct Record {
+				double time;
+				std::size_t offset;
+				std::size_t size;
+				bool keyframe;
+			};
+
+			std::string data;
+			int protocolVersion;
+			std::vector<Record> records;
+			/** The indices of the keyframe records. */
+			std::vector<std::size_t> keyframes;
+
+			std::size_t nextRecord = 0;
+			double time = 0.0;
+
+			Keyframe DecodeKeyframe(const Record&) const;
+		};
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,154 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "DemoRecorder.h"
+#include "GameMap.h"
+#include <Core/Debug.h>
+#include <Core/IStream.h>
+
+namespace spades {
+	namespace client {
+		namespace {
+			void AppendVarUInt(std::vector<char>& out, std::uint64_t value) {
+				while (value >= 0x80) {
+					out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+					value >>= 7;
+				}
+				out.push_back(static_cast<char>(value));
+			}
+
+			void AppendUInt(std::vector<char>& out, std::uint32_t value, int numBytes) {
+				for (int i = 0; i < numBytes; i++)
+					out.push_back(static_cast<char>(value >> (i * 8)));
+			}
+
+			std::uint32_t PackPosition(int x, int y, int z) {
+				return static_cast<std::uint32_t>(x) | static_cast<std::uint32_t>(y) << 12 |
+				       static_cast<std::uint32_t>(z) << 24;
+			}
+		} // namespace
+
+		DemoRecorder::DemoRecorder(std::unique_ptr<IStream> stream, int protocolVersion,
+		                           double startTime)
+		    : stream(std::move(stream)), startTime(startTime) {
+			SPADES_MARK_FUNCTION();
+
+			const char header[] = {'S', 'P', 'D', 'M', static_cast<char>(FormatVersion),
+			                       static_cast<char>(protocolVersion)};
+			this->stream->Write(header, sizeof(header));
+		}
+
+		DemoRecorder::~DemoRecorder() {
+			SPADES_MARK_FUNCTION();
+
+			ReleaseMap();
+			stream->Flush();
+		}
+
+		void DemoRecorder::WriteRecord(RecordKind kind, double time, const char* data,
+		                               std::size_t size) {
+			// The clock may go backward by a tiny bit between the threads stamping the packets
+			std::uint64_t timeMs = static_cast<std::uint64_t>(
+			  std::max(std::floor((time - startTime) * 1000.0), 0.0));
+			timeMs = std::max(timeMs, lastRecordTime);
+
+			buffer.clear();
+			buffer.push_back(static_cast<char>(kind));
+			AppendVarUInt(buffer, timeMs - lastRecordTime);
+			AppendVarUInt(buffer, size);
+			stream->Write(buffer.data(), buffer.size());
+			stream->Write(data, size);
+
+			lastRecordTime = timeMs;
+			numRecords++;
+		}
+
+		void DemoRecorder::AddPacket(double time, const char* data, std::size_t size) {
+			WriteRecord(RecordKind::Packet, time, data, size);
+		}
+
+		void DemoRecorder::MarkMapStart() {
+			SPAssert(numRecords > 0);
+
+			ReleaseMap();
+			mapStartRecord = numRecords - 1;
+		}
+
+		void DemoRecorder::SetMap(Handle<GameMap> newMap, double time) {
+			SPADES_MARK_FUNCTION();
+			SPAssert(mapStartRecord);
+
+			ReleaseMap();
+			map = std::move(newMap);
+			if (map)
+				map->AddListener(this);
+			nextKeyframeTime = time + KeyframeInterval;
+		}
+
+		void DemoRecorder::ReleaseMap() {
+			if (map)
+				map->RemoveListener(this);
+			map = Handle<GameMap>();
+			modifiedVoxels.clear();
+		}
+
+		bool DemoRecorder::IsKeyframeDue(double time) const {
+			return map && time >= nextKeyframeTime;
+		}
+
+		void DemoRecorder::AddKeyframe(double time,
+		                               const std::vector<std::vector<char>>& packets) {
+			SPADES_MARK_FUNCTION();
+			SPAssert(map);
+
+			std::vector<char> payload;
+			AppendVarUInt(payload, *mapStartRecord);
+
+			AppendVarUInt(payload, modifiedVoxels.size());
+			for (std::uint32_t packed : modifiedVoxels) {
+				int x = packed & 0xfff, y = (packed >> 12) & 0xfff, z = packed >> 24;
+				bool solid = map->IsSolid(x, y, z);
+				AppendUInt(payload, x, 2);
+				AppendUInt(payload, y, 2);
+				AppendUInt(payload, z, 1);
+				AppendUInt(payload, solid ? 1 : 0, 1);
+				if (solid)
+					AppendUInt(payload, map->GetColor(x, y, z), 4);
+			}
+
+			AppendVarUInt(payload, packets.size());
+			for (const std::vector<char>& packet : packets) {
+				AppendVarUInt(payload, packet.size());
+				payload.insert(payload.end(), packet.begin(), packet.end());
+			}
+
+			WriteRecord(RecordKind::Keyframe, time, payload.data(), payload.size());
+			nextKeyframeTime = time + KeyframeInterval;
+		}
+
+		void DemoRecorder::GameMapChanged(int x, int y, int z, GameMap*) {
+			modifiedVoxels.insert(PackPosition(x, y, z));
+		}
+	} // namespace client
+} // namespace spades
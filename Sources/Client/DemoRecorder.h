@@ -0,0 +1,111 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "IGameMapListener.h"
+#include <Core/RefCountedObject.h>
+#include <Core/TMPUtils.h>
+
+namespace spades {
+	class IStream;
+
+	namespace client {
+		class GameMap;
+
+		/**
+		 * Writes the packets received from a server to a demo file, which `DemoPlayer` plays
+		 * back without a connection.
+		 *
+		 * The file starts with the magic `SPDM`, the format version, and the protocol version
+		 * (one byte each after the magic). Each record that follows has a kind byte, the time
+		 * since the previous record in milliseconds and the payload size as unsigned LEB128
+		 * numbers, and the payload.
+		 *
+		 * A packet record holds a received payload as-is, including the map chunks. A keyframe
+		 * record holds the state of the game from which the playback can resume: the index of
+		 * the record that started the current map, the voxels modified since then, and the
+		 * packets that recreate the world on a client that has just loaded the map.
+		 */
+		class DemoRecorder : public IGameMapListener {
+		public:
+			enum { FormatVersion = 1 };
+			enum class RecordKind : std::uint8_t { Packet = 0, Keyframe = 1 };
+
+			/** The demo time between keyframes, in seconds. */
+			enum { KeyframeInterval = 30 };
+
+			/**
+			 * @param startTime The time at which the recording starts, on the clock used by
+			 *                  `AddPacket` and `AddKeyframe`.
+			 */
+			DemoRecorder(std::unique_ptr<IStream>, int protocolVersion, double startTime);
+			~DemoRecorder();
+
+			DemoRecorder(const DemoRecorder&) = delete;
+			void operator=(const DemoRecorder&) = delete;
+
+			void AddPacket(double time, const char* data, std::size_t size);
+
+			/**
+			 * Marks the last added packet as the start of a new map. Stops tracking the voxels
+			 * of the previous map.
+			 */
+			void MarkMapStart();
+
+			/**
+			 * Starts tracking the voxels of the map started by the last `MarkMapStart`, which
+			 * must not be modified yet. A keyframe becomes due `KeyframeInterval` seconds later.
+			 */
+			void SetMap(Handle<GameMap>, double time);
+
+			bool IsKeyframeDue(double time) const;
+
+			/** Writes a keyframe with the specified world packets and the current map. */
+			void AddKeyframe(double time, const std::vector<std::vector<char>>& packets);
+
+			void GameMapChanged(int x, int y, int z, GameMap*) override;
+
+		private:
+			std::unique_ptr<IStream> stream;
+			double startTime;
+			std::uint64_t lastRecordTime = 0;
+			std::uint64_t numRecords = 0;
+
+			stmp::optional<std::uint64_t> mapStartRecord;
+			Handle<GameMap> map;
+			double nextKeyframeTime = 0.0;
+			/** The voxels modified since the map start, packed by `PackPosition`. */
+			std::unordered_set<std::uint32_t> modifiedVoxels;
+
+			/** A scratch buffer for a record. */
+			std::vector<char> buffer;
+
+			void WriteRecord(RecordKind, double time, const char* data, std::size_t size);
+			void ReleaseMap();
+		};
+	} // namespace client
+} // namespace spades
@@ -18,7 +18,10 @@
 
  */
 
+#include <atomic>
+#include <functional>
 #include <limits.h>
+#include <thread>
 
 #include "FallingBlock.h"
 #include "Client.h"
@@ -27,20 +30,103 @@
 #include "IAudioChunk.h"
 #include "IAudioDevice.h"
 #include "IRenderer.h"
-#include "ParticleSpriteEntity.h"
-#include "SmokeSpriteEntity.h"
+#include "ParticleSystem.h"
 #include "World.h"
+#include <Core/ConcurrentDispatch.h>
 #include <Core/Debug.h>
 #include <Core/Exception.h>
 #include <Core/Settings.h>
+#include <Core/Thread.h>
 
 SPADES_SETTING(cg_particles);
 
 namespace spades {
 	namespace client {
 
-		FallingBlock::FallingBlock(Client* client, std::vector<IntVector3> blocks) : client(client) {
-			if (blocks.empty())
+		namespace {
+			/** The maximum number of sprites drawn while the model is being built. */
+			constexpr std::size_t MaxPlaceholderSprites = 64;
+
+			/**
+			 * Runs the dispatches for `FallingBlock::ModelBuild` one by one. Building the
+			 * model of a large structure takes a while, and the global dispatch pool must not
+			 * be kept busy by it because the client waits for the work on the pool every frame.
+			 */
+			class ModelBuilderThread : public Thread {
+			public:
+				std::atomic<DispatchQueue*> queue{nullptr};
+
+				void Run() override {
+					SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+					DispatchQueue* q = DispatchQueue::GetThreadQueue();
+					queue.store(q);
+					q->EnterEventLoop();
+				}
+			};
+
+			DispatchQueue& GetModelBuilderQueue() {
+				// Never destroyed. The thread waits for work until the process exits.
+				static ModelBuilderThread* thread = [] {
+					auto* t = new ModelBuilderThread();
+					t->Start();
+					return t;
+				}();
+
+				DispatchQueue* q;
+				while (!(q = thread->queue.load()))
+					std::this_thread::yield();
+				return *q;
+			}
+		} // namespace
+
+		/**
+		 * The inputs and the outputs of building the model. Shared with the worker thread,
+		 * so `FallingBlock` can be destroyed without waiting for it.
+		 */
+		struct FallingBlock::ModelBuild {
+			Handle<IRenderer> renderer;
+
+			std::vector<IntVector3> blocks;
+			std::vector<uint32_t> colors;
+			IntVector3 minPos, maxPos;
+			Vector3 origin;
+
+			Handle<VoxelModel> vmodel;
+			std::function<Handle<IModel>()> createModel;
+			/** Set when the worker thread is done with `Run`. */
+			std::atomic<bool> done{false};
+
+			/** Runs on the worker thread. */
+			void Run() {
+				SPADES_MARK_FUNCTION();
+
+				// build voxel model
+				auto m = Handle<VoxelModel>::New(maxPos.x - minPos.x + 1,
+				                                 maxPos.y - minPos.y + 1,
+				                                 maxPos.z - minPos.z + 1);
+
+				for (std::size_t i = 0; i < blocks.size(); i++) {
+					IntVector3 v = blocks[i] - minPos;
+					m->SetSolid(v.x, v.y, v.z, colors[i]);
+				}
+				m->SetOrigin(origin);
+
+				std::vector<IntVector3>().swap(blocks);
+				std::vector<uint32_t>().swap(colors);
+
+				// build the mesh
+				createModel = renderer->PrepareModel(*m);
+				vmodel = std::move(m);
+
+				done = true;
+			}
+		};
+
+		FallingBlock::FallingBlock(Client* client, std::vector<IntVector3> blocks)
+		    : client(client), modelBuild(std::make_shared<ModelBuild>()) {
+			ModelBuild& build = *modelBuild;
+			build.blocks = std::move(blocks);
+			if (build.blocks.empty())
 				SPRaise("No block given");
 
 			// find min/max
@@ -52,9 +138,9 @@ namespace spades {
 			uint64_t xSum, ySum, zSum;
 			xSum = ySum = zSum = 0;
 
-			numBlocks = (int)blocks.size();
+			numBlocks = (int)build.blocks.size();
 
-			for (const auto& v : blocks) {
+			for (const auto& v : build.blocks) {
 				if (v.x < minX) minX = v.x;
 				if (v.y < minY) minY = v.y;
 				if (v.z < minZ) minZ = v.z;
@@ -67,28 +153,26 @@ namespace spades {
 				zSum += v.z;
 			}
 
+			build.minPos = MakeIntVector3(minX, minY, minZ);
+			build.maxPos = MakeIntVector3(maxX, maxY, maxZ);
+
 			const Handle<GameMap>& map = client->GetWorld()->GetMap();
 			SPAssert(map);
 
-			// build voxel model
-			vmodel = new VoxelModel(maxX - minX + 1, maxY - minY + 1, maxZ - minZ + 1);
-
-			for (const auto& v : blocks) {
+			// The map might be modified while the model is being built, so read the colors now
+			build.colors.reserve(build.blocks.size());
+			for (const auto& v : build.blocks) {
 				uint32_t col = map->GetColor(v.x, v.y, v.z);
 				col = map->GetColorJit(col); // jit the colour
 				col &= 0xFFFFFF; // use the default material
-				vmodel->SetSolid(v.x - minX, v.y - minY, v.z - minZ, col);
+				build.colors.push_back(col);
 			}
 
 			// center of gravity
-			Vector3 origin;
+			Vector3& origin = build.origin;
 			origin.x = (float)minX - (float)xSum / (float)numBlocks;
 			origin.y = (float)minY - (float)ySum / (float)numBlocks;
 			origin.z = (float)minZ - (float)zSum / (float)numBlocks;
-			vmodel->SetOrigin(origin);
-
-			// build renderer model
-			model = client->GetRenderer().CreateModel(*vmodel).Unmanage();
 
 			Vector3 matTrans = MakeVector3((float)minX, (float)minY, (float)minZ);
 			matTrans += 0.5F; // voxelmodel's (0,0,0) origins on block center
@@ -98,14 +182,51 @@ namespace spades {
 			velocity = {0.0F, 0.0F, 0.0F};
 			rotation = SampleRandom() & 3;
 			time = 1.0F;
+
+			// pick the placeholder blocks
+			placeholderImage = client->GetRenderer().RegisterImage("Gfx/White.tga");
+			std::size_t step = (build.blocks.size() + MaxPlaceholderSprites - 1) /
+			                   MaxPlaceholderSprites;
+			for (std::size_t i = 0; i < build.blocks.size(); i += step) {
+				IntVector3 v = build.blocks[i] - build.minPos;
+				placeholderPoints.push_back(MakeVector3(v) + origin);
+				placeholderColors.push_back(ConvertColorRGBA(IntVectorFromColor(build.colors[i])));
+			}
+
+			build.renderer = Handle<IRenderer>{client->GetRenderer()};
+
+			std::shared_ptr<ModelBuild> buildRef = modelBuild;
+			auto buildModel = [buildRef] { buildRef->Run(); };
+			auto* dispatch = new FunctionDispatch<decltype(buildModel)>(buildModel);
+			dispatch->StartOn(&GetModelBuilderQueue());
+			dispatch->Release();
 		}
 
-		FallingBlock::~FallingBlock() {
-			model->Release();
-			vmodel->Release();
+		void FallingBlock::FinishModel() {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(modelBuild && modelBuild->done);
+
+			vmodel = std::move(modelBuild->vmodel);
+			if (modelBuild->createModel) {
+				// upload to the renderer
+				model = modelBuild->createModel();
+			}
+			modelBuild.reset();
+
+			std::vector<Vector3>().swap(placeholderPoints);
+			std::vector<Vector4>().swap(placeholderColors);
+			std::vector<SpriteParam>().swap(placeholderSprites);
 		}
 
 		bool FallingBlock::Update(float dt) {
+			if (modelBuild && modelBuild->done)
+				FinishModel();
+
+			// Breaking the blocks into particles needs the model, so stay put until it's ready
+			if (time <= 0.0F && modelBuild)
+				return true;
+
 			time -= 1.0F / 5.0F * dt;
 
 			const auto& viewOrigin = client->GetLastSceneDef().viewOrigin;
@@ -127,6 +248,11 @@ namespace spades {
 
 			// destroy
 			if (time <= 0.0F) {
+				if (modelBuild)
+					return true;
+				if (!vmodel)
+					return false;
+
 				int w = vmodel->GetWidth();
 				int h = vmodel->GetHeight();
 				int d = vmodel->GetDepth();
@@ -167,24 +293,24 @@ namespace spades {
 
 							if (cg_particles) {
 								for (int i = 0; i < 4; i++) {
-									auto ent = stmp::make_unique<ParticleSpriteEntity>(
-									  *client, img.GetPointerOrNull(), color);
-									ent->SetTrajectory(p3, RandomAxis() * 4.0F, 1.0F, 0.6F);
-									ent->SetRadius(0.4F + getRandom() * getRandom() * 0.1F);
-									ent->SetLifeTime(2.0F, 0.0F, 1.0F);
+									ParticleSystem::Particle particle(color);
+									particle.SetTrajectory(p3, RandomAxis() * 4.0F, 1.0F, 0.6F);
+									particle.SetRadius(0.4F + getRandom() * getRandom() * 0.1F);
+									particle.SetLifeTime(2.0F, 0.0F, 1.0F);
 									if (usePrecisePhysics)
-										ent->SetBlockHitAction(BlockHitAction::BounceWeak);
-									client->AddLocalEntity(std::move(ent));
+										particle.SetBlockHitAction(BlockHitAction::BounceWeak);
+									client->GetParticleSystem().AddSprite(*img, particle);
 								}
 
 								if ((int)cg_particles >= 2) {
-									auto ent = stmp::make_unique<SmokeSpriteEntity>(*client, color, 70.0F);
-									ent->SetTrajectory(p3, RandomAxis() * 0.2F, 1.0F, 0.0F);
-									ent->SetRotation(getRandom() * M_PI_F * 2.0F);
-									ent->SetRadius(1.0F, 0.5F);
-									ent->SetBlockHitAction(BlockHitAction::Ignore);
-									ent->SetLifeTime(1.0F + getRandom() * 0.5F, 0.0F, 1.0F);
-									client->AddLocalEntity(std::move(ent));
+									ParticleSystem::Particle particle(color);
+									particle.SetTrajectory(p3, RandomAxis() * 0.2F, 1.0F, 0.0F);
+									particle.SetRotation(getRandom() * M_PI_F * 2.0F);
+									particle.SetRadius(1.0F, 0.5F);
+									particle.SetBlockHitAction(BlockHitAction::Ignore);
+									particle.SetLifeTime(1.0F + getRandom() * 0.5F, 0.0F, 1.0F);
+									client->GetParticleSystem().AddSmoke(SmokeSpriteEntity::Type::Steady,
+									                                     70.0F, particle);
 								}
 							}
 						}
@@ -252,7 +378,22 @@ namespace spades {
 			param.ghost = true;
 			param.opacity = std::max(0.25F, time);
 			param.matrix = matrix;
-			client->GetRenderer().RenderModel(*model, param);
+
+			IRenderer& renderer = client->GetRenderer();
+			if (model) {
+				renderer.RenderModel(*model, param);
+				return;
+			}
+
+			// the model is not ready yet
+			placeholderSprites.clear();
+			for (std::size_t i = 0; i < placeholderPoints.size(); i++) {
+				Vector4 color = placeholderColors[i] * param.opacity; // premultiplied alpha
+				placeholderSprites.push_back(SpriteParam{
+				  (matrix * placeholderPoints[i]).GetXYZ(), 0.6F, 0.0F, color});
+			}
+			renderer.AddSprites(*placeholderImage, placeholderSprites.data(),
+			                    placeholderSprites.size());
 		}
 	} // namespace client
 } // namespace spades
\ No newline at end of file
@@ -20,35 +20,58 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include "ILocalEntity.h"
+#include "IRenderer.h"
 #include <Core/Math.h>
 #include <Core/VoxelModel.h>
 
 namespace spades {
 	namespace client {
 		class Client;
+		class IImage;
 		class IModel;
+
+		/**
+		 * A group of blocks that fell off the map.
+		 *
+		 * The voxel model and its mesh are built on a dedicated worker thread, which might take
+		 * a while for a large structure. Until they are ready, some of the blocks are drawn as
+		 * sprites.
+		 */
 		class FallingBlock : public ILocalEntity {
 			Client* client;
-			IModel* model;
-			VoxelModel* vmodel;
+			Handle<IModel> model;
+			Handle<VoxelModel> vmodel;
 			Matrix4 matrix;
 			Vector3 velocity;
 			int rotation;
 			float time;
 			int numBlocks;
 
+			struct ModelBuild;
+			/** Null after `FinishModel`. */
+			std::shared_ptr<ModelBuild> modelBuild;
+
+			Handle<IImage> placeholderImage;
+			/** The local positions of the blocks drawn until `model` is ready. */
+			std::vector<Vector3> placeholderPoints;
+			std::vector<Vector4> placeholderColors;
+			std::vector<SpriteParam> placeholderSprites;
+
+			/** Creates `model` from `modelBuild`, which must be done. */
+			void FinishModel();
+
 			/** @return non-zero if bounced, 2 when sound should be played. */
 			int MoveBlock(float fsynctics);
 
 		public:
 			FallingBlock(Client*, std::vector<IntVector3> blocks);
-			~FallingBlock();
 
 			bool Update(float dt) override;
 			void Render3D() override;
 		};
 	} // namespace client
-} // namespace spades
\ No newline at end of file
+} // namespace spades
@@ -20,17 +20,31 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <thread>
 #include <vector>
 
 #include "GameMap.h"
+#include "GameMapSnapshot.h"
+#include <Core/ConcurrentDispatch.h>
 #include <Core/Debug.h>
 #include <Core/Exception.h>
 #include <Core/FileManager.h>
 #include <Core/IStream.h>
 #include <Core/RandomAccessAdaptor.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 1
+#include <emmintrin.h>
+#else
+#define ENABLE_SSE2 0
+#endif
+
 namespace spades {
 	namespace client {
 
@@ -44,20 +58,163 @@ namespace spades {
 			return (u.c & 0xFFFFFF) | (100UL << 24);
 		}
 
+		static uint32_t ComputeDefaultColor(const int* groundCols, int x, int y, int z) {
+			// Same as `GetDirtColor`, but the noise is derived from the coordinates so the
+			// color of a voxel doesn't change every time it's queried
+			int j = groundCols[(z >> 3) + 1];
+			int i = groundCols[(z >> 3)];
+			i += ((j - i) * (z & 7)) >> 3;
+
+			IntVector3 col;
+			col.x = abs((x & 7) - 4);
+			col.y = abs((y & 7) - 4);
+			col.z = abs((z & 7) - 4);
+			i += 4 * (col.x << 16 | col.y << 8 | col.z);
+
+			uint32_t hash = (uint32_t)x * 73856093U ^ (uint32_t)y * 19349663U ^
+			                (uint32_t)z * 83492791U;
+			return swapColor(i + 0x10101 * (hash % 7));
+		}
+
 		GameMap::GameMap() {
 			SPADES_MARK_FUNCTION();
 
 			for (int x = 0; x < DefaultWidth; x++)
 			for (int y = 0; y < DefaultHeight; y++) {
 				solidMap[x][y] = 1; // ground only
-				for (int z = 0; z < DefaultDepth; z++) {
-					uint32_t col = GetDirtColor(x, y, z);
-					colorMap[x][y][z] = swapColor(col);
-				}
+				colorColumns[x][y] = ColorColumn{0, 0, 0};
 			}
+
+			for (auto& row : dirtySnapshotChunks)
+				std::fill(std::begin(row), std::end(row), true);
 		}
 		GameMap::~GameMap() { SPADES_MARK_FUNCTION(); }
 
+		uint32_t GameMap::GetDefaultColor(int x, int y, int z) const {
+			return ComputeDefaultColor(groundCols, x, y, z);
+		}
+
+		std::size_t GameMap::GetColorStorageSize() const {
+			return numColorPages * (ColorPageSize + DefaultDepth) * sizeof(uint32_t);
+		}
+
+		uint32_t GameMap::AllocateColorSlot(uint32_t& capacity) {
+			SPAssert(capacity > 0 && capacity <= DefaultDepth);
+
+			for (uint32_t c = capacity; c <= DefaultDepth; c++) {
+				auto& slots = freeColorSlots[c];
+				if (!slots.empty()) {
+					uint32_t offset = slots.back();
+					slots.pop_back();
+					capacity = c;
+					return offset;
+				}
+			}
+
+			if (numColorPages == 0 || colorPoolTail + capacity > ColorPageSize) {
+				if (numColorPages == MaxColorPages)
+					SPRaise("Color pool exhausted");
+
+				if (numColorPages > 0 && colorPoolTail < ColorPageSize) {
+					// Keep the remainder of the last page for smaller slots
+					uint32_t base = (uint32_t)(numColorPages - 1) << ColorPageBits;
+					freeColorSlots[ColorPageSize - colorPoolTail].push_back(base + colorPoolTail);
+				}
+
+				colorPages[numColorPages].reset(new uint32_t[ColorPageSize + DefaultDepth]);
+				numColorPages++;
+				colorPoolTail = 0;
+			}
+
+			uint32_t base = (uint32_t)(numColorPages - 1) << ColorPageBits;
+			uint32_t offset = base + colorPoolTail;
+			colorPoolTail += capacity;
+			return offset;
+		}
+
+		void GameMap::ReleaseColorSlot(uint32_t offset, uint32_t capacity) {
+			if (capacity == 0)
+				return;
+			freeColorSlots[capacity].push_back(offset);
+		}
+
+		void GameMap::StoreColor(int x, int y, int z, uint32_t color) {
+			ColorColumn& column = colorColumns[x][y];
+			uint64_t bit = 1ULL << z;
+			int index = PopCount64(column.mask & (bit - 1));
+
+			if (column.mask & bit) {
+				GetColorSlot(column.offset)[index] = color;
+				return;
+			}
+
+			int count = PopCount64(column.mask);
+			if ((uint32_t)count < column.capacity) {
+				uint32_t* colors = GetColorSlot(column.offset);
+				std::copy_backward(colors + index, colors + count, colors + count + 1);
+				colors[index] = color;
+				column.mask |= bit;
+				return;
+			}
+
+			// Move the column to a larger slot. Leave some room for the blocks
+			// likely to be placed nearby.
+			uint32_t capacity = std::min<uint32_t>(std::max<uint32_t>(count * 2, 4), DefaultDepth);
+			uint32_t offset = AllocateColorSlot(capacity);
+			uint32_t* newColors = GetColorSlot(offset);
+			if (count > 0) {
+				const uint32_t* colors = GetColorSlot(column.offset);
+				std::copy(colors, colors + index, newColors);
+				std::copy(colors + index, colors + count, newColors + index + 1);
+			}
+			newColors[index] = color;
+
+			ReleaseColorSlot(column.offset, column.capacity);
+			column.offset = offset;
+			column.capacity = capacity;
+			column.mask |= bit;
+		}
+
+		void GameMap::EraseColor(int x, int y, int z) {
+			ColorColumn& column = colorColumns[x][y];
+			uint64_t bit = 1ULL << z;
+			SPAssert(column.mask & bit);
+
+			int index = PopCount64(column.mask & (bit - 1));
+			int count = PopCount64(column.mask);
+			uint32_t* colors = GetColorSlot(column.offset);
+			std::copy(colors + index + 1, colors + count, colors + index);
+			column.mask &= ~bit;
+
+			if (column.mask == 0) {
+				ReleaseColorSlot(column.offset, column.capacity);
+				column.offset = 0;
+				column.capacity = 0;
+			}
+		}
+
+		void GameMap::SetColumn(int x, int y, uint64_t solid, uint64_t colorMask,
+		                        const uint32_t* colors) {
+			ColorColumn& column = colorColumns[x][y];
+			uint32_t count = (uint32_t)PopCount64(colorMask);
+
+			if (count > column.capacity) {
+				ReleaseColorSlot(column.offset, column.capacity);
+				column.capacity = count;
+				column.offset = AllocateColorSlot(column.capacity);
+			} else if (count == 0) {
+				ReleaseColorSlot(column.offset, column.capacity);
+				column.offset = 0;
+				column.capacity = 0;
+			}
+
+			if (count > 0)
+				std::copy(colors, colors + count, GetColorSlot(column.offset));
+			column.mask = colorMask;
+			solidMap[x][y] = solid;
+			MarkModified(x, y);
+		}
+
 		void GameMap::AddListener(spades::client::IGameMapListener* l) {
 			std::lock_guard<std::mutex> _guard{listenersMutex};
 			listeners.push_back(l);
@@ -70,6 +227,39 @@ namespace spades {
 				listeners.erase(it);
 		}
 
+		void GameMap::AddPendingChange(int x, int y, int z) {
+			IntVector3 v{x, y, z};
+			if (pendingChanges.voxels.empty()) {
+				pendingChanges.minCorner = pendingChanges.maxCorner = v;
+			} else {
+				IntVector3& minCorner = pendingChanges.minCorner;
+				IntVector3& maxCorner = pendingChanges.maxCorner;
+				minCorner.x = std::min(minCorner.x, x);
+				minCorner.y = std::min(minCorner.y, y);
+				minCorner.z = std::min(minCorner.z, z);
+				maxCorner.x = std::max(maxCorner.x, x);
+				maxCorner.y = std::max(maxCorner.y, y);
+				maxCorner.z = std::max(maxCorner.z, z);
+			}
+			pendingChanges.voxels.push_back(v);
+		}
+
+		void GameMap::CommitChanges() {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(changeDepth > 0);
+			if (--changeDepth > 0 || pendingChanges.voxels.empty())
+				return;
+
+			// Reset `pendingChanges` before the notification in case a listener calls `Set`
+			GameMapChanges changes;
+			std::swap(changes, pendingChanges);
+
+			std::lock_guard<std::mutex> guard{listenersMutex};
+			for (auto* l : listeners)
+				l->GameMapChangesCommitted(changes, this);
+		}
+
 		static void WriteColor(std::vector<char>& buffer, int color) {
 			buffer.push_back((char)(color >> 16));
 			buffer.push_back((char)(color >> 8));
@@ -77,73 +267,234 @@ namespace spades {
 			buffer.push_back((char)(color >> 24));
 		}
 
+		/** Returns the index of the first set bit at or after `from`, or 64 if there's none. */
+		static inline int FindSetBit(uint64_t bits, int from) {
+			if (from >= 64)
+				return 64;
+			bits >>= from;
+			return bits ? from + CountTrailingZeros64(bits) : 64;
+		}
+
 		// base on pysnip
+		void GameMap::EncodeColumn(std::vector<char>& buffer, int x, int y) const {
+			const int d = Depth();
+			const uint64_t solid = solidMap[x][y];
+			const uint64_t surface = GetSurfaceMap(x, y);
+			const uint64_t interior = solid & ~surface;
+
+			int z = 0;
+			while (z < d) {
+				// find the air region
+				int air_start = z;
+				z = FindSetBit(solid, z);
+
+				// find the top region
+				int top_colors_start = z;
+				z = FindSetBit(~surface, z);
+				int top_colors_end = z;
+
+				// now skip past the solid voxels
+				z = FindSetBit(~interior, z);
+
+				// at the end of the solid voxels, we have colored voxels.
+				// in the "normal" case they're bottom colors; but it's
+				// possible to have air-color-solid-color-solid-color-air,
+				// which we encode as air-color-solid-0, 0-color-solid-air
+
+				// so figure out if we have any bottom colors at this point
+				int bottom_colors_start = z;
+
+				int i = FindSetBit(~surface, z);
+				if (i != d)
+					z = i;
+				int bottom_colors_end = z;
+
+				// now we're ready to write a span
+				int top_colors_len = top_colors_end - top_colors_start;
+				int bottom_colors_len = bottom_colors_end - bottom_colors_start;
+
+				int colors = top_colors_len + bottom_colors_len;
+
+				if (z == d)
+					buffer.push_back(0);
+				else
+					buffer.push_back(colors + 1);
+				buffer.push_back(top_colors_start);
+				buffer.push_back(top_colors_end - 1);
+				buffer.push_back(air_start);
+
+				WriteColors(buffer, x, y, top_colors_start, top_colors_len);
+				WriteColors(buffer, x, y, bottom_colors_start, bottom_colors_len);
+			}
+		}
+
+		void GameMap::WriteColors(std::vector<char>& buffer, int x, int y, int z,
+		                          int count) const {
+			if (count == 0)
+				return;
+
+			const ColorColumn& column = colorColumns[x][y];
+			uint64_t bits = (count == 64 ? ~0ULL : (1ULL << count) - 1) << z;
+			if ((column.mask & bits) != bits) {
+				// Some of the voxels use the default color
+				for (int i = 0; i < count; ++i)
+					WriteColor(buffer, GetColor(x, y, z + i));
+				return;
+			}
+
+			// The colors are stored consecutively
+			const uint32_t* colors =
+			  GetColorSlot(column.offset) + PopCount64(column.mask & ((1ULL << z) - 1));
+			for (int i = 0; i < count; ++i)
+				WriteColor(buffer, colors[i]);
+		}
+
 		void GameMap::Save(spades::IStream* stream) {
-			int w = Width();
-			int h = Height();
-			int d = Depth();
-			std::vector<char> buffer;
-			buffer.reserve(10 * 1024 * 1024);
-			for (int y = 0; y < h; y++) {
-				for (int x = 0; x < w; x++) {
-					int z = 0;
-					while (z < d) {
-						// find the air region
-						int air_start = z;
-						while (z < d && !IsSolid(x, y, z))
-							++z;
-
-						// find the top region
-						int top_colors_start = z;
-						while (z < d && IsSurface(x, y, z))
-							++z;
-						int top_colors_end = z;
-
-						// now skip past the solid voxels
-						while (z < d && IsSolid(x, y, z) && !IsSurface(x, y, z))
-							++z;
-
-						// at the end of the solid voxels, we have colored voxels.
-						// in the "normal" case they're bottom colors; but it's
-						// possible to have air-color-solid-color-solid-color-air,
-						// which we encode as air-color-solid-0, 0-color-solid-air
-
-						// so figure out if we have any bottom colors at this point
-						int bottom_colors_start = z;
-
-						int i = z;
-						while (i < d && IsSurface(x, y, i))
-							++i;
-
-						if (i != d) {
-							while (IsSurface(x, y, z))
-								++z;
-						}
-						int bottom_colors_end = z;
+			SPADES_MARK_FUNCTION();
 
-						// now we're ready to write a span
-						int top_colors_len = top_colors_end - top_colors_start;
-						int bottom_colors_len = bottom_colors_end - bottom_colors_start;
+			// Encode rows in batches. The dispatches and the current thread take batches until
+			// none is left, and the outputs are written in the row order afterwards.
+			const int rowsPerBatch = 16;
+			const int numBatches = DefaultHeight / rowsPerBatch;
+			std::vector<std::vector<char>> outputs(numBatches);
+			std::atomic<int> nextBatch{0};
+			std::mutex exceptionMutex;
+			std::exception_ptr exceptionThrown;
+
+			auto encodeBatches = [&]() {
+				try {
+					for (;;) {
+						int batch = nextBatch.fetch_add(1);
+						if (batch >= numBatches)
+							break;
 
-						int colors = top_colors_len + bottom_colors_len;
+						std::vector<char>& buffer = outputs[batch];
+						buffer.reserve(256 * 1024);
 
-						if (z == d)
-							buffer.push_back(0);
-						else
-							buffer.push_back(colors + 1);
-						buffer.push_back(top_colors_start);
-						buffer.push_back(top_colors_end - 1);
-						buffer.push_back(air_start);
-
-						for (i = 0; i < top_colors_len; ++i)
-							WriteColor(buffer, GetColor(x, y, top_colors_start + i));
-						for (i = 0; i < bottom_colors_len; ++i)
-							WriteColor(buffer, GetColor(x, y, bottom_colors_start + i));
+						for (int y = batch * rowsPerBatch; y < (batch + 1) * rowsPerBatch; y++)
+							for (int x = 0; x < DefaultWidth; x++)
+								EncodeColumn(buffer, x, y);
 					}
+				} catch (...) {
+					std::lock_guard<std::mutex> lock{exceptionMutex};
+					if (!exceptionThrown)
+						exceptionThrown = std::current_exception();
+
+					// Make the others stop early
+					nextBatch.store(numBatches);
 				}
+			};
+
+			int numDispatches = std::min<int>(std::thread::hardware_concurrency(), numBatches) - 1;
+			std::vector<std::unique_ptr<ConcurrentDispatch>> dispatches;
+			for (int i = 0; i < numDispatches; i++) {
+				dispatches.emplace_back(
+				  new FunctionDispatch<decltype(encodeBatches)>(encodeBatches));
+				dispatches.back()->Start();
 			}
 
-			stream->Write(buffer.data(), buffer.size());
+			encodeBatches();
+
+			for (const auto& dispatch : dispatches)
+				dispatch->Join();
+
+			if (exceptionThrown)
+				std::rethrow_exception(exceptionThrown);
+
+			for (const std::vector<char>& buffer : outputs)
+				stream->Write(buffer.data(), buffer.size());
+		}
+
+		namespace {
+			/** The header of the data written by `GameMap::SaveDecoded`. */
+			struct DecodedMapHeader {
+				char magic[4];
+				uint32_t version;
+				uint32_t width, height, depth;
+				uint32_t numColors;
+			};
+
+			const char decodedMapMagic[4] = {'S', 'P', 'D', 'M'};
+			const uint32_t decodedMapVersion = 1;
+		} // namespace
+
+		void GameMap::SaveDecoded(spades::IStream* stream) const {
+			SPADES_MARK_FUNCTION();
+
+			const int numColumns = DefaultWidth * DefaultHeight;
+			std::vector<uint64_t> solids(numColumns), colorMasks(numColumns);
+			std::vector<uint32_t> colors;
+			for (int y = 0; y < DefaultHeight; y++)
+				for (int x = 0; x < DefaultWidth; x++) {
+					const ColorColumn& column = colorColumns[x][y];
+					solids[x + y * DefaultWidth] = solidMap[x][y];
+					colorMasks[x + y * DefaultWidth] = column.mask;
+					if (column.mask) {
+						const uint32_t* slot = GetColorSlot(column.offset);
+						colors.insert(colors.end(), slot, slot + PopCount64(column.mask));
+					}
+				}
+
+			DecodedMapHeader header;
+			std::copy(std::begin(decodedMapMagic), std::end(decodedMapMagic), header.magic);
+			header.version = decodedMapVersion;
+			header.width = DefaultWidth;
+			header.height = DefaultHeight;
+			header.depth = DefaultDepth;
+			header.numColors = (uint32_t)colors.size();
+
+			stream->Write(&header, sizeof(header));
+			stream->Write(solids.data(), solids.size() * sizeof(uint64_t));
+			stream->Write(colorMasks.data(), colorMasks.size() * sizeof(uint64_t));
+			stream->Write(colors.data(), colors.size() * sizeof(uint32_t));
+		}
+
+		GameMap* GameMap::LoadDecoded(spades::IStream* stream) {
+			SPADES_MARK_FUNCTION();
+
+			auto readExactly = [&](void* buffer, std::size_t numBytes) {
+				if (stream->Read(buffer, numBytes) != numBytes)
+					SPRaise("File truncated");
+			};
+
+			DecodedMapHeader header;
+			readExactly(&header, sizeof(header));
+			if (!std::equal(std::begin(decodedMapMagic), std::end(decodedMapMagic),
+			                header.magic))
+				SPRaise("Not a decoded map");
+			if (header.version != decodedMapVersion)
+				SPRaise("Unsupported decoded map version: %u", (unsigned int)header.version);
+			if (header.width != DefaultWidth || header.height != DefaultHeight ||
+			    header.depth != DefaultDepth)
+				SPRaise("Unsupported map size: %ux%ux%u", (unsigned int)header.width,
+				        (unsigned int)header.height, (unsigned int)header.depth);
+			if (header.numColors > (uint32_t)(DefaultWidth * DefaultHeight * DefaultDepth))
+				SPRaise("Invalid number of colors: %u", (unsigned int)header.numColors);
+
+			const int numColumns = DefaultWidth * DefaultHeight;
+			std::vector<uint64_t> solids(numColumns), colorMasks(numColumns);
+			std::vector<uint32_t> colors(header.numColors);
+			readExactly(solids.data(), solids.size() * sizeof(uint64_t));
+			readExactly(colorMasks.data(), colorMasks.size() * sizeof(uint64_t));
+			readExactly(colors.data(), colors.size() * sizeof(uint32_t));
+
+			auto map = Handle<GameMap>::New();
+
+			std::size_t colorIndex = 0;
+			for (int y = 0; y < DefaultHeight; y++)
+				for (int x = 0; x < DefaultWidth; x++) {
+					uint64_t colorMask = colorMasks[x + y * DefaultWidth];
+					std::size_t count = PopCount64(colorMask);
+					if (count > colors.size() - colorIndex)
+						SPRaise("Color data truncated");
+					map->SetColumn(x, y, solids[x + y * DefaultWidth], colorMask,
+					               colors.data() + colorIndex);
+					colorIndex += count;
+				}
+			if (colorIndex != colors.size())
+				SPRaise("Unused color data");
+
+			return std::move(map).Unmanage();
 		}
 
 		bool GameMap::ClipBox(int x, int y, int z) const {
@@ -186,97 +537,118 @@ namespace spades {
 			return ClipWorld((int)floorf(x), (int)floorf(y), (int)floorf(z));
 		}
 
-		bool GameMap::CastRay(spades::Vector3 v0, spades::Vector3 v1, float length,
-		                      spades::IntVector3& vOut) const {
-			SPADES_MARK_FUNCTION_DEBUG();
+		namespace {
+			/** The state of the integer ray stepping used by `GameMap::CastRay`. */
+			struct VoxlapRay {
+				IntVector3 a, c, d, p, i;
+				long cnt;
+
+				VoxlapRay(Vector3 v0, Vector3 v1, float length) {
+					v1 = v0 + v1 * length;
+
+					Vector3 f, g;
+					cnt = 0;
+
+					a = v0.Floor();
+					c = v1.Floor();
+
+					if (c.x < a.x) {
+						d.x = -1;
+						f.x = v0.x - a.x;
+						g.x = (v0.x - v1.x) * 1024;
+						cnt += a.x - c.x;
+					} else if (c.x != a.x) {
+						d.x = 1;
+						f.x = a.x + 1 - v0.x;
+						g.x = (v1.x - v0.x) * 1024;
+						cnt += c.x - a.x;
+					} else {
+						d.x = 0;
+						f.x = g.x = 0.0F;
+					}
+					if (c.y < a.y) {
+						d.y = -1;
+						f.y = v0.y - a.y;
+						g.y = (v0.y - v1.y) * 1024;
+						cnt += a.y - c.y;
+					} else if (c.y != a.y) {
+						d.y = 1;
+						f.y = a.y + 1 - v0.y;
+						g.y = (v1.y - v0.y) * 1024;
+						cnt += c.y - a.y;
+					} else {
+						d.y = 0;
+						f.y = g.y = 0.0F;
+					}
+					if (c.z < a.z) {
+						d.z = -1;
+						f.z = v0.z - a.z;
+						g.z = (v0.z - v1.z) * 1024;
+						cnt += a.z - c.z;
+					} else if (c.z != a.z) {
+						d.z = 1;
+						f.z = a.z + 1 - v0.z;
+						g.z = (v1.z - v0.z) * 1024;
+						cnt += c.z - a.z;
+					} else {
+						d.z = 0;
+						f.z = g.z = 0.0F;
+					}
 
-			SPAssert(!v0.IsNaN());
-			SPAssert(!v1.IsNaN());
-			SPAssert(!std::isnan(length));
-
-			v1 = v0 + v1 * length;
-
-			Vector3 f, g;
-			IntVector3 a, c, d, p, i;
-			long cnt = 0;
-
-			a = v0.Floor();
-			c = v1.Floor();
-
-			if (c.x < a.x) {
-				d.x = -1;
-				f.x = v0.x - a.x;
-				g.x = (v0.x - v1.x) * 1024;
-				cnt += a.x - c.x;
-			} else if (c.x != a.x) {
-				d.x = 1;
-				f.x = a.x + 1 - v0.x;
-				g.x = (v1.x - v0.x) * 1024;
-				cnt += c.x - a.x;
-			} else {
-				d.x = 0;
-				f.x = g.x = 0.0F;
-			}
-			if (c.y < a.y) {
-				d.y = -1;
-				f.y = v0.y - a.y;
-				g.y = (v0.y - v1.y) * 1024;
-				cnt += a.y - c.y;
-			} else if (c.y != a.y) {
-				d.y = 1;
-				f.y = a.y + 1 - v0.y;
-				g.y = (v1.y - v0.y) * 1024;
-				cnt += c.y - a.y;
-			} else {
-				d.y = 0;
-				f.y = g.y = 0.0F;
-			}
-			if (c.z < a.z) {
-				d.z = -1;
-				f.z = v0.z - a.z;
-				g.z = (v0.z - v1.z) * 1024;
-				cnt += a.z - c.z;
-			} else if (c.z != a.z) {
-				d.z = 1;
-				f.z = a.z + 1 - v0.z;
-				g.z = (v1.z - v0.z) * 1024;
-				cnt += c.z - a.z;
-			} else {
-				d.z = 0;
-				f.z = g.z = 0.0F;
-			}
+					Vector3 pp = MakeVector3(f.x * g.z - f.z * g.x, f.y * g.z - f.z * g.y,
+					                         f.y * g.x - f.x * g.y);
+					p = pp.Floor();
+					i = g.Floor();
 
-			Vector3 pp =
-			  MakeVector3(f.x * g.z - f.z * g.x, f.y * g.z - f.z * g.y, f.y * g.x - f.x * g.y);
-			p = pp.Floor();
-			i = g.Floor();
-
-			if (cnt > (long)length)
-				cnt = (long)length;
-
-			while (cnt > 0) {
-				if (((p.x | p.y) >= 0) && (a.z != c.z)) {
-					a.z += d.z;
-					p.x -= i.x;
-					p.y -= i.y;
-				} else if ((p.z >= 0) && (a.x != c.x)) {
-					a.x += d.x;
-					p.x += i.z;
-					p.z -= i.y;
-				} else {
-					a.y += d.y;
-					p.y += i.z;
-					p.z += i.x;
+					if (cnt > (long)length)
+						cnt = (long)length;
 				}
 
-				if (IsSolidWrapped(a.x, a.y, a.z)) {
-					vOut = a;
-					return true;
+				void Step() {
+					if (((p.x | p.y) >= 0) && (a.z != c.z)) {
+						a.z += d.z;
+						p.x -= i.x;
+						p.y -= i.y;
+					} else if ((p.z >= 0) && (a.x != c.x)) {
+						a.x += d.x;
+						p.x += i.z;
+						p.z -= i.y;
+					} else {
+						a.y += d.y;
+						p.y += i.z;
+						p.z += i.x;
+					}
 				}
-				cnt--;
+			};
+
+			/** Implements `CastRay` for `GameMap` and `GameMapSnapshot`. */
+			template <class Map>
+			bool CastRayImpl(const Map& map, Vector3 v0, Vector3 v1, float length,
+			                 IntVector3& vOut) {
+				SPAssert(!v0.IsNaN());
+				SPAssert(!v1.IsNaN());
+				SPAssert(!std::isnan(length));
+
+				VoxlapRay ray{v0, v1, length};
+
+				while (ray.cnt > 0) {
+					ray.Step();
+
+					if (map.IsSolidWrapped(ray.a.x, ray.a.y, ray.a.z)) {
+						vOut = ray.a;
+						return true;
+					}
+					ray.cnt--;
+				}
+
+				return false;
 			}
+		} // namespace
 
-			return false;
+		bool GameMap::CastRay(spades::Vector3 v0, spades::Vector3 v1, float length,
+		                      spades::IntVector3& vOut) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+			return CastRayImpl(*this, v0, v1, length, vOut);
 		}
 
 		GameMap::RayCastResult GameMap::CastRay2(spades::Vector3 v0, spades::Vector3 dir,
@@ -380,6 +752,528 @@ namespace spades {
 			return result;
 		}
 
+#if ENABLE_SSE2
+		namespace {
+			/** Evaluates `GameMap::IsSolidWrapped` for four voxels and returns a bitmask. */
+			template <class Map>
+			unsigned int IsSolidWrapped4(const Map& map, __m128i x, __m128i y, __m128i z) {
+				alignas(16) int32_t xs[4], ys[4], zs[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(xs), x);
+				_mm_store_si128(reinterpret_cast<__m128i*>(ys), y);
+				_mm_store_si128(reinterpret_cast<__m128i*>(zs), z);
+
+				unsigned int bits = 0;
+				for (int k = 0; k < 4; k++)
+					bits |= (unsigned int)((map.GetSolidMapWrapped(xs[k], ys[k]) >> (zs[k] & 63)) & 1)
+					        << k;
+
+				// Above the map is air, and below the map is solid
+				__m128i above = _mm_cmplt_epi32(z, _mm_setzero_si128());
+				__m128i below = _mm_cmpgt_epi32(z, _mm_set1_epi32(map.Depth() - 1));
+				bits &= ~(unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(above, below)));
+				bits |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(below));
+				return bits;
+			}
+		} // namespace
+#endif
+
+		namespace {
+			using RayPacket = GameMap::RayPacket;
+			using RayPacketResult = GameMap::RayPacketResult;
+
+			/** Implements `CastRayPacket` for `GameMap` and `GameMapSnapshot`. */
+			template <class Map>
+			void CastRayPacketImpl(const Map& map, const RayPacket& packet,
+			                       RayPacketResult& result) {
+				const int numRays = packet.numRays;
+				SPAssert(numRays >= 0 && numRays <= RayPacket::MaxRays);
+
+#if ENABLE_SSE2
+				enum { NumLanes = 4 };
+
+				// The setup is done in the same way as `CastRay`. Unused lanes are left inactive.
+				alignas(16) int32_t ax[RayPacket::MaxRays], ay[RayPacket::MaxRays],
+				  az[RayPacket::MaxRays], cx[RayPacket::MaxRays], cz[RayPacket::MaxRays], dx[RayPacket::MaxRays], dy[RayPacket::MaxRays],
+				  dz[RayPacket::MaxRays], px[RayPacket::MaxRays], py[RayPacket::MaxRays],
+				  pz[RayPacket::MaxRays], ix[RayPacket::MaxRays], iy[RayPacket::MaxRays],
+				  iz[RayPacket::MaxRays], cnt[RayPacket::MaxRays];
+				unsigned int activeLanes = 0;
+
+				for (int k = 0; k < RayPacket::MaxRays; k++) {
+					if (k < numRays) {
+						SPAssert(!std::isnan(packet.length[k]));
+						VoxlapRay ray{
+						  MakeVector3(packet.originX[k], packet.originY[k], packet.originZ[k]),
+						  MakeVector3(packet.dirX[k], packet.dirY[k], packet.dirZ[k]),
+						  packet.length[k]};
+						ax[k] = ray.a.x, ay[k] = ray.a.y, az[k] = ray.a.z;
+						cx[k] = ray.c.x, cz[k] = ray.c.z;
+						dx[k] = ray.d.x, dy[k] = ray.d.y, dz[k] = ray.d.z;
+						px[k] = ray.p.x, py[k] = ray.p.y, pz[k] = ray.p.z;
+						ix[k] = ray.i.x, iy[k] = ray.i.y, iz[k] = ray.i.z;
+						cnt[k] = (int32_t)std::min<long>(ray.cnt, INT_MAX);
+						if (ray.cnt > 0)
+							activeLanes |= 1U << k;
+
+						result.hit[k] = false;
+						result.startSolid[k] = false;
+					} else {
+						ax[k] = ay[k] = az[k] = cx[k] = cz[k] = 0;
+						dx[k] = dy[k] = dz[k] = px[k] = py[k] = pz[k] = 0;
+						ix[k] = iy[k] = iz[k] = 0;
+						cnt[k] = 0;
+					}
+				}
+
+				const int numGroups = (numRays + NumLanes - 1) / NumLanes;
+				const __m128i minusOne = _mm_set1_epi32(-1);
+
+				while (activeLanes) {
+					for (int g = 0; g < numGroups; g++) {
+						int o = g * NumLanes;
+						if (!((activeLanes >> o) & ((1U << NumLanes) - 1)))
+							continue;
+						__m128i a_x = _mm_load_si128(reinterpret_cast<const __m128i*>(ax + o));
+						__m128i a_y = _mm_load_si128(reinterpret_cast<const __m128i*>(ay + o));
+						__m128i a_z = _mm_load_si128(reinterpret_cast<const __m128i*>(az + o));
+						__m128i p_x = _mm_load_si128(reinterpret_cast<const __m128i*>(px + o));
+						__m128i p_y = _mm_load_si128(reinterpret_cast<const __m128i*>(py + o));
+						__m128i p_z = _mm_load_si128(reinterpret_cast<const __m128i*>(pz + o));
+						__m128i c_x = _mm_load_si128(reinterpret_cast<const __m128i*>(cx + o));
+						__m128i c_z = _mm_load_si128(reinterpret_cast<const __m128i*>(cz + o));
+						__m128i i_x = _mm_load_si128(reinterpret_cast<const __m128i*>(ix + o));
+						__m128i i_y = _mm_load_si128(reinterpret_cast<const __m128i*>(iy + o));
+						__m128i i_z = _mm_load_si128(reinterpret_cast<const __m128i*>(iz + o));
+
+						// `VoxlapRay::Step` with the branches turned into masks
+						__m128i stepZ = _mm_andnot_si128(_mm_cmpeq_epi32(a_z, c_z),
+						                                 _mm_cmpgt_epi32(_mm_or_si128(p_x, p_y), minusOne));
+						__m128i stepX = _mm_andnot_si128(
+						  stepZ, _mm_andnot_si128(_mm_cmpeq_epi32(a_x, c_x),
+						                          _mm_cmpgt_epi32(p_z, minusOne)));
+						__m128i stepY = _mm_andnot_si128(_mm_or_si128(stepZ, stepX), minusOne);
+
+						a_x = _mm_add_epi32(
+						  a_x, _mm_and_si128(stepX, _mm_load_si128(reinterpret_cast<const __m128i*>(dx + o))));
+						a_y = _mm_add_epi32(
+						  a_y, _mm_and_si128(stepY, _mm_load_si128(reinterpret_cast<const __m128i*>(dy + o))));
+						a_z = _mm_add_epi32(
+						  a_z, _mm_and_si128(stepZ, _mm_load_si128(reinterpret_cast<const __m128i*>(dz + o))));
+						p_x = _mm_sub_epi32(p_x, _mm_and_si128(stepZ, i_x));
+						p_y = _mm_sub_epi32(p_y, _mm_and_si128(stepZ, i_y));
+						p_x = _mm_add_epi32(p_x, _mm_and_si128(stepX, i_z));
+						p_z = _mm_sub_epi32(p_z, _mm_and_si128(stepX, i_y));
+						p_y = _mm_add_epi32(p_y, _mm_and_si128(stepY, i_z));
+						p_z = _mm_add_epi32(p_z, _mm_and_si128(stepY, i_x));
+
+						_mm_store_si128(reinterpret_cast<__m128i*>(ax + o), a_x);
+						_mm_store_si128(reinterpret_cast<__m128i*>(ay + o), a_y);
+						_mm_store_si128(reinterpret_cast<__m128i*>(az + o), a_z);
+						_mm_store_si128(reinterpret_cast<__m128i*>(px + o), p_x);
+						_mm_store_si128(reinterpret_cast<__m128i*>(py + o), p_y);
+						_mm_store_si128(reinterpret_cast<__m128i*>(pz + o), p_z);
+
+						// Inactive lanes keep stepping, but their results are not touched anymore
+						unsigned int lanes = (activeLanes >> o) & ((1U << NumLanes) - 1);
+						unsigned int hits = IsSolidWrapped4(map, a_x, a_y, a_z) & lanes;
+						for (unsigned int h = hits; h; h &= h - 1) {
+							int k = o + CountTrailingZeros64(h);
+							result.hit[k] = true;
+							result.hitBlockX[k] = ax[k];
+							result.hitBlockY[k] = ay[k];
+							result.hitBlockZ[k] = az[k];
+						}
+
+						__m128i c = _mm_add_epi32(
+						  _mm_load_si128(reinterpret_cast<const __m128i*>(cnt + o)), minusOne);
+						_mm_store_si128(reinterpret_cast<__m128i*>(cnt + o), c);
+						lanes &= ~hits;
+						lanes &= (unsigned int)_mm_movemask_ps(
+						  _mm_castsi128_ps(_mm_cmpgt_epi32(c, _mm_setzero_si128())));
+						activeLanes = (activeLanes & ~(((1U << NumLanes) - 1) << o)) | (lanes << o);
+					}
+				}
+#else
+				for (int k = 0; k < numRays; k++) {
+					IntVector3 hitBlock;
+					result.hit[k] = CastRayImpl(
+					  map, MakeVector3(packet.originX[k], packet.originY[k], packet.originZ[k]),
+					  MakeVector3(packet.dirX[k], packet.dirY[k], packet.dirZ[k]), packet.length[k],
+					  hitBlock);
+					result.startSolid[k] = false;
+					result.hitBlockX[k] = hitBlock.x;
+					result.hitBlockY[k] = hitBlock.y;
+					result.hitBlockZ[k] = hitBlock.z;
+				}
+#endif
+			}
+		} // namespace
+
+		void GameMap::CastRayPacket(const RayPacket& packet, RayPacketResult& result) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+			CastRayPacketImpl(*this, packet, result);
+		}
+
+		void GameMap::CastRay2Packet(const RayPacket& packet, int maxSteps,
+		                             RayPacketResult& result) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+
+			const int numRays = packet.numRays;
+			SPAssert(numRays >= 0 && numRays <= RayPacket::MaxRays);
+
+#if ENABLE_SSE2
+			enum { NumLanes = 4 };
+
+			// The setup is done in the same way as `CastRay2`. SSE arithmetic on each
+			// lane rounds in the same way as the scalar code, so the results are identical.
+			Vector3 origins[RayPacket::MaxRays], dirs[RayPacket::MaxRays];
+			alignas(16) float fvX[RayPacket::MaxRays], fvY[RayPacket::MaxRays],
+			  fvZ[RayPacket::MaxRays], invX[RayPacket::MaxRays], invY[RayPacket::MaxRays],
+			  invZ[RayPacket::MaxRays], absDirX[RayPacket::MaxRays], absDirY[RayPacket::MaxRays],
+			  absDirZ[RayPacket::MaxRays];
+			alignas(16) int32_t ivX[RayPacket::MaxRays], ivY[RayPacket::MaxRays],
+			  ivZ[RayPacket::MaxRays], stepX[RayPacket::MaxRays], stepY[RayPacket::MaxRays],
+			  stepZ[RayPacket::MaxRays], hasX[RayPacket::MaxRays], hasY[RayPacket::MaxRays],
+			  hasZ[RayPacket::MaxRays];
+			// The normal of the last step
+			alignas(16) int32_t normX[RayPacket::MaxRays], normY[RayPacket::MaxRays],
+			  normZ[RayPacket::MaxRays];
+			unsigned int activeLanes = 0;
+
+			for (int k = 0; k < RayPacket::MaxRays; k++) {
+				fvX[k] = fvY[k] = fvZ[k] = 0.0F;
+				invX[k] = invY[k] = invZ[k] = 0.0F;
+				absDirX[k] = absDirY[k] = absDirZ[k] = 0.0F;
+				ivX[k] = ivY[k] = ivZ[k] = 0;
+				stepX[k] = stepY[k] = stepZ[k] = 0;
+				hasX[k] = hasY[k] = hasZ[k] = 0;
+				normX[k] = normY[k] = normZ[k] = 0;
+				if (k >= numRays)
+					continue;
+
+				Vector3 v0 = MakeVector3(packet.originX[k], packet.originY[k], packet.originZ[k]);
+				Vector3 dir = MakeVector3(packet.dirX[k], packet.dirY[k], packet.dirZ[k]);
+				SPAssert(!v0.IsNaN());
+				SPAssert(!dir.IsNaN());
+
+				dir = dir.Normalize();
+				origins[k] = v0;
+				dirs[k] = dir;
+
+				IntVector3 iv = v0.Floor();
+				if (IsSolidWrapped(iv.x, iv.y, iv.z)) {
+					result.hit[k] = true;
+					result.startSolid[k] = true;
+					result.hitPosX[k] = v0.x;
+					result.hitPosY[k] = v0.y;
+					result.hitPosZ[k] = v0.z;
+					result.hitBlockX[k] = iv.x;
+					result.hitBlockY[k] = iv.y;
+					result.hitBlockZ[k] = iv.z;
+					result.normalX[k] = result.normalY[k] = result.normalZ[k] = 0;
+					continue;
+				}
+
+				fvX[k] = (dir.x > 0.0F) ? (float)(iv.x + 1) - v0.x : v0.x - (float)iv.x;
+				fvY[k] = (dir.y > 0.0F) ? (float)(iv.y + 1) - v0.y : v0.y - (float)iv.y;
+				fvZ[k] = (dir.z > 0.0F) ? (float)(iv.z + 1) - v0.z : v0.z - (float)iv.z;
+
+				invX[k] = (dir.x != 0.0F) ? 1.0F / fabsf(dir.x) : dir.x;
+				invY[k] = (dir.y != 0.0F) ? 1.0F / fabsf(dir.y) : dir.y;
+				invZ[k] = (dir.z != 0.0F) ? 1.0F / fabsf(dir.z) : dir.z;
+				hasX[k] = invX[k] != 0.0F ? -1 : 0;
+				hasY[k] = invY[k] != 0.0F ? -1 : 0;
+				hasZ[k] = invZ[k] != 0.0F ? -1 : 0;
+
+				absDirX[k] = fabsf(dir.x);
+				absDirY[k] = fabsf(dir.y);
+				absDirZ[k] = fabsf(dir.z);
+				stepX[k] = (dir.x > 0.0F) ? 1 : -1;
+				stepY[k] = (dir.y > 0.0F) ? 1 : -1;
+				stepZ[k] = (dir.z > 0.0F) ? 1 : -1;
+				ivX[k] = iv.x;
+				ivY[k] = iv.y;
+				ivZ[k] = iv.z;
+
+				activeLanes |= 1U << k;
+			}
+
+			const int numGroups = (numRays + NumLanes - 1) / NumLanes;
+			const __m128 one = _mm_set1_ps(1.0F);
+			const __m128 allOnes = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+			for (int i = 0; i < maxSteps && activeLanes; i++) {
+				for (int g = 0; g < numGroups; g++) {
+					int o = g * NumLanes;
+					if (!((activeLanes >> o) & ((1U << NumLanes) - 1)))
+						continue;
+					__m128 fv_x = _mm_load_ps(fvX + o);
+					__m128 fv_y = _mm_load_ps(fvY + o);
+					__m128 fv_z = _mm_load_ps(fvZ + o);
+					__m128 has_x = _mm_castsi128_ps(
+					  _mm_load_si128(reinterpret_cast<const __m128i*>(hasX + o)));
+					__m128 has_y = _mm_castsi128_ps(
+					  _mm_load_si128(reinterpret_cast<const __m128i*>(hasY + o)));
+					__m128 has_z = _mm_castsi128_ps(
+					  _mm_load_si128(reinterpret_cast<const __m128i*>(hasZ + o)));
+
+					// Choose the nearest plane in the same order as `CastRay2`
+					__m128 hasNextBlock = has_x;
+					__m128 selX = has_x, selY, selZ;
+					__m128 nextBlockTime = _mm_and_ps(has_x, _mm_mul_ps(fv_x, _mm_load_ps(invX + o)));
+
+					__m128 t = _mm_mul_ps(fv_y, _mm_load_ps(invY + o));
+					__m128 take = _mm_and_ps(
+					  has_y, _mm_or_ps(_mm_andnot_ps(hasNextBlock, allOnes), _mm_cmplt_ps(t, nextBlockTime)));
+					nextBlockTime = _mm_or_ps(_mm_and_ps(take, t), _mm_andnot_ps(take, nextBlockTime));
+					hasNextBlock = _mm_or_ps(hasNextBlock, take);
+					selX = _mm_andnot_ps(take, selX);
+					selY = take;
+
+					t = _mm_mul_ps(fv_z, _mm_load_ps(invZ + o));
+					take = _mm_and_ps(
+					  has_z, _mm_or_ps(_mm_andnot_ps(hasNextBlock, allOnes), _mm_cmplt_ps(t, nextBlockTime)));
+					nextBlockTime = _mm_or_ps(_mm_and_ps(take, t), _mm_andnot_ps(take, nextBlockTime));
+					selX = _mm_andnot_ps(take, selX);
+					selY = _mm_andnot_ps(take, selY);
+					selZ = take;
+
+					fv_x = _mm_sub_ps(fv_x, _mm_mul_ps(_mm_load_ps(absDirX + o), nextBlockTime));
+					fv_y = _mm_sub_ps(fv_y, _mm_mul_ps(_mm_load_ps(absDirY + o), nextBlockTime));
+					fv_z = _mm_sub_ps(fv_z, _mm_mul_ps(_mm_load_ps(absDirZ + o), nextBlockTime));
+					fv_x = _mm_or_ps(_mm_and_ps(selX, one), _mm_andnot_ps(selX, fv_x));
+					fv_y = _mm_or_ps(_mm_and_ps(selY, one), _mm_andnot_ps(selY, fv_y));
+					fv_z = _mm_or_ps(_mm_and_ps(selZ, one), _mm_andnot_ps(selZ, fv_z));
+					_mm_store_ps(fvX + o, fv_x);
+					_mm_store_ps(fvY + o, fv_y);
+					_mm_store_ps(fvZ + o, fv_z);
+
+					// normal = iv - nextBlock
+					__m128i n_x = _mm_sub_epi32(
+					  _mm_setzero_si128(),
+					  _mm_and_si128(_mm_castps_si128(selX),
+					                _mm_load_si128(reinterpret_cast<const __m128i*>(stepX + o))));
+					__m128i n_y = _mm_sub_epi32(
+					  _mm_setzero_si128(),
+					  _mm_and_si128(_mm_castps_si128(selY),
+					                _mm_load_si128(reinterpret_cast<const __m128i*>(stepY + o))));
+					__m128i n_z = _mm_sub_epi32(
+					  _mm_setzero_si128(),
+					  _mm_and_si128(_mm_castps_si128(selZ),
+					                _mm_load_si128(reinterpret_cast<const __m128i*>(stepZ + o))));
+					_mm_store_si128(reinterpret_cast<__m128i*>(normX + o), n_x);
+					_mm_store_si128(reinterpret_cast<__m128i*>(normY + o), n_y);
+					_mm_store_si128(reinterpret_cast<__m128i*>(normZ + o), n_z);
+
+					// `iv` is advanced right away. Only the active lanes matter, and they don't
+					// read it until the next step.
+					__m128i next_x =
+					  _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(ivX + o)), n_x);
+					__m128i next_y =
+					  _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(ivY + o)), n_y);
+					__m128i next_z =
+					  _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(ivZ + o)), n_z);
+					_mm_store_si128(reinterpret_cast<__m128i*>(ivX + o), next_x);
+					_mm_store_si128(reinterpret_cast<__m128i*>(ivY + o), next_y);
+					_mm_store_si128(reinterpret_cast<__m128i*>(ivZ + o), next_z);
+
+					// Inactive lanes keep stepping, but their results are not touched anymore
+					unsigned int hits = IsSolidWrapped4(*this, next_x, next_y, next_z) &
+					                    (activeLanes >> o) & ((1U << NumLanes) - 1);
+					for (; hits; hits &= hits - 1) {
+						int k = o + CountTrailingZeros64(hits);
+						const Vector3& dir = dirs[k];
+						result.hit[k] = true;
+						result.startSolid[k] = false;
+						result.hitPosX[k] = (dir.x > 0.0F) ? (float)(ivX[k] + 1) - fvX[k]
+						                                   : (float)ivX[k] + fvX[k];
+						result.hitPosY[k] = (dir.y > 0.0F) ? (float)(ivY[k] + 1) - fvY[k]
+						                                   : (float)ivY[k] + fvY[k];
+						result.hitPosZ[k] = (dir.z > 0.0F) ? (float)(ivZ[k] + 1) - fvZ[k]
+						                                   : (float)ivZ[k] + fvZ[k];
+						result.hitBlockX[k] = ivX[k];
+						result.hitBlockY[k] = ivY[k];
+						result.hitBlockZ[k] = ivZ[k];
+						result.normalX[k] = normX[k];
+						result.normalY[k] = normY[k];
+						result.normalZ[k] = normZ[k];
+						activeLanes &= ~(1U << k);
+					}
+				}
+			}
+
+			// The remaining rays didn't hit anything
+			for (unsigned int lanes = activeLanes; lanes; lanes &= lanes - 1) {
+				int k = CountTrailingZeros64(lanes);
+				result.hit[k] = false;
+				result.startSolid[k] = false;
+				result.hitPosX[k] = origins[k].x;
+				result.hitPosY[k] = origins[k].y;
+				result.hitPosZ[k] = origins[k].z;
+				result.hitBlockX[k] = ivX[k];
+				result.hitBlockY[k] = ivY[k];
+				result.hitBlockZ[k] = ivZ[k];
+				result.normalX[k] = normX[k];
+				result.normalY[k] = normY[k];
+				result.normalZ[k] = normZ[k];
+			}
+#else
+			for (int k = 0; k < numRays; k++) {
+				RayCastResult r =
+				  CastRay2(MakeVector3(packet.originX[k], packet.originY[k], packet.originZ[k]),
+				           MakeVector3(packet.dirX[k], packet.dirY[k], packet.dirZ[k]), maxSteps);
+				result.hit[k] = r.hit;
+				result.startSolid[k] = r.startSolid;
+				result.hitPosX[k] = r.hitPos.x;
+				result.hitPosY[k] = r.hitPos.y;
+				result.hitPosZ[k] = r.hitPos.z;
+				result.hitBlockX[k] = r.hitBlock.x;
+				result.hitBlockY[k] = r.hitBlock.y;
+				result.hitBlockZ[k] = r.hitBlock.z;
+				result.normalX[k] = r.normal.x;
+				result.normalY[k] = r.normal.y;
+				result.normalZ[k] = r.normal.z;
+			}
+#endif
+		}
+
+		namespace {
+			/** A bounds-checked view of VOXLAP5 terrain data that is entirely in memory. */
+			class MemoryView {
+			public:
+				MemoryView(const char* data, std::size_t size) : data{data}, size{size} {}
+
+				template <class T> T Read(std::size_t offset) const {
+					if (offset > size || size - offset < sizeof(T))
+						SPRaise("Unexpected EOF");
+					T value;
+					std::memcpy(&value, data + offset, sizeof(T));
+					return value;
+				}
+
+				void Prefetch(std::size_t) const {}
+
+			private:
+				const char* data;
+				std::size_t size;
+			};
+
+			/**
+			 * Decodes a column starting at `pos` and advances `pos` to the next column.
+			 *
+			 * @param colors Receives the colors of the voxels in `colorMask`, in the increasing
+			 *               order of Z.
+			 * @param groundCols Used to compute the colors of the voxels without one. See
+			 *                   `ComputeDefaultColor`.
+			 */
+			template <class View>
+			void DecodeColumn(View& view, std::size_t& pos, uint64_t& solid, uint64_t& colorMask,
+			                  uint32_t* colors, int x, int y, const int* groundCols) {
+				const int depth = GameMap::DefaultDepth;
+
+				solid = 0xFFFFFFFFFFFFFFFFULL;
+				colorMask = 0;
+
+				// Colors usually come in the increasing order of Z, in which case
+				// they are simply appended to `colors`
+				int numColors = 0;
+				auto setColor = [&](int z, uint32_t col) {
+					uint64_t bit = 1ULL << z;
+					int index = PopCount64(colorMask & (bit - 1));
+					if (!(colorMask & bit)) {
+						std::copy_backward(colors + index, colors + numColors,
+						                   colors + numColors + 1);
+						colorMask |= bit;
+						numColors++;
+					}
+					colors[index] = col;
+				};
+				auto getColor = [&](int z) {
+					uint64_t bit = 1ULL << z;
+					if (!(colorMask & bit))
+						return ComputeDefaultColor(groundCols, x, y, z);
+					return colors[PopCount64(colorMask & (bit - 1))];
+				};
+
+				int z = 0;
+				for (;;) {
+					// Read a block ahead in attempt to minimize the number of calls to
+					// `IStream::Read`
+					view.Prefetch(pos + GameMap::DefaultWidth);
+
+					int number_4byte_chunks = view.template Read<int8_t>(pos);
+					int top_color_start = view.template Read<int8_t>(pos + 1);
+					int top_color_end = view.template Read<int8_t>(pos + 2); // inclusive
+
+					for (int i = z; i < top_color_start; i++)
+						solid &= ~(1ULL << i);
+
+					size_t colorOffset = pos + 4;
+					for (z = top_color_start; z <= top_color_end; z++) {
+						setColor(z, swapColor(view.template Read<uint32_t>(colorOffset)));
+						colorOffset += 4;
+					}
+
+					if (top_color_end == depth - 2)
+						setColor(depth - 1, getColor(depth - 2));
+
+					int len_bottom = top_color_end - top_color_start + 1;
+
+					// check for end of data marker
+					if (number_4byte_chunks == 0) {
+						// infer ACTUAL number of 4-byte chunks from the length of the color data
+						pos += 4 * (len_bottom + 1);
+						break;
+					}
+
+					// infer the number of bottom colors in next span from chunk length
+					int len_top = (number_4byte_chunks - 1) - len_bottom;
+
+					// now skip the v pointer past the data to the beginning of the next span
+					pos += (int)view.template Read<int8_t>(pos) * 4;
+
+					int bottom_color_end = view.template Read<int8_t>(pos + 3); // aka air start
+					int bottom_color_start = bottom_color_end - len_top;
+
+					for (z = bottom_color_start; z < bottom_color_end; z++) {
+						setColor(z, swapColor(view.template Read<uint32_t>(colorOffset)));
+						colorOffset += 4;
+					}
+
+					if (bottom_color_end == depth - 1)
+						setColor(depth - 1, getColor(depth - 2));
+				}
+			}
+
+			/**
+			 * Finds the end of the column starting at `pos` by following the span headers.
+			 *
+			 * @return `false` if the column is incomplete. `pos` is left unmodified in this case.
+			 */
+			bool SkipColumn(const char* data, std::size_t size, std::size_t& pos) {
+				std::size_t p = pos;
+				for (;;) {
+					if (p > size || size - p < 4)
+						return false;
+
+					int number_4byte_chunks = (int8_t)data[p];
+					if (number_4byte_chunks == 0) {
+						int top_color_start = (int8_t)data[p + 1];
+						int top_color_end = (int8_t)data[p + 2];
+						int len_bottom = top_color_end - top_color_start + 1;
+						p += 4 * (len_bottom + 1);
+						if (p > size)
+							return false;
+						pos = p;
+						return true;
+					}
+					if (number_4byte_chunks < 0)
+						SPRaise("Malformed span header");
+					p += number_4byte_chunks * 4;
+				}
+			}
+		} // namespace
+
 		GameMap* GameMap::Load(spades::IStream* stream, std::function<void(int)> onProgress) {
 			SPADES_MARK_FUNCTION();
 
@@ -392,67 +1286,371 @@ namespace spades {
 			if (onProgress)
 				onProgress(0);
 
+			uint32_t colors[DefaultDepth];
+
 			for (int y = 0; y < DefaultHeight; y++) {
 				for (int x = 0; x < DefaultWidth; x++) {
-					map->solidMap[x][y] = 0xFFFFFFFFFFFFFFFFULL;
+					uint64_t solid, colorMask;
+					DecodeColumn(view, pos, solid, colorMask, colors, x, y, map->groundCols);
+					map->SetColumn(x, y, solid, colorMask, colors);
 
-					int z = 0;
-					for (;;) {
-						// Read a block ahead in attempt to minimize the number of calls to
-						// `IStream::Read`
-						view.Prefetch(pos + DefaultWidth);
-
-						int number_4byte_chunks = view.Read<int8_t>(pos);
-						int top_color_start = view.Read<int8_t>(pos + 1);
-						int top_color_end = view.Read<int8_t>(pos + 2); // inclusive
-
-						for (int i = z; i < top_color_start; i++)
-							map->Set(x, y, i, false, 0, true);
-
-						size_t colorOffset = pos + 4;
-						for (z = top_color_start; z <= top_color_end; z++) {
-							uint32_t col = swapColor(view.Read<uint32_t>(colorOffset));
-							map->Set(x, y, z, true, col, true);
-							colorOffset += 4;
-						}
+					if (onProgress)
+						onProgress(x + y * DefaultHeight + 1);
+				}
+			}
 
-						if (top_color_end == DefaultDepth - 2)
-							map->Set(x, y, DefaultDepth - 1, true, map->GetColor(x, y, DefaultDepth - 2), true);
+			return std::move(map).Unmanage();
+		}
 
-						int len_bottom = top_color_end - top_color_start + 1;
+		void GameMap::BeginProgressiveLoad() { numLoadedRows.store(0, std::memory_order_relaxed); }
 
-						// check for end of data marker
-						if (number_4byte_chunks == 0) {
-							// infer ACTUAL number of 4-byte chunks from the length of the color data
-							pos += 4 * (len_bottom + 1);
-							break;
+		void GameMap::LoadProgressively(spades::IStream* stream,
+		                                std::function<void(int)> onProgress) {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(GetNumLoadedRows() == 0);
+
+			RandomAccessAdaptor view{*stream};
+
+			size_t pos = 0;
+
+			if (onProgress)
+				onProgress(0);
+
+			uint32_t colors[DefaultDepth];
+
+			for (int y = 0; y < DefaultHeight; y++) {
+				for (int x = 0; x < DefaultWidth; x++) {
+					uint64_t solid, colorMask;
+					DecodeColumn(view, pos, solid, colorMask, colors, x, y, groundCols);
+					SetColumn(x, y, solid, colorMask, colors);
+
+					if (onProgress)
+						onProgress(x + y * DefaultHeight + 1);
+				}
+
+				numLoadedRows.store(y + 1, std::memory_order_release);
+			}
+		}
+
+		void GameMap::LoadProgressivelyParallel(spades::IStream* stream,
+		                                        std::function<void(int)> onProgress) {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(GetNumLoadedRows() == 0);
+
+			if (onProgress)
+				onProgress(0);
+
+			const int rowsPerBatch = 8;
+			const int numBatches = DefaultHeight / rowsPerBatch;
+			const int batchColumns = DefaultWidth * rowsPerBatch;
+
+			struct Batch {
+				std::vector<char> data;
+				/** The offsets of the columns in `data`. */
+				std::vector<std::size_t> columnOffsets;
+			};
+			std::vector<Batch> batches(numBatches);
+
+			// `SetColumn` and the publication of the rows are serialized by this
+			std::mutex commitMutex;
+			std::vector<bool> batchDecoded(numBatches);
+			int numPublishedBatches = 0;
+			std::exception_ptr exceptionThrown;
+
+			auto decodeBatch = [&](int batchIndex) {
+				Batch& batch = batches[batchIndex];
+				std::vector<uint64_t> solids(batchColumns);
+				std::vector<uint64_t> colorMasks(batchColumns);
+				std::vector<uint32_t> colors(batchColumns * DefaultDepth);
+				int firstColumn = batchIndex * batchColumns;
+
+				try {
+					MemoryView view{batch.data.data(), batch.data.size()};
+					for (int i = 0; i < batchColumns; i++) {
+						int index = firstColumn + i;
+						std::size_t columnPos = batch.columnOffsets[i];
+						DecodeColumn(view, columnPos, solids[i], colorMasks[i],
+						             colors.data() + i * DefaultDepth, index % DefaultWidth,
+						             index / DefaultWidth, groundCols);
+					}
+					std::vector<char>().swap(batch.data);
+
+					std::lock_guard<std::mutex> lock{commitMutex};
+					for (int i = 0; i < batchColumns; i++) {
+						int index = firstColumn + i;
+						SetColumn(index % DefaultWidth, index / DefaultWidth, solids[i],
+						          colorMasks[i], colors.data() + i * DefaultDepth);
+					}
+
+					batchDecoded[batchIndex] = true;
+					int oldNumPublishedBatches = numPublishedBatches;
+					while (numPublishedBatches < numBatches && batchDecoded[numPublishedBatches])
+						numPublishedBatches++;
+					if (numPublishedBatches != oldNumPublishedBatches) {
+						int numRows = numPublishedBatches * rowsPerBatch;
+						numLoadedRows.store(numRows, std::memory_order_release);
+						if (onProgress)
+							onProgress(numRows * DefaultWidth);
+					}
+				} catch (...) {
+					std::lock_guard<std::mutex> lock{commitMutex};
+					if (!exceptionThrown)
+						exceptionThrown = std::current_exception();
+				}
+			};
+
+			std::vector<std::unique_ptr<ConcurrentDispatch>> dispatches;
+			auto joinAll = [&]() {
+				for (const auto& dispatch : dispatches)
+					dispatch->Join();
+			};
+
+			try {
+				// `data` starts with the batch being located
+				std::vector<char> data;
+				std::vector<std::size_t> columnOffsets{0};
+				std::size_t pos = 0;
+				bool eof = false;
+
+				while ((int)dispatches.size() < numBatches) {
+					if (SkipColumn(data.data(), data.size(), pos)) {
+						if ((int)columnOffsets.size() < batchColumns) {
+							columnOffsets.push_back(pos);
+							continue;
 						}
 
-						// infer the number of bottom colors in next span from chunk length
-						int len_top = (number_4byte_chunks - 1) - len_bottom;
+						int batchIndex = (int)dispatches.size();
+						Batch& batch = batches[batchIndex];
+						batch.data.assign(data.begin(), data.begin() + pos);
+						batch.columnOffsets.swap(columnOffsets);
+						data.erase(data.begin(), data.begin() + pos);
+						columnOffsets.assign(1, 0);
+						pos = 0;
+
+						auto run = [&decodeBatch, batchIndex]() { decodeBatch(batchIndex); };
+						dispatches.emplace_back(new FunctionDispatch<decltype(run)>(run));
+						dispatches.back()->Start();
+						continue;
+					}
+
+					if (eof)
+						SPRaise("Unexpected EOF");
+
+					std::size_t oldSize = data.size();
+					data.resize(oldSize + 65536);
+					std::size_t numBytesRead = stream->Read(data.data() + oldSize, 65536);
+					data.resize(oldSize + numBytesRead);
+					eof = numBytesRead == 0;
+				}
+			} catch (...) {
+				joinAll();
+				throw;
+			}
+
+			joinAll();
+
+			if (exceptionThrown)
+				std::rethrow_exception(exceptionThrown);
+		}
+
+		GameMap* GameMap::LoadParallel(spades::IStream* stream,
+		                               std::function<void(int)> onProgress) {
+			SPADES_MARK_FUNCTION();
+
+			const int numColumns = DefaultWidth * DefaultHeight;
 
-						// now skip the v pointer past the data to the beginning of the next span
-						pos += (int)view.Read<int8_t>(pos) * 4;
+			if (onProgress)
+				onProgress(0);
+
+			// Read the whole stream, locating the columns as they arrive
+			std::vector<char> data;
+			std::vector<std::size_t> columnOffsets(numColumns + 1);
+			int numColumnsFound = 0;
+			std::size_t pos = 0;
+			bool eof = false;
+
+			data.reserve(4 * 1024 * 1024);
+
+			while (numColumnsFound < numColumns) {
+				if (SkipColumn(data.data(), data.size(), pos)) {
+					columnOffsets[++numColumnsFound] = pos;
 
-						int bottom_color_end = view.Read<int8_t>(pos + 3); // aka air start
-						int bottom_color_start = bottom_color_end - len_top;
+					// The final value is reported after the columns are decoded
+					if (onProgress && numColumnsFound < numColumns)
+						onProgress(numColumnsFound);
+					continue;
+				}
+
+				if (eof)
+					SPRaise("Unexpected EOF");
+
+				std::size_t oldSize = data.size();
+				data.resize(oldSize + 65536);
+				std::size_t numBytesRead = stream->Read(data.data() + oldSize, 65536);
+				data.resize(oldSize + numBytesRead);
+				eof = numBytesRead == 0;
+			}
+
+			auto map = Handle<GameMap>::New();
+
+			// Decode rows in batches. The dispatches and the current thread take batches until
+			// none is left, so the decoding completes even if the dispatch threads are busy.
+			const int rowsPerBatch = 8;
+			const int numBatches = DefaultHeight / rowsPerBatch;
+			std::atomic<int> nextBatch{0};
+			std::mutex allocationMutex;
+			std::mutex exceptionMutex;
+			std::exception_ptr exceptionThrown;
+
+			auto decodeBatches = [&]() {
+				const int batchColumns = DefaultWidth * rowsPerBatch;
+				std::vector<uint64_t> solids(batchColumns);
+				std::vector<uint64_t> colorMasks(batchColumns);
+				std::vector<uint32_t> colors(batchColumns * DefaultDepth);
+
+				try {
+					MemoryView view{data.data(), data.size()};
+
+					for (;;) {
+						int batch = nextBatch.fetch_add(1);
+						if (batch >= numBatches)
+							break;
 
-						for (z = bottom_color_start; z < bottom_color_end; z++) {
-							uint32_t col = swapColor(view.Read<uint32_t>(colorOffset));
-							map->Set(x, y, z, true, col, true);
-							colorOffset += 4;
+						int firstColumn = batch * batchColumns;
+						for (int i = 0; i < batchColumns; i++) {
+							int index = firstColumn + i;
+							std::size_t columnPos = columnOffsets[index];
+							DecodeColumn(view, columnPos, solids[i], colorMasks[i],
+							             colors.data() + i * DefaultDepth, index % DefaultWidth,
+							             index / DefaultWidth, map->groundCols);
 						}
 
-						if (bottom_color_end == DefaultDepth - 1)
-							map->Set(x, y, DefaultDepth - 1, true, map->GetColor(x, y, DefaultDepth - 2), true);
+						// Only the slot allocation needs to be serialized
+						{
+							std::lock_guard<std::mutex> lock{allocationMutex};
+							for (int i = 0; i < batchColumns; i++) {
+								int index = firstColumn + i;
+								ColorColumn& column =
+								  map->colorColumns[index % DefaultWidth][index / DefaultWidth];
+								column.capacity = (uint32_t)PopCount64(colorMasks[i]);
+								if (column.capacity > 0)
+									column.offset = map->AllocateColorSlot(column.capacity);
+							}
+						}
+
+						for (int i = 0; i < batchColumns; i++) {
+							int index = firstColumn + i;
+							int x = index % DefaultWidth, y = index / DefaultWidth;
+							ColorColumn& column = map->colorColumns[x][y];
+							const uint32_t* columnColors = colors.data() + i * DefaultDepth;
+							std::copy(columnColors, columnColors + PopCount64(colorMasks[i]),
+							          map->GetColorSlot(column.offset));
+							column.mask = colorMasks[i];
+							map->solidMap[x][y] = solids[i];
+						}
 					}
+				} catch (...) {
+					std::lock_guard<std::mutex> lock{exceptionMutex};
+					if (!exceptionThrown)
+						exceptionThrown = std::current_exception();
 
-					if (onProgress)
-						onProgress(x + y * DefaultHeight + 1);
+					// Make the others stop early
+					nextBatch.store(numBatches);
 				}
+			};
+
+			int numDispatches = std::min<int>(std::thread::hardware_concurrency(), numBatches) - 1;
+			std::vector<std::unique_ptr<ConcurrentDispatch>> dispatches;
+			for (int i = 0; i < numDispatches; i++) {
+				dispatches.emplace_back(
+				  new FunctionDispatch<decltype(decodeBatches)>(decodeBatches));
+				dispatches.back()->Start();
 			}
 
+			decodeBatches();
+
+			for (const auto& dispatch : dispatches)
+				dispatch->Join();
+
+			if (exceptionThrown)
+				std::rethrow_exception(exceptionThrown);
+
+			if (onProgress)
+				onProgress(numColumns);
+
 			return std::move(map).Unmanage();
 		}
+		Handle<GameMapSnapshot> GameMap::CreateSnapshot() {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(GetNumLoadedRows() == Height());
+
+			if (lastSnapshot && lastSnapshot->version == version)
+				return lastSnapshot;
+
+			auto snapshot = Handle<GameMapSnapshot>::New();
+			snapshot->version = version;
+			std::copy(std::begin(groundCols), std::end(groundCols), snapshot->groundCols);
+
+			const int chunkSize = SnapshotChunkSize;
+			for (int cx = 0; cx < GameMapSnapshot::NumChunksX; cx++)
+				for (int cy = 0; cy < GameMapSnapshot::NumChunksY; cy++) {
+					if (!dirtySnapshotChunks[cx][cy]) {
+						snapshot->chunks[cx][cy] = lastSnapshot->chunks[cx][cy];
+						continue;
+					}
+
+					auto chunk = std::make_shared<GameMapSnapshot::Chunk>();
+					uint32_t numColors = 0;
+					for (int x = 0; x < chunkSize; x++)
+						for (int y = 0; y < chunkSize; y++) {
+							const ColorColumn& column =
+							  colorColumns[cx * chunkSize + x][cy * chunkSize + y];
+							chunk->colorOffset[x][y] = numColors;
+							numColors += (uint32_t)PopCount64(column.mask);
+						}
+
+					chunk->colors.resize(numColors);
+					for (int x = 0; x < chunkSize; x++)
+						for (int y = 0; y < chunkSize; y++) {
+							int mx = cx * chunkSize + x, my = cy * chunkSize + y;
+							const ColorColumn& column = colorColumns[mx][my];
+							chunk->solidMap[x][y] = solidMap[mx][my];
+							chunk->colorMask[x][y] = column.mask;
+							if (column.mask) {
+								const uint32_t* colors = GetColorSlot(column.offset);
+								std::copy(colors, colors + PopCount64(column.mask),
+								          chunk->colors.begin() + chunk->colorOffset[x][y]);
+							}
+						}
+
+					snapshot->chunks[cx][cy] = std::move(chunk);
+					dirtySnapshotChunks[cx][cy] = false;
+				}
+
+			lastSnapshot = snapshot;
+			return snapshot;
+		}
+
+		GameMapSnapshot::GameMapSnapshot() { SPADES_MARK_FUNCTION(); }
+		GameMapSnapshot::~GameMapSnapshot() { SPADES_MARK_FUNCTION(); }
+
+		uint32_t GameMapSnapshot::GetDefaultColor(int x, int y, int z) const {
+			return ComputeDefaultColor(groundCols, x, y, z);
+		}
+
+		bool GameMapSnapshot::CastRay(spades::Vector3 v0, spades::Vector3 v1, float length,
+		                              spades::IntVector3& vOut) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+			return CastRayImpl(*this, v0, v1, length, vOut);
+		}
+
+		void GameMapSnapshot::CastRayPacket(const GameMap::RayPacket& packet,
+		                                    GameMap::RayPacketResult& result) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+			CastRayPacketImpl(*this, packet, result);
+		}
 	} // namespace client
 } // namespace spades
\ No newline at end of file
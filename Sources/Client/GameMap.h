@@ -21,10 +21,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include <Core/Debug.h>
 #include <Core/Math.h>
@@ -35,6 +38,8 @@
 namespace spades {
 	class IStream;
 	namespace client {
+		class GameMapSnapshot;
+
 		class GameMap : public RefCountedObject {
 		protected:
 			~GameMap();
@@ -46,6 +51,8 @@ namespace spades {
 				DefaultHeight = 512,
 				DefaultDepth = 64 // should be <= 64
 			};
+			/** The size of the chunks `GameMapSnapshot` copies on write. */
+			enum { SnapshotChunkBits = 4, SnapshotChunkSize = 1 << SnapshotChunkBits };
 			GameMap();
 
 			/**
@@ -58,8 +65,69 @@ namespace spades {
 			 */
 			static GameMap* Load(IStream*, std::function<void(int)> onProgress = {});
 
+			/**
+			 * Construct a `GameMap` from VOXLAP5 terrain data supplied by the specified stream,
+			 * decoding the columns on the dispatch thread pool.
+			 *
+			 * The stream is read to the end before the decoding starts. `onProgress` is called
+			 * as columns arrive from the stream, but the final value
+			 * (`DefaultWidth * DefaultHeight`) is only reported after the decoding is complete.
+			 */
+			static GameMap* LoadParallel(IStream*, std::function<void(int)> onProgress = {});
+
+			/**
+			 * Marks all rows (sets of columns with the same Y coordinate) as not loaded in
+			 * preparation for `LoadProgressively`. Must be called before the `GameMap` is shared
+			 * with other threads.
+			 */
+			void BeginProgressiveLoad();
+
+			/**
+			 * Fills this `GameMap` with VOXLAP5 terrain data supplied by the specified stream.
+			 * Each row is published through `GetNumLoadedRows` as soon as it's decoded, so other
+			 * threads can start reading it while the remaining part is still being decoded.
+			 *
+			 * `BeginProgressiveLoad` must be called first. Listeners are not notified.
+			 */
+			void LoadProgressively(IStream*, std::function<void(int)> onProgress = {});
+
+			/**
+			 * Same as `LoadProgressively`, but decodes the rows on the dispatch thread pool.
+			 * Rows are located in the stream as they arrive, and each batch of rows is decoded
+			 * as soon as all of its columns are available. The batches are published in order.
+			 */
+			void LoadProgressivelyParallel(IStream*, std::function<void(int)> onProgress = {});
+
+			/**
+			 * Returns the number of rows that can be accessed. This is less than `Height()` only
+			 * while the map is being loaded by `LoadProgressively`, in which case the rows at
+			 * and after the returned value must not be accessed.
+			 */
+			int GetNumLoadedRows() const { return numLoadedRows.load(std::memory_order_acquire); }
+
+			/**
+			 * Checks if all rows in `[minY, maxY]` can be accessed. A range extending past the
+			 * map boundary wraps around, so it's only considered loaded when the whole map is.
+			 */
+			bool AreRowsLoaded(int minY, int maxY) const {
+				int n = GetNumLoadedRows();
+				if (n == Height())
+					return true;
+				return minY >= 0 && maxY < n;
+			}
+
 			void Save(IStream*);
 
+			/**
+			 * Writes the decoded voxels in a flat layout (the solid bitmaps, the color masks,
+			 * and then the colors), which `LoadDecoded` can read back without decoding VXL spans.
+			 * The data is in the native byte order and is meant for local caching only.
+			 */
+			void SaveDecoded(IStream*) const;
+
+			/** Constructs a `GameMap` from data written by `SaveDecoded`. */
+			static GameMap* LoadDecoded(IStream*);
+
 			int Width() const { return DefaultWidth; }
 			int Height() const { return DefaultHeight; }
 			int Depth() const { return DefaultDepth; }
@@ -108,14 +176,41 @@ namespace spades {
 				return false;
 			}
 
+			/**
+			 * Computes `IsSurface` for all voxels in a column at once.
+			 * @return A bitmask where the bit `z` indicates `IsSurface(x, y, z)`.
+			 */
+			inline uint64_t GetSurfaceMap(int x, int y) const {
+				SPAssert(IsValidMapCoord(x, y, 0));
+				static_assert(DefaultDepth == 64, "A column must fit in a 64-bit word");
+
+				// A solid voxel is on the surface unless all of its neighbours are solid.
+				// Neighbours outside the map are considered solid.
+				uint64_t solid = solidMap[x][y];
+				uint64_t covered = ((solid << 1) | 1ULL) & ((solid >> 1) | (1ULL << 63));
+				if (x > 0)
+					covered &= solidMap[x - 1][y];
+				if (x < Width() - 1)
+					covered &= solidMap[x + 1][y];
+				if (y > 0)
+					covered &= solidMap[x][y - 1];
+				if (y < Height() - 1)
+					covered &= solidMap[x][y + 1];
+				return solid & ~covered;
+			}
+
 			/** @return 0xHHBBGGRR where HH is health (up to 100) */
 			inline uint32_t GetColor(int x, int y, int z) const {
 				SPAssert(IsValidMapCoord(x, y, z));
-				return colorMap[x][y][z];
+				const ColorColumn& column = colorColumns[x][y];
+				uint64_t bit = 1ULL << z;
+				if (!(column.mask & bit))
+					return GetDefaultColor(x, y, z);
+				return GetColorSlot(column.offset)[PopCount64(column.mask & (bit - 1))];
 			}
 
 			inline uint32_t GetColorWrapped(int x, int y, int z) const {
-				return colorMap[x & (Width() - 1)][y & (Height() - 1)][z & (Depth() - 1)];
+				return GetColor(x & (Width() - 1), y & (Height() - 1), z & (Depth() - 1));
 			}
 
 			inline void Set(int x, int y, int z, bool solid, uint32_t color, bool unsafe = false) {
@@ -133,18 +228,81 @@ namespace spades {
 					solidMap[x][y] = value;
 				}
 
-				if (solid && color != colorMap[x][y][z]) {
-					changed = true;
-					colorMap[x][y][z] = color;
+				if (solid) {
+					if (color != GetColor(x, y, z)) {
+						changed = true;
+						StoreColor(x, y, z, color);
+					}
+				} else if (colorColumns[x][y].mask & mask) {
+					// Air doesn't need a color
+					EraseColor(x, y, z);
 				}
 
+				if (changed)
+					MarkModified(x, y);
+
 				if (!unsafe && changed) {
+					if (changeDepth > 0) {
+						AddPendingChange(x, y, z);
+						return;
+					}
+
 					std::lock_guard<std::mutex> guard{listenersMutex};
 					for (auto* l : listeners)
 						l->GameMapChanged(x, y, z, this);
 				}
 			}
 
+			/**
+			 * Starts a change transaction. Until the matching `CommitChanges` call, `Set` records
+			 * the modified voxels instead of notifying the listeners each time. Transactions
+			 * can be nested, in which case the outermost one delivers the notification.
+			 *
+			 * Must be called from the thread calling `Set`.
+			 */
+			void BeginChanges() { changeDepth++; }
+
+			/**
+			 * Ends a change transaction started by `BeginChanges`. If this ends the outermost
+			 * transaction and any voxel was modified, every listener receives a single
+			 * `IGameMapListener::GameMapChangesCommitted` call.
+			 */
+			void CommitChanges();
+
+			/** Calls `BeginChanges` and `CommitChanges` on construction and destruction. */
+			class ChangeTransaction {
+				GameMap& map;
+
+			public:
+				ChangeTransaction(GameMap& map) : map(map) { map.BeginChanges(); }
+				~ChangeTransaction() { map.CommitChanges(); }
+
+				ChangeTransaction(const ChangeTransaction&) = delete;
+				void operator=(const ChangeTransaction&) = delete;
+			};
+
+			/**
+			 * Returns a counter incremented every time a voxel is modified. Can be compared
+			 * with `GameMapSnapshot::GetVersion` to find out if a snapshot is up-to-date.
+			 */
+			uint64_t GetVersion() const { return version; }
+
+			/**
+			 * Creates an immutable copy of the current map contents, which can be read from
+			 * any thread without synchronization. Only the chunks modified since the previous
+			 * call are copied; the others are shared with the previous snapshot.
+			 *
+			 * Must be called from the thread calling `Set`, and not while the map is being
+			 * loaded by `LoadProgressively`.
+			 */
+			Handle<GameMapSnapshot> CreateSnapshot();
+
+			/**
+			 * Returns the number of bytes used to store voxel colors, including
+			 * the free space in the color pool.
+			 */
+			std::size_t GetColorStorageSize() const;
+
 			void AddListener(IGameMapListener*);
 			void RemoveListener(IGameMapListener*);
 
@@ -164,8 +322,78 @@ namespace spades {
 				IntVector3 hitBlock;
 				IntVector3 normal;
 			};
+
 			RayCastResult CastRay2(Vector3 v0, Vector3 dir, int maxSteps) const;
 
+			/**
+			 * A group of rays cast together by `CastRayPacket` or `CastRay2Packet`, stored in
+			 * the structure-of-arrays layout.
+			 */
+			struct RayPacket {
+				enum { MaxRays = 8 };
+				int numRays = 0;
+				float originX[MaxRays], originY[MaxRays], originZ[MaxRays];
+				float dirX[MaxRays], dirY[MaxRays], dirZ[MaxRays];
+				/** The maximum distance of each ray. Only used by `CastRayPacket`. */
+				float length[MaxRays];
+
+				bool IsFull() const { return numRays == MaxRays; }
+
+				/** Adds a ray and returns its index in the packet. */
+				int Add(Vector3 origin, Vector3 dir, float length = 0.0F) {
+					SPAssert(!IsFull());
+					int i = numRays++;
+					originX[i] = origin.x;
+					originY[i] = origin.y;
+					originZ[i] = origin.z;
+					dirX[i] = dir.x;
+					dirY[i] = dir.y;
+					dirZ[i] = dir.z;
+					this->length[i] = length;
+					return i;
+				}
+			};
+
+			/** The results of a `RayPacket`, indexed in the same way as the rays. */
+			struct RayPacketResult {
+				bool hit[RayPacket::MaxRays];
+				bool startSolid[RayPacket::MaxRays];
+				float hitPosX[RayPacket::MaxRays], hitPosY[RayPacket::MaxRays],
+				  hitPosZ[RayPacket::MaxRays];
+				int hitBlockX[RayPacket::MaxRays], hitBlockY[RayPacket::MaxRays],
+				  hitBlockZ[RayPacket::MaxRays];
+				int normalX[RayPacket::MaxRays], normalY[RayPacket::MaxRays],
+				  normalZ[RayPacket::MaxRays];
+
+				IntVector3 GetHitBlock(int i) const {
+					return MakeIntVector3(hitBlockX[i], hitBlockY[i], hitBlockZ[i]);
+				}
+
+				RayCastResult Get(int i) const {
+					RayCastResult result;
+					result.hit = hit[i];
+					result.startSolid = startSolid[i];
+					result.hitPos = MakeVector3(hitPosX[i], hitPosY[i], hitPosZ[i]);
+					result.hitBlock = GetHitBlock(i);
+					result.normal = MakeIntVector3(normalX[i], normalY[i], normalZ[i]);
+					return result;
+				}
+			};
+
+			/**
+			 * Casts all rays of `packet` in the same way as `CastRay`, stepping them together
+			 * with SIMD instructions. `dir` must be normalized. Only `hit` and `hitBlock` of
+			 * `result` are filled.
+			 */
+			void CastRayPacket(const RayPacket& packet, RayPacketResult& result) const;
+
+			/**
+			 * Casts all rays of `packet` in the same way as `CastRay2`, stepping them together
+			 * with SIMD instructions. The results are bit-identical to `CastRay2`.
+			 */
+			void CastRay2Packet(const RayPacket& packet, int maxSteps,
+			                    RayPacketResult& result) const;
+
 			// adapted from VOXLAP5.C by Ken Silverman <http://advsys.net/ken/>
 			uint32_t gkrand = 0;
 			inline uint32_t GetColorJit(uint32_t col, uint32_t amount = 0x70707) {
@@ -194,10 +422,98 @@ namespace spades {
 			}
 
 		private:
+			/**
+			 * Colors are only stored for voxels that were given one explicitly (i.e., the surface
+			 * voxels of a loaded map and the blocks placed afterwards). Each column owns a slot in
+			 * the color pool, which holds the colors of the voxels in `mask` in the increasing
+			 * order of Z. Other solid voxels get a procedurally generated dirt color.
+			 */
+			struct ColorColumn {
+				uint64_t mask;
+				/** The location of the slot in the color pool. */
+				uint32_t offset;
+				/** The number of colors the slot can hold. */
+				uint32_t capacity;
+			};
+
+			enum {
+				ColorPageBits = 16,
+				ColorPageSize = 1 << ColorPageBits,
+				/**
+				 * Pages are never reallocated, so the page table has a fixed size. This allows
+				 * four times as many colors as there are voxels in the map.
+				 */
+				MaxColorPages =
+				  (DefaultWidth * DefaultHeight * DefaultDepth * 4) >> ColorPageBits
+			};
+
 			uint64_t solidMap[DefaultWidth][DefaultHeight];
-			uint32_t colorMap[DefaultWidth][DefaultHeight][DefaultDepth];
+			ColorColumn colorColumns[DefaultWidth][DefaultHeight];
+
+			/**
+			 * Each page has `DefaultDepth` spare elements at the end so a reader racing with
+			 * `Set` never reads past the page, even if it sees a mask and an offset that don't
+			 * belong together.
+			 */
+			std::unique_ptr<uint32_t[]> colorPages[MaxColorPages];
+			std::size_t numColorPages = 0;
+			/** The first unused offset in the last page. */
+			uint32_t colorPoolTail = 0;
+			/** Released slots, indexed by capacity. */
+			std::vector<uint32_t> freeColorSlots[DefaultDepth + 1];
+
+			std::atomic<int> numLoadedRows{DefaultHeight};
+
 			std::list<IGameMapListener*> listeners;
 			std::mutex listenersMutex;
+
+			/** Incremented by every modification. See `GetVersion`. */
+			uint64_t version = 0;
+			/** Set for the snapshot chunks modified since `lastSnapshot` was created. */
+			bool dirtySnapshotChunks[DefaultWidth >> SnapshotChunkBits]
+			                        [DefaultHeight >> SnapshotChunkBits];
+			/** The last value returned by `CreateSnapshot`. Clean chunks are taken from here. */
+			Handle<GameMapSnapshot> lastSnapshot;
+
+			void MarkModified(int x, int y) {
+				dirtySnapshotChunks[x >> SnapshotChunkBits][y >> SnapshotChunkBits] = true;
+				version++;
+			}
+
+			/** The nesting level of change transactions. */
+			int changeDepth = 0;
+			GameMapChanges pendingChanges;
+
+			inline const uint32_t* GetColorSlot(uint32_t offset) const {
+				return colorPages[offset >> ColorPageBits].get() + (offset & (ColorPageSize - 1));
+			}
+			inline uint32_t* GetColorSlot(uint32_t offset) {
+				return colorPages[offset >> ColorPageBits].get() + (offset & (ColorPageSize - 1));
+			}
+
+			uint32_t GetDefaultColor(int x, int y, int z) const;
+
+			friend class GameMapSnapshot;
+
+			uint32_t AllocateColorSlot(uint32_t& capacity);
+			void ReleaseColorSlot(uint32_t offset, uint32_t capacity);
+			void StoreColor(int x, int y, int z, uint32_t color);
+			void EraseColor(int x, int y, int z);
+
+			/** Records a voxel modified during a change transaction in `pendingChanges`. */
+			void AddPendingChange(int x, int y, int z);
+
+			/** Appends the VOXLAP5 representation of a column to `buffer`. */
+			void EncodeColumn(std::vector<char>& buffer, int x, int y) const;
+			/** Appends the colors of `count` voxels starting at `(x, y, z)` to `buffer`. */
+			void WriteColors(std::vector<char>& buffer, int x, int y, int z, int count) const;
+
+			/**
+			 * Replaces the contents of a column.
+			 *
+			 * @param colors The colors of the voxels in `colorMask`, in the increasing order of Z.
+			 */
+			void SetColumn(int x, int y, uint64_t solid, uint64_t colorMask, const uint32_t* colors);
 		};
 	} // namespace client
 } // namespace spades
\ No newline at end of file
@@ -0,0 +1,245 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "GameMap.h"
+#include "GameMapCache.h"
+#include <Core/ConcurrentDispatch.h>
+#include <Core/Debug.h>
+#include <Core/DynamicMemoryStream.h>
+#include <Core/FileManager.h>
+#include <Core/IStream.h>
+#include <Core/Math.h>
+#include <Core/Settings.h>
+#include <Core/Stopwatch.h>
+
+DEFINE_SPADES_SETTING(cg_mapCache, "1");
+DEFINE_SPADES_SETTING(cg_mapCacheEntries, "8");
+
+namespace spades {
+	namespace client {
+		namespace {
+			const char* const indexPath = "Cache/Maps/Index.txt";
+
+			struct Entry {
+				int slot;
+				GameMapCache::Key key;
+				/** Larger for more recently used entries. */
+				std::uint64_t lastUse;
+			};
+
+			/**
+			 * The entries whose files are complete. A slot is removed from here before its file
+			 * is overwritten, so the index never refers to a partially written file.
+			 */
+			std::vector<Entry> entries;
+			std::uint64_t useCounter = 0;
+			bool indexLoaded = false;
+			/** Guards the variables above, which are also accessed by `pendingStore`. */
+			std::mutex indexMutex;
+
+			/** The last write started by `Store`. Waited for by the next `Store`. */
+			ConcurrentDispatch* pendingStore = nullptr;
+
+			std::string GetSlotPath(int slot) {
+				char buf[64];
+				snprintf(buf, sizeof(buf), "Cache/Maps/%d.bin", slot);
+				return buf;
+			}
+
+			void LoadIndex() {
+				if (indexLoaded)
+					return;
+				indexLoaded = true;
+
+				if (!FileManager::FileExists(indexPath))
+					return;
+
+				try {
+					for (const std::string& line :
+					     SplitIntoLines(FileManager::ReadAllBytes(indexPath))) {
+						Entry entry;
+						unsigned int checksum, size;
+						unsigned long long lastUse;
+						if (sscanf(line.c_str(), "%d %x %u %llu", &entry.slot, &checksum, &size,
+						           &lastUse) != 4 ||
+						    entry.slot < 0)
+							continue;
+						entry.key = {checksum, size};
+						entry.lastUse = lastUse;
+						entries.push_back(entry);
+						useCounter = std::max<std::uint64_t>(useCounter, lastUse);
+					}
+				} catch (const std::exception& ex) {
+					SPLog("Failed to read the map cache index: %s", ex.what());
+					entries.clear();
+				}
+			}
+
+			void SaveIndex() {
+				try {
+					std::string text;
+					for (const Entry& entry : entries) {
+						char buf[128];
+						snprintf(buf, sizeof(buf), "%d %08x %u %llu\n", entry.slot,
+						         (unsigned int)entry.key.checksum, (unsigned int)entry.key.size,
+						         (unsigned long long)entry.lastUse);
+						text += buf;
+					}
+					auto stream = FileManager::OpenForWriting(indexPath);
+					stream->Write(text);
+				} catch (const std::exception& ex) {
+					SPLog("Failed to write the map cache index: %s", ex.what());
+				}
+			}
+
+			std::vector<Entry>::iterator FindEntry(const GameMapCache::Key& key) {
+				return std::find_if(entries.begin(), entries.end(), [&](const Entry& entry) {
+					return entry.key.checksum == key.checksum && entry.key.size == key.size;
+				});
+			}
+
+			/** Removes an entry to make room for a new one and returns the slot to use. */
+			int AllocateSlot() {
+				int maxEntries = std::max((int)cg_mapCacheEntries, 1);
+				if ((int)entries.size() < maxEntries) {
+					for (int slot = 0;; slot++) {
+						auto it = std::find_if(entries.begin(), entries.end(),
+						                       [&](const Entry& entry) { return entry.slot == slot; });
+						if (it == entries.end())
+							return slot;
+					}
+				}
+
+				// Evict the least recently used ones
+				std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+					return a.lastUse > b.lastUse;
+				});
+				int slot = entries[maxEntries - 1].slot;
+				entries.resize(maxEntries - 1);
+				return slot;
+			}
+		} // namespace
+
+		Handle<GameMap> GameMapCache::Load(const Key& key) {
+			SPADES_MARK_FUNCTION();
+
+			if (!cg_mapCache)
+				return {};
+
+			std::string path;
+			{
+				std::lock_guard<std::mutex> lock{indexMutex};
+				LoadIndex();
+
+				auto it = FindEntry(key);
+				if (it == entries.end())
+					return {};
+				it->lastUse = ++useCounter;
+				path = GetSlotPath(it->slot);
+				SaveIndex();
+			}
+
+			try {
+				Stopwatch sw;
+				auto stream = FileManager::OpenForReading(path.c_str());
+				Handle<GameMap> map{GameMap::LoadDecoded(stream.get()), false};
+				SPLog("Loaded the cached map '%s' in %.2f ms", path.c_str(),
+				      sw.GetTime() * 1000.0);
+				return map;
+			} catch (const std::exception& ex) {
+				SPLog("Failed to load the cached map '%s': %s", path.c_str(), ex.what());
+
+				// Forget the entry so that the next `Store` for the key overwrites it
+				std::lock_guard<std::mutex> lock{indexMutex};
+				auto it = FindEntry(key);
+				if (it != entries.end()) {
+					entries.erase(it);
+					SaveIndex();
+				}
+				return {};
+			}
+		}
+
+		void GameMapCache::Store(const Key& key, const GameMap& map) {
+			SPADES_MARK_FUNCTION();
+
+			if (!cg_mapCache)
+				return;
+
+			if (pendingStore) {
+				pendingStore->Join();
+				delete pendingStore;
+				pendingStore = nullptr;
+			}
+
+			int slot;
+			{
+				std::lock_guard<std::mutex> lock{indexMutex};
+				LoadIndex();
+
+				if (FindEntry(key) != entries.end())
+					return;
+
+				slot = AllocateSlot();
+				SaveIndex();
+			}
+
+			// Only the copy of the map is made here. Writing the file is done in background
+			// not to stall the game.
+			std::shared_ptr<DynamicMemoryStream> data = std::make_shared<DynamicMemoryStream>();
+			try {
+				map.SaveDecoded(data.get());
+			} catch (const std::exception& ex) {
+				SPLog("Failed to encode the map for the cache: %s", ex.what());
+				return;
+			}
+
+			auto write = [data, slot, key]() {
+				std::string path = GetSlotPath(slot);
+				try {
+					data->SetPosition(0);
+					auto stream = FileManager::OpenForWriting(path.c_str());
+					char buffer[65536];
+					std::size_t numBytes;
+					while ((numBytes = data->Read(buffer, sizeof(buffer))) > 0)
+						stream->Write(buffer, numBytes);
+					stream.reset();
+
+					std::lock_guard<std::mutex> lock{indexMutex};
+					entries.push_back(Entry{slot, key, ++useCounter});
+					SaveIndex();
+					SPLog("Stored the map to the cache: '%s'", path.c_str());
+				} catch (const std::exception& ex) {
+					SPLog("Failed to store the map to the cache '%s': %s", path.c_str(),
+					      ex.what());
+				}
+			};
+			pendingStore = new FunctionDispatch<decltype(write)>(write);
+			pendingStore->Start();
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,64 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <Core/RefCountedObject.h>
+
+namespace spades {
+	namespace client {
+		class GameMap;
+
+		/**
+		 * A persistent cache of decoded maps, which allows a map that was received before
+		 * to be used without downloading and decoding it again.
+		 *
+		 * The entries are written by `GameMap::SaveDecoded` and are keyed by the CRC-32
+		 * checksum and the size of the compressed VXL stream, which are what a server speaking
+		 * the protocol version 0.76 advertises in the MapStart packet. At most
+		 * `cg_mapCacheEntries` maps are kept; the least recently used one is evicted to make
+		 * room for a new one.
+		 */
+		class GameMapCache {
+			GameMapCache() {}
+
+		public:
+			struct Key {
+				std::uint32_t checksum;
+				std::uint32_t size;
+			};
+
+			/**
+			 * Returns the cached map for the specified key. Returns a null handle if the
+			 * cache is disabled, or the entry doesn't exist or is unreadable.
+			 */
+			static Handle<GameMap> Load(const Key&);
+
+			/**
+			 * Stores the map for the specified key unless it's already cached. The map is
+			 * serialized on the calling thread and written to the disk in background. Errors
+			 * are logged and otherwise ignored.
+			 */
+			static void Store(const Key&, const GameMap&);
+		};
+	} // namespace client
+} // namespace spades
@@ -27,8 +27,12 @@
 #include <Core/Exception.h>
 #include <Core/IRunnable.h>
 #include <Core/PipeStream.h>
+#include <Core/Settings.h>
 #include <Core/Thread.h>
 
+DEFINE_SPADES_SETTING(cg_parallelMapDecode, "1");
+DEFINE_SPADES_SETTING(cg_progressiveMapLoad, "1");
+
 namespace spades {
 	namespace client {
 
@@ -53,10 +57,21 @@ namespace spades {
 				try {
 					DeflateStream inflate(rawDataReader.get(), CompressModeDecompress, false);
 
-					GameMap* gameMapPtr =
-					  GameMap::Load(&inflate, [this](int x) { HandleProgress(x); });
-
-					result->gameMap = Handle<GameMap>{gameMapPtr, false};
+					auto onProgress = [this](int x) { HandleProgress(x); };
+					if (parent.partialGameMap) {
+						// Decode in place so the renderer can consume the rows decoded so far
+						if (cg_parallelMapDecode)
+							parent.partialGameMap->LoadProgressivelyParallel(&inflate, onProgress);
+						else
+							parent.partialGameMap->LoadProgressively(&inflate, onProgress);
+						result->gameMap = parent.partialGameMap;
+					} else {
+						GameMap* gameMapPtr = cg_parallelMapDecode
+						                        ? GameMap::LoadParallel(&inflate, onProgress)
+						                        : GameMap::Load(&inflate, onProgress);
+
+						result->gameMap = Handle<GameMap>{gameMapPtr, false};
+					}
 				} catch (...) {
 					// Capture the current exception
 					result->exceptionThrown = std::current_exception();
@@ -74,6 +89,11 @@ namespace spades {
 		GameMapLoader::GameMapLoader() : progressCell{0} {
 			SPADES_MARK_FUNCTION();
 
+			if (cg_progressiveMapLoad) {
+				partialGameMap = Handle<GameMap>::New();
+				partialGameMap->BeginProgressiveLoad();
+			}
+
 			auto pipe = CreatePipeStream();
 
 			rawDataWriter = std::move(std::get<0>(pipe));
@@ -85,9 +105,23 @@ namespace spades {
 			decodingThread->Start();
 		}
 
+		GameMapLoader::GameMapLoader(Handle<GameMap> cachedMap)
+		    : progressCell{512 * 512}, partialGameMap{cachedMap} {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(cachedMap);
+
+			auto result = stmp::make_unique<Result>();
+			result->gameMap = std::move(cachedMap);
+			resultCell.store(std::move(result));
+		}
+
 		GameMapLoader::~GameMapLoader() {
 			SPADES_MARK_FUNCTION();
 
+			if (!decodingThread)
+				return;
+
 			// Hang up the writer. This causes the decoder thread to exit gracefully.
 			rawDataWriter.reset();
 
@@ -98,6 +132,11 @@ namespace spades {
 		void GameMapLoader::AddRawChunk(const char* bytes, std::size_t numBytes) {
 			SPADES_MARK_FUNCTION();
 
+			rawDataSize += static_cast<std::uint32_t>(numBytes);
+
+			if (IsCached())
+				return;
+
 			if (!rawDataWriter)
 				SPRaise("The raw data channel is already closed.");
 			rawDataWriter->Write(bytes, numBytes);
@@ -106,6 +145,9 @@ namespace spades {
 		void GameMapLoader::MarkEOF() {
 			SPADES_MARK_FUNCTION();
 
+			if (IsCached())
+				return;
+
 			if (!rawDataWriter)
 				SPRaise("The raw data channel is already closed.");
 			rawDataWriter.reset();
@@ -116,7 +158,8 @@ namespace spades {
 		void GameMapLoader::WaitComplete() {
 			SPADES_MARK_FUNCTION();
 
-			decodingThread->Join();
+			if (decodingThread)
+				decodingThread->Join();
 
 			SPAssert(IsComplete());
 		}
@@ -19,6 +19,7 @@
  */
 
 #include <atomic>
+#include <cstdint>
 #include <memory>
 
 #include <Core/IStream.h>
@@ -38,6 +39,13 @@ namespace spades {
 		class GameMapLoader {
 		public:
 			GameMapLoader();
+
+			/**
+			 * Constructs a loader that is already complete with the specified map, which was
+			 * found in `GameMapCache`. Raw data passed to `AddRawChunk` is only counted.
+			 */
+			explicit GameMapLoader(Handle<GameMap> cachedMap);
+
 			~GameMapLoader();
 
 			GameMapLoader(const GameMapLoader&) = delete;
@@ -81,6 +89,20 @@ namespace spades {
 			 */
 			Handle<GameMap> TakeGameMap();
 
+			/**
+			 * Gets the `GameMap` being loaded. Its rows become accessible one by one while
+			 * decoding is in progress (see `GameMap::GetNumLoadedRows`).
+			 *
+			 * Returns a null handle if progressive loading is disabled.
+			 */
+			Handle<GameMap> GetPartialGameMap() const { return partialGameMap; }
+
+			/** Returns the number of bytes passed to `AddRawChunk` so far. */
+			std::uint32_t GetRawDataSize() const { return rawDataSize; }
+
+			/** Returns `true` if this loader was constructed with a cached map. */
+			bool IsCached() const { return !decodingThread; }
+
 		private:
 			struct Decoder;
 			struct Result;
@@ -99,6 +121,11 @@ namespace spades {
 
 			/** The cell for receiving the decode result. */
 			stmp::atomic_unique_ptr<Result> resultCell;
+
+			/** The map being filled by the decoding thread if progressive loading is enabled. */
+			Handle<GameMap> partialGameMap;
+
+			std::uint32_t rawDataSize = 0;
 		};
 
 	} // namespace client
@@ -0,0 +1,136 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "GameMap.h"
+#include <Core/Debug.h>
+#include <Core/Math.h>
+#include <Core/RefCountedObject.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * An immutable copy of the voxels of a `GameMap`, created by
+		 * `GameMap::CreateSnapshot`. Unlike `GameMap`, a snapshot can be read from any thread
+		 * while the main thread keeps modifying the map.
+		 *
+		 * The columns are stored in chunks of `GameMap::SnapshotChunkSize`² columns. A chunk
+		 * that wasn't modified between two snapshots is shared by them.
+		 *
+		 * The out-of-line members are defined in `GameMap.cpp` so the ray casting code can be
+		 * shared with `GameMap`.
+		 */
+		class GameMapSnapshot : public RefCountedObject {
+			friend class GameMap;
+
+		public:
+			enum {
+				ChunkBits = GameMap::SnapshotChunkBits,
+				ChunkSize = GameMap::SnapshotChunkSize,
+				NumChunksX = GameMap::DefaultWidth >> ChunkBits,
+				NumChunksY = GameMap::DefaultHeight >> ChunkBits
+			};
+
+			struct Chunk {
+				uint64_t solidMap[ChunkSize][ChunkSize];
+				/** The voxels having their colors stored in `colors`. */
+				uint64_t colorMask[ChunkSize][ChunkSize];
+				/** The index of the first color of each column in `colors`. */
+				uint32_t colorOffset[ChunkSize][ChunkSize];
+				std::vector<uint32_t> colors;
+			};
+
+			GameMapSnapshot();
+
+			int Width() const { return GameMap::DefaultWidth; }
+			int Height() const { return GameMap::DefaultHeight; }
+			int Depth() const { return GameMap::DefaultDepth; }
+
+			/** Returns the value of `GameMap::GetVersion` when this snapshot was created. */
+			uint64_t GetVersion() const { return version; }
+
+			inline uint64_t GetSolidMap(int x, int y) const {
+				return GetChunk(x, y).solidMap[x & (ChunkSize - 1)][y & (ChunkSize - 1)];
+			}
+			inline uint64_t GetSolidMapWrapped(int x, int y) const {
+				return GetSolidMap(x & (Width() - 1), y & (Height() - 1));
+			}
+
+			inline bool IsSolid(int x, int y, int z) const {
+				SPAssert(x >= 0 && y >= 0 && z >= 0 && x < Width() && y < Height() &&
+				         z < Depth());
+				return ((GetSolidMap(x, y) >> (uint64_t)z) & 1ULL) != 0;
+			}
+
+			/** Same as `GameMap::IsSolidWrapped`. */
+			inline bool IsSolidWrapped(int x, int y, int z) const {
+				if (z < 0)
+					return false;
+				if (z >= Depth())
+					return true;
+				return ((GetSolidMapWrapped(x, y) >> (uint64_t)z) & 1ULL) != 0;
+			}
+
+			/** @return 0xHHBBGGRR where HH is health (up to 100) */
+			inline uint32_t GetColor(int x, int y, int z) const {
+				SPAssert(x >= 0 && y >= 0 && z >= 0 && x < Width() && y < Height() &&
+				         z < Depth());
+				const Chunk& chunk = GetChunk(x, y);
+				int cx = x & (ChunkSize - 1), cy = y & (ChunkSize - 1);
+				uint64_t mask = chunk.colorMask[cx][cy];
+				uint64_t bit = 1ULL << z;
+				if (!(mask & bit))
+					return GetDefaultColor(x, y, z);
+				return chunk.colors[chunk.colorOffset[cx][cy] + PopCount64(mask & (bit - 1))];
+			}
+
+			inline uint32_t GetColorWrapped(int x, int y, int z) const {
+				return GetColor(x & (Width() - 1), y & (Height() - 1), z & (Depth() - 1));
+			}
+
+			/** Same as `GameMap::CastRay`. */
+			bool CastRay(Vector3 v0, Vector3 v1, float length, IntVector3& vOut) const;
+
+			/** Same as `GameMap::CastRayPacket`. */
+			void CastRayPacket(const GameMap::RayPacket& packet,
+			                   GameMap::RayPacketResult& result) const;
+
+		protected:
+			~GameMapSnapshot();
+
+		private:
+			std::shared_ptr<const Chunk> chunks[NumChunksX][NumChunksY];
+			uint64_t version = 0;
+			/** A copy of `GameMap::groundCols`. */
+			int groundCols[9];
+
+			inline const Chunk& GetChunk(int x, int y) const {
+				return *chunks[x >> ChunkBits][y >> ChunkBits];
+			}
+
+			uint32_t GetDefaultColor(int x, int y, int z) const;
+		};
+	} // namespace client
+} // namespace spades
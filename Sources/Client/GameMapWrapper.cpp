@@ -18,28 +18,64 @@
 
  */
 
-#include <cstring>
-#include <deque>
-#include <queue>
-#include <set>
+#include <algorithm>
 #include <vector>
 
 #include "GameMap.h"
 #include "GameMapWrapper.h"
 #include <Core/Debug.h>
+#include <Core/Math.h>
 #include <Core/Stopwatch.h>
 
 namespace spades {
 	namespace client {
+		namespace {
+			/**
+			 * Extends `seed` (which must be a subset of `solid`) to the runs of consecutive set
+			 * bits of `solid` it overlaps with. (Kogge-Stone occluded fill)
+			 */
+			inline uint64_t FillRuns(uint64_t seed, uint64_t solid) {
+				uint64_t up = seed, down = seed;
+				uint64_t upPass = solid, downPass = solid;
+
+				up |= upPass & (up << 1);
+				upPass &= upPass << 1;
+				up |= upPass & (up << 2);
+				upPass &= upPass << 2;
+				up |= upPass & (up << 4);
+				upPass &= upPass << 4;
+				up |= upPass & (up << 8);
+				upPass &= upPass << 8;
+				up |= upPass & (up << 16);
+				upPass &= upPass << 16;
+				up |= upPass & (up << 32);
+
+				down |= downPass & (down >> 1);
+				downPass &= downPass >> 1;
+				down |= downPass & (down >> 2);
+				downPass &= downPass >> 2;
+				down |= downPass & (down >> 4);
+				downPass &= downPass >> 4;
+				down |= downPass & (down >> 8);
+				downPass &= downPass >> 8;
+				down |= downPass & (down >> 16);
+				downPass &= downPass >> 16;
+				down |= downPass & (down >> 32);
+
+				return up | down;
+			}
+		} // namespace
+
 		GameMapWrapper::GameMapWrapper(GameMap& mp) : map(mp) {
 			SPADES_MARK_FUNCTION();
 
 			width = mp.Width();
 			height = mp.Height();
 			depth = mp.Depth();
-			// TODO: `stmp::make_unique` doesn't support array initialization yet
-			linkMap.reset(new uint8_t[width * height * depth]);
-			memset(linkMap.get(), 0, width * height * depth);
+			SPAssert(depth <= 64);
+
+			settledMap.resize(width * height, 0);
+			floodMap.resize(width * height, 0);
 		}
 
 		GameMapWrapper::~GameMapWrapper() { SPADES_MARK_FUNCTION(); }
@@ -47,311 +83,140 @@ namespace spades {
 		void GameMapWrapper::Rebuild() {
 			SPADES_MARK_FUNCTION();
 
-			Stopwatch stopwatch;
+			// The connectivity isn't cached between calls, so there's nothing to recompute
+			std::fill(settledMap.begin(), settledMap.end(), 0);
+			std::fill(floodMap.begin(), floodMap.end(), 0);
+			settledColumns.clear();
+			floodColumns.clear();
+			floodStack.clear();
+		}
 
-			GameMap& m = map;
-			memset(linkMap.get(), 0, width * height * depth);
+		void GameMapWrapper::AddBlock(int x, int y, int z, uint32_t color) {
+			SPADES_MARK_FUNCTION();
 
-			for (int x = 0; x < width; x++)
-			for (int y = 0; y < height; y++)
-				SetLink(x, y, depth - 1, Root);
+			// Adding a block never disconnects anything
+			map.Set(x, y, z, true, color);
+		}
 
-			std::deque<CellPos> queue(width * height * 2);
+		void GameMapWrapper::FloodFill(int x, int y, int z,
+		                               std::vector<std::vector<CellPos>>& clusters) {
+			SPADES_MARK_FUNCTION_DEBUG();
 
-			for (int x = 0; x < width; x++)
-			for (int y = 0; y < height; y++)
-			if (m.IsSolid(x, y, depth - 2)) {
-				SetLink(x, y, depth - 2, PositiveZ);
-				queue.push_back(CellPos(x, y, depth - 2));
-			}
+			// The bottom layer is the ground. The layer above it is always linked to the
+			// ground as well.
+			const uint64_t groundMask = (uint64_t)3 << (depth - 2);
+			const GameMap& m = map;
 
-			while (!queue.empty()) {
-				CellPos p = queue.front();
-				queue.pop_front();
+			SPAssert(floodStack.empty());
+			SPAssert(floodColumns.empty());
 
-				int x = p.x, y = p.y, z = p.z;
+			bool grounded = false;
+			floodStack.push_back(ColumnSpan{(short)x, (short)y, (uint64_t)1 << z});
 
-				if (p.x > 0 && m.IsSolid(x - 1, y, z) && GetLink(x - 1, y, z) == Invalid) {
-					SetLink(x - 1, y, z, PositiveX);
-					queue.push_back(CellPos(x - 1, y, z));
-				}
-				if (p.x < width - 1 && m.IsSolid(x + 1, y, z) && GetLink(x + 1, y, z) == Invalid) {
-					SetLink(x + 1, y, z, NegativeX);
-					queue.push_back(CellPos(x + 1, y, z));
-				}
-				if (p.y > 0 && m.IsSolid(x, y - 1, z) && GetLink(x, y - 1, z) == Invalid) {
-					SetLink(x, y - 1, z, PositiveY);
-					queue.push_back(CellPos(x, y - 1, z));
-				}
-				if (p.y < height - 1 && m.IsSolid(x, y + 1, z) && GetLink(x, y + 1, z) == Invalid) {
-					SetLink(x, y + 1, z, NegativeY);
-					queue.push_back(CellPos(x, y + 1, z));
-				}
-				if (p.z > 0 && m.IsSolid(x, y, z - 1) && GetLink(x, y, z - 1) == Invalid) {
-					SetLink(x, y, z - 1, PositiveZ);
-					queue.push_back(CellPos(x, y, z - 1));
-				}
-				if (p.z < depth - 1 && m.IsSolid(x, y, z + 1) && GetLink(x, y, z + 1) == Invalid) {
-					SetLink(x, y, z + 1, NegativeZ);
-					queue.push_back(CellPos(x, y, z + 1));
-				}
-			}
+			while (!floodStack.empty()) {
+				ColumnSpan span = floodStack.back();
+				floodStack.pop_back();
 
-			SPLog("%.3f msecs to rebuild", stopwatch.GetTime() * 1000.0);
-		}
+				uint32_t column = (uint32_t)(span.x * height + span.y);
+				uint64_t solid = m.GetSolidMap(span.x, span.y);
+				uint64_t mask = FillRuns(span.mask & solid, solid);
 
-		void GameMapWrapper::AddBlock(int x, int y, int z, uint32_t color) {
-			SPADES_MARK_FUNCTION();
+				if (mask & settledMap[column]) {
+					// Reached a component already known to be grounded. (A floating one is
+					// visited as a whole, so it can't be reached from outside.)
+					grounded = true;
+					break;
+				}
 
-			GameMap& m = map;
+				mask &= ~floodMap[column];
+				if (!mask)
+					continue;
 
-			if (GetLink(x, y, z) != Invalid) {
-				SPAssert(m.IsSolid(x, y, z));
-				return;
+				if (!floodMap[column])
+					floodColumns.push_back(column);
+				floodMap[column] |= mask;
+
+				if (mask & groundMask) {
+					grounded = true;
+					break;
+				}
+
+				auto visitNeighbor = [&](int nx, int ny) {
+					uint64_t neighborMask = mask & m.GetSolidMap(nx, ny) & ~floodMap[nx * height + ny];
+					if (neighborMask)
+						floodStack.push_back(ColumnSpan{(short)nx, (short)ny, neighborMask});
+				};
+				if (span.x > 0)
+					visitNeighbor(span.x - 1, span.y);
+				if (span.x < width - 1)
+					visitNeighbor(span.x + 1, span.y);
+				if (span.y > 0)
+					visitNeighbor(span.x, span.y - 1);
+				if (span.y < height - 1)
+					visitNeighbor(span.x, span.y + 1);
 			}
 
-			m.Set(x, y, z, true, color);
+			floodStack.clear();
 
-			if (GetLink(x, y, z) != Invalid)
-				return;
+			std::vector<CellPos> cluster;
+			for (uint32_t column : floodColumns) {
+				uint64_t mask = floodMap[column];
+				floodMap[column] = 0;
 
-			LinkType l = Invalid;
-			if (x > 0 && m.IsSolid(x - 1, y, z) && GetLink(x - 1, y, z) != Invalid) {
-				l = NegativeX;
-				SPAssert(GetLink(x - 1, y, z) != PositiveX);
-			}
-			if (x < width - 1 && m.IsSolid(x + 1, y, z) && GetLink(x + 1, y, z) != Invalid) {
-				l = PositiveX;
-				SPAssert(GetLink(x + 1, y, z) != NegativeX);
-			}
-			if (y > 0 && m.IsSolid(x, y - 1, z) && GetLink(x, y - 1, z) != Invalid) {
-				l = NegativeY;
-				SPAssert(GetLink(x, y - 1, z) != PositiveY);
-			}
-			if (y < height - 1 && m.IsSolid(x, y + 1, z) && GetLink(x, y + 1, z) != Invalid) {
-				l = PositiveY;
-				SPAssert(GetLink(x, y + 1, z) != NegativeY);
-			}
-			if (z > 0 && m.IsSolid(x, y, z - 1) && GetLink(x, y, z - 1) != Invalid) {
-				l = NegativeZ;
-				SPAssert(GetLink(x, y, z - 1) != PositiveZ);
-			}
-			if (z < depth - 1 && m.IsSolid(x, y, z + 1) && GetLink(x, y, z + 1) != Invalid) {
-				l = PositiveZ;
-				SPAssert(GetLink(x, y, z + 1) != NegativeZ);
-			}
-			SetLink(x, y, z, l);
-
-			if (l == Invalid)
-				return;
-			// if there's invalid block around this block,
-			// rebuild tree
-			std::deque<CellPos> queue;
-			queue.push_back(CellPos(x, y, z));
-			while (!queue.empty()) {
-				CellPos p = queue.front();
-				queue.pop_front();
-
-				int x = p.x, y = p.y, z = p.z;
-				SPAssert(m.IsSolid(x, y, z));
-
-				LinkType thisLink = GetLink(x, y, z);
-
-				if (p.x > 0 && m.IsSolid(x - 1, y, z) && GetLink(x - 1, y, z) == Invalid &&
-				    thisLink != NegativeX) {
-					SetLink(x - 1, y, z, PositiveX);
-					queue.push_back(CellPos(x - 1, y, z));
-				}
-				if (p.x < width - 1 && m.IsSolid(x + 1, y, z) && GetLink(x + 1, y, z) == Invalid &&
-				    thisLink != PositiveX) {
-					SetLink(x + 1, y, z, NegativeX);
-					queue.push_back(CellPos(x + 1, y, z));
-				}
-				if (p.y > 0 && m.IsSolid(x, y - 1, z) && GetLink(x, y - 1, z) == Invalid &&
-				    thisLink != NegativeY) {
-					SetLink(x, y - 1, z, PositiveY);
-					queue.push_back(CellPos(x, y - 1, z));
-				}
-				if (p.y < height - 1 && m.IsSolid(x, y + 1, z) && GetLink(x, y + 1, z) == Invalid &&
-				    thisLink != PositiveY) {
-					SetLink(x, y + 1, z, NegativeY);
-					queue.push_back(CellPos(x, y + 1, z));
-				}
-				if (p.z > 0 && m.IsSolid(x, y, z - 1) && GetLink(x, y, z - 1) == Invalid &&
-				    thisLink != NegativeZ) {
-					SetLink(x, y, z - 1, PositiveZ);
-					queue.push_back(CellPos(x, y, z - 1));
-				}
-				if (p.z < depth - 1 && m.IsSolid(x, y, z + 1) && GetLink(x, y, z + 1) == Invalid &&
-				    thisLink != PositiveZ) {
-					SetLink(x, y, z + 1, NegativeZ);
-					queue.push_back(CellPos(x, y, z + 1));
-				}
+				if (!settledMap[column])
+					settledColumns.push_back(column);
+				settledMap[column] |= mask;
+
+				if (grounded)
+					continue;
+
+				int cx = column / height, cy = column % height;
+				for (; mask; mask &= mask - 1)
+					cluster.emplace_back(cx, cy, (int)CountTrailingZeros64(mask));
 			}
-		}
+			floodColumns.clear();
 
-		template <typename T> static inline bool EqualTwoCond(T a, T b, T c, bool cond) {
-			return a == b || (cond && a == c);
+			if (!grounded)
+				clusters.emplace_back(std::move(cluster));
 		}
 
-		std::vector<CellPos> GameMapWrapper::RemoveBlocks(const std::vector<CellPos>& cells) {
+		std::vector<std::vector<CellPos>>
+		GameMapWrapper::RemoveBlocks(const std::vector<CellPos>& cells) {
 			SPADES_MARK_FUNCTION();
 
+			std::vector<std::vector<CellPos>> clusters;
 			if (cells.empty())
-				return std::vector<CellPos>();
+				return clusters;
 
 			GameMap& m = map;
 
-			// solid, but unlinked cells
-			std::vector<CellPos> unlinkedCells;
-			std::deque<CellPos> queue;
-
-			// unlink children
-			for (size_t i = 0; i < cells.size(); i++) {
-				CellPos pos = cells[i];
+			for (const auto& pos : cells)
 				m.Set(pos.x, pos.y, pos.z, false, 0);
-				// if(GetLink(pos.x, pos.y, pos.z) == Invalid){
-				// this block is already disconnected.
-				// }
-
-				if (GetLink(pos.x, pos.y, pos.z) == Marked)
-					continue;
 
-				SPAssert(GetLink(pos.x, pos.y, pos.z) != Root);
-
-				SetLink(pos.x, pos.y, pos.z, Invalid);
-				queue.push_back(pos);
-
-				while (!queue.empty()) {
-					pos = queue.front();
-					queue.pop_front();
-
-					if (m.IsSolid(pos.x, pos.y, pos.z))
-						unlinkedCells.push_back(pos);
-					// don't "continue;" when non-solid
-
-					int x = pos.x, y = pos.y, z = pos.z;
-					if (x > 0 && EqualTwoCond(GetLink(x - 1, y, z), PositiveX, Invalid,
-					                          m.IsSolid(x - 1, y, z))) {
-						SetLink(x - 1, y, z, Marked);
-						queue.push_back(CellPos(x - 1, y, z));
-					}
-					if (x < width - 1 && EqualTwoCond(GetLink(x + 1, y, z), NegativeX, Invalid,
-					                                  m.IsSolid(x + 1, y, z))) {
-						SetLink(x + 1, y, z, Marked);
-						queue.push_back(CellPos(x + 1, y, z));
-					}
-					if (y > 0 && EqualTwoCond(GetLink(x, y - 1, z), PositiveY, Invalid,
-					                          m.IsSolid(x, y - 1, z))) {
-						SetLink(x, y - 1, z, Marked);
-						queue.push_back(CellPos(x, y - 1, z));
-					}
-					if (y < height - 1 && EqualTwoCond(GetLink(x, y + 1, z), NegativeY, Invalid,
-					                                   m.IsSolid(x, y + 1, z))) {
-						SetLink(x, y + 1, z, Marked);
-						queue.push_back(CellPos(x, y + 1, z));
-					}
-					if (z > 0 && EqualTwoCond(GetLink(x, y, z - 1), PositiveZ, Invalid,
-					                          m.IsSolid(x, y, z - 1))) {
-						SetLink(x, y, z - 1, Marked);
-						queue.push_back(CellPos(x, y, z - 1));
-					}
-					if (z < depth - 1 && EqualTwoCond(GetLink(x, y, z + 1), NegativeZ, Invalid,
-					                                  m.IsSolid(x, y, z + 1))) {
-						SetLink(x, y, z + 1, Marked);
-						queue.push_back(CellPos(x, y, z + 1));
-					}
-				}
+			// Every block that lost its support is next to one of the removed blocks
+			auto visit = [&](int x, int y, int z) {
+				if (x < 0 || y < 0 || z < 0 || x >= width || y >= height || z >= depth)
+					return;
+				if (!m.IsSolid(x, y, z))
+					return;
+				if ((settledMap[x * height + y] >> z) & 1)
+					return;
+				FloodFill(x, y, z, clusters);
+			};
+			for (const auto& pos : cells) {
+				visit(pos.x - 1, pos.y, pos.z);
+				visit(pos.x + 1, pos.y, pos.z);
+				visit(pos.x, pos.y - 1, pos.z);
+				visit(pos.x, pos.y + 1, pos.z);
+				visit(pos.x, pos.y, pos.z - 1);
+				visit(pos.x, pos.y, pos.z + 1);
 			}
 
-			// remove "visited" mark
-			for (const auto& pos : unlinkedCells) {
-				if (GetLink(pos.x, pos.y, pos.z) == Marked)
-					SetLink(pos.x, pos.y, pos.z, Invalid);
-			}
-
-			SPAssert(queue.empty());
-
-			// start relinking
-			for (const auto& pos : unlinkedCells) {
-				int x = pos.x, y = pos.y, z = pos.z;
-				if (!m.IsSolid(x, y, z)) {
-					// notice: (x,y,z) may be air, so
-					// don't use SPAssert()
-					continue;
-				}
-
-				LinkType newLink = Invalid;
-				if (z < depth - 1 && GetLink(x, y, z + 1) != Invalid) {
-					newLink = PositiveZ;
-				} else if (x > 0 && GetLink(x - 1, y, z) != Invalid) {
-					newLink = NegativeX;
-				} else if (x < width - 1 && GetLink(x + 1, y, z) != Invalid) {
-					newLink = PositiveX;
-				} else if (y > 0 && GetLink(x, y - 1, z) != Invalid) {
-					newLink = NegativeY;
-				} else if (y < height - 1 && GetLink(x, y + 1, z) != Invalid) {
-					newLink = PositiveY;
-				} else if (z > 0 && GetLink(x, y, z - 1) != Invalid) {
-					newLink = NegativeZ;
-				}
-
-				if (newLink != Invalid) {
-					SetLink(x, y, z, newLink);
-					queue.push_back(pos);
-				}
-			}
-
-			while (!queue.empty()) {
-				CellPos p = queue.front();
-				queue.pop_front();
-
-				int x = p.x, y = p.y, z = p.z;
-				LinkType thisLink = GetLink(x, y, z);
-
-				if (p.x > 0 && m.IsSolid(x - 1, y, z) && GetLink(x - 1, y, z) == Invalid &&
-				    thisLink != NegativeX) {
-					SetLink(x - 1, y, z, PositiveX);
-					queue.push_back(CellPos(x - 1, y, z));
-				}
-				if (p.x < width - 1 && m.IsSolid(x + 1, y, z) && GetLink(x + 1, y, z) == Invalid &&
-				    thisLink != PositiveX) {
-					SetLink(x + 1, y, z, NegativeX);
-					queue.push_back(CellPos(x + 1, y, z));
-				}
-				if (p.y > 0 && m.IsSolid(x, y - 1, z) && GetLink(x, y - 1, z) == Invalid &&
-				    thisLink != NegativeY) {
-					SetLink(x, y - 1, z, PositiveY);
-					queue.push_back(CellPos(x, y - 1, z));
-				}
-				if (p.y < height - 1 && m.IsSolid(x, y + 1, z) && GetLink(x, y + 1, z) == Invalid &&
-				    thisLink != PositiveY) {
-					SetLink(x, y + 1, z, NegativeY);
-					queue.push_back(CellPos(x, y + 1, z));
-				}
-				if (p.z > 0 && m.IsSolid(x, y, z - 1) && GetLink(x, y, z - 1) == Invalid &&
-				    thisLink != NegativeZ) {
-					SetLink(x, y, z - 1, PositiveZ);
-					queue.push_back(CellPos(x, y, z - 1));
-				}
-				if (p.z < depth - 1 && m.IsSolid(x, y, z + 1) && GetLink(x, y, z + 1) == Invalid &&
-				    thisLink != PositiveZ) {
-					SetLink(x, y, z + 1, NegativeZ);
-					queue.push_back(CellPos(x, y, z + 1));
-				}
-			}
-
-			std::vector<CellPos> floatingBlocks;
-			floatingBlocks.reserve(unlinkedCells.size());
-
-			for (const auto& p : unlinkedCells) {
-				if (!m.IsSolid(p.x, p.y, p.z))
-					continue;
-				if (GetLink(p.x, p.y, p.z) == Invalid)
-					floatingBlocks.push_back(p);
-			}
+			for (uint32_t column : settledColumns)
+				settledMap[column] = 0;
+			settledColumns.clear();
 
-			return floatingBlocks;
+			return clusters;
 		}
 	} // namespace client
-} // namespace spades
\ No newline at end of file
+} // namespace spades
@@ -68,36 +68,44 @@ namespace spades {
 			}
 		};
 
-		/** Wraps GameMap and provides floating-block detection.*/
+		/**
+		 * Wraps GameMap and provides floating-block detection.
+		 *
+		 * Blocks are connected to the ground if they are linked to the bottom layer through
+		 * face-adjacent solid blocks. The connectivity is searched on the 64-voxel column
+		 * bitmasks of `GameMap`, filling whole vertical runs of solid voxels at once.
+		 */
 		class GameMapWrapper {
 			friend class Client; // FIXME: for debug
 		public:
 		private:
 			GameMap& map;
 
-			/** Each element represents where this cell is connected from. */
-			std::unique_ptr<uint8_t[]> linkMap;
-
-			enum LinkType {
-				Invalid = 0,
-				Root,
-				NegativeX,
-				PositiveX,
-				NegativeY,
-				PositiveY,
-				NegativeZ,
-				PositiveZ,
-				Marked
+			int width, height, depth;
+
+			/** A set of voxels in the column `(x, y)` to be visited by a flood fill. */
+			struct ColumnSpan {
+				short x, y;
+				uint64_t mask;
 			};
 
-			int width, height, depth;
+			// Scratch buffers reused by `RemoveBlocks`. Only the columns listed in
+			// `settledColumns` and `floodColumns` have non-zero masks.
 
-			inline LinkType GetLink(int x, int y, int z) {
-				return (LinkType)linkMap[(x * height + y) * depth + z];
-			}
-			void SetLink(int x, int y, int z, LinkType l) {
-				linkMap[(x * height + y) * depth + z] = l;
-			}
+			/** The voxels already classified by an earlier flood fill of this call. */
+			std::vector<uint64_t> settledMap;
+			std::vector<uint32_t> settledColumns;
+			/** The voxels visited by the current flood fill. */
+			std::vector<uint64_t> floodMap;
+			std::vector<uint32_t> floodColumns;
+			std::vector<ColumnSpan> floodStack;
+
+			/**
+			 * Visits the connected component containing the solid voxel `(x, y, z)`, stopping
+			 * as soon as it's found to be connected to the ground. If it isn't, its blocks are
+			 * appended to `clusters` as a new cluster.
+			 */
+			void FloodFill(int x, int y, int z, std::vector<std::vector<CellPos>>& clusters);
 
 		public:
 			GameMapWrapper(GameMap&);
@@ -106,10 +114,13 @@ namespace spades {
 			/** Addes a new block. */
 			void AddBlock(int x, int y, int z, uint32_t color);
 
-			/** Removes the specified blocks, and returns floating blocks.
-			 * This function, however, doesn't remove floating blocks. */
-			std::vector<CellPos> RemoveBlocks(const std::vector<CellPos>&);
+			/**
+			 * Removes the specified blocks, and returns floating blocks grouped by the
+			 * connected components. This function, however, doesn't remove floating blocks.
+			 */
+			std::vector<std::vector<CellPos>> RemoveBlocks(const std::vector<CellPos>&);
 
+			/** Resets the scratch buffers. Call this after the map was replaced as a whole. */
 			void Rebuild();
 		};
 	} // namespace client
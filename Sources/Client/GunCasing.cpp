@@ -24,7 +24,7 @@
 #include "IAudioChunk.h"
 #include "IAudioDevice.h"
 #include "IRenderer.h"
-#include "ParticleSpriteEntity.h"
+#include "ParticleSystem.h"
 #include "World.h"
 #include <Core/Settings.h>
 
@@ -104,14 +104,14 @@ namespace spades {
 
 					int splats = SampleRandomInt(0, 2);
 					for (int i = 0; i < splats; i++) {
-						auto ent = stmp::make_unique<ParticleSpriteEntity>(*client, img, col);
-						ent->SetTrajectory(pt, MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
+						ParticleSystem::Particle particle(col);
+						particle.SetTrajectory(pt, MakeVector3(SampleRandomFloat() - SampleRandomFloat(),
 															SampleRandomFloat() - SampleRandomFloat(),
 															-SampleRandomFloat()) * 2.0F, 1.0F, 0.4F);
-						ent->SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
-						ent->SetRadius(0.1F + SampleRandomFloat() * SampleRandomFloat() * 0.1F);
-						ent->SetLifeTime(2.0F, 0.0F, 1.0F);
-						client->AddLocalEntity(std::move(ent));
+						particle.SetRotation(SampleRandomFloat() * M_PI_F * 2.0F);
+						particle.SetRadius(0.1F + SampleRandomFloat() * SampleRandomFloat() * 0.1F);
+						particle.SetLifeTime(2.0F, 0.0F, 1.0F);
+						client->GetParticleSystem().AddSprite(*img, particle);
 					}
 				}
 
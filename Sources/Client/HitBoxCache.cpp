@@ -0,0 +1,282 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <algorithm>
+
+#include "HitBoxCache.h"
+#include <Core/Debug.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 1
+#include <emmintrin.h>
+#else
+#define ENABLE_SSE2 0
+#endif
+
+#if defined(__AVX__)
+#define ENABLE_AVX 1
+#include <immintrin.h>
+#else
+#define ENABLE_AVX 0
+#endif
+
+namespace spades {
+	namespace client {
+		namespace {
+			/** The number of boxes `HitBoxCache::fields` are padded to. */
+			constexpr std::size_t MaxSimdWidth = 8;
+
+#if ENABLE_SSE2
+			struct Sse2Lanes {
+				using Float = __m128;
+				enum { Width = 4 };
+
+				static Float Load(const float* p) { return _mm_loadu_ps(p); }
+				static void Store(float* p, Float a) { _mm_storeu_ps(p, a); }
+				static Float Splat(float v) { return _mm_set1_ps(v); }
+				static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+				static Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+				static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+				static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+				// These match the scalar comparison operators when one of the operands is NaN
+				static Float CmpGe(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+				static Float CmpLt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+				static Float CmpLe(Float a, Float b) { return _mm_cmple_ps(a, b); }
+				static Float CmpNe(Float a, Float b) { return _mm_cmpneq_ps(a, b); }
+				static Float And(Float a, Float b) { return _mm_and_ps(a, b); }
+				static Float Or(Float a, Float b) { return _mm_or_ps(a, b); }
+				static Float Select(Float mask, Float a, Float b) {
+					return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+				}
+				static int MoveMask(Float a) { return _mm_movemask_ps(a); }
+			};
+#endif
+
+#if ENABLE_AVX
+			struct AvxLanes {
+				using Float = __m256;
+				enum { Width = 8 };
+
+				static Float Load(const float* p) { return _mm256_loadu_ps(p); }
+				static void Store(float* p, Float a) { _mm256_storeu_ps(p, a); }
+				static Float Splat(float v) { return _mm256_set1_ps(v); }
+				static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+				static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+				static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+				static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+				static Float CmpGe(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+				static Float CmpLt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+				static Float CmpLe(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+				static Float CmpNe(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+				static Float And(Float a, Float b) { return _mm256_and_ps(a, b); }
+				static Float Or(Float a, Float b) { return _mm256_or_ps(a, b); }
+				static Float Select(Float mask, Float a, Float b) {
+					return _mm256_blendv_ps(b, a, mask);
+				}
+				static int MoveMask(Float a) { return _mm256_movemask_ps(a); }
+			};
+#endif
+
+			template <class V> struct Lanes3 {
+				typename V::Float x, y, z;
+			};
+
+			/** Evaluates `Vector3::Dot` in the same order of operations. */
+			template <class V>
+			inline typename V::Float Dot(const Lanes3<V>& a, const Lanes3<V>& b) {
+				return V::Add(V::Add(V::Mul(a.x, b.x), V::Mul(a.y, b.y)), V::Mul(a.z, b.z));
+			}
+
+			/**
+			 * One of the three plane tests of `OBB3::RayCast`. `norm` is the normal of the
+			 * plane, and `u` and `w` are the two other axes.
+			 *
+			 * @return The mask of the lanes where the plane was hit.
+			 */
+			template <class V>
+			inline typename V::Float
+			TestPlane(const Lanes3<V>& start, const Lanes3<V>& end, const Lanes3<V>& dir,
+			          const Lanes3<V>& norm, typename V::Float normLen, const Lanes3<V>& u,
+			          typename V::Float uLen, const Lanes3<V>& w, typename V::Float wLen,
+			          Lanes3<V>& hitPos) {
+				using F = typename V::Float;
+				const F zero = V::Splat(0.0F);
+
+				F dot = Dot(dir, norm);
+				F startp = Dot(start, norm);
+				F endp = Dot(end, norm);
+
+				F hit = V::Select(V::CmpLt(startp, endp), V::Div(startp, V::Sub(startp, endp)),
+				                  V::Div(V::Sub(normLen, startp), V::Sub(endp, startp)));
+
+				hitPos.x = V::Add(start.x, V::Mul(dir.x, hit));
+				hitPos.y = V::Add(start.y, V::Mul(dir.y, hit));
+				hitPos.z = V::Add(start.z, V::Mul(dir.z, hit));
+
+				F ud = Dot(hitPos, u);
+				F wd = Dot(hitPos, w);
+
+				F mask = V::And(V::CmpNe(dot, zero), V::CmpGe(hit, zero));
+				mask = V::And(mask, V::And(V::CmpGe(ud, zero), V::CmpGe(wd, zero)));
+				mask = V::And(mask, V::And(V::CmpLe(ud, uLen), V::CmpLe(wd, wLen)));
+				return mask;
+			}
+		} // namespace
+
+		HitBoxCache::HitBoxCache() {}
+
+		void HitBoxCache::Clear() {
+			boxes.clear();
+			for (std::vector<float>& field : fields)
+				field.clear();
+		}
+
+		void HitBoxCache::Add(int playerId, const Player::HitBoxes& hb) {
+			AddBox(playerId, Part::Head, hb.head);
+			AddBox(playerId, Part::Torso, hb.torso);
+			AddBox(playerId, Part::Limb1, hb.limbs[0]);
+			AddBox(playerId, Part::Limb2, hb.limbs[1]);
+			AddBox(playerId, Part::Arms, hb.limbs[2]);
+		}
+
+		void HitBoxCache::AddBox(int playerId, Part part, const OBB3& obb) {
+			std::size_t index = boxes.size();
+			boxes.push_back(Box{playerId, part, obb});
+
+			if (index >= fields[0].size()) {
+				// The empty boxes are masked out by `RayCastSimd`
+				for (std::vector<float>& field : fields)
+					field.resize(field.size() + MaxSimdWidth, 0.0F);
+			}
+
+			const Matrix4& m = obb.m;
+			Vector3 axisX = m.GetAxis(0), axisY = m.GetAxis(1), axisZ = m.GetAxis(2);
+			Matrix4 inv = m.InversedFast();
+
+			const float values[NumFields] = {
+			  axisX.x, axisX.y, axisX.z, axisY.x, axisY.y, axisY.z, axisZ.x, axisZ.y, axisZ.z,
+			  Vector3::Dot(axisX, axisX), Vector3::Dot(axisY, axisY), Vector3::Dot(axisZ, axisZ),
+			  m.m[12], m.m[13], m.m[14],
+			  inv.m[0], inv.m[4], inv.m[8], inv.m[12],
+			  inv.m[1], inv.m[5], inv.m[9], inv.m[13],
+			  inv.m[2], inv.m[6], inv.m[10], inv.m[14]};
+			for (int i = 0; i < NumFields; i++)
+				fields[i][index] = values[i];
+		}
+
+		void HitBoxCache::RayCast(Vector3 start, Vector3 dir, std::vector<Hit>& hits) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+
+#if ENABLE_AVX
+			RayCastSimd<AvxLanes>(start, dir, hits);
+#elif ENABLE_SSE2
+			RayCastSimd<Sse2Lanes>(start, dir, hits);
+#else
+			for (const Box& box : boxes) {
+				OBB3 obb = box.obb;
+				Vector3 hitPos;
+				if (obb.RayCast(start, dir, &hitPos))
+					hits.push_back(Hit{box.playerId, box.part, hitPos});
+			}
+#endif
+		}
+
+		template <class V>
+		void HitBoxCache::RayCastSimd(Vector3 start, Vector3 dir, std::vector<Hit>& hits) const {
+			using F = typename V::Float;
+			static_assert(MaxSimdWidth % V::Width == 0, "Padding is not enough");
+
+			const F zero = V::Splat(0.0F);
+			const F one = V::Splat(1.0F);
+			const Lanes3<V> rayStart{V::Splat(start.x), V::Splat(start.y), V::Splat(start.z)};
+			const Lanes3<V> rayDir{V::Splat(dir.x), V::Splat(dir.y), V::Splat(dir.z)};
+
+			float outX[V::Width], outY[V::Width], outZ[V::Width];
+
+			for (std::size_t i = 0; i < boxes.size(); i += V::Width) {
+				auto load = [&](Field f) { return V::Load(fields[f].data() + i); };
+
+				// Inside test (`OBB3::operator &&`)
+				F rx = V::Add(V::Add(V::Add(V::Mul(load(Inv0), rayStart.x),
+				                            V::Mul(load(Inv4), rayStart.y)),
+				                     V::Mul(load(Inv8), rayStart.z)),
+				              V::Mul(load(Inv12), one));
+				F ry = V::Add(V::Add(V::Add(V::Mul(load(Inv1), rayStart.x),
+				                            V::Mul(load(Inv5), rayStart.y)),
+				                     V::Mul(load(Inv9), rayStart.z)),
+				              V::Mul(load(Inv13), one));
+				F rz = V::Add(V::Add(V::Add(V::Mul(load(Inv2), rayStart.x),
+				                            V::Mul(load(Inv6), rayStart.y)),
+				                     V::Mul(load(Inv10), rayStart.z)),
+				              V::Mul(load(Inv14), one));
+				F inside = V::And(V::And(V::CmpGe(rx, zero), V::CmpGe(ry, zero)),
+				                  V::CmpGe(rz, zero));
+				inside = V::And(inside, V::And(V::And(V::CmpLt(rx, one), V::CmpLt(ry, one)),
+				                               V::CmpLt(rz, one)));
+
+				// Plane tests in the box's origin-relative space
+				const Lanes3<V> origin{load(OriginX), load(OriginY), load(OriginZ)};
+				const Lanes3<V> s{V::Sub(rayStart.x, origin.x), V::Sub(rayStart.y, origin.y),
+				                  V::Sub(rayStart.z, origin.z)};
+				const Lanes3<V> e{V::Add(s.x, rayDir.x), V::Add(s.y, rayDir.y),
+				                  V::Add(s.z, rayDir.z)};
+				const Lanes3<V> axisX{load(AxisXX), load(AxisXY), load(AxisXZ)};
+				const Lanes3<V> axisY{load(AxisYX), load(AxisYY), load(AxisYZ)};
+				const Lanes3<V> axisZ{load(AxisZX), load(AxisZY), load(AxisZZ)};
+				const F lenX = load(AxisXLen), lenY = load(AxisYLen), lenZ = load(AxisZLen);
+
+				Lanes3<V> hitX, hitY, hitZ;
+				F maskX = TestPlane<V>(s, e, rayDir, axisX, lenX, axisY, lenY, axisZ, lenZ, hitX);
+				F maskY = TestPlane<V>(s, e, rayDir, axisY, lenY, axisX, lenX, axisZ, lenZ, hitY);
+				F maskZ = TestPlane<V>(s, e, rayDir, axisZ, lenZ, axisX, lenX, axisY, lenY, hitZ);
+
+				// `OBB3::RayCast` returns the first test that succeeded
+				Lanes3<V> pos = hitZ;
+				pos.x = V::Select(maskY, hitY.x, pos.x);
+				pos.y = V::Select(maskY, hitY.y, pos.y);
+				pos.z = V::Select(maskY, hitY.z, pos.z);
+				pos.x = V::Select(maskX, hitX.x, pos.x);
+				pos.y = V::Select(maskX, hitX.y, pos.y);
+				pos.z = V::Select(maskX, hitX.z, pos.z);
+
+				int insideMask = V::MoveMask(inside);
+				int mask = insideMask | V::MoveMask(V::Or(V::Or(maskX, maskY), maskZ));
+				std::size_t numLanes = std::min<std::size_t>(V::Width, boxes.size() - i);
+				mask &= (1 << numLanes) - 1;
+				if (mask == 0)
+					continue;
+
+				V::Store(outX, V::Add(pos.x, origin.x));
+				V::Store(outY, V::Add(pos.y, origin.y));
+				V::Store(outZ, V::Add(pos.z, origin.z));
+
+				for (std::size_t k = 0; k < numLanes; k++) {
+					if (!(mask & (1 << k)))
+						continue;
+
+					const Box& box = boxes[i + k];
+					Vector3 hitPos = (insideMask & (1 << k)) ? start
+					                                         : MakeVector3(outX[k], outY[k], outZ[k]);
+					hits.push_back(Hit{box.playerId, box.part, hitPos});
+				}
+			}
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,105 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "Player.h"
+#include <Core/Math.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * The hit boxes of a set of players stored as a structure of arrays so a ray can be
+		 * tested against all of them with SIMD instructions.
+		 *
+		 * `RayCast` gives exactly the same results as calling `OBB3::RayCast` on each box in
+		 * turn, so the hit tests built on top of it behave just like the scalar ones.
+		 */
+		class HitBoxCache {
+		public:
+			/** The hit boxes of a player, in the order they are added and tested. */
+			enum class Part { Head, Torso, Limb1, Limb2, Arms };
+			enum { NumPartsPerPlayer = 5 };
+
+			struct Hit {
+				int playerId;
+				Part part;
+				Vector3 hitPos;
+			};
+
+			HitBoxCache();
+
+			void Clear();
+			void Add(int playerId, const Player::HitBoxes&);
+
+			std::size_t GetNumBoxes() const { return boxes.size(); }
+
+			/**
+			 * Tests a ray against every box and appends the hits to `hits`, ordered by the
+			 * order the players were added in and then by `Part`.
+			 */
+			void RayCast(Vector3 start, Vector3 dir, std::vector<Hit>& hits) const;
+
+		private:
+			enum Field {
+				// The axes of the box
+				AxisXX, AxisXY, AxisXZ,
+				AxisYX, AxisYY, AxisYZ,
+				AxisZX, AxisZY, AxisZZ,
+				// The squared lengths of the axes
+				AxisXLen, AxisYLen, AxisZLen,
+				OriginX, OriginY, OriginZ,
+				// The rows of `OBB3::m.InversedFast()`, used by the inside test
+				Inv0, Inv4, Inv8, Inv12,
+				Inv1, Inv5, Inv9, Inv13,
+				Inv2, Inv6, Inv10, Inv14,
+				NumFields
+			};
+
+			struct Box {
+				int playerId;
+				Part part;
+				OBB3 obb;
+			};
+
+			std::vector<Box> boxes;
+			/** Padded to a multiple of the SIMD width with empty boxes. */
+			std::vector<float> fields[NumFields];
+
+			void AddBox(int playerId, Part, const OBB3&);
+
+			template <class V>
+			void RayCastSimd(Vector3 start, Vector3 dir, std::vector<Hit>& hits) const;
+		};
+
+		/** A `HitBoxCache` and a hit buffer reused by the hit scans of a `World`. */
+		struct HitScanBuffers {
+			HitBoxCache hitBoxes;
+			std::vector<HitBoxCache::Hit> hits;
+
+			void Clear() {
+				hitBoxes.Clear();
+				hits.clear();
+			}
+		};
+	} // namespace client
+} // namespace spades
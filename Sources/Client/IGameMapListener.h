@@ -20,12 +20,42 @@
 
 #pragma once
 
+#include <vector>
+
+#include <Core/Math.h>
+
 namespace spades {
 	namespace client {
 		class GameMap;
+
+		/** A set of voxels modified by a map change transaction. */
+		struct GameMapChanges {
+			/** The modified voxels. A voxel might appear more than once. */
+			std::vector<IntVector3> voxels;
+
+			/** The inclusive bounding box of `voxels`. */
+			IntVector3 minCorner, maxCorner;
+
+			/** Checks if the bounding box is no larger than `size` along every axis. */
+			bool IsCompact(int size) const {
+				return maxCorner.x - minCorner.x < size && maxCorner.y - minCorner.y < size &&
+				       maxCorner.z - minCorner.z < size;
+			}
+		};
+
 		class IGameMapListener {
 		public:
 			virtual void GameMapChanged(int x, int y, int z, GameMap*) = 0;
+
+			/**
+			 * Called once when a transaction (see `GameMap::BeginChanges`) that modified at
+			 * least one voxel is committed. The default implementation calls `GameMapChanged`
+			 * for each voxel.
+			 */
+			virtual void GameMapChangesCommitted(const GameMapChanges& changes, GameMap* map) {
+				for (const IntVector3& v : changes.voxels)
+					GameMapChanged(v.x, v.y, v.z, map);
+			}
 		};
 	} // namespace client
-} // namespace spades
\ No newline at end of file
+} // namespace spades
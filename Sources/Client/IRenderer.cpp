@@ -19,7 +19,20 @@
  */
 
 #include "IRenderer.h"
+#include <Core/VoxelModel.h>
 
 namespace spades {
-	namespace client {}
-} // namespace spades
\ No newline at end of file
+	namespace client {
+		std::function<Handle<IModel>()> IRenderer::PrepareModel(VoxelModel& model) {
+			Handle<VoxelModel> m{model};
+			return [this, m] { return CreateModel(*m); };
+		}
+
+		void IRenderer::AddSprites(IImage& image, const SpriteParam* sprites, std::size_t count) {
+			for (std::size_t i = 0; i < count; i++) {
+				SetColorAlphaPremultiplied(sprites[i].color);
+				AddSprite(image, sprites[i].center, sprites[i].radius, sprites[i].rotation);
+			}
+		}
+	} // namespace client
+} // namespace spades
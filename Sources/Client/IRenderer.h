@@ -21,6 +21,7 @@
 #pragma once
 
 #include <array>
+#include <functional>
 
 #include "IImage.h"
 #include "IModel.h"
@@ -95,6 +96,15 @@ namespace spades {
 			bool useLensFlare = false;
 		};
 
+		/** A sprite added by `IRenderer::AddSprites`. */
+		struct SpriteParam {
+			Vector3 center;
+			float radius;
+			float rotation;
+			/** The color, alpha premultiplied. */
+			Vector4 color;
+		};
+
 		class IRenderer : public RefCountedObject {
 		protected:
 			virtual ~IRenderer() {}
@@ -117,6 +127,15 @@ namespace spades {
 
 			virtual Handle<IImage> CreateImage(Bitmap&) = 0;
 			virtual Handle<IModel> CreateModel(VoxelModel&) = 0;
+			/**
+			 * Does the part of `CreateModel` that doesn't need the renderer's thread, such as
+			 * building a mesh. Unlike other methods, this can be called from any thread.
+			 * `VoxelModel` must not be modified afterwards.
+			 *
+			 * @return A function that finishes creating the model. It must be called on the
+			 *         renderer's thread while the renderer is alive.
+			 */
+			virtual std::function<Handle<IModel>()> PrepareModel(VoxelModel&);
 
 			virtual void SetGameMap(stmp::optional<GameMap&>) = 0;
 
@@ -132,6 +151,11 @@ namespace spades {
 			virtual void AddDebugLine(Vector3 a, Vector3 b, Vector4 color) = 0;
 
 			virtual void AddSprite(IImage&, Vector3 center, float radius, float rotation) = 0;
+			/**
+			 * Adds sprites sharing the same image. Equivalent to calling
+			 * `SetColorAlphaPremultiplied` and `AddSprite` for each of them.
+			 */
+			virtual void AddSprites(IImage&, const SpriteParam* sprites, std::size_t count);
 			virtual void AddLongSprite(IImage&, Vector3 p1, Vector3 p2, float radius) = 0;
 
 			/** Finalizes a scene. 2D drawing follows. */
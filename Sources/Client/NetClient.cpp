@@ -19,6 +19,8 @@
 
  */
 
+#include <algorithm>
+#include <cstring>
 #include <math.h>
 #include <string.h>
 #include <vector>
@@ -26,12 +28,16 @@
 #include <enet/enet.h>
 
 #include "CTFGameMode.h"
-#include "Client.h"
+#include "DemoPlayer.h"
+#include "DemoRecorder.h"
 #include "GameMap.h"
+#include "GameMapCache.h"
 #include "GameMapLoader.h"
 #include "GameProperties.h"
 #include "Grenade.h"
+#include "INetClientListener.h"
 #include "NetClient.h"
+#include "NetworkThread.h"
 #include "Player.h"
 #include "TCGameMode.h"
 #include "Weapon.h"
@@ -47,6 +53,7 @@
 #include <Core/TMPUtils.h>
 
 DEFINE_SPADES_SETTING(cg_unicode, "1");
+DEFINE_SPADES_SETTING(cg_demoSpeed, "1");
 
 namespace spades {
 	namespace client {
@@ -133,23 +140,89 @@ namespace spades {
 			}
 		} // namespace
 
+		namespace {
+			/** A range of bytes in a packet. Valid as long as the `NetPacketReader` is. */
+			struct PacketSpan {
+				const char* data;
+				std::size_t size;
+
+				const char* begin() const { return data; }
+				const char* end() const { return data + size; }
+				bool empty() const { return size == 0; }
+			};
+
+			std::uint32_t LoadUInt32(const char* p) {
+				return static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[0])) |
+				       static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[1])) << 8 |
+				       static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[2])) << 16 |
+				       static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[3])) << 24;
+			}
+
+			float LoadFloat(const char* p) {
+				std::uint32_t v = LoadUInt32(p);
+				float f;
+				std::memcpy(&f, &v, sizeof(f));
+				return f;
+			}
+
+			Vector3 LoadVector3(const char* p) {
+				return MakeVector3(LoadFloat(p), LoadFloat(p + 4), LoadFloat(p + 8));
+			}
+
+			IntVector3 LoadIntVector3(const char* p) {
+				return IntVector3::Make(static_cast<int>(LoadUInt32(p)),
+				                        static_cast<int>(LoadUInt32(p + 4)),
+				                        static_cast<int>(LoadUInt32(p + 8)));
+			}
+		} // namespace
+
+		/**
+		 * Parses a packet in place. When constructed from an `ENetPacket`, the reader owns
+		 * the packet and destroys it when it's destroyed. Otherwise, the bytes must outlive
+		 * the reader.
+		 */
 		class NetPacketReader {
-			std::vector<char> data;
+			ENetPacket* packet = nullptr;
+			const char* data;
+			size_t size;
 			size_t pos;
 
+			const char* Consume(size_t siz) {
+				if (siz > size - pos)
+					SPRaise("Received packet truncated");
+
+				const char* p = data + pos;
+				pos += siz;
+				return p;
+			}
+
 		public:
-			NetPacketReader(ENetPacket* packet) {
-				SPADES_MARK_FUNCTION();
+			NetPacketReader(ENetPacket* packet)
+			    : packet(packet),
+			      data(reinterpret_cast<const char*>(packet->data)),
+			      size(packet->dataLength),
+			      pos(1) {
+				if (size == 0) {
+					enet_packet_destroy(packet);
+					SPRaise("Received empty packet");
+				}
+			}
 
-				data.resize(packet->dataLength);
-				memcpy(data.data(), packet->data, packet->dataLength);
-				enet_packet_destroy(packet);
-				pos = 1;
+			NetPacketReader(const char* data, std::size_t size) : data(data), size(size), pos(1) {
+				SPAssert(size > 0);
+			}
+
+			NetPacketReader(const NetPacketReader&) = delete;
+			void operator=(const NetPacketReader&) = delete;
+
+			NetPacketReader(NetPacketReader&& o)
+			    : packet(o.packet), data(o.data), size(o.size), pos(o.pos) {
+				o.packet = nullptr;
 			}
 
-			NetPacketReader(const std::vector<char> inData) {
-				data = inData;
-				pos = 1;
+			~NetPacketReader() {
+				if (packet)
+					enet_packet_destroy(packet);
 			}
 
 			unsigned int GetTypeRaw() { return static_cast<unsigned int>(data[0]); }
@@ -158,107 +231,124 @@ namespace spades {
 			uint32_t ReadInt() {
 				SPADES_MARK_FUNCTION();
 
-				uint32_t value = 0;
-				if (pos + 4 > data.size())
-					SPRaise("Received packet truncated");
-
-				value |= ((uint32_t)(uint8_t)data[pos++]);
-				value |= ((uint32_t)(uint8_t)data[pos++]) << 8;
-				value |= ((uint32_t)(uint8_t)data[pos++]) << 16;
-				value |= ((uint32_t)(uint8_t)data[pos++]) << 24;
-				return value;
+				return LoadUInt32(Consume(4));
 			}
 
 			uint16_t ReadShort() {
 				SPADES_MARK_FUNCTION();
 
-				uint32_t value = 0;
-				if (pos + 2 > data.size())
-					SPRaise("Received packet truncated");
-
-				value |= ((uint32_t)(uint8_t)data[pos++]);
-				value |= ((uint32_t)(uint8_t)data[pos++]) << 8;
-				return (uint16_t)value;
+				const char* p = Consume(2);
+				return static_cast<uint16_t>(static_cast<uint8_t>(p[0]) |
+				                             static_cast<uint8_t>(p[1]) << 8);
 			}
 
 			uint8_t ReadByte() {
 				SPADES_MARK_FUNCTION();
 
-				if (pos >= data.size())
-					SPRaise("Received packet truncated");
-
-				return (uint8_t)data[pos++];
+				return static_cast<uint8_t>(*Consume(1));
 			}
 
 			float ReadFloat() {
 				SPADES_MARK_FUNCTION();
-				union {
-					float f;
-					uint32_t v;
-				};
-				v = ReadInt();
-				return f;
+
+				return LoadFloat(Consume(4));
 			}
 
 			IntVector3 ReadIntColor() {
 				SPADES_MARK_FUNCTION();
+				const char* p = Consume(3);
 				IntVector3 col;
-				col.z = ReadByte(); // B
-				col.y = ReadByte(); // G
-				col.x = ReadByte(); // R
+				col.z = static_cast<uint8_t>(p[0]); // B
+				col.y = static_cast<uint8_t>(p[1]); // G
+				col.x = static_cast<uint8_t>(p[2]); // R
 				return col;
 			}
 			IntVector3 ReadIntVector3() {
 				SPADES_MARK_FUNCTION();
-				IntVector3 v;
-				v.x = ReadInt();
-				v.y = ReadInt();
-				v.z = ReadInt();
-				return v;
+				return LoadIntVector3(Consume(12));
 			}
 			Vector3 ReadVector3() {
 				SPADES_MARK_FUNCTION();
-				Vector3 v;
-				v.x = ReadFloat();
-				v.y = ReadFloat();
-				v.z = ReadFloat();
-				return v;
+				return LoadVector3(Consume(12));
 			}
 
-			std::size_t GetPosition() { return data.size(); }
-			std::size_t GetNumRemainingBytes() { return data.size() - pos; }
-			std::vector<char> GetData() { return data; }
+			std::size_t GetPosition() { return size; }
+			std::size_t GetNumRemainingBytes() { return size - pos; }
+			/** Returns the whole packet including the type byte. */
+			PacketSpan GetData() { return {data, size}; }
 
-			std::string ReadData(size_t siz) {
-				if (pos + siz > data.size())
-					SPRaise("Received packet truncated");
-
-				std::string s = std::string(data.data() + pos, siz);
-				pos += siz;
-				return s;
-			}
-			std::string ReadRemainingData() {
-				return std::string(data.data() + pos, data.size() - pos);
-			}
+			PacketSpan ReadData(size_t siz) { return {Consume(siz), siz}; }
+			PacketSpan ReadRemainingData() { return ReadData(size - pos); }
 
 			std::string ReadString(size_t siz) {
 				SPADES_MARK_FUNCTION_DEBUG();
-				// convert to C string once so that null-chars are removed
-				return DecodeString(ReadData(siz).c_str());
+				// stop at the first null-char like a C string
+				PacketSpan span = ReadData(siz);
+				const char* end = static_cast<const char*>(std::memchr(span.data, 0, span.size));
+				return DecodeString(std::string(span.data, end ? end : span.end()));
 			}
 			std::string ReadRemainingString() {
 				SPADES_MARK_FUNCTION_DEBUG();
-				// convert to C string once so that null-chars are removed
-				return DecodeString(ReadRemainingData().c_str());
+				return ReadString(size - pos);
+			}
+
+			// Decoders for the frequent packets. Each checks the bounds once.
+
+			struct WorldUpdateEntry {
+				int playerId;
+				Vector3 position;
+				Vector3 front;
+			};
+
+			/** @param withPlayerId `true` for protocol 0.76, which adds a player ID byte. */
+			std::size_t GetNumWorldUpdateEntries(bool withPlayerId) {
+				return (size - 1) / (withPlayerId ? 25 : 24);
+			}
+			WorldUpdateEntry ReadWorldUpdateEntry(int index, bool withPlayerId) {
+				WorldUpdateEntry entry;
+				const char* p = Consume(withPlayerId ? 25 : 24);
+				if (withPlayerId)
+					entry.playerId = static_cast<uint8_t>(*(p++));
+				else
+					entry.playerId = index;
+				entry.position = LoadVector3(p);
+				entry.front = LoadVector3(p + 12);
+				return entry;
+			}
+
+			struct BlockAction {
+				int playerId;
+				int action;
+				IntVector3 position;
+			};
+
+			BlockAction ReadBlockAction() {
+				const char* p = Consume(14);
+				BlockAction blockAction;
+				blockAction.playerId = static_cast<uint8_t>(p[0]);
+				blockAction.action = static_cast<uint8_t>(p[1]);
+				blockAction.position = LoadIntVector3(p + 2);
+				return blockAction;
+			}
+
+			/** The layout of `InputData` and `WeaponInput`. */
+			struct InputBits {
+				int playerId;
+				uint8_t bits;
+			};
+
+			InputBits ReadInputBits() {
+				const char* p = Consume(2);
+				return {static_cast<uint8_t>(p[0]), static_cast<uint8_t>(p[1])};
 			}
 
 			void DumpDebug() {
 #if 1
 				char buf[1024];
 				std::string str;
-				sprintf(buf, "Packet 0x%02x [len=%d]", (int)GetType(), (int)data.size());
+				sprintf(buf, "Packet 0x%02x [len=%d]", (int)GetType(), (int)size);
 				str = buf;
-				int bytes = (int)data.size();
+				int bytes = (int)size;
 				if (bytes > 64)
 					bytes = 64;
 
@@ -336,6 +426,8 @@ namespace spades {
 
 			std::size_t GetPosition() { return data.size(); }
 
+			const std::vector<char>& GetData() const { return data; }
+
 			void Update(std::size_t position, std::uint8_t newValue) {
 				SPADES_MARK_FUNCTION_DEBUG();
 
@@ -365,7 +457,7 @@ namespace spades {
 			}
 		};
 
-		NetClient::NetClient(Client* c) : client(c), host(nullptr), peer(nullptr) {
+		NetClient::NetClient(INetClientListener* c) : client(c), host(nullptr), peer(nullptr) {
 			SPADES_MARK_FUNCTION();
 
 			enet_initialize();
@@ -393,7 +485,7 @@ namespace spades {
 
 			std::fill(savedPlayerTeam.begin(), savedPlayerTeam.end(), -1);
 
-			bandwidthMonitor.reset(new BandwidthMonitor(host));
+			bandwidthMonitor.reset(new BandwidthMonitor());
 		}
 		NetClient::~NetClient() {
 			SPADES_MARK_FUNCTION();
@@ -426,12 +518,15 @@ namespace spades {
 			ENetAddress addr = hostname.GetENetAddress();
 			SPLog("Connecting to %u:%u", (unsigned int)addr.host, (unsigned int)addr.port);
 
-			savedPackets.clear();
+			savedPackets.Clear();
 
 			peer = enet_host_connect(host, &addr, 1, protocolVersion);
 			if (peer == NULL)
 				SPRaise("Failed to create ENet peer");
 
+			networkThread = stmp::make_unique<NetworkThread>(*host, *peer);
+			networkThread->Start();
+
 			properties.reset(new GameProperties(hostname.GetProtocolVersion()));
 
 			status = NetClientStatusConnecting;
@@ -441,14 +536,24 @@ namespace spades {
 		void NetClient::Disconnect() {
 			SPADES_MARK_FUNCTION();
 
+			if (demoPlayer) {
+				demoPlayer.reset();
+				status = NetClientStatusNotConnected;
+				statusString = _Tr("NetClient", "Not connected");
+				return;
+			}
+
 			if (!peer)
 				return;
 
+			StopNetworkThread();
+			demoRecorder.reset();
+
 			enet_peer_disconnect(peer, 0);
 			status = NetClientStatusNotConnected;
 			statusString = _Tr("NetClient", "Not connected");
 
-			savedPackets.clear();
+			savedPackets.Clear();
 
 			ENetEvent event;
 			SPLog("Waiting for graceful disconnection");
@@ -476,10 +581,10 @@ namespace spades {
 		int NetClient::GetPing() {
 			SPADES_MARK_FUNCTION();
 
-			if (status == NetClientStatusNotConnected)
+			if (status == NetClientStatusNotConnected || !networkThread)
 				return -1;
 
-			auto rtt = peer->roundTripTime;
+			auto rtt = networkThread->GetRoundTripTime();
 			if (rtt == 0)
 				return -1;
 			return static_cast<int>(rtt);
@@ -491,15 +596,28 @@ namespace spades {
 			if (status == NetClientStatusNotConnected)
 				return;
 
-			if (bandwidthMonitor)
+			if (demoPlayer) {
+				DoDemoEvents();
+				return;
+			}
+
+			if (bandwidthMonitor && networkThread) {
+				std::uint64_t sent, received;
+				networkThread->TakeTraffic(sent, received);
+				bandwidthMonitor->AccumulateTraffic(sent, received);
 				bandwidthMonitor->Update();
+			}
+
+			NetworkThread::Event event;
+			while (networkThread && networkThread->PollEvent(event, timeout)) {
+				currentPacketAge = networkThread->GetTime() - event.arrivalTime;
 
-			ENetEvent event;
-			while (enet_host_service(host, &event, timeout) > 0) {
 				if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
 					if (GetWorld())
 						client->SetWorld(NULL);
 
+					StopNetworkThread();
+					demoRecorder.reset();
 					enet_peer_reset(peer);
 					peer = NULL;
 					status = NetClientStatusNotConnected;
@@ -510,131 +628,145 @@ namespace spades {
 					SPRaise("Disconnected: %s", reasonStr.c_str());
 				}
 
-				stmp::optional<NetPacketReader> readerOrNone;
-				if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-					readerOrNone.reset(event.packet);
-					auto& reader = readerOrNone.value();
-
-					try {
-						if (HandleHandshakePackets(reader))
-							continue;
-					} catch (const std::exception& ex) {
-						int type = reader.GetType();
-						reader.DumpDebug();
-						SPRaise("Exception while handling packet type 0x%08x:\n%s", type, ex.what());
+				if (event.type == ENET_EVENT_TYPE_CONNECT) {
+					if (status == NetClientStatusConnecting)
+						statusString = _Tr("NetClient", "Awaiting for state");
+				} else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+					NetPacketReader reader(event.packet);
+					if (demoRecorder) {
+						PacketSpan payload = reader.GetData();
+						demoRecorder->AddPacket(event.arrivalTime, payload.data, payload.size);
 					}
-				}
 
-				if (status == NetClientStatusConnecting) {
-					if (event.type == ENET_EVENT_TYPE_CONNECT) {
-						statusString = _Tr("NetClient", "Awaiting for state");
-					} else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-						auto& reader = readerOrNone.value();
-						reader.DumpDebug();
-						if (reader.GetType() != PacketTypeMapStart)
-							SPRaise("Unexpected packet: %d", (int)reader.GetType());
+					HandleReceivedPacket(reader);
+				}
+			}
 
-						auto mapSize = reader.ReadInt();
-						SPLog("Map size advertised by the server: %lu", (unsigned long)mapSize);
+			if (demoRecorder && networkThread && status == NetClientStatusConnected) {
+				double time = networkThread->GetTime();
+				if (demoRecorder->IsKeyframeDue(time))
+					WriteDemoKeyframe(time);
+			}
+		}
 
-						mapLoader.reset(new GameMapLoader());
-						mapLoadMonitor.reset(new MapDownloadMonitor(*mapLoader));
+		void NetClient::HandleReceivedPacket(NetPacketReader& reader) {
+			SPADES_MARK_FUNCTION();
 
-						status = NetClientStatusReceivingMap;
-						statusString = _Tr("NetClient", "Loading snapshot");
-					}
-				} else if (status == NetClientStatusReceivingMap) {
-					SPAssert(mapLoader);
+			try {
+				if (HandleHandshakePackets(reader))
+					return;
+			} catch (const std::exception& ex) {
+				int type = reader.GetType();
+				reader.DumpDebug();
+				SPRaise("Exception while handling packet type 0x%08x:\n%s", type, ex.what());
+			}
 
-					if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-						auto& reader = readerOrNone.value();
+			if (status == NetClientStatusConnecting) {
+				reader.DumpDebug();
+				if (reader.GetType() != PacketTypeMapStart)
+					SPRaise("Unexpected packet: %d", (int)reader.GetType());
 
-						if (reader.GetType() == PacketTypeMapChunk) {
-							std::vector<char> dt = reader.GetData();
+				StartMapLoad(reader);
+			} else if (status == NetClientStatusReceivingMap) {
+				SPAssert(mapLoader);
 
-							mapLoader->AddRawChunk(dt.data() + 1, dt.size() - 1);
-							mapLoadMonitor->AccumulateBytes(
-							  static_cast<unsigned int>(dt.size() - 1));
-						} else {
-							reader.DumpDebug();
-
-							// The actual size of the map data cannot be known beforehand because
-							// of compression. This means we must detect the end of the map
-							// transfer in another way.
-							//
-							// We do this by checking for a StateData packet, which is sent
-							// directly after the map transfer completes.
-							//
-							// A number of other packets can also be received while loading the map:
-							//
-							//  - World update packets (WorldUpdate, ExistingPlayer, and
-							//    CreatePlayer) for the current round. We must store such packets
-							//    temporarily and process them later when a `World` is created.
-							//
-							//  - Leftover reload packet from the previous round. This happens when
-							//    you initiate the reload action and a map change occurs before it
-							//    is completed. In pyspades, sending a reload packet is implemented
-							//    by registering a callback function to the Twisted reactor. This
-							//    callback function sends a reload packet, but it does not check if
-							//    the current game round is finished, nor is it unregistered on a
-							//    map change.
-							//
-							//    Such a reload packet would not (and should not) have any effect on
-							//    the current round. Also, an attempt to process it would result in
-							//    an "invalid player ID" exception, so we simply drop it during
-							//    map load sequence.
-							//
-
-							if (reader.GetType() == PacketTypeStateData) {
-								status = NetClientStatusConnected;
-								statusString = _Tr("NetClient", "Connected");
-
-								try {
-									MapLoaded();
-								} catch (const std::exception& ex) {
-									if (strstr(ex.what(), "File truncated") ||
-									    strstr(ex.what(), "EOF reached")) {
-										SPLog("Map decoder returned error:\n%s", ex.what());
-										Disconnect();
-										statusString = _Tr("NetClient", "Error");
-										throw;
-									}
-								} catch (...) {
-									Disconnect();
-									statusString = _Tr("NetClient", "Error");
-									throw;
-								}
+				if (reader.GetType() == PacketTypeMapChunk) {
+					PacketSpan chunk = reader.ReadRemainingData();
 
-								HandleGamePacket(reader);
-							} else if (reader.GetType() == PacketTypeWeaponReload) {
-								// Drop the reload packet. Pyspades does not
-								// cancel the reload packets on map change and
-								// they would cause an error if we would
-								// process them
-							} else {
-								// Save the packet for later
-								savedPackets.push_back(reader.GetData());
-							}
-						}
-					}
-				} else if (status == NetClientStatusConnected) {
-					if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-						auto& reader = readerOrNone.value();
+					mapLoader->AddRawChunk(chunk.data, chunk.size);
+					mapLoadMonitor->AccumulateBytes(static_cast<unsigned int>(chunk.size));
+				} else {
+					reader.DumpDebug();
+
+					// The actual size of the map data cannot be known beforehand because
+					// of compression. This means we must detect the end of the map
+					// transfer in another way.
+					//
+					// We do this by checking for a StateData packet, which is sent
+					// directly after the map transfer completes.
+					//
+					// A number of other packets can also be received while loading the map:
+					//
+					//  - World update packets (WorldUpdate, ExistingPlayer, and
+					//    CreatePlayer) for the current round. We must store such packets
+					//    temporarily and process them later when a `World` is created.
+					//
+					//  - Leftover reload packet from the previous round. This happens when
+					//    you initiate the reload action and a map change occurs before it
+					//    is completed. In pyspades, sending a reload packet is implemented
+					//    by registering a callback function to the Twisted reactor. This
+					//    callback function sends a reload packet, but it does not check if
+					//    the current game round is finished, nor is it unregistered on a
+					//    map change.
+					//
+					//    Such a reload packet would not (and should not) have any effect on
+					//    the current round. Also, an attempt to process it would result in
+					//    an "invalid player ID" exception, so we simply drop it during
+					//    map load sequence.
+					//
+
+					if (reader.GetType() == PacketTypeStateData) {
+						status = NetClientStatusConnected;
+						statusString = _Tr("NetClient", "Connected");
 
 						try {
-							HandleGamePacket(reader);
+							MapLoaded();
 						} catch (const std::exception& ex) {
-							int type = reader.GetType();
-							reader.DumpDebug();
-							SPRaise("Exception while handling packet type 0x%08x:\n%s", type, ex.what());
+							if (strstr(ex.what(), "File truncated") ||
+							    strstr(ex.what(), "EOF reached")) {
+								SPLog("Map decoder returned error:\n%s", ex.what());
+								Disconnect();
+								statusString = _Tr("NetClient", "Error");
+								throw;
+							}
+						} catch (...) {
+							Disconnect();
+							statusString = _Tr("NetClient", "Error");
+							throw;
 						}
+
+						HandleGamePacket(reader);
+					} else if (reader.GetType() == PacketTypeWeaponReload) {
+						// Drop the reload packet. Pyspades does not
+						// cancel the reload packets on map change and
+						// they would cause an error if we would
+						// process them
+					} else {
+						// Save the packet for later
+						PacketSpan packet = reader.GetData();
+						savedPackets.Add(packet.data, packet.size, GetCoalescingKey(reader));
 					}
 				}
+			} else if (status == NetClientStatusConnected) {
+				try {
+					HandleGamePacket(reader);
+				} catch (const std::exception& ex) {
+					int type = reader.GetType();
+					reader.DumpDebug();
+					SPRaise("Exception while handling packet type 0x%08x:\n%s", type, ex.what());
+				}
 			}
 		}
 
 		stmp::optional<World&> NetClient::GetWorld() { return client->GetWorld(); }
 
+		void NetClient::SendPacket(ENetPacket* packet) {
+			if (!networkThread) {
+				// Playing a demo
+				enet_packet_destroy(packet);
+				return;
+			}
+			networkThread->Send(packet);
+		}
+
+		void NetClient::StopNetworkThread() {
+			if (!networkThread)
+				return;
+
+			networkThread->Stop();
+			networkThread.reset();
+		}
+
 		stmp::optional<Player&> NetClient::GetPlayerOrNull(int pId) {
 			SPADES_MARK_FUNCTION();
 			if (!GetWorld())
@@ -737,6 +869,26 @@ namespace spades {
 			SendSupportedExtensions();
 		}
 
+		stmp::optional<std::uint32_t> NetClient::GetCoalescingKey(NetPacketReader& r) {
+			std::uint32_t type = r.GetTypeRaw();
+			switch (r.GetType()) {
+				case PacketTypePositionData:
+				case PacketTypeOrientationData:
+					// Only sent for the local player
+					return type;
+				case PacketTypeWorldUpdate:
+					// 0.75 sends all players in every packet, but 0.76 doesn't
+					if (protocolVersion == 3)
+						return type;
+					return {};
+				default:
+					// The other per-player states (e.g., the tool and the block color) are read
+					// by the handlers of later packets such as BlockAction, so dropping their
+					// earlier updates would change the outcome of the replay
+					return {};
+			}
+		}
+
 		void NetClient::HandleGamePacket(spades::client::NetPacketReader& r) {
 			SPADES_MARK_FUNCTION();
 
@@ -748,30 +900,37 @@ namespace spades {
 						// ignore this now
 						break;
 					}
-					p.RepositionPlayer(r.ReadVector3());
+					Vector3 position = r.ReadVector3();
+					// Without a measured round trip time, there's no telling which of the
+					// recorded inputs the server has seen yet
+					int ping = GetPing();
+					if (ping < 0)
+						p.RepositionPlayer(position);
+					else
+						p.GetWorld().ReconcileLocalPlayer(position, ping / 1000.0F);
+					p.GetWorld().InvalidatePlayerGrid();
 				} break;
 				case PacketTypeOrientationData: {
 					Player& p = GetLocalPlayer();
 					p.SetOrientation(r.ReadVector3());
 				} break;
 				case PacketTypeWorldUpdate: {
-					int bytesPerEntry = 24;
-					if (protocolVersion == 4)
-						bytesPerEntry++;
+					bool withPlayerId = protocolVersion == 4;
 
 					client->MarkWorldUpdate();
+					if (GetWorld())
+						GetWorld()->MarkPlayerSnapshotArrival(static_cast<float>(currentPacketAge));
 
-					int entries = static_cast<int>(r.GetPosition() / bytesPerEntry);
+					int entries = static_cast<int>(r.GetNumWorldUpdateEntries(withPlayerId));
 					for (int i = 0; i < entries; i++) {
-						int idx = i;
-						if (protocolVersion == 4) {
-							idx = r.ReadByte();
-							if (idx < 0 || idx >= properties->GetMaxNumPlayerSlots())
-								SPRaise("Invalid player ID %d received with WorldUpdate", idx);
-						}
+						NetPacketReader::WorldUpdateEntry entry =
+						  r.ReadWorldUpdateEntry(i, withPlayerId);
+						int idx = entry.playerId;
+						if (idx >= properties->GetMaxNumPlayerSlots())
+							SPRaise("Invalid player ID %d received with WorldUpdate", idx);
 
-						Vector3 pos = r.ReadVector3();
-						Vector3 front = r.ReadVector3();
+						Vector3 pos = entry.position;
+						Vector3 front = entry.front;
 
 						savedPlayerPos.at(idx) = pos;
 						savedPlayerFront.at(idx) = front;
@@ -785,8 +944,7 @@ namespace spades {
 								auto p = GetWorld()->GetPlayer(idx);
 								if (p && p != GetWorld()->GetLocalPlayer()
 									&& p->IsAlive() && !p->IsSpectator()) {
-									p->RepositionPlayer(pos);
-									p->SetOrientation(front);
+									GetWorld()->AddPlayerSnapshot(*p, pos, front);
 								}
 							}
 						}
@@ -797,8 +955,9 @@ namespace spades {
 					if (!GetWorld())
 						break;
 					{
-						Player& p = GetPlayer(r.ReadByte());
-						PlayerInput inp = ParsePlayerInput(r.ReadByte());
+						NetPacketReader::InputBits bits = r.ReadInputBits();
+						Player& p = GetPlayer(bits.playerId);
+						PlayerInput inp = ParsePlayerInput(bits.bits);
 
 						if (&p == GetWorld()->GetLocalPlayer()) {
 							if (inp.jump) // handle "/fly" jump
@@ -814,8 +973,9 @@ namespace spades {
 					if (!GetWorld())
 						break;
 					{
-						Player& p = GetPlayer(r.ReadByte());
-						WeaponInput inp = ParseWeaponInput(r.ReadByte());
+						NetPacketReader::InputBits bits = r.ReadInputBits();
+						Player& p = GetPlayer(bits.playerId);
+						WeaponInput inp = ParseWeaponInput(bits.bits);
 
 						if (&p == GetWorld()->GetLocalPlayer())
 							break;
@@ -993,9 +1153,10 @@ namespace spades {
 					client->PlayerSpawned(pRef);
 				} break;
 				case PacketTypeBlockAction: {
-					stmp::optional<Player&> p = GetPlayerOrNull(r.ReadByte());
-					int action = r.ReadByte();
-					IntVector3 pos = r.ReadIntVector3();
+					NetPacketReader::BlockAction blockAction = r.ReadBlockAction();
+					stmp::optional<Player&> p = GetPlayerOrNull(blockAction.playerId);
+					int action = blockAction.action;
+					IntVector3 pos = blockAction.position;
 
 					std::vector<IntVector3> cells;
 					if (action == BlockActionCreate) {
@@ -1008,26 +1169,30 @@ namespace spades {
 								if (p->IsLocalPlayer())
 									client->RegisterPlacedBlocks(1);
 							}
-							client->PlayerCreatedBlock(*p);
+							if (!replayingSavedPackets)
+								client->PlayerCreatedBlock(*p);
 						}
 					} else if (action == BlockActionTool) {
 						cells.push_back(pos);
 						GetWorld()->DestroyBlock(cells);
 						if (p && p->IsToolSpade())
 							p->GotBlock();
-						client->PlayerDestroyedBlockWithWeaponOrTool(pos);
+						if (!replayingSavedPackets)
+							client->PlayerDestroyedBlockWithWeaponOrTool(pos);
 					} else if (action == BlockActionDig) {
 						for (int z = -1; z <= 1; z++)
 							cells.push_back(MakeIntVector3(pos.x, pos.y, pos.z + z));
 						GetWorld()->DestroyBlock(cells);
-						client->PlayerDiggedBlock(pos);
+						if (!replayingSavedPackets)
+							client->PlayerDiggedBlock(pos);
 					} else if (action == BlockActionGrenade) {
 						for (int x = -1; x <= 1; x++)
 						for (int y = -1; y <= 1; y++)
 						for (int z = -1; z <= 1; z++)
 							cells.push_back(MakeIntVector3(pos.x + x, pos.y + y, pos.z + z));
 						GetWorld()->DestroyBlock(cells);
-						client->GrenadeDestroyedBlock(pos);
+						if (!replayingSavedPackets)
+							client->GrenadeDestroyedBlock(pos);
 					}
 				} break;
 				case PacketTypeBlockLine: {
@@ -1049,7 +1214,8 @@ namespace spades {
 						p->UseBlocks(blocks);
 						if (p->IsLocalPlayer())
 							client->RegisterPlacedBlocks(blocks);
-						client->PlayerCreatedBlock(*p);
+						if (!replayingSavedPackets)
+							client->PlayerCreatedBlock(*p);
 					}
 				} break;
 				case PacketTypeStateData:
@@ -1183,19 +1349,9 @@ namespace spades {
 				} break;
 				case PacketTypeMapStart: {
 					// next map!
-					if (protocolVersion == 4)
-						SendMapCached();
-
 					client->SetWorld(NULL);
 
-					auto mapSize = r.ReadInt();
-					SPLog("Map size advertised by the server: %lu", (unsigned long)mapSize);
-
-					mapLoader.reset(new GameMapLoader());
-					mapLoadMonitor.reset(new MapDownloadMonitor(*mapLoader));
-
-					status = NetClientStatusReceivingMap;
-					statusString = _Tr("NetClient", "Loading snapshot");
+					StartMapLoad(r);
 				} break;
 				case PacketTypeMapChunk: SPRaise("Unexpected: received Map Chunk while game");
 				case PacketTypePlayerLeft: {
@@ -1425,7 +1581,7 @@ namespace spades {
 				}
 
 				w.Update(lengthLabel, (uint8_t)(w.GetPosition() - beginLabel));
-				enet_peer_send(peer, 0, w.CreatePacket());
+				SendPacket(w.CreatePacket());
 			}
 		}
 
@@ -1448,7 +1604,7 @@ namespace spades {
 			w.WriteInt((uint32_t)score);
 			w.WriteColor(GetWorld()->GetTeamColor(team));
 			w.WriteString(name, 16);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendPosition(spades::Vector3 v) {
@@ -1456,7 +1612,7 @@ namespace spades {
 
 			NetPacketWriter w(PacketTypePositionData);
 			w.WriteVector3(v);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendOrientation(spades::Vector3 v) {
@@ -1464,7 +1620,7 @@ namespace spades {
 
 			NetPacketWriter w(PacketTypeOrientationData);
 			w.WriteVector3(v);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendPlayerInput(PlayerInput inp) {
@@ -1488,7 +1644,7 @@ namespace spades {
 			NetPacketWriter w(PacketTypeInputData);
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteByte(bits);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendWeaponInput(WeaponInput inp) {
@@ -1504,7 +1660,7 @@ namespace spades {
 			NetPacketWriter w(PacketTypeWeaponInput);
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteByte(bits);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendHit(int targetPlayerId, HitType type) {
@@ -1520,7 +1676,7 @@ namespace spades {
 				case HitTypeMelee: w.WriteByte((uint8_t)4); break;
 				default: SPInvalidEnum("type", type);
 			}
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendGrenade(const Grenade& g) {
@@ -1531,7 +1687,7 @@ namespace spades {
 			w.WriteFloat(g.GetFuse());
 			w.WriteVector3(g.GetPosition());
 			w.WriteVector3(g.GetVelocity());
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendTool() {
@@ -1547,7 +1703,7 @@ namespace spades {
 				case Player::ToolGrenade: w.WriteByte((uint8_t)3); break;
 				default: SPInvalidEnum("tool", type);
 			}
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendHeldBlockColor() {
@@ -1556,7 +1712,7 @@ namespace spades {
 			NetPacketWriter w(PacketTypeSetColour);
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteColor(GetLocalPlayer().GetBlockColor());
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendBlockAction(spades::IntVector3 v, BlockActionType type) {
@@ -1572,7 +1728,7 @@ namespace spades {
 				default: SPInvalidEnum("type", type);
 			}
 			w.WriteIntVector3(v);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendBlockLine(spades::IntVector3 v1, spades::IntVector3 v2) {
@@ -1582,7 +1738,7 @@ namespace spades {
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteIntVector3(v1);
 			w.WriteIntVector3(v2);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendChat(std::string text, bool global) {
@@ -1593,7 +1749,7 @@ namespace spades {
 			w.WriteByte((uint8_t)(global ? 0 : 1));
 			w.WriteString(text);
 			w.WriteByte((uint8_t)0);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendReload() {
@@ -1603,7 +1759,7 @@ namespace spades {
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteByte((uint8_t)0); // clip_ammo; not used?
 			w.WriteByte((uint8_t)0); // reserve_ammo; not used?
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendTeamChange(int team) {
@@ -1612,7 +1768,7 @@ namespace spades {
 			NetPacketWriter w(PacketTypeChangeTeam);
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteByte((uint8_t)team);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendWeaponChange(WeaponType wType) {
@@ -1621,20 +1777,19 @@ namespace spades {
 			NetPacketWriter w(PacketTypeChangeWeapon);
 			w.WriteByte((uint8_t)GetLocalPlayer().GetId());
 			w.WriteByte((uint8_t)wType);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
-		void NetClient::SendMapCached() {
+		void NetClient::SendMapCached(bool cached) {
 			SPADES_MARK_FUNCTION();
 
 			// The AoS 0.76 protocol allows the client to load a map from a local cache
 			// if possible. After receiving MapStart, the client should respond with
 			// MapCached to indicate whether the map with a given checksum exists in the
-			// cache or not. We didn't implement a local cache, so we always ask the
-			// server to send fresh map data.
+			// cache or not.
 			NetPacketWriter w(PacketTypeMapCached);
-			w.WriteByte((uint8_t)0);
-			enet_peer_send(peer, 0, w.CreatePacket());
+			w.WriteByte((uint8_t)(cached ? 1 : 0));
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendHandShakeValid(int challenge) {
@@ -1644,7 +1799,7 @@ namespace spades {
 			w.WriteInt((uint32_t)challenge);
 
 			SPLog("Sending hand shake back.");
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendVersion() {
@@ -1661,7 +1816,7 @@ namespace spades {
 			w.WriteString(osInfo);
 
 			SPLog("Sending version back.");
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
 		}
 
 		void NetClient::SendSupportedExtensions() {
@@ -1675,7 +1830,38 @@ namespace spades {
 			}
 
 			SPLog("Sending extension support.");
-			enet_peer_send(peer, 0, w.CreatePacket());
+			SendPacket(w.CreatePacket());
+		}
+
+		void NetClient::StartMapLoad(NetPacketReader& reader) {
+			SPADES_MARK_FUNCTION();
+
+			if (demoRecorder)
+				demoRecorder->MarkMapStart();
+
+			auto mapSize = reader.ReadInt();
+			SPLog("Map size advertised by the server: %lu", (unsigned long)mapSize);
+
+			// 0.76 servers also advertise the checksum, so the map can be looked up in the cache
+			// before it's sent. The server skips the map transfer if we report a cache hit.
+			Handle<GameMap> cachedMap;
+			mapCacheKey.reset();
+			if (protocolVersion == 4) {
+				GameMapCache::Key key{reader.ReadInt(), mapSize};
+				mapCacheKey = key;
+				cachedMap = GameMapCache::Load(key);
+				// A demo must contain the map, so have it sent anyway while recording
+				SendMapCached(cachedMap && !demoRecorder);
+			}
+
+			if (cachedMap)
+				mapLoader.reset(new GameMapLoader(std::move(cachedMap)));
+			else
+				mapLoader.reset(new GameMapLoader());
+			mapLoadMonitor.reset(new MapDownloadMonitor(*mapLoader));
+
+			status = NetClientStatusReceivingMap;
+			statusString = _Tr("NetClient", "Loading snapshot");
 		}
 
 		void NetClient::MapLoaded() {
@@ -1694,9 +1880,17 @@ namespace spades {
 			GameMap* map = mapLoader->TakeGameMap().Unmanage();
 			SPLog("The game map was decoded successfully.");
 
+			// Store the map under the key advertised by the server, which is the one it will be
+			// looked up by. Servers might send the map even if it's cached, in which case the
+			// data is not decoded and there's nothing new to store.
+			if (mapCacheKey && !mapLoader->IsCached() && mapLoader->GetRawDataSize() > 0)
+				GameMapCache::Store(*mapCacheKey, *map);
+
 			// now initialize world
 			World* w = new World(properties);
 			w->SetMap(map);
+			if (demoRecorder && networkThread)
+				demoRecorder->SetMap(Handle<GameMap>(map), networkThread->GetTime());
 			map->Release();
 			SPLog("World initialized.");
 
@@ -1704,22 +1898,274 @@ namespace spades {
 
 			SPAssert(GetWorld());
 
-			SPLog("World loaded. Processing saved packets (%d)...", (int)savedPackets.size());
+			SPLog("World loaded. Processing saved packets (%d, %d superseded)...",
+			      (int)savedPackets.GetNumPackets(), (int)savedPackets.GetNumSupersededPackets());
 
 			std::fill(savedPlayerTeam.begin(), savedPlayerTeam.end(), -1);
 
-			// do saved packets
+			// do saved packets. The block changes are applied to the map in one transaction
+			// by the next `World::Advance`. `networkThread` keeps acknowledging the new
+			// packets meanwhile.
+			bool wasReplaying = replayingSavedPackets; // `SeekDemo` may be fast-forwarding
+			replayingSavedPackets = true;
 			try {
-				for (const auto& packets : savedPackets) {
-					NetPacketReader r(packets);
+				for (const auto& record : savedPackets.GetRecords()) {
+					if (record.superseded)
+						continue;
+					NetPacketReader r(record.data, record.size);
 					HandleGamePacket(r);
 				}
-				savedPackets.clear();
+				replayingSavedPackets = wasReplaying;
+				savedPackets.Clear();
 				SPLog("Done.");
 			} catch (...) {
-				savedPackets.clear();
+				replayingSavedPackets = wasReplaying;
+				savedPackets.Clear();
+				throw;
+			}
+		}
+
+		void NetClient::StartRecording(std::unique_ptr<IStream> stream) {
+			SPADES_MARK_FUNCTION();
+			SPAssert(networkThread);
+			SPAssert(status == NetClientStatusConnecting);
+
+			demoRecorder = stmp::make_unique<DemoRecorder>(std::move(stream), protocolVersion,
+			                                               networkThread->GetTime());
+		}
+
+		void NetClient::WriteDemoKeyframe(double time) {
+			SPADES_MARK_FUNCTION();
+
+			World& world = GetWorld().value();
+			std::vector<std::vector<char>> packets;
+
+			// The packets are ordered like the ones received while joining a game. The
+			// positions come first because `ExistingPlayer` creates a player at the last
+			// position received.
+			int numPlayers = 0;
+			for (int i = 0; i < static_cast<int>(world.GetNumPlayerSlots()); i++) {
+				if (world.GetPlayer(i))
+					numPlayers = i + 1;
+			}
+
+			{
+				NetPacketWriter w(PacketTypeWorldUpdate);
+				for (int i = 0; i < numPlayers; i++) {
+					stmp::optional<Player&> p = world.GetPlayer(i);
+					if (protocolVersion == 4) {
+						if (!p)
+							continue;
+						w.WriteByte(static_cast<uint8_t>(i));
+					}
+					w.WriteVector3(p ? p->GetPosition() : savedPlayerPos[i]);
+					w.WriteVector3(p ? p->GetFront() : savedPlayerFront[i]);
+				}
+				packets.push_back(w.GetData());
+			}
+
+			stmp::optional<int> localPlayerIndex = world.GetLocalPlayerIndex();
+			for (int i = 0; i < numPlayers; i++) {
+				stmp::optional<Player&> p = world.GetPlayer(i);
+				if (!p || (localPlayerIndex && *localPlayerIndex == i))
+					continue;
+
+				World::PlayerPersistent& pers = world.GetPlayerPersistent(i);
+				NetPacketWriter w(PacketTypeExistingPlayer);
+				w.WriteByte(static_cast<uint8_t>(i));
+				w.WriteByte(static_cast<uint8_t>(p->GetTeamId()));
+				w.WriteByte(static_cast<uint8_t>(p->GetWeaponType()));
+				w.WriteByte(static_cast<uint8_t>(p->GetTool()));
+				w.WriteInt(static_cast<uint32_t>(pers.score));
+				w.WriteColor(p->GetBlockColor());
+				w.WriteString(pers.name);
+				packets.push_back(w.GetData());
+			}
+
+			{
+				NetPacketWriter w(PacketTypeStateData);
+				w.WriteByte(static_cast<uint8_t>(localPlayerIndex ? *localPlayerIndex : 0));
+				w.WriteColor(world.GetFogColor());
+				w.WriteColor(world.GetTeam(0).color);
+				w.WriteColor(world.GetTeam(1).color);
+				w.WriteString(world.GetTeam(0).name, 10);
+				w.WriteString(world.GetTeam(1).name, 10);
+
+				stmp::optional<IGameMode&> mode = world.GetMode();
+				if (mode && mode->ModeType() == IGameMode::m_CTF) {
+					auto& ctf = dynamic_cast<CTFGameMode&>(mode.value());
+					CTFGameMode::Team& team1 = ctf.GetTeam(0);
+					CTFGameMode::Team& team2 = ctf.GetTeam(1);
+
+					w.WriteByte(CTFGameMode::m_CTF);
+					w.WriteByte(static_cast<uint8_t>(team1.score));
+					w.WriteByte(static_cast<uint8_t>(team2.score));
+					w.WriteByte(static_cast<uint8_t>(ctf.GetCaptureLimit()));
+					w.WriteByte((team1.hasIntel ? 1 : 0) | (team2.hasIntel ? 2 : 0));
+
+					// The same layout as the one read by `HandleGamePacket`
+					auto writeIntel = [&](CTFGameMode::Team& carrierTeam,
+					                      CTFGameMode::Team& flagTeam) {
+						if (carrierTeam.hasIntel) {
+							w.WriteByte(static_cast<uint8_t>(carrierTeam.carrierId));
+							for (int i = 0; i < 11; i++)
+								w.WriteByte(0);
+						} else {
+							w.WriteVector3(flagTeam.flagPos);
+						}
+					};
+					writeIntel(team2, team1);
+					writeIntel(team1, team2);
+
+					w.WriteVector3(team1.basePos);
+					w.WriteVector3(team2.basePos);
+				} else {
+					w.WriteByte(IGameMode::m_TC);
+					int numTerritories = 0;
+					if (mode && mode->ModeType() == IGameMode::m_TC)
+						numTerritories = dynamic_cast<TCGameMode&>(mode.value()).GetNumTerritories();
+					w.WriteByte(static_cast<uint8_t>(numTerritories));
+					for (int i = 0; i < numTerritories; i++) {
+						auto& t = dynamic_cast<TCGameMode&>(mode.value()).GetTerritory(i);
+						w.WriteVector3(t.pos);
+						w.WriteByte(static_cast<uint8_t>(t.ownerTeamId));
+					}
+				}
+				packets.push_back(w.GetData());
+			}
+
+			// The local player is created by `CreatePlayer` so that the client follows it
+			if (stmp::optional<Player&> p = world.GetLocalPlayer()) {
+				NetPacketWriter w(PacketTypeCreatePlayer);
+				w.WriteByte(static_cast<uint8_t>(p->GetId()));
+				w.WriteByte(static_cast<uint8_t>(p->GetWeaponType()));
+				w.WriteByte(static_cast<uint8_t>(p->GetTeamId()));
+				w.WriteVector3(p->GetPosition() + MakeVector3(0.0F, 0.0F, 2.4F));
+				w.WriteString(world.GetPlayerPersistent(p->GetId()).name);
+				packets.push_back(w.GetData());
+			}
+
+			demoRecorder->AddKeyframe(time, packets);
+		}
+
+		void NetClient::PlayDemo(std::unique_ptr<DemoPlayer> player) {
+			SPADES_MARK_FUNCTION();
+
+			Disconnect();
+			SPAssert(status == NetClientStatusNotConnected);
+
+			protocolVersion = player->GetProtocolVersion();
+			properties.reset(new GameProperties(protocolVersion == 4 ? ProtocolVersion::v076
+			                                                         : ProtocolVersion::v075));
+			savedPackets.Clear();
+			std::fill(savedPlayerTeam.begin(), savedPlayerTeam.end(), -1);
+
+			demoPlayer = std::move(player);
+			demoStopwatch.Reset();
+			numDemoFrames = 0;
+			demoEndReported = false;
+
+			status = NetClientStatusConnecting;
+			statusString = _Tr("NetClient", "Playing a demo");
+		}
+
+		float NetClient::AdvanceDemoClock(float dt) {
+			if (!demoPlayer)
+				return dt;
+
+			if (!demoPlayer->IsFinished())
+				numDemoFrames++;
+			return demoPlayer->Advance(dt, std::max(static_cast<float>(cg_demoSpeed), 0.0F));
+		}
+
+		void NetClient::DoDemoEvents() {
+			SPADES_MARK_FUNCTION();
+
+			while (stmp::optional<DemoPlayer::Packet> packet = demoPlayer->ReadPacket()) {
+				currentPacketAge = demoPlayer->GetTime() - packet->time;
+
+				NetPacketReader reader(packet->data, packet->size);
+				HandleReceivedPacket(reader);
+			}
+
+			if (demoPlayer->IsFinished() && !demoEndReported) {
+				demoEndReported = true;
+				SPLog("Demo finished: %.2f seconds of the game played in %.2f seconds (%d frames)",
+				      demoPlayer->GetTime(), demoStopwatch.GetTime(), numDemoFrames);
+				statusString = _Tr("NetClient", "End of the demo");
+			}
+		}
+
+		Handle<GameMap> NetClient::LoadDemoMap(std::size_t mapStartRecord) {
+			SPADES_MARK_FUNCTION();
+
+			// The map chunks are followed by StateData
+			GameMapLoader loader;
+			for (std::size_t i = mapStartRecord + 1; i < demoPlayer->GetNumRecords(); i++) {
+				DemoPlayer::Packet packet = demoPlayer->GetPacket(i);
+				NetPacketReader reader(packet.data, packet.size);
+				if (reader.GetType() == PacketTypeStateData)
+					break;
+				if (reader.GetType() == PacketTypeMapChunk) {
+					PacketSpan chunk = reader.ReadRemainingData();
+					loader.AddRawChunk(chunk.data, chunk.size);
+				}
+			}
+
+			loader.MarkEOF();
+			loader.WaitComplete();
+			return loader.TakeGameMap();
+		}
+
+		void NetClient::SeekDemo(double time) {
+			SPADES_MARK_FUNCTION();
+
+			if (!demoPlayer)
+				SPRaise("Not playing a demo");
+
+			stmp::optional<DemoPlayer::Keyframe> keyframe = demoPlayer->Seek(time);
+
+			if (GetWorld())
+				client->SetWorld(NULL);
+			mapLoader.reset();
+			mapLoadMonitor.reset();
+			savedPackets.Clear();
+			std::fill(savedPlayerTeam.begin(), savedPlayerTeam.end(), -1);
+			demoEndReported = false;
+
+			// Skip the effects of the events on the way
+			replayingSavedPackets = true;
+			try {
+				if (keyframe) {
+					Handle<GameMap> map = LoadDemoMap(keyframe->mapStartRecord);
+					for (const DemoPlayer::VoxelChange& voxel : keyframe->voxels) {
+						const IntVector3& v = voxel.position;
+						if (map->IsValidMapCoord(v.x, v.y, v.z))
+							map->Set(v.x, v.y, v.z, voxel.solid, voxel.color);
+					}
+
+					World* w = new World(properties);
+					w->SetMap(map);
+					client->SetWorld(w);
+
+					status = NetClientStatusConnected;
+					for (const DemoPlayer::Packet& packet : keyframe->packets) {
+						NetPacketReader reader(packet.data, packet.size);
+						HandleGamePacket(reader);
+					}
+				} else {
+					status = NetClientStatusConnecting;
+				}
+
+				DoDemoEvents();
+				replayingSavedPackets = false;
+			} catch (...) {
+				replayingSavedPackets = false;
 				throw;
 			}
+
+			SPLog("Demo seeked to %.1f seconds (keyframe at %.1f seconds)", demoPlayer->GetTime(),
+			      keyframe ? keyframe->time : 0.0);
 		}
 
 		float NetClient::GetMapReceivingProgress() {
@@ -1728,6 +2174,12 @@ namespace spades {
 			return mapLoader->GetProgress();
 		}
 
+		Handle<GameMap> NetClient::GetReceivingGameMap() {
+			SPAssert(status == NetClientStatusReceivingMap);
+
+			return mapLoader->GetPartialGameMap();
+		}
+
 		std::string NetClient::GetStatusString() {
 			if (status == NetClientStatusReceivingMap) {
 				// Display extra information
@@ -1739,17 +2191,20 @@ namespace spades {
 			return statusString;
 		}
 
-		NetClient::BandwidthMonitor::BandwidthMonitor(ENetHost* host)
-		    : host(host), lastDown(0.0), lastUp(0.0) {
-			sw.Reset();
+		NetClient::BandwidthMonitor::BandwidthMonitor() : lastDown(0.0), lastUp(0.0) { sw.Reset(); }
+
+		void NetClient::BandwidthMonitor::AccumulateTraffic(std::uint64_t sent,
+		                                                    std::uint64_t received) {
+			sentBytes += sent;
+			receivedBytes += received;
 		}
 
 		void NetClient::BandwidthMonitor::Update() {
 			if (sw.GetTime() > 0.5) {
-				lastUp = host->totalSentData / sw.GetTime();
-				lastDown = host->totalReceivedData / sw.GetTime();
-				host->totalSentData = 0;
-				host->totalReceivedData = 0;
+				lastUp = sentBytes / sw.GetTime();
+				lastDown = receivedBytes / sw.GetTime();
+				sentBytes = 0;
+				receivedBytes = 0;
 				sw.Reset();
 			}
 		}
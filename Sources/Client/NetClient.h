@@ -28,23 +28,30 @@
 #include <unordered_map>
 #include <vector>
 
+#include "DeferredPacketQueue.h"
+#include "GameMapCache.h"
 #include "PhysicsConstants.h"
 #include "Player.h"
 #include <Core/Debug.h>
 #include <Core/Math.h>
 #include <Core/ServerAddress.h>
 #include <Core/Stopwatch.h>
+#include <Core/TMPUtils.h>
 #include <Core/VersionInfo.h>
 #include <OpenSpades.h>
 
 struct _ENetHost;
 struct _ENetPeer;
+struct _ENetPacket;
 typedef _ENetHost ENetHost;
 typedef _ENetPeer ENetPeer;
+typedef _ENetPacket ENetPacket;
 
 namespace spades {
+	class IStream;
+
 	namespace client {
-		class Client;
+		class INetClientListener;
 		class Player;
 		enum NetClientStatus {
 			NetClientStatusNotConnected = 0,
@@ -66,13 +73,19 @@ namespace spades {
 		struct WeaponInput;
 		class Grenade;
 		struct GameProperties;
+		class GameMap;
 		class GameMapLoader;
+		class NetworkThread;
+		class DemoRecorder;
+		class DemoPlayer;
 
 		class NetClient {
-			Client* client;
+			INetClientListener* client;
 			NetClientStatus status;
 			ENetHost* host;
 			ENetPeer* peer;
+			/** Services `host` while `peer` exists. */
+			std::unique_ptr<NetworkThread> networkThread;
 			std::string statusString;
 
 			class MapDownloadMonitor {
@@ -92,6 +105,11 @@ namespace spades {
 			std::unique_ptr<GameMapLoader> mapLoader;
 			/** Only valid in the `NetClientStatusReceivingMap` state */
 			std::unique_ptr<MapDownloadMonitor> mapLoadMonitor;
+			/**
+			 * The key advertised by the server in MapStart, if any. The received map is stored
+			 * in `GameMapCache` under this key.
+			 */
+			stmp::optional<GameMapCache::Key> mapCacheKey;
 
 			std::shared_ptr<GameProperties> properties;
 
@@ -102,13 +120,15 @@ namespace spades {
 			std::unordered_map<uint8_t, uint8_t> implementedExtensions{{ExtensionType128Player, 1},};
 
 			class BandwidthMonitor {
-				ENetHost* host;
 				Stopwatch sw;
+				std::uint64_t sentBytes = 0;
+				std::uint64_t receivedBytes = 0;
 				double lastDown;
 				double lastUp;
 
 			public:
-				BandwidthMonitor(ENetHost*);
+				BandwidthMonitor();
+				void AccumulateTraffic(std::uint64_t sent, std::uint64_t received);
 				double GetDownlinkBps() { return lastDown * 8.0; }
 				double GetUplinkBps() { return lastUp * 8.0; }
 				void Update();
@@ -120,7 +140,18 @@ namespace spades {
 			std::vector<Vector3> savedPlayerFront;
 			std::vector<int> savedPlayerTeam;
 
-			std::vector<std::vector<char>> savedPackets;
+			/** The game packets received during the map transfer. */
+			DeferredPacketQueue savedPackets;
+			/** Set while `savedPackets` are processed to skip the effects of past events. */
+			bool replayingSavedPackets = false;
+
+			/** Writes the received packets to a demo file while connected. */
+			std::unique_ptr<DemoRecorder> demoRecorder;
+			/** Supplies the packets instead of `networkThread` while playing a demo. */
+			std::unique_ptr<DemoPlayer> demoPlayer;
+			Stopwatch demoStopwatch;
+			int numDemoFrames = 0;
+			bool demoEndReported = false;
 
 			unsigned int lastPlayerInput;
 			unsigned int lastWeaponInput;
@@ -128,9 +159,19 @@ namespace spades {
 			// used for some scripts including Arena
 			IntVector3 temporaryPlayerBlockColor;
 
+			/** Handles a packet received in any state. */
+			void HandleReceivedPacket(NetPacketReader&);
 			bool HandleHandshakePackets(NetPacketReader&);
 			void HandleExtensionPacket(NetPacketReader&);
 			void HandleGamePacket(NetPacketReader&);
+			/** The age of the packet being handled, in seconds. */
+			double currentPacketAge = 0.0;
+			/**
+			 * Returns the key by which a packet saved while the map is loading can be replaced
+			 * by a later one. Only the packets that overwrite a state that no other packet's
+			 * handler reads have a key.
+			 */
+			stmp::optional<std::uint32_t> GetCoalescingKey(NetPacketReader&);
 			stmp::optional<World&> GetWorld();
 			Player& GetPlayer(int);
 			stmp::optional<Player&> GetPlayerOrNull(int);
@@ -139,15 +180,26 @@ namespace spades {
 
 			std::string DisconnectReasonString(uint32_t);
 
+			void SendPacket(ENetPacket*);
+			void StopNetworkThread();
+
+			void DoDemoEvents();
+			/** Writes the world packets of a keyframe, mimicking what a joining client gets. */
+			void WriteDemoKeyframe(double time);
+			/** Decodes the map chunks following the specified record of the demo. */
+			Handle<GameMap> LoadDemoMap(std::size_t mapStartRecord);
+
+			/** Handles a MapStart packet. */
+			void StartMapLoad(NetPacketReader&);
 			void MapLoaded();
 
-			void SendMapCached();
+			void SendMapCached(bool cached);
 			void SendVersion();
 			void SendVersionEnhanced(const std::set<std::uint8_t>& propertyIds);
 			void SendSupportedExtensions();
 
 		public:
-			NetClient(Client*);
+			NetClient(INetClientListener*);
 			~NetClient();
 
 			NetClientStatus GetStatus() { return status; }
@@ -162,6 +214,16 @@ namespace spades {
 			 */
 			float GetMapReceivingProgress();
 
+			/**
+			 * Gets the map being received. Only the rows reported by
+			 * `GameMap::GetNumLoadedRows` are accessible.
+			 * `GetStatus()` must be `NetClientStatusReceivingMap`.
+			 *
+			 * @return The partially loaded map, or a null handle if progressive map
+			 *         loading is disabled.
+			 */
+			Handle<GameMap> GetReceivingGameMap();
+
 			/**
 			 * Return a non-null reference to `GameProperties` for this connection.
 			 * Must be the connected state.
@@ -174,6 +236,26 @@ namespace spades {
 			void Connect(const ServerAddress& hostname);
 			void Disconnect();
 
+			/**
+			 * Writes the packets received from now on to the stream as a demo. Must be called
+			 * right after `Connect`. The recording ends with the connection.
+			 */
+			void StartRecording(std::unique_ptr<IStream>);
+
+			/** Plays a demo instead of connecting to a server. Outgoing packets are discarded. */
+			void PlayDemo(std::unique_ptr<DemoPlayer>);
+			bool IsPlayingDemo() { return demoPlayer != nullptr; }
+
+			/**
+			 * Advances the demo playback by the real time `dt` at the speed set by
+			 * `cg_demoSpeed` (0 = as fast as possible) and returns the game time that passed.
+			 * Returns `dt` if no demo is being played.
+			 */
+			float AdvanceDemoClock(float dt);
+
+			/** Restarts the demo playback from the specified time, in seconds. */
+			void SeekDemo(double time);
+
 			int GetPing();
 
 			void DoEvents(int timeout = 0);
@@ -0,0 +1,164 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include "NetworkThread.h"
+#include <Core/Debug.h>
+#include <Core/TMPUtils.h>
+#include <Core/Thread.h>
+#include <Imports/SDL.h>
+
+namespace spades {
+	namespace client {
+		namespace {
+			/** How long `enet_host_service` waits for a packet, in milliseconds. This also
+			 * bounds the delay before a packet passed to `Send` is sent. */
+			constexpr int ServiceTimeout = 1;
+		} // namespace
+
+		NetworkThread::NetworkThread(ENetHost& host, ENetPeer& peer)
+		    : host(host), peer(peer), outgoing(1024), incoming(4096) {}
+
+		NetworkThread::~NetworkThread() { Stop(); }
+
+		void NetworkThread::Start() {
+			SPADES_MARK_FUNCTION();
+			SPAssert(!thread);
+
+			stopwatch.Reset();
+			stopRequested = false;
+			thread = stmp::make_unique<Thread>(this);
+			thread->Start();
+		}
+
+		void NetworkThread::Stop() {
+			SPADES_MARK_FUNCTION();
+
+			if (!thread)
+				return;
+
+			stopRequested = true;
+			thread->Join();
+			thread.reset();
+
+			// Now this thread owns the host
+			SendPendingPackets();
+
+			Event event;
+			while (incoming.TryPop(event)) {
+				if (event.packet)
+					enet_packet_destroy(event.packet);
+			}
+		}
+
+		void NetworkThread::Send(ENetPacket* packet) {
+			while (!outgoing.TryPush(packet))
+				SDL_Delay(0);
+		}
+
+		bool NetworkThread::PollEvent(Event& event, int timeout) {
+			if (incoming.TryPop(event))
+				return true;
+
+			for (int i = 0; i < timeout; i++) {
+				SDL_Delay(1);
+				if (incoming.TryPop(event))
+					return true;
+			}
+			return false;
+		}
+
+		void NetworkThread::TakeTraffic(std::uint64_t& sent, std::uint64_t& received) {
+			sent = bytesSent.exchange(0);
+			received = bytesReceived.exchange(0);
+		}
+
+		void NetworkThread::SendPendingPackets() {
+			ENetPacket* packet;
+			bool sentAny = false;
+			while (outgoing.TryPop(packet)) {
+				if (enet_peer_send(&peer, 0, packet) < 0)
+					enet_packet_destroy(packet);
+				sentAny = true;
+			}
+			if (sentAny)
+				enet_host_flush(&host);
+		}
+
+		void NetworkThread::Run() {
+			SPADES_MARK_FUNCTION();
+
+			Event pending;
+			bool hasPending = false;
+			bool disconnected = false;
+
+			while (!stopRequested) {
+				SendPendingPackets();
+
+				// If the game thread falls behind, leave the packets in ENet's queue
+				if (hasPending) {
+					if (!incoming.TryPush(pending)) {
+						SDL_Delay(1);
+						continue;
+					}
+					hasPending = false;
+				}
+
+				if (disconnected) {
+					// The peer is gone; wait for the game thread to stop us
+					SDL_Delay(1);
+					continue;
+				}
+
+				ENetEvent event;
+				int result = enet_host_service(&host, &event, ServiceTimeout);
+
+				// `roundTripTime` starts at `ENET_PEER_DEFAULT_ROUND_TRIP_TIME`, which is no
+				// measurement. `packetThrottleEpoch` is set by the first acknowledgement.
+				if (peer.packetThrottleEpoch != 0)
+					roundTripTime = peer.roundTripTime;
+				bytesSent += host.totalSentData;
+				bytesReceived += host.totalReceivedData;
+				host.totalSentData = 0;
+				host.totalReceivedData = 0;
+
+				// Take all the events that arrived at once
+				while (result > 0) {
+					pending.type = event.type;
+					pending.packet = event.type == ENET_EVENT_TYPE_RECEIVE ? event.packet : nullptr;
+					pending.data = event.data;
+					pending.arrivalTime = stopwatch.GetTime();
+
+					if (event.type == ENET_EVENT_TYPE_DISCONNECT)
+						disconnected = true;
+
+					if (!incoming.TryPush(pending)) {
+						hasPending = true;
+						break;
+					}
+					if (disconnected)
+						break;
+
+					result = enet_host_check_events(&host, &event);
+				}
+			}
+		}
+	} // namespace client
+} // namespace spades
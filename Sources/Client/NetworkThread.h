@@ -0,0 +1,109 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <enet/enet.h>
+
+#include <Core/IRunnable.h>
+#include <Core/SpscQueue.h>
+#include <Core/Stopwatch.h>
+
+namespace spades {
+	class Thread;
+
+	namespace client {
+		/**
+		 * Services an ENet host on a dedicated thread, so that receiving and sending packets
+		 * doesn't wait for the game thread's next frame.
+		 *
+		 * The game thread posts outgoing packets with `Send` and takes the received events
+		 * with `PollEvent`. Both go through lock-free single-producer single-consumer
+		 * queues. While the thread is running, nothing else may use the host or the peer.
+		 */
+		class NetworkThread : public IRunnable {
+		public:
+			struct Event {
+				ENetEventType type = ENET_EVENT_TYPE_NONE;
+				/** The received packet, owned by the receiver of the event. */
+				ENetPacket* packet = nullptr;
+				std::uint32_t data = 0;
+				/** When the event was received, in seconds since `Start`. */
+				double arrivalTime = 0.0;
+			};
+
+			NetworkThread(ENetHost&, ENetPeer&);
+			~NetworkThread();
+
+			void Start();
+
+			/**
+			 * Stops the thread. The packets posted but not sent yet are handed to ENet, and
+			 * the events not polled yet are discarded. Does nothing if not running.
+			 */
+			void Stop();
+
+			/** Sends a packet to the peer. Takes the ownership of `packet`. */
+			void Send(ENetPacket* packet);
+
+			/**
+			 * Takes the next event received from the peer.
+			 * @param timeout The maximum time to wait for an event, in milliseconds.
+			 * @return `false` if there was no event.
+			 */
+			bool PollEvent(Event&, int timeout = 0);
+
+			/** Returns the current time on the clock used by `Event::arrivalTime`. */
+			double GetTime() { return stopwatch.GetTime(); }
+
+			/**
+			 * Returns the round trip time measured by ENet, or 0 until the first reliable
+			 * packet is acknowledged.
+			 */
+			std::uint32_t GetRoundTripTime() const { return roundTripTime.load(); }
+
+			/** Returns and resets the number of bytes sent and received so far. */
+			void TakeTraffic(std::uint64_t& sent, std::uint64_t& received);
+
+			void Run() override;
+
+		private:
+			ENetHost& host;
+			ENetPeer& peer;
+			std::unique_ptr<Thread> thread;
+			Stopwatch stopwatch;
+
+			SpscQueue<ENetPacket*> outgoing;
+			SpscQueue<Event> incoming;
+
+			std::atomic<bool> stopRequested{false};
+			std::atomic<std::uint32_t> roundTripTime{0};
+			std::atomic<std::uint64_t> bytesSent{0};
+			std::atomic<std::uint64_t> bytesReceived{0};
+
+			void SendPendingPackets();
+		};
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,442 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "Client.h"
+#include "GameMap.h"
+#include "IImage.h"
+#include "ParticleSystem.h"
+#include "World.h"
+#include <Core/Debug.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENABLE_SSE2 1
+#include <emmintrin.h>
+#else
+#define ENABLE_SSE2 0
+#endif
+
+namespace spades {
+	namespace client {
+		namespace {
+			enum ParticleFlags : std::uint8_t {
+				FlagAdditive = 1 << 0,
+				FlagBounce = 1 << 1,
+				FlagDeleteOnHit = 1 << 2,
+				FlagDead = 1 << 3
+			};
+
+			/** `a[i] += b[i] * s` */
+			void MultiplyAdd(float* a, const float* b, float s, std::size_t count) {
+				std::size_t i = 0;
+#if ENABLE_SSE2
+				__m128 sv = _mm_set1_ps(s);
+				for (; i + 4 <= count; i += 4) {
+					__m128 av = _mm_loadu_ps(a + i);
+					__m128 bv = _mm_loadu_ps(b + i);
+					_mm_storeu_ps(a + i, _mm_add_ps(av, _mm_mul_ps(bv, sv)));
+				}
+#endif
+				for (; i < count; i++)
+					a[i] += b[i] * s;
+			}
+
+			/** `a[i] *= b[i]` */
+			void Multiply(float* a, const float* b, std::size_t count) {
+				std::size_t i = 0;
+#if ENABLE_SSE2
+				for (; i + 4 <= count; i += 4) {
+					__m128 av = _mm_loadu_ps(a + i);
+					__m128 bv = _mm_loadu_ps(b + i);
+					_mm_storeu_ps(a + i, _mm_mul_ps(av, bv));
+				}
+#endif
+				for (; i < count; i++)
+					a[i] *= b[i];
+			}
+
+			/** `a[i] += s` */
+			void AddScalar(float* a, float s, std::size_t count) {
+				std::size_t i = 0;
+#if ENABLE_SSE2
+				__m128 sv = _mm_set1_ps(s);
+				for (; i + 4 <= count; i += 4)
+					_mm_storeu_ps(a + i, _mm_add_ps(_mm_loadu_ps(a + i), sv));
+#endif
+				for (; i < count; i++)
+					a[i] += s;
+			}
+
+			/** Same as `GameMap::ClipWorld`, reading the solid bit columns directly. */
+			inline bool ClipWorld(const GameMap& map, int x, int y, int z) {
+				if (x < 0 || x >= GameMap::DefaultWidth || y < 0 || y >= GameMap::DefaultHeight ||
+				    z < 0)
+					return false;
+				if (z >= GameMap::DefaultDepth - 1) {
+					if (z > GameMap::DefaultDepth - 1)
+						return true;
+					z = GameMap::DefaultDepth - 2;
+				}
+				return ((map.GetSolidMap(x, y) >> z) & 1) != 0;
+			}
+		} // namespace
+
+		void ParticleSystem::Particle::SetLifeTime(float lifeTime, float fadeIn, float fadeOut) {
+			lifetime = lifeTime;
+			fadeInDuration = fadeIn;
+			fadeOutDuration = fadeOut;
+		}
+
+		void ParticleSystem::Particle::SetTrajectory(Vector3 pos, Vector3 vel, float damp,
+		                                             float grav) {
+			position = pos;
+			velocity = vel;
+			velocityDamp = damp;
+			gravityScale = grav;
+		}
+
+		void ParticleSystem::Particle::SetRotation(float initialAng, float angleVel) {
+			angle = initialAng;
+			rotationVelocity = angleVel;
+		}
+
+		void ParticleSystem::Particle::SetRadius(float initialRad, float radVel, float damp) {
+			radius = initialRad;
+			radiusVelocity = radVel;
+			radiusDamp = damp;
+		}
+
+		struct ParticleSystem::Pool {
+			enum Field {
+				PosX, PosY, PosZ,
+				LastPosX, LastPosY, LastPosZ,
+				VelX, VelY, VelZ,
+				Radius, RadiusVelocity,
+				Angle, RotationVelocity,
+				VelocityDamp, RadiusDamp, GravityScale,
+				Time, LifeTime, FadeIn, FadeOut,
+				ColorR, ColorG, ColorB, ColorA,
+				// Only used by smoke
+				Frame, Fps,
+				// The result of `powf` for `VelocityDamp` and `RadiusDamp`
+				VelocityDampFactor, RadiusDampFactor,
+				NumFields
+			};
+
+			/** `nullptr` for smoke. */
+			Handle<IImage> image;
+			SmokeSpriteEntity::Type smokeType;
+
+			std::size_t count = 0;
+			std::vector<float> fields[NumFields];
+			std::vector<std::uint8_t> flags;
+
+			Pool(IImage* image, SmokeSpriteEntity::Type smokeType)
+			    : image(image), smokeType(smokeType) {
+				for (std::vector<float>& field : fields)
+					field.resize(PoolCapacity);
+				flags.resize(PoolCapacity);
+			}
+
+			bool IsSmoke() const { return !image; }
+
+			/** The number of images `Draw` can use. */
+			int GetNumFrames() const {
+				if (!IsSmoke())
+					return 1;
+				return smokeType == SmokeSpriteEntity::Type::Steady ? 180 : 48;
+			}
+
+			float* Get(Field f) { return fields[f].data(); }
+
+			void Add(const Particle& p, float fps) {
+				if (count >= PoolCapacity)
+					return;
+
+				std::size_t i = count++;
+				const float values[NumFields] = {
+				  p.position.x, p.position.y, p.position.z,
+				  p.position.x, p.position.y, p.position.z,
+				  p.velocity.x, p.velocity.y, p.velocity.z,
+				  p.radius, p.radiusVelocity,
+				  p.angle, p.rotationVelocity,
+				  p.velocityDamp, p.radiusDamp, p.gravityScale,
+				  0.0F, p.lifetime, p.fadeInDuration, p.fadeOutDuration,
+				  p.color.x, p.color.y, p.color.z, p.color.w,
+				  0.0F, fps,
+				  1.0F, 1.0F};
+				for (int f = 0; f < NumFields; f++)
+					fields[f][i] = values[f];
+
+				std::uint8_t fl = 0;
+				if (p.additive)
+					fl |= FlagAdditive;
+				if (p.blockHitAction == BlockHitAction::Delete)
+					fl |= FlagDeleteOnHit;
+				else if (p.blockHitAction == BlockHitAction::BounceWeak)
+					fl |= FlagBounce;
+				flags[i] = fl;
+			}
+
+			void Update(float dt, const GameMap* map);
+			void RemoveDead();
+		};
+
+		void ParticleSystem::Pool::Update(float dt, const GameMap* map) {
+			const std::size_t n = count;
+			float* time = Get(Time);
+			const float* lifetime = Get(LifeTime);
+
+			AddScalar(time, dt, n);
+			for (std::size_t i = 0; i < n; i++) {
+				if (time[i] > lifetime[i])
+					flags[i] |= FlagDead;
+			}
+
+			if (IsSmoke()) {
+				// See `SmokeSpriteEntity::Update`
+				float* frame = Get(Frame);
+				MultiplyAdd(frame, Get(Fps), dt, n);
+				if (smokeType == SmokeSpriteEntity::Type::Steady) {
+					for (std::size_t i = 0; i < n; i++)
+						frame[i] = fmodf(frame[i], 180.0F);
+				} else {
+					for (std::size_t i = 0; i < n; i++) {
+						if (frame[i] > 47.0F) {
+							frame[i] = 47.0F;
+							flags[i] |= FlagDead;
+						}
+					}
+				}
+			}
+
+			// See `ParticleSpriteEntity::Update`
+			float* posX = Get(PosX);
+			float* posY = Get(PosY);
+			float* posZ = Get(PosZ);
+			float* lastPosX = Get(LastPosX);
+			float* lastPosY = Get(LastPosY);
+			float* lastPosZ = Get(LastPosZ);
+			float* velX = Get(VelX);
+			float* velY = Get(VelY);
+			float* velZ = Get(VelZ);
+			float* radius = Get(Radius);
+
+			std::copy(posX, posX + n, lastPosX);
+			std::copy(posY, posY + n, lastPosY);
+			std::copy(posZ, posZ + n, lastPosZ);
+			MultiplyAdd(posX, velX, dt, n);
+			MultiplyAdd(posY, velY, dt, n);
+			MultiplyAdd(posZ, velZ, dt, n);
+			MultiplyAdd(velZ, Get(GravityScale), 32.0F * dt, n);
+
+			if (map) {
+				for (std::size_t i = 0; i < n; i++) {
+					std::uint8_t fl = flags[i];
+					if (!(fl & (FlagBounce | FlagDeleteOnHit)) || (fl & FlagDead))
+						continue;
+
+					IntVector3 lp =
+					  MakeVector3(posX[i], posY[i], posZ[i]).Floor();
+					if (!ClipWorld(*map, lp.x, lp.y, lp.z))
+						continue;
+
+					if (fl & FlagDeleteOnHit) {
+						flags[i] |= FlagDead;
+						continue;
+					}
+
+					IntVector3 lp2 = MakeVector3(lastPosX[i], lastPosY[i], lastPosZ[i]).Floor();
+					if (lp.z != lp2.z && ((lp.x == lp2.x && lp.y == lp2.y) ||
+					                      !ClipWorld(*map, lp.x, lp.y, lp2.z)))
+						velZ[i] = -velZ[i];
+					else if (lp.x != lp2.x && ((lp.y == lp2.y && lp.z == lp2.z) ||
+					                           !ClipWorld(*map, lp2.x, lp.y, lp.z)))
+						velX[i] = -velX[i];
+					else if (lp.y != lp2.y && ((lp.x == lp2.x && lp.z == lp2.z) ||
+					                           !ClipWorld(*map, lp.x, lp2.y, lp.z)))
+						velY[i] = -velY[i];
+
+					// set back to old position
+					posX[i] = lastPosX[i];
+					posY[i] = lastPosY[i];
+					posZ[i] = lastPosZ[i];
+
+					// lose some velocity due to friction
+					velX[i] *= 0.46F;
+					velY[i] *= 0.46F;
+					velZ[i] *= 0.46F;
+					radius[i] *= 0.75F;
+				}
+			}
+
+			float* radiusVelocity = Get(RadiusVelocity);
+			MultiplyAdd(radius, radiusVelocity, dt, n);
+			MultiplyAdd(Get(Angle), Get(RotationVelocity), dt, n);
+
+			const float* velocityDamp = Get(VelocityDamp);
+			const float* radiusDamp = Get(RadiusDamp);
+			float* velocityDampFactor = Get(VelocityDampFactor);
+			float* radiusDampFactor = Get(RadiusDampFactor);
+			for (std::size_t i = 0; i < n; i++) {
+				velocityDampFactor[i] =
+				  velocityDamp[i] != 1.0F ? powf(velocityDamp[i], dt) : 1.0F;
+				radiusDampFactor[i] = radiusDamp[i] != 1.0F ? powf(radiusDamp[i], dt) : 1.0F;
+			}
+			Multiply(velX, velocityDampFactor, n);
+			Multiply(velY, velocityDampFactor, n);
+			Multiply(velZ, velocityDampFactor, n);
+			Multiply(radiusVelocity, radiusDampFactor, n);
+
+			RemoveDead();
+		}
+
+		void ParticleSystem::Pool::RemoveDead() {
+			std::size_t i = 0;
+			while (i < count) {
+				if (!(flags[i] & FlagDead)) {
+					i++;
+					continue;
+				}
+
+				// Replace with the last one
+				std::size_t last = --count;
+				if (i != last) {
+					for (std::vector<float>& field : fields)
+						field[i] = field[last];
+					flags[i] = flags[last];
+				}
+			}
+		}
+
+		ParticleSystem::ParticleSystem(Client& client) : client(client) {}
+
+		ParticleSystem::~ParticleSystem() {}
+
+		ParticleSystem::Pool& ParticleSystem::GetPool(IImage* image,
+		                                              SmokeSpriteEntity::Type smokeType) {
+			for (const auto& pool : pools) {
+				if (image ? pool->image.GetPointerOrNull() == image
+				          : pool->IsSmoke() && pool->smokeType == smokeType)
+					return *pool;
+			}
+
+			pools.emplace_back(new Pool(image, smokeType));
+			return *pools.back();
+		}
+
+		void ParticleSystem::AddSprite(IImage& image, const Particle& p) {
+			GetPool(&image, SmokeSpriteEntity::Type::Steady).Add(p, 0.0F);
+		}
+
+		void ParticleSystem::AddSmoke(SmokeSpriteEntity::Type type, float fps, const Particle& p) {
+			GetPool(nullptr, type).Add(p, fps);
+		}
+
+		void ParticleSystem::Clear() {
+			for (const auto& pool : pools)
+				pool->count = 0;
+		}
+
+		std::size_t ParticleSystem::GetNumParticles() const {
+			std::size_t count = 0;
+			for (const auto& pool : pools)
+				count += pool->count;
+			return count;
+		}
+
+		void ParticleSystem::Update(float dt) {
+			SPADES_MARK_FUNCTION();
+
+			World* world = client.GetWorld();
+			const GameMap* map = world ? world->GetMap().GetPointerOrNull() : nullptr;
+
+			for (const auto& pool : pools)
+				pool->Update(dt, map);
+		}
+
+		void ParticleSystem::Draw() {
+			SPADES_MARK_FUNCTION();
+
+			IRenderer& renderer = client.GetRenderer();
+
+			for (const auto& poolPtr : pools) {
+				Pool& pool = *poolPtr;
+				if (pool.count == 0)
+					continue;
+
+				int numFrames = pool.GetNumFrames();
+				if (drawBuffers.size() < static_cast<std::size_t>(numFrames))
+					drawBuffers.resize(numFrames);
+				for (int i = 0; i < numFrames; i++)
+					drawBuffers[i].clear();
+
+				const float* posX = pool.Get(Pool::PosX);
+				const float* posY = pool.Get(Pool::PosY);
+				const float* posZ = pool.Get(Pool::PosZ);
+				const float* radius = pool.Get(Pool::Radius);
+				const float* angle = pool.Get(Pool::Angle);
+				const float* time = pool.Get(Pool::Time);
+				const float* lifetime = pool.Get(Pool::LifeTime);
+				const float* fadeIn = pool.Get(Pool::FadeIn);
+				const float* fadeOut = pool.Get(Pool::FadeOut);
+				const float* frame = pool.Get(Pool::Frame);
+
+				for (std::size_t i = 0; i < pool.count; i++) {
+					// See `ParticleSpriteEntity::Render3D`
+					float fade = 1.0F;
+					if (time[i] < fadeIn[i])
+						fade *= time[i] / fadeIn[i];
+					if (time[i] > lifetime[i] - fadeOut[i])
+						fade *= (lifetime[i] - time[i]) / fadeOut[i];
+
+					Vector4 col = MakeVector4(pool.fields[Pool::ColorR][i], pool.fields[Pool::ColorG][i],
+					                          pool.fields[Pool::ColorB][i], pool.fields[Pool::ColorA][i]);
+					col.w *= fade;
+
+					// premultiplied alpha!
+					col.x *= col.w;
+					col.y *= col.w;
+					col.z *= col.w;
+
+					if (pool.flags[i] & FlagAdditive)
+						col.w = 0.0F;
+
+					int frameIndex = pool.IsSmoke() ? (int)floorf(frame[i]) : 0;
+					drawBuffers[frameIndex].push_back(
+					  SpriteParam{MakeVector3(posX[i], posY[i], posZ[i]), radius[i], angle[i], col});
+				}
+
+				for (int i = 0; i < numFrames; i++) {
+					const std::vector<SpriteParam>& sprites = drawBuffers[i];
+					if (sprites.empty())
+						continue;
+
+					IImage& image = pool.IsSmoke()
+					                  ? SmokeSpriteEntity::GetSequence(i, &renderer, pool.smokeType)
+					                  : *pool.image;
+					renderer.AddSprites(image, sprites.data(), sprites.size());
+				}
+			}
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,113 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "IRenderer.h"
+#include "ParticleSpriteEntity.h"
+#include "SmokeSpriteEntity.h"
+#include <Core/Math.h>
+
+namespace spades {
+	namespace client {
+		class Client;
+		class GameMap;
+		class IImage;
+
+		/**
+		 * Simulates and draws the short-lived sprite particles (debris, smoke, splashes).
+		 *
+		 * This behaves like `ParticleSpriteEntity` and `SmokeSpriteEntity` but doesn't
+		 * allocate an object for each particle. The particles are stored in fixed-capacity
+		 * pools, one for each image (or smoke animation), as a structure of arrays. Removed
+		 * particles are replaced with the last one in the pool.
+		 */
+		class ParticleSystem {
+		public:
+			/** The maximum number of particles in a pool. Extra particles are discarded. */
+			enum { PoolCapacity = 4096 };
+
+			/** The initial state of a particle. The defaults match `ParticleSpriteEntity`. */
+			struct Particle {
+				Vector4 color = MakeVector4(1, 1, 1, 1);
+				bool additive = false;
+				BlockHitAction blockHitAction = BlockHitAction::Delete;
+
+				Vector3 position = MakeVector3(0, 0, 0);
+				Vector3 velocity = MakeVector3(0, 0, 0);
+				float radius = 1.0F, radiusVelocity = 0.0F;
+				float angle = 0.0F, rotationVelocity = 0.0F;
+
+				float velocityDamp = 1.0F;
+				float radiusDamp = 1.0F;
+				float gravityScale = 1.0F;
+
+				float lifetime = 1.0F;
+				float fadeInDuration = 0.1F;
+				float fadeOutDuration = 0.5F;
+
+				Particle(Vector4 color) : color(color) {}
+
+				void SetAdditive(bool b) { additive = b; }
+				void SetLifeTime(float lifeTime, float fadeIn, float fadeOut);
+				void SetTrajectory(Vector3 initialPos, Vector3 initialVel, float velDamp = 1.0F,
+				                   float gravScale = 1.0F);
+				void SetRotation(float initialAng, float angleVel = 0.0F);
+				void SetRadius(float initialRad, float radiusVel = 0.0F, float radDamp = 1.0F);
+				void SetBlockHitAction(BlockHitAction act) { blockHitAction = act; }
+			};
+
+			ParticleSystem(Client&);
+			~ParticleSystem();
+
+			/** Adds a particle drawn with `image`. */
+			void AddSprite(IImage& image, const Particle&);
+
+			/** Adds a particle animated like `SmokeSpriteEntity`. */
+			void AddSmoke(SmokeSpriteEntity::Type, float fps, const Particle&);
+
+			/** Remove all particles. */
+			void Clear();
+
+			/** Update the particles' states. */
+			void Update(float dt);
+
+			/** Issue drawing commands. */
+			void Draw();
+
+			std::size_t GetNumParticles() const;
+
+		private:
+			struct Pool;
+
+			Client& client;
+			/** At most one for each image or smoke type. */
+			std::vector<std::unique_ptr<Pool>> pools;
+			/** Scratch buffers for `Draw`, one for each image drawn by a pool. */
+			std::vector<std::vector<SpriteParam>> drawBuffers;
+
+			Pool& GetPool(IImage* image, SmokeSpriteEntity::Type smokeType);
+		};
+	} // namespace client
+} // namespace spades
@@ -24,6 +24,7 @@
 #include "GameMap.h"
 #include "GameMapWrapper.h"
 #include "Grenade.h"
+#include "HitBoxCache.h"
 #include "HitTestDebugger.h"
 #include "IWorldListener.h"
 #include "PhysicsConstants.h"
@@ -352,9 +353,50 @@ namespace spades {
 		void Player::Update(float dt) {
 			SPADES_MARK_FUNCTION();
 
-			auto* listener = world.GetListener();
+			MovePlayer(dt);
+			UpdateTool(dt);
+		}
+
+		void Player::UpdateMovement(float dt) {
+			SPADES_MARK_FUNCTION();
 
 			MovePlayer(dt);
+		}
+
+		Player::MovementState Player::GetMovementState() {
+			MovementState state;
+			state.position = position;
+			state.velocity = velocity;
+			state.orientation = orientation;
+			state.eye = eye;
+			state.input = input;
+			state.airborne = airborne;
+			state.wade = wade;
+			state.lastJump = lastJump;
+			state.lastClimbTime = lastClimbTime;
+			state.moveDistance = moveDistance;
+			state.moveSteps = moveSteps;
+			return state;
+		}
+
+		void Player::SetMovementState(const MovementState& state) {
+			position = state.position;
+			velocity = state.velocity;
+			orientation = state.orientation;
+			eye = state.eye;
+			input = state.input;
+			airborne = state.airborne;
+			wade = state.wade;
+			lastJump = state.lastJump;
+			lastClimbTime = state.lastClimbTime;
+			moveDistance = state.moveDistance;
+			moveSteps = state.moveSteps;
+		}
+
+		void Player::UpdateTool(float dt) {
+			SPADES_MARK_FUNCTION();
+
+			auto* listener = world.GetListener();
 
 			if (tool == ToolSpade) {
 				if (weapInput.primary) {
@@ -514,72 +556,100 @@ namespace spades {
 			// The custom state data, optionally set by `BulletHitPlayer`'s implementation
 			std::unique_ptr<IBulletHitScanState> stateCell;
 
+			// Pellets don't change the map's shape, so their map raycasts are done together
+			// beforehand
+			std::vector<Vector3> pelletDirs;
+			std::vector<GameMap::RayCastResult> mapResults;
+			pelletDirs.reserve(pellets);
+			mapResults.reserve(pellets);
+
 			Vector3 pelletDir = dir;
+			GameMap::RayPacket packet;
 			for (int i = 0; i < pellets; i++) {
 				// AoS 0.75's way (pelletDir shouldn't be normalized!)
 				pelletDir.x += (SampleRandomFloat() - SampleRandomFloat()) * spread;
 				pelletDir.y += (SampleRandomFloat() - SampleRandomFloat()) * spread;
 				pelletDir.z += (SampleRandomFloat() - SampleRandomFloat()) * spread;
 
-				dir = pelletDir.Normalize();
+				pelletDirs.push_back(pelletDir.Normalize());
+				packet.Add(muzzle, pelletDirs.back());
 
-				// first do map raycast
-				GameMap::RayCastResult mapResult;
-				mapResult = map->CastRay2(muzzle, dir, 256);
+				if (packet.IsFull() || i == pellets - 1) {
+					GameMap::RayPacketResult packetResult;
+					map->CastRay2Packet(packet, 256, packetResult);
+					for (int k = 0; k < packet.numRays; k++)
+						mapResults.push_back(packetResult.Get(k));
+					packet.numRays = 0;
+				}
+			}
+
+			// The players don't move between pellets, so the hit boxes of all the players any
+			// of the pellets might hit are computed only once
+			std::vector<std::bitset<NumPlayerSlots>> pelletCandidates;
+			std::bitset<NumPlayerSlots> allCandidates;
+			pelletCandidates.reserve(pellets);
+			for (int i = 0; i < pellets; i++) {
+				pelletCandidates.push_back(world.GetPlayersNearRay(muzzle, pelletDirs[i]));
+				allCandidates |= pelletCandidates.back();
+			}
+
+			HitScanBuffers& buffers = world.GetHitScanBuffers();
+			for (size_t i = 0; i < world.GetNumPlayerSlots(); i++) {
+				if (!allCandidates[i])
+					continue;
+
+				// TODO: This is a repeated pattern, add something like
+				// `World::GetExistingPlayerRange()` returning a range
+				auto maybeOther = world.GetPlayer(static_cast<unsigned int>(i));
+				if (maybeOther == this || !maybeOther)
+					continue;
+
+				Player& other = maybeOther.value();
+				if (!other.IsAlive() || other.IsSpectator())
+					continue; // filter deads/spectators
+
+				buffers.hitBoxes.Add(static_cast<int>(i), other.GetHitBoxes());
+			}
+
+			for (int i = 0; i < pellets; i++) {
+				dir = pelletDirs[i];
+
+				const GameMap::RayCastResult& mapResult = mapResults[i];
 
 				stmp::optional<Player&> hitPlayer;
 				float hitPlayerDist2D = 0.0F; // disregarding Z coordinate
 				float hitPlayerDist3D = 0.0F;
 				HitBodyPart hitPart = HitBodyPart::None;
 
-				for (size_t i = 0; i < world.GetNumPlayerSlots(); i++) {
-					// TODO: This is a repeated pattern, add something like
-					// `World::GetExistingPlayerRange()` returning a range
-					auto maybeOther = world.GetPlayer(static_cast<unsigned int>(i));
-					if (maybeOther == this || !maybeOther)
-						continue;
-
-					Player& other = maybeOther.value();
-					if (!other.IsAlive() || other.IsSpectator())
-						continue; // filter deads/spectators
-					if (!other.RayCastApprox(muzzle, dir))
-						continue; // quickly reject players unlikely to be hit
+				const std::bitset<NumPlayerSlots>& candidates = pelletCandidates[i];
+				int approxPlayerId = -1;
+				bool approxHit = false;
 
-					Vector3 hitPos;
-					HitBoxes hb = other.GetHitBoxes();
-					if (hb.head.RayCast(muzzle, dir, &hitPos)) {
-						float const dist = (hitPos - muzzle).GetLength2D();
-						if (!hitPlayer || dist < hitPlayerDist2D) {
-							hitPlayer = other;
-							hitPlayerDist2D = dist;
-							hitPlayerDist3D = (hitPos - muzzle).GetLength();
-							hitPart = HitBodyPart::Head;
-						}
-					}
+				buffers.hits.clear();
+				buffers.hitBoxes.RayCast(muzzle, dir, buffers.hits);
+				for (const HitBoxCache::Hit& hit : buffers.hits) {
+					if (!candidates[hit.playerId])
+						continue;
 
-					if (hb.torso.RayCast(muzzle, dir, &hitPos)) {
-						float const dist = (hitPos - muzzle).GetLength2D();
-						if (!hitPlayer || dist < hitPlayerDist2D) {
-							hitPlayer = other;
-							hitPlayerDist2D = dist;
-							hitPlayerDist3D = (hitPos - muzzle).GetLength();
-							hitPart = HitBodyPart::Torso;
-						}
+					Player& other = world.GetPlayer(static_cast<unsigned int>(hit.playerId)).value();
+					if (hit.playerId != approxPlayerId) {
+						approxPlayerId = hit.playerId;
+						approxHit = other.RayCastApprox(muzzle, dir);
 					}
+					if (!approxHit)
+						continue; // quickly reject players unlikely to be hit
 
-					for (int j = 0; j < 3; j++) {
-						if (hb.limbs[j].RayCast(muzzle, dir, &hitPos)) {
-							float const dist = (hitPos - muzzle).GetLength2D();
-							if (!hitPlayer || dist < hitPlayerDist2D) {
-								hitPlayer = other;
-								hitPlayerDist2D = dist;
-								hitPlayerDist3D = (hitPos - muzzle).GetLength();
-								switch (j) {
-									case 0: hitPart = HitBodyPart::Limb1; break;
-									case 1: hitPart = HitBodyPart::Limb2; break;
-									case 2: hitPart = HitBodyPart::Arms; break;
-								}
-							}
+					float const dist = (hit.hitPos - muzzle).GetLength2D();
+					if (!hitPlayer || dist < hitPlayerDist2D) {
+						hitPlayer = other;
+						hitPlayerDist2D = dist;
+						hitPlayerDist3D = (hit.hitPos - muzzle).GetLength();
+						switch (hit.part) {
+							case HitBoxCache::Part::Head: hitPart = HitBodyPart::Head; break;
+							case HitBoxCache::Part::Torso: hitPart = HitBodyPart::Torso; break;
+							case HitBoxCache::Part::Limb1: hitPart = HitBodyPart::Limb1; break;
+							case HitBoxCache::Part::Limb2: hitPart = HitBodyPart::Limb2; break;
+							case HitBoxCache::Part::Arms: hitPart = HitBodyPart::Arms; break;
 						}
 					}
 				}
@@ -986,6 +1056,29 @@ namespace spades {
 				return;
 			}
 
+			ApplyInputAcceleration(fsynctics);
+
+			// this is a linear approximation that's done in pysnip
+			// accurate computation is not difficult
+			float f = fsynctics + 1.0F;
+			velocity.z += fsynctics;
+			velocity.z /= f; // air friction
+
+			if (wade) // water friction
+				f = fsynctics * 6.0F + 1.0F;
+			else if (!airborne) // ground friction
+				f = fsynctics * 4.0F + 1.0F;
+
+			velocity.x /= f;
+			velocity.y /= f;
+
+			float f2 = velocity.z;
+			BoxClipMove(fsynctics);
+
+			FinishMove(fsynctics, f2);
+		}
+
+		void Player::ApplyInputAcceleration(float fsynctics) {
 			if (input.jump && !lastJump && IsOnGroundOrWade()) {
 				PlayerJump();
 			} else if (!input.jump) {
@@ -1022,24 +1115,9 @@ namespace spades {
 				velocity.x += right.x * f;
 				velocity.y += right.y * f;
 			}
+		}
 
-			// this is a linear approximation that's done in pysnip
-			// accurate computation is not difficult
-			f = fsynctics + 1.0F;
-			velocity.z += fsynctics;
-			velocity.z /= f; // air friction
-
-			if (wade) // water friction
-				f = fsynctics * 6.0F + 1.0F;
-			else if (!airborne) // ground friction
-				f = fsynctics * 4.0F + 1.0F;
-
-			velocity.x /= f;
-			velocity.y /= f;
-
-			float f2 = velocity.z;
-			BoxClipMove(fsynctics);
-
+		void Player::FinishMove(float fsynctics, float f2) {
 			// hit ground... check if hurt
 			if (!velocity.z && f2 > FALL_SLOW_DOWN) {
 				// slow down on landing
@@ -1053,7 +1131,7 @@ namespace spades {
 
 			if (IsOnGroundOrWade()) {
 				// count move distance
-				f = fsynctics * 32.0F;
+				float f = fsynctics * 32.0F;
 				float dx = f * velocity.x;
 				float dy = f * velocity.y;
 				float dist = sqrtf(dx*dx + dy*dy);
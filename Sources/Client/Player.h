@@ -59,6 +59,8 @@ namespace spades {
 		};
 
 		class Player {
+			friend class PlayerMovementBatch;
+
 		public:
 			enum ToolType { ToolSpade = 0, ToolBlock, ToolWeapon, ToolGrenade };
 			struct HitBoxes {
@@ -66,6 +68,20 @@ namespace spades {
 				OBB3 limbs[3];
 				OBB3 head;
 			};
+			/** The part of the state read and written by `Update` when moving the player. */
+			struct MovementState {
+				Vector3 position;
+				Vector3 velocity;
+				Vector3 orientation;
+				Vector3 eye;
+				PlayerInput input;
+				bool airborne;
+				bool wade;
+				bool lastJump;
+				float lastClimbTime;
+				float moveDistance;
+				int moveSteps;
+			};
 
 		private:
 			World& world;
@@ -122,8 +138,15 @@ namespace spades {
 			float respawnTime;
 
 			void MoveCorpse(float fsynctics);
+			/** The reference implementation of `PlayerMovementBatch`. */
 			void MovePlayer(float fsynctics);
+			void ApplyInputAcceleration(float fsynctics);
 			void BoxClipMove(float fsynctics);
+			/**
+			 * Handles landing and footsteps after the player was moved.
+			 * @param f2 The vertical velocity before the clip move.
+			 */
+			void FinishMove(float fsynctics, float f2);
 			bool TryUncrouch();
 
 			void UseSpade(bool dig);
@@ -221,6 +244,15 @@ namespace spades {
 
 			void UpdateSmooth(float dt);
 			void Update(float dt);
+			/** Same as `Update` except that it doesn't move the player. */
+			void UpdateTool(float dt);
+			/** Same as `Update` except that it doesn't use the tool. */
+			void UpdateMovement(float dt);
+
+			MovementState GetMovementState();
+			/** Restores a state returned by `GetMovementState` without the side effects of
+			 * `SetInput`. */
+			void SetMovementState(const MovementState&);
 
 			float GetTimeToNextSpade();
 			float GetTimeToNextDig();
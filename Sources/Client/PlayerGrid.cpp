@@ -0,0 +1,115 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <cmath>
+#include <limits>
+
+#include "PhysicsConstants.h"
+#include "PlayerGrid.h"
+#include <Core/Debug.h>
+
+namespace spades {
+	namespace client {
+		constexpr float PlayerGrid::Margin;
+
+		PlayerGrid::PlayerGrid() { Clear(); }
+
+		void PlayerGrid::Clear() {
+			for (auto& column : cells)
+				for (PlayerSet& cell : column)
+					cell.reset();
+			outsidePlayers.reset();
+		}
+
+		void PlayerGrid::Add(int playerId, Vector3 position) {
+			SPAssert(playerId >= 0 && playerId < (int)NumPlayerSlots);
+
+			const float scale = 1.0F / CellSize;
+			float minX = (position.x - Margin) * scale + BorderCells;
+			float minY = (position.y - Margin) * scale + BorderCells;
+			float maxX = (position.x + Margin) * scale + BorderCells;
+			float maxY = (position.y + Margin) * scale + BorderCells;
+
+			// This also catches NaN
+			if (!(minX >= 0.0F && minY >= 0.0F && maxX < NumCellsX && maxY < NumCellsY)) {
+				outsidePlayers.set(playerId);
+				return;
+			}
+
+			for (int x = (int)minX; x <= (int)maxX; x++)
+				for (int y = (int)minY; y <= (int)maxY; y++)
+					cells[x][y].set(playerId);
+		}
+
+		PlayerGrid::PlayerSet PlayerGrid::FindPlayersNearRay(Vector3 start, Vector3 dir) const {
+			SPADES_MARK_FUNCTION_DEBUG();
+
+			PlayerSet result = outsidePlayers;
+			if (start.IsNaN() || dir.IsNaN()) {
+				result.set();
+				return result;
+			}
+
+			// Walk through the cells crossed by the horizontal projection of the ray
+			const float scale = 1.0F / CellSize;
+			float x = start.x * scale + BorderCells;
+			float y = start.y * scale + BorderCells;
+			int cx = (int)std::floor(x), cy = (int)std::floor(y);
+			auto visit = [&](int cx, int cy) {
+				if (cx >= 0 && cy >= 0 && cx < NumCellsX && cy < NumCellsY)
+					result |= cells[cx][cy];
+			};
+
+			visit(cx, cy);
+
+			float length2D = std::sqrt(dir.x * dir.x + dir.y * dir.y);
+			if (!(length2D > 1.0e-6F))
+				return result; // vertical (or invalid) ray
+
+			float ux = dir.x / length2D, uy = dir.y / length2D;
+			const float infinity = std::numeric_limits<float>::infinity();
+			const float maxDistance = (FOG_DISTANCE + Margin) * scale;
+
+			int stepX = ux > 0.0F ? 1 : -1;
+			int stepY = uy > 0.0F ? 1 : -1;
+			float deltaX = ux != 0.0F ? 1.0F / std::fabs(ux) : infinity;
+			float deltaY = uy != 0.0F ? 1.0F / std::fabs(uy) : infinity;
+			float nextX = ux != 0.0F ? (ux > 0.0F ? cx + 1 - x : x - cx) * deltaX : infinity;
+			float nextY = uy != 0.0F ? (uy > 0.0F ? cy + 1 - y : y - cy) * deltaY : infinity;
+
+			while (true) {
+				if (nextX < nextY) {
+					if (nextX > maxDistance)
+						break;
+					cx += stepX;
+					nextX += deltaX;
+				} else {
+					if (nextY > maxDistance)
+						break;
+					cy += stepY;
+					nextY += deltaY;
+				}
+				visit(cx, cy);
+			}
+
+			return result;
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,73 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#pragma once
+
+#include <bitset>
+
+#include "GameMap.h"
+#include "World.h"
+#include <Core/Math.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * A uniform 2D grid of players used to find the players a hit-scan ray might hit
+		 * without testing every player slot.
+		 *
+		 * Each cell holds the set of players within `Margin` blocks (horizontally) of it.
+		 * A player passes `Player::RayCastApprox` (with the default tolerance) only if the
+		 * ray passes within 3 blocks of the player, so the margin also allows the players
+		 * to move a little after they were added to the grid.
+		 */
+		class PlayerGrid {
+		public:
+			using PlayerSet = std::bitset<NumPlayerSlots>;
+
+			/** How far (in blocks) a player can be from a ray's path and still be found. */
+			static constexpr float Margin = 4.0F;
+
+			PlayerGrid();
+
+			void Clear();
+			void Add(int playerId, Vector3 position);
+
+			/**
+			 * Returns the players that might be within `Margin` blocks of the ray (measured
+			 * horizontally) up to `FOG_DISTANCE` blocks away from `start`.
+			 */
+			PlayerSet FindPlayersNearRay(Vector3 start, Vector3 dir) const;
+
+		private:
+			enum {
+				CellBits = 4,
+				CellSize = 1 << CellBits,
+				/** Cells beyond the map boundary for the players near or outside it. */
+				BorderCells = 1,
+				NumCellsX = (GameMap::DefaultWidth >> CellBits) + BorderCells * 2,
+				NumCellsY = (GameMap::DefaultHeight >> CellBits) + BorderCells * 2
+			};
+
+			PlayerSet cells[NumCellsX][NumCellsY];
+			/** The players too far outside the map to fit in the grid. Always returned. */
+			PlayerSet outsidePlayers;
+		};
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,65 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include "PlayerInputHistory.h"
+
+namespace spades {
+	namespace client {
+		PlayerInputHistory::PlayerInputHistory() {}
+
+		void PlayerInputHistory::Clear() { numEntries = 0; }
+
+		void PlayerInputHistory::Push(const Entry& entry) {
+			if (numEntries > 0 && entry.tick != latestTick + 1)
+				Clear();
+
+			entries[entry.tick % Capacity] = entry;
+			latestTick = entry.tick;
+			if (numEntries < Capacity)
+				numEntries++;
+		}
+
+		PlayerInputHistory::Entry* PlayerInputHistory::GetEntry(std::uint32_t tick) {
+			if (numEntries == 0 || latestTick - tick >= numEntries)
+				return nullptr;
+			return &entries[tick % Capacity];
+		}
+
+		const PlayerInputHistory::Entry* PlayerInputHistory::GetEntry(std::uint32_t tick) const {
+			return const_cast<PlayerInputHistory*>(this)->GetEntry(tick);
+		}
+
+		stmp::optional<std::uint32_t> PlayerInputHistory::GetLatestTick() const {
+			if (numEntries == 0)
+				return {};
+			return latestTick;
+		}
+
+		stmp::optional<std::uint32_t> PlayerInputHistory::FindTick(float time) const {
+			for (std::uint32_t i = 0; i < numEntries; i++) {
+				std::uint32_t tick = latestTick - i;
+				if (entries[tick % Capacity].time <= time)
+					return tick;
+			}
+			return {};
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,81 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Player.h"
+#include <Core/TMPUtils.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * A ring buffer of the local player's recent inputs and movement states, keyed by
+		 * the tick (`World::Advance` call) they were used in.
+		 *
+		 * When the server corrects the local player's position, `World` rewinds the player
+		 * to the tick the correction is about and replays the inputs from there.
+		 */
+		class PlayerInputHistory {
+		public:
+			/** About two seconds at 60 ticks per second. */
+			enum { Capacity = 128 };
+
+			struct Entry {
+				std::uint32_t tick;
+				/** The world time at the start of the tick. */
+				float time;
+				float dt;
+				/** The state at the start of the tick. */
+				Player::MovementState state;
+			};
+
+			PlayerInputHistory();
+
+			void Clear();
+
+			/**
+			 * Records the tick following the latest one. A tick that doesn't follow it
+			 * clears the history first.
+			 */
+			void Push(const Entry&);
+
+			/** Returns `nullptr` if `tick` is not in the history (anymore). */
+			Entry* GetEntry(std::uint32_t tick);
+			const Entry* GetEntry(std::uint32_t tick) const;
+
+			stmp::optional<std::uint32_t> GetLatestTick() const;
+
+			/**
+			 * Returns the latest tick that started at or before `time`, or nothing if
+			 * `time` predates the history.
+			 */
+			stmp::optional<std::uint32_t> FindTick(float time) const;
+
+		private:
+			std::array<Entry, Capacity> entries;
+			std::uint32_t numEntries = 0;
+			std::uint32_t latestTick = 0;
+		};
+	} // namespace client
+} // namespace spades
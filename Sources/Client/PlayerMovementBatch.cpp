@@ -0,0 +1,243 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "PlayerMovementBatch.h"
+#include "GameMap.h"
+#include "Player.h"
+#include "World.h"
+#include <Core/Debug.h>
+
+namespace spades {
+	namespace client {
+		PlayerMovementBatch::PlayerMovementBatch(World& world) : world(world) {}
+
+		void PlayerMovementBatch::Integrate(const std::vector<Player*>& playersToMove, float dt) {
+			SPADES_MARK_FUNCTION();
+
+			movedPlayers = playersToMove;
+			lanes.clear();
+			players.clear();
+			posX.clear();
+			posY.clear();
+			posZ.clear();
+			velX.clear();
+			velY.clear();
+			velZ.clear();
+			fallVelocity.clear();
+			flags.clear();
+
+			for (Player* p : movedPlayers) {
+				if (p->IsAlive()) {
+					lanes.push_back(static_cast<int>(players.size()));
+					Gather(*p, dt);
+				} else {
+					lanes.push_back(-1);
+				}
+			}
+
+			if (players.empty())
+				return;
+
+			const Handle<GameMap>& map = world.GetMap();
+			SPAssert(map);
+
+			ApplyFriction(dt);
+			ClipMove(*map, dt);
+		}
+
+		void PlayerMovementBatch::Apply(std::size_t index, float dt) {
+			SPAssert(index < movedPlayers.size());
+
+			int lane = lanes[index];
+			if (lane < 0)
+				movedPlayers[index]->MoveCorpse(dt);
+			else
+				Scatter(static_cast<std::size_t>(lane), dt);
+		}
+
+		void PlayerMovementBatch::Gather(Player& p, float dt) {
+			// This might emit a `PlayerJumped` event, so it's done separately for each player
+			p.ApplyInputAcceleration(dt);
+
+			std::uint8_t f = 0;
+			if (p.input.crouch)
+				f |= FlagCrouch;
+			if (p.input.sprint)
+				f |= FlagSprint;
+			if (p.orientation.z < 0.5F)
+				f |= FlagLookingDown;
+			if (p.airborne)
+				f |= FlagAirborne;
+			if (p.wade)
+				f |= FlagWade;
+
+			players.push_back(&p);
+			posX.push_back(p.position.x);
+			posY.push_back(p.position.y);
+			posZ.push_back(p.position.z);
+			velX.push_back(p.velocity.x);
+			velY.push_back(p.velocity.y);
+			velZ.push_back(p.velocity.z);
+			fallVelocity.push_back(0.0F);
+			flags.push_back(f);
+		}
+
+		void PlayerMovementBatch::ApplyFriction(float dt) {
+			// See `Player::MovePlayer`
+			const float airFriction = dt + 1.0F;
+			const float waterFriction = dt * 6.0F + 1.0F;
+			const float groundFriction = dt * 4.0F + 1.0F;
+			const std::size_t count = players.size();
+
+			for (std::size_t i = 0; i < count; i++) {
+				velZ[i] += dt;
+				velZ[i] /= airFriction;
+				fallVelocity[i] = velZ[i];
+			}
+
+			for (std::size_t i = 0; i < count; i++) {
+				float f = (flags[i] & FlagWade)
+				            ? waterFriction
+				            : (flags[i] & FlagAirborne) ? airFriction : groundFriction;
+				velX[i] /= f;
+				velY[i] /= f;
+			}
+		}
+
+		void PlayerMovementBatch::ClipMove(const GameMap& map, float dt) {
+			// See `Player::BoxClipMove`
+			const float f = dt * 32.0F;
+
+			for (std::size_t i = 0; i < players.size(); i++) {
+				std::uint8_t fl = flags[i];
+				float px = posX[i], py = posY[i], pz = posZ[i];
+				float vx = velX[i], vy = velY[i], vz = velZ[i];
+				bool crouch = (fl & FlagCrouch) != 0;
+				bool canClimb = !crouch && (fl & FlagLookingDown) && !(fl & FlagSprint);
+				bool climb = false;
+
+				float offset = crouch ? 0.45F : 0.9F;
+				float m = crouch ? 0.9F : 1.35F;
+
+				float nx = f * vx + px;
+				float ny = f * vy + py;
+				float nz = pz + offset;
+				float z;
+
+				z = m;
+				float bx = nx + ((vx > 0.0F) ? 0.45F : -0.45F);
+				while (z >= -1.36F && !map.ClipBox(bx, py - 0.45F, nz + z) &&
+				       !map.ClipBox(bx, py + 0.45F, nz + z))
+					z -= 0.9F;
+				if (z < -1.36F) {
+					px = nx;
+				} else if (canClimb) {
+					z = 0.35F;
+					while (z >= -2.36F && !map.ClipBox(bx, py - 0.45F, nz + z) &&
+					       !map.ClipBox(bx, py + 0.45F, nz + z))
+						z -= 0.9F;
+					if (z < -2.36F) {
+						px = nx;
+						climb = true;
+					} else {
+						vx = 0.0F;
+					}
+				} else {
+					vx = 0.0F;
+				}
+
+				z = m;
+				float by = ny + ((vy > 0.0F) ? 0.45F : -0.45F);
+				while (z >= -1.36F && !map.ClipBox(px - 0.45F, by, nz + z) &&
+				       !map.ClipBox(px + 0.45F, by, nz + z))
+					z -= 0.9F;
+				if (z < -1.36F) {
+					py = ny;
+				} else if (canClimb && !climb) {
+					z = 0.35F;
+					while (z >= -2.36F && !map.ClipBox(px - 0.45F, by, nz + z) &&
+					       !map.ClipBox(px + 0.45F, by, nz + z))
+						z -= 0.9F;
+					if (z < -2.36F) {
+						py = ny;
+						climb = true;
+					} else {
+						vy = 0.0F;
+					}
+				} else if (!climb) {
+					vy = 0.0F;
+				}
+
+				if (climb) {
+					// slow down when climbing
+					vx *= 0.5F;
+					vy *= 0.5F;
+					nz--;
+					m = -1.35F;
+				} else {
+					if (vz < 0.0F)
+						m = -m;
+					nz += vz * f;
+				}
+
+				fl |= FlagAirborne;
+				if (climb)
+					fl |= FlagClimb;
+				if (map.ClipBox(px - 0.45F, py - 0.45F, nz + m) ||
+				    map.ClipBox(px - 0.45F, py + 0.45F, nz + m) ||
+				    map.ClipBox(px + 0.45F, py - 0.45F, nz + m) ||
+				    map.ClipBox(px + 0.45F, py + 0.45F, nz + m)) {
+					if (vz >= 0.0F) {
+						if (pz > 61.0F)
+							fl |= FlagWade;
+						else
+							fl &= ~FlagWade;
+						fl &= ~FlagAirborne;
+					}
+
+					vz = 0.0F;
+				} else {
+					pz = nz - offset;
+				}
+
+				posX[i] = px;
+				posY[i] = py;
+				posZ[i] = pz;
+				velX[i] = vx;
+				velY[i] = vy;
+				velZ[i] = vz;
+				flags[i] = fl;
+			}
+		}
+
+		void PlayerMovementBatch::Scatter(std::size_t i, float dt) {
+			Player& p = *players[i];
+
+			p.velocity = MakeVector3(velX[i], velY[i], velZ[i]);
+			p.airborne = (flags[i] & FlagAirborne) != 0;
+			p.wade = (flags[i] & FlagWade) != 0;
+			if (flags[i] & FlagClimb)
+				p.lastClimbTime = world.GetTime();
+			p.RepositionPlayer(MakeVector3(posX[i], posY[i], posZ[i]));
+
+			p.FinishMove(dt, fallVelocity[i]);
+		}
+	} // namespace client
+} // namespace spades
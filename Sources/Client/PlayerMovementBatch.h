@@ -0,0 +1,98 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Core/Math.h>
+
+namespace spades {
+	namespace client {
+		class World;
+		class Player;
+		class GameMap;
+
+		/**
+		 * Moves many players at once. The kinematic state of the living players is gathered
+		 * into arrays and integrated in a few passes over all of them by `Integrate`, and then
+		 * written back to each player by `Apply`.
+		 *
+		 * This is not equivalent to calling `Player::MovePlayer` for each player, which is
+		 * kept as the reference implementation and the default (see `cg_batchPlayerMovement`):
+		 *
+		 *  - `Integrate` computes every player's movement from its state before any tool is
+		 *    updated. If an earlier player's tool kills, damages, or repositions a later
+		 *    player, `Apply` still moves the later player as computed from the stale state.
+		 *  - The `PlayerJumped` events are emitted by `Integrate` for all the players before
+		 *    any other event, rather than interleaved with each player's update.
+		 *
+		 * The results only match while no such interaction happens during a tick.
+		 */
+		class PlayerMovementBatch {
+		public:
+			PlayerMovementBatch(World&);
+
+			/**
+			 * Computes the movement of the given players (both living and dead) by `dt`
+			 * seconds. The players are left untouched until `Apply` is called.
+			 */
+			void Integrate(const std::vector<Player*>& players, float dt);
+
+			/**
+			 * Moves `players[index]` of the last `Integrate` call. Must be called once for
+			 * each of them with the same `dt`.
+			 */
+			void Apply(std::size_t index, float dt);
+
+		private:
+			enum Flag : std::uint8_t {
+				FlagCrouch = 1 << 0,
+				FlagSprint = 1 << 1,
+				/** `orientation.z < 0.5F`. Players can climb only if this is set. */
+				FlagLookingDown = 1 << 2,
+				FlagAirborne = 1 << 3,
+				FlagWade = 1 << 4,
+				FlagClimb = 1 << 5
+			};
+
+			World& world;
+
+			/** The players passed to `Integrate`. */
+			std::vector<Player*> movedPlayers;
+			/** The index of each of `movedPlayers` in `players`, or -1 if it's dead. */
+			std::vector<int> lanes;
+
+			/** The living players. */
+			std::vector<Player*> players;
+			std::vector<float> posX, posY, posZ;
+			std::vector<float> velX, velY, velZ;
+			/** The vertical velocity before `ClipMove`, used to detect landings. */
+			std::vector<float> fallVelocity;
+			std::vector<std::uint8_t> flags;
+
+			void Gather(Player&, float dt);
+			void ApplyFriction(float dt);
+			void ClipMove(const GameMap&, float dt);
+			void Scatter(std::size_t index, float dt);
+		};
+	} // namespace client
+} // namespace spades
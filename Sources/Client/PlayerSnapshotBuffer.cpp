@@ -0,0 +1,178 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "PlayerSnapshotBuffer.h"
+
+namespace spades {
+	namespace client {
+		constexpr float PlayerSnapshotBuffer::MinPlayoutDelay;
+		constexpr float PlayerSnapshotBuffer::MaxPlayoutDelay;
+		constexpr float PlayerSnapshotBuffer::MaxExtrapolation;
+
+		namespace {
+			/** Weight of a new sample in the moving averages. */
+			constexpr float SmoothingFactor = 0.1F;
+			/** A larger jump (in blocks) is a teleport and isn't interpolated. */
+			constexpr float TeleportDistance = 10.0F;
+		} // namespace
+
+		PlayerSnapshotBuffer::PlayerSnapshotBuffer(std::size_t numPlayerSlots)
+		    : players(numPlayerSlots) {}
+
+		void PlayerSnapshotBuffer::MarkArrival(float time) {
+			if (lastArrival < 0.0F || time - packetTime > MaxPlayoutDelay) {
+				// The first packet, or the first one after a pause
+				packetTime = time;
+			} else {
+				float interval = std::max(std::min(time - lastArrival, MaxPlayoutDelay), 0.0F);
+				meanInterval += (interval - meanInterval) * SmoothingFactor;
+
+				// Time-stamp the packet mostly by the expected arrival time, so a late or
+				// bursty packet doesn't make the movement uneven
+				float expected = packetTime + meanInterval;
+				jitter += (std::fabs(time - expected) - jitter) * SmoothingFactor;
+				packetTime = expected + (time - expected) * SmoothingFactor;
+			}
+			lastArrival = time;
+		}
+
+		void PlayerSnapshotBuffer::Add(int playerId, const Vector3& position,
+		                               const Vector3& front) {
+			PlayerBuffer& buffer = players.at(playerId);
+
+			if (buffer.count > 0 &&
+			    (position - buffer[buffer.count - 1].position).GetSquaredLength() >
+			      TeleportDistance * TeleportDistance)
+				Reset(playerId);
+
+			if (buffer.count == Capacity) {
+				buffer.first = (buffer.first + 1) % Capacity;
+				buffer.count--;
+			}
+
+			Snapshot& snapshot = buffer.snapshots[(buffer.first + buffer.count) % Capacity];
+			snapshot.time = packetTime;
+			snapshot.position = position;
+			snapshot.front = front;
+			buffer.count++;
+		}
+
+		void PlayerSnapshotBuffer::Reset(int playerId) {
+			PlayerBuffer& buffer = players.at(playerId);
+			buffer.count = 0;
+			buffer.extrapolating = false;
+		}
+
+		void PlayerSnapshotBuffer::Clear() {
+			for (std::size_t i = 0; i < players.size(); i++)
+				Reset(static_cast<int>(i));
+			lastArrival = -1.0F;
+		}
+
+		void PlayerSnapshotBuffer::Update(float dt) {
+			// Enough to cover a late packet, plus the error of time-stamping on ticks
+			float target = meanInterval + jitter * 3.0F + dt;
+			target = std::max(std::min(target, MaxPlayoutDelay), MinPlayoutDelay);
+
+			// Change the delay gradually so the players don't visibly speed up or slow down
+			float maxChange = dt * 0.1F;
+			playoutDelay += std::max(std::min(target - playoutDelay, maxChange), -maxChange);
+
+			if (depthCount > 0)
+				bufferDepth = depthSum / depthCount;
+			depthSum = 0.0F;
+			depthCount = 0;
+		}
+
+		bool PlayerSnapshotBuffer::Sample(int playerId, float time, Vector3& position,
+		                                  Vector3& front) {
+			PlayerBuffer& buffer = players.at(playerId);
+			if (buffer.count == 0)
+				return false;
+
+			float playoutTime = time - playoutDelay;
+
+			// Drop the snapshots that are not needed anymore. Two are kept for extrapolation.
+			while (buffer.count >= 3 && buffer[1].time <= playoutTime) {
+				buffer.first = (buffer.first + 1) % Capacity;
+				buffer.count--;
+			}
+
+			std::uint32_t depth = 0;
+			for (std::uint32_t i = 0; i < buffer.count; i++) {
+				if (buffer[i].time > playoutTime)
+					depth++;
+			}
+			depthSum += static_cast<float>(depth);
+			depthCount++;
+
+			const Snapshot& first = buffer[0];
+			if (playoutTime <= first.time) {
+				position = first.position;
+				front = first.front;
+				return true;
+			}
+
+			if (buffer.count >= 2 && playoutTime < buffer[1].time) {
+				const Snapshot& next = buffer[1];
+				float per = (playoutTime - first.time) / (next.time - first.time);
+				position = Mix(first.position, next.position, per);
+				front = Mix(first.front, next.front, per);
+				buffer.extrapolating = false;
+				return true;
+			}
+
+			// Ran past the last snapshot; keep moving in the same direction for a while
+			if (!buffer.extrapolating) {
+				buffer.extrapolating = true;
+				underruns++;
+			}
+
+			const Snapshot& last = buffer[buffer.count - 1];
+			if (playoutTime - last.time > MaxExtrapolation) {
+				// Let the caller simulate the player until the next snapshot arrives
+				return false;
+			}
+
+			position = last.position;
+			front = last.front;
+			if (buffer.count >= 2) {
+				const Snapshot& previous = buffer[buffer.count - 2];
+				float interval = last.time - previous.time;
+				float extrapolation = playoutTime - last.time;
+				if (interval > 0.0F)
+					position += (last.position - previous.position) * (extrapolation / interval);
+			}
+			return true;
+		}
+
+		PlayerSnapshotBuffer::Stats PlayerSnapshotBuffer::GetStats() const {
+			Stats stats;
+			stats.playoutDelay = playoutDelay;
+			stats.bufferDepth = bufferDepth;
+			stats.underruns = underruns;
+			return stats;
+		}
+	} // namespace client
+} // namespace spades
@@ -0,0 +1,119 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <Core/Math.h>
+
+namespace spades {
+	namespace client {
+		/**
+		 * A jitter buffer for the remote players' positions sent in `WorldUpdate` packets.
+		 *
+		 * The snapshots are time-stamped on arrival (smoothed over the previous packets) and
+		 * played back `GetPlayoutDelay()` seconds late, interpolating between the two
+		 * snapshots around the playout time.
+		 * The delay follows the mean interval between the packets plus a multiple of its
+		 * deviation, so it grows when the packets arrive irregularly and shrinks back when
+		 * they don't. If the buffer of a player runs dry, the last movement is extrapolated
+		 * for a short time, after which the player is left to the physics simulation until
+		 * the next snapshot arrives.
+		 */
+		class PlayerSnapshotBuffer {
+		public:
+			/** The maximum number of snapshots kept for each player. */
+			enum { Capacity = 32 };
+
+			static constexpr float MinPlayoutDelay = 0.05F;
+			static constexpr float MaxPlayoutDelay = 0.5F;
+			/** How long the movement is extrapolated after the last snapshot. */
+			static constexpr float MaxExtrapolation = 0.2F;
+
+			struct Stats {
+				float playoutDelay = 0.0F;
+				/** The mean number of snapshots ahead of the playout time. */
+				float bufferDepth = 0.0F;
+				/** The number of times a player ran past the last snapshot. */
+				std::uint64_t underruns = 0;
+			};
+
+			PlayerSnapshotBuffer(std::size_t numPlayerSlots);
+
+			/** Records the arrival of a packet. Call this before its `Add` calls. */
+			void MarkArrival(float time);
+			/** Adds a snapshot from the packet passed to the last `MarkArrival` call. */
+			void Add(int playerId, const Vector3& position, const Vector3& front);
+
+			/** Discards the snapshots of a player, e.g., after it respawned. */
+			void Reset(int playerId);
+			void Clear();
+
+			/** Adjusts the playout delay. Call this once for each tick before `Sample`. */
+			void Update(float dt);
+
+			/**
+			 * Computes the position and orientation of a player at the playout time.
+			 * @return `false` if there are no snapshots of the player or the playout time is
+			 *         more than `MaxExtrapolation` seconds past the last one.
+			 */
+			bool Sample(int playerId, float time, Vector3& position, Vector3& front);
+
+			float GetPlayoutDelay() const { return playoutDelay; }
+			Stats GetStats() const;
+
+		private:
+			struct Snapshot {
+				float time;
+				Vector3 position;
+				Vector3 front;
+			};
+
+			struct PlayerBuffer {
+				std::array<Snapshot, Capacity> snapshots;
+				std::uint32_t first = 0;
+				std::uint32_t count = 0;
+				bool extrapolating = false;
+
+				const Snapshot& operator[](std::uint32_t i) const {
+					return snapshots[(first + i) % Capacity];
+				}
+			};
+
+			std::vector<PlayerBuffer> players;
+
+			float lastArrival = -1.0F;
+			/** The time stamp of the last packet. */
+			float packetTime = 0.0F;
+			float meanInterval = 0.1F;
+			float jitter = 0.0F;
+			float playoutDelay = 0.1F;
+
+			float depthSum = 0.0F;
+			int depthCount = 0;
+			float bufferDepth = 0.0F;
+			std::uint64_t underruns = 0;
+		};
+	} // namespace client
+} // namespace spades
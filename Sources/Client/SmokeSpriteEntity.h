@@ -34,9 +34,10 @@ namespace spades {
 			float frame;
 			float fps;
 			Type type;
-			static IImage& GetSequence(int i, IRenderer* r, Type);
 
 		public:
+			static IImage& GetSequence(int i, IRenderer* r, Type);
+
 			SmokeSpriteEntity(Client& cli, Vector4 color, float fps, Type type = Type::Steady);
 
 			static void Preload(IRenderer*);
@@ -21,30 +21,45 @@
 
 #include <cmath>
 #include <cstdlib>
-#include <deque>
 
+#include "BlockRegenerationWheel.h"
 #include "GameMap.h"
 #include "GameMapWrapper.h"
 #include "GameProperties.h"
 #include "Grenade.h"
+#include "HitBoxCache.h"
 #include "HitTestDebugger.h"
 #include "IGameMode.h"
 #include "IWorldListener.h"
 #include "Player.h"
+#include "PlayerGrid.h"
+#include "PlayerInputHistory.h"
+#include "PlayerSnapshotBuffer.h"
+#include "PlayerMovementBatch.h"
 #include "Weapon.h"
 #include "World.h"
 #include <Core/Debug.h>
 #include <Core/FileManager.h>
 #include <Core/IStream.h>
 #include <Core/Settings.h>
+#include <Core/Stopwatch.h>
 
 DEFINE_SPADES_SETTING(cg_debugHitTest, "0");
+DEFINE_SPADES_SETTING(cg_batchPlayerMovement, "0");
+DEFINE_SPADES_SETTING(cg_reconcilePosition, "1");
+DEFINE_SPADES_SETTING(cg_smoothRemotePlayers, "1");
 
 namespace spades {
 	namespace client {
 
 		World::World(const std::shared_ptr<GameProperties>& gameProperties)
-		    : gameProperties{gameProperties} {
+		    : gameProperties{gameProperties},
+		      playerGrid{stmp::make_unique<PlayerGrid>()},
+		      hitScanBuffers{stmp::make_unique<HitScanBuffers>()},
+		      playerMovement{stmp::make_unique<PlayerMovementBatch>(*this)},
+		      localPlayerHistory{stmp::make_unique<PlayerInputHistory>()},
+		      playerSnapshots{stmp::make_unique<PlayerSnapshotBuffer>(NumPlayerSlots)},
+		      damagedBlocks{stmp::make_unique<BlockRegenerationWheel>()} {
 			SPADES_MARK_FUNCTION();
 		}
 		World::~World() { SPADES_MARK_FUNCTION(); }
@@ -71,6 +86,24 @@ namespace spades {
 		}
 
 		void World::UpdatePlayer(float dt, bool locked) {
+			if (locked && cg_batchPlayerMovement) {
+				movedPlayers.clear();
+				for (const auto& p : players) {
+					if (p && !p->IsSpectator())
+						movedPlayers.push_back(p.get());
+				}
+
+				// A player's hit scans must see the players after it at their old positions
+				// just like `Player::Update` does, so each player is moved right before its
+				// tool is updated
+				playerMovement->Integrate(movedPlayers, dt);
+				for (std::size_t i = 0; i < movedPlayers.size(); i++) {
+					playerMovement->Apply(i, dt);
+					movedPlayers[i]->UpdateTool(dt);
+				}
+				return;
+			}
+
 			for (const auto& p : players) {
 				if (p && !p->IsSpectator()) {
 					if (locked) {
@@ -85,25 +118,42 @@ namespace spades {
 		void World::Advance(float dt) {
 			SPADES_MARK_FUNCTION();
 
+			// Only read the clock if the timings were requested
+			stmp::optional<Stopwatch> stopwatch;
+			if (advanceTimings)
+				stopwatch = Stopwatch();
+			double lastLapTime = 0.0;
+			auto lap = [&](double AdvanceTimings::*phase) {
+				if (!stopwatch)
+					return;
+				double t = stopwatch->GetTime();
+				advanceTimings->*phase += t - lastLapTime;
+				lastLapTime = t;
+			};
+
 			ApplyBlockActions();
+			lap(&AdvanceTimings::blockActions);
 
-			UpdatePlayer(dt, true);
+			// The players move only a little in `UpdatePlayer`, which `PlayerGrid::Margin`
+			// accounts for
+			UpdatePlayerGrid();
+			lap(&AdvanceTimings::playerGrid);
 
-			while (!damagedBlocksQueue.empty()) {
-				auto it = damagedBlocksQueue.begin();
-				if (it->first > time)
-					break;
+			RecordLocalPlayerInput(dt);
+			UpdatePlayer(dt, true);
+			ApplyPlayerSnapshots(dt);
+			lap(&AdvanceTimings::players);
 
-				const auto& pos = it->second;
+			damagedBlocks->PopExpired(time, regeneratedBlocks);
+			for (const IntVector3& pos : regeneratedBlocks) {
 				if (map && map->IsSolid(pos.x, pos.y, pos.z)) {
 					uint32_t col = map->GetColor(pos.x, pos.y, pos.z);
 					col = (col & 0xFFFFFF) | (100UL << 24);
 					map->Set(pos.x, pos.y, pos.z, true, col);
 				}
-
-				damagedBlocksQueueMap.erase(damagedBlocksQueueMap.find(pos));
-				damagedBlocksQueue.erase(it);
 			}
+			regeneratedBlocks.clear();
+			lap(&AdvanceTimings::blockRegeneration);
 
 			std::vector<decltype(grenades.begin())> removedGrenades;
 			for (auto it = grenades.begin(); it != grenades.end(); it++) {
@@ -113,8 +163,10 @@ namespace spades {
 			}
 			for (auto it : removedGrenades)
 				grenades.erase(it);
+			lap(&AdvanceTimings::grenades);
 
 			time += dt;
+			tick++;
 		}
 
 		void World::SetMap(Handle<GameMap> newMap) {
@@ -143,96 +195,139 @@ namespace spades {
 			SPADES_MARK_FUNCTION();
 
 			players.at(i) = std::move(p);
+			InvalidatePlayerGrid();
+			playerSnapshots->Reset(i);
+			if (localPlayerIndex && *localPlayerIndex == i)
+				localPlayerHistory->Clear();
 			if (listener)
 				listener->PlayerObjectSet(i);
 		}
 
-		void World::SetMode(std::unique_ptr<IGameMode> m) { mode = std::move(m); }
+		void World::SetLocalPlayerIndex(stmp::optional<int> p) {
+			localPlayerIndex = p;
+			localPlayerHistory->Clear();
+		}
 
-		void World::MarkBlockForRegeneration(const IntVector3& blockLocation) {
-			UnmarkBlockForRegeneration(blockLocation);
+		void World::RecordLocalPlayerInput(float dt) {
+			stmp::optional<Player&> p = GetLocalPlayer();
+			if (!p || p->IsSpectator() || !cg_reconcilePosition) {
+				localPlayerHistory->Clear();
+				return;
+			}
 
-			// Regenerate after 10 seconds
-			auto result = damagedBlocksQueue.emplace(time + 10.0F, blockLocation);
-			damagedBlocksQueueMap.emplace(blockLocation, result);
+			PlayerInputHistory::Entry entry;
+			entry.tick = tick;
+			entry.time = time;
+			entry.dt = dt;
+			entry.state = p->GetMovementState();
+			localPlayerHistory->Push(entry);
 		}
 
-		void World::UnmarkBlockForRegeneration(const IntVector3& blockLocation) {
-			auto it = damagedBlocksQueueMap.find(blockLocation);
-			if (it == damagedBlocksQueueMap.end())
+		void World::ReconcileLocalPlayer(const Vector3& position, float latency) {
+			SPADES_MARK_FUNCTION();
+
+			stmp::optional<Player&> p = GetLocalPlayer();
+			if (!p)
 				return;
 
-			damagedBlocksQueue.erase(it->second);
-			damagedBlocksQueueMap.erase(it);
+			stmp::optional<std::uint32_t> firstTick = localPlayerHistory->FindTick(time - latency);
+			if (!firstTick) {
+				p->RepositionPlayer(position);
+				return;
+			}
+
+			std::uint32_t lastTick = *localPlayerHistory->GetLatestTick();
+			Player::MovementState current = p->GetMovementState();
+
+			// The sounds and effects of the movement were already produced
+			IWorldListener* savedListener = listener;
+			float savedTime = time;
+			listener = nullptr;
+
+			for (std::uint32_t t = *firstTick;; t++) {
+				PlayerInputHistory::Entry& entry = *localPlayerHistory->GetEntry(t);
+				time = entry.time;
+				if (t == *firstTick) {
+					p->SetMovementState(entry.state);
+					p->RepositionPlayer(position);
+				} else {
+					p->SetInput(entry.state.input);
+					p->SetOrientation(entry.state.orientation);
+				}
+
+				// Later corrections replay from the corrected states
+				entry.state = p->GetMovementState();
+				p->UpdateMovement(entry.dt);
+
+				if (t == lastTick)
+					break;
+			}
+
+			time = savedTime;
+			listener = savedListener;
+
+			// Apply the inputs given after the last tick
+			p->SetInput(current.input);
+			p->SetOrientation(current.orientation);
 		}
 
-		static std::vector<std::vector<CellPos>>
-		ClusterizeBlocks(const std::vector<CellPos>& blocks) {
-			std::unordered_map<CellPos, bool, CellPosHash> blockMap;
-			for (const auto& block : blocks)
-				blockMap[block] = true;
+		void World::MarkPlayerSnapshotArrival(float age) {
+			playerSnapshots->MarkArrival(time - age);
+		}
 
-			std::vector<std::vector<CellPos>> ret;
-			std::deque<decltype(blockMap)::iterator> queue;
+		void World::AddPlayerSnapshot(Player& p, const Vector3& position, const Vector3& front) {
+			if (!cg_smoothRemotePlayers) {
+				p.RepositionPlayer(position);
+				p.SetOrientation(front);
+				InvalidatePlayerGrid();
+				return;
+			}
 
-			ret.reserve(64);
-			// wish I could `reserve()` queue...
+			playerSnapshots->Add(p.GetId(), position, front);
+		}
 
-			std::size_t addedCount = 0;
+		void World::ApplyPlayerSnapshots(float dt) {
+			if (!cg_smoothRemotePlayers) {
+				playerSnapshots->Clear();
+				return;
+			}
 
-			for (auto it = blockMap.begin(); it != blockMap.end(); it++) {
-				SPAssert(queue.empty());
+			playerSnapshots->Update(dt);
 
-				if (!it->second)
+			for (std::size_t i = 0; i < players.size(); i++) {
+				const auto& p = players[i];
+				if (!p || p->IsLocalPlayer() || !p->IsAlive() || p->IsSpectator()) {
+					playerSnapshots->Reset(static_cast<int>(i));
 					continue;
-				queue.emplace_back(it);
-
-				std::vector<CellPos> outBlocks;
-
-				while (!queue.empty()) {
-					auto blockitem = queue.front();
-					queue.pop_front();
-
-					if (!blockitem->second)
-						continue;
-
-					auto pos = blockitem->first;
-					outBlocks.emplace_back(pos);
-					blockitem->second = false;
-
-					decltype(blockMap)::iterator nextIt;
-
-					nextIt = blockMap.find(CellPos(pos.x - 1, pos.y, pos.z));
-					if (nextIt != blockMap.end() && nextIt->second)
-						queue.emplace_back(nextIt);
-					nextIt = blockMap.find(CellPos(pos.x + 1, pos.y, pos.z));
-					if (nextIt != blockMap.end() && nextIt->second)
-						queue.emplace_back(nextIt);
-					nextIt = blockMap.find(CellPos(pos.x, pos.y - 1, pos.z));
-					if (nextIt != blockMap.end() && nextIt->second)
-						queue.emplace_back(nextIt);
-					nextIt = blockMap.find(CellPos(pos.x, pos.y + 1, pos.z));
-					if (nextIt != blockMap.end() && nextIt->second)
-						queue.emplace_back(nextIt);
-					nextIt = blockMap.find(CellPos(pos.x, pos.y, pos.z - 1));
-					if (nextIt != blockMap.end() && nextIt->second)
-						queue.emplace_back(nextIt);
-					nextIt = blockMap.find(CellPos(pos.x, pos.y, pos.z + 1));
-					if (nextIt != blockMap.end() && nextIt->second)
-						queue.emplace_back(nextIt);
 				}
 
-				SPAssert(!outBlocks.empty());
-				addedCount += outBlocks.size();
-				ret.emplace_back(std::move(outBlocks));
+				// If there's no snapshot to play, the position simulated by `UpdatePlayer` is kept
+				Vector3 position, front;
+				if (playerSnapshots->Sample(static_cast<int>(i), time, position, front)) {
+					p->RepositionPlayer(position);
+					p->SetOrientation(front);
+				}
 			}
+		}
 
-			SPAssert(addedCount == blocks.size());
+		void World::SetMode(std::unique_ptr<IGameMode> m) { mode = std::move(m); }
 
-			return ret;
+		void World::MarkBlockForRegeneration(const IntVector3& blockLocation) {
+			// Regenerate after 10 seconds
+			damagedBlocks->Schedule(blockLocation, time + 10.0F);
+		}
+
+		void World::UnmarkBlockForRegeneration(const IntVector3& blockLocation) {
+			damagedBlocks->Cancel(blockLocation);
 		}
 
 		void World::ApplyBlockActions() {
+			if (!map)
+				return;
+
+			// Notify the map listeners once with all changes
+			GameMap::ChangeTransaction transaction{*map};
+
 			for (const auto& creation : createdBlocks) {
 				const auto& pos = creation.first;
 				const auto& col = creation.second;
@@ -251,10 +346,9 @@ namespace spades {
 					continue;
 				cells.emplace_back(cell);
 			}
-			cells = mapWrapper->RemoveBlocks(cells);
 
 			std::vector<IntVector3> cells2;
-			for (const auto& cluster : ClusterizeBlocks(cells)) {
+			for (const auto& cluster : mapWrapper->RemoveBlocks(cells)) {
 				cells2.resize(cluster.size());
 				for (std::size_t i = 0; i < cluster.size(); i++) {
 					auto p = cluster[i];
@@ -384,6 +478,31 @@ namespace spades {
 			return ret;
 		}
 
+		void World::UpdatePlayerGrid() {
+			SPADES_MARK_FUNCTION_DEBUG();
+
+			// Dead players and spectators are included as they might be respawned
+			// before the next update
+			playerGrid->Clear();
+			for (int i = 0; i < (int)players.size(); i++) {
+				if (players[i])
+					playerGrid->Add(i, players[i]->GetPosition());
+			}
+			playerGridStale = false;
+		}
+
+		std::bitset<NumPlayerSlots> World::GetPlayersNearRay(spades::Vector3 start,
+		                                                     spades::Vector3 dir) {
+			if (playerGridStale)
+				UpdatePlayerGrid();
+			return playerGrid->FindPlayersNearRay(start, dir);
+		}
+
+		HitScanBuffers& World::GetHitScanBuffers() {
+			hitScanBuffers->Clear();
+			return *hitScanBuffers;
+		}
+
 		World::WeaponRayCastResult World::WeaponRayCast(spades::Vector3 startPos,
 			spades::Vector3 dir, stmp::optional<int> excludePlayerId) {
 			WeaponRayCastResult result;
@@ -391,9 +510,11 @@ namespace spades {
 			float hitPlayerDist = 0.0F;
 			hitTag_t hitFlag = hit_None;
 
+			std::bitset<NumPlayerSlots> candidates = GetPlayersNearRay(startPos, dir);
+			HitScanBuffers& buffers = GetHitScanBuffers();
 			for (int i = 0; i < (int)players.size(); i++) {
 				const auto& p = players[i];
-				if (!p || (excludePlayerId && *excludePlayerId == i))
+				if (!candidates[i] || !p || (excludePlayerId && *excludePlayerId == i))
 					continue;
 
 				if (!p->IsAlive() || p->IsSpectator())
@@ -401,46 +522,25 @@ namespace spades {
 				if (!p->RayCastApprox(startPos, dir))
 					continue; // quickly reject players unlikely to be hit
 
-				Vector3 hitPos;
-				Player::HitBoxes hb = p->GetHitBoxes();
-				if (hb.head.RayCast(startPos, dir, &hitPos)) {
-					float const dist = (hitPos - startPos).GetSquaredLength();
-					if (!hitPlayerId || dist < hitPlayerDist) {
-						if (hitPlayerId != i) {
-							hitPlayerId = i;
-							hitFlag = hit_None;
-						}
-
-						hitPlayerDist = dist;
-						hitFlag |= hit_Head;
-					}
-				}
-
-				if (hb.torso.RayCast(startPos, dir, &hitPos)) {
-					float const dist = (hitPos - startPos).GetSquaredLength();
-					if (!hitPlayerId || dist < hitPlayerDist) {
-						if (hitPlayerId != i) {
-							hitPlayerId = i;
-							hitFlag = hit_None;
-						}
+				buffers.hitBoxes.Add(i, p->GetHitBoxes());
+			}
 
-						hitPlayerDist = dist;
-						hitFlag |= hit_Torso;
+			buffers.hitBoxes.RayCast(startPos, dir, buffers.hits);
+			for (const HitBoxCache::Hit& hit : buffers.hits) {
+				float const dist = (hit.hitPos - startPos).GetSquaredLength();
+				if (!hitPlayerId || dist < hitPlayerDist) {
+					if (hitPlayerId != hit.playerId) {
+						hitPlayerId = hit.playerId;
+						hitFlag = hit_None;
 					}
-				}
 
-				for (int j = 0; j < 3; j++) {
-					if (hb.limbs[j].RayCast(startPos, dir, &hitPos)) {
-						float const dist = (hitPos - startPos).GetSquaredLength();
-						if (!hitPlayerId || dist < hitPlayerDist) {
-							if (hitPlayerId != i) {
-								hitPlayerId = i;
-								hitFlag = hit_None;
-							}
-
-							hitPlayerDist = dist;
-							hitFlag |= (j == 2) ? hit_Arms : hit_Legs;
-						}
+					hitPlayerDist = dist;
+					switch (hit.part) {
+						case HitBoxCache::Part::Head: hitFlag |= hit_Head; break;
+						case HitBoxCache::Part::Torso: hitFlag |= hit_Torso; break;
+						case HitBoxCache::Part::Limb1:
+						case HitBoxCache::Part::Limb2: hitFlag |= hit_Legs; break;
+						case HitBoxCache::Part::Arms: hitFlag |= hit_Arms; break;
 					}
 				}
 			}
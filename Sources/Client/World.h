@@ -22,6 +22,7 @@
 #pragma once
 
 #include <array>
+#include <bitset>
 #include <list>
 #include <map>
 #include <memory>
@@ -38,6 +39,7 @@
 
 namespace spades {
 	namespace client {
+		class BlockRegenerationWheel;
 		class GameMap;
 		class GameMapWrapper;
 		class Player;
@@ -46,6 +48,11 @@ namespace spades {
 		class IGameMode;
 		class Client; // FIXME: for debug
 		class HitTestDebugger;
+		struct HitScanBuffers;
+		class PlayerGrid;
+		class PlayerInputHistory;
+		class PlayerSnapshotBuffer;
+		class PlayerMovementBatch;
 		struct GameProperties;
 
 		constexpr std::size_t NumPlayerSlots = 128;
@@ -62,15 +69,26 @@ namespace spades {
 				int score;
 				PlayerPersistent() : score(0) { ; }
 			};
+			/** The wall time spent on each phase of `Advance`, in seconds. */
+			struct AdvanceTimings {
+				double blockActions = 0.0;
+				double playerGrid = 0.0;
+				double players = 0.0;
+				double blockRegeneration = 0.0;
+				double grenades = 0.0;
+			};
 
 		private:
 			IWorldListener* listener = nullptr;
+			AdvanceTimings* advanceTimings = nullptr;
 
 			std::unique_ptr<IGameMode> mode;
 
 			Handle<GameMap> map;
 			std::unique_ptr<GameMapWrapper> mapWrapper;
 			float time = 0.0F;
+			/** The number of `Advance` calls so far. */
+			std::uint32_t tick = 0;
 			IntVector3 fogColor;
 			Team teams[3];
 
@@ -80,17 +98,37 @@ namespace spades {
 			std::array<PlayerPersistent, NumPlayerSlots> playerPersistents;
 			stmp::optional<int> localPlayerIndex;
 
+			/** The positions of `players`, refreshed by `Advance`. See `GetPlayersNearRay`. */
+			std::unique_ptr<PlayerGrid> playerGrid;
+			bool playerGridStale = true;
+
+			/** See `GetHitScanBuffers`. */
+			std::unique_ptr<HitScanBuffers> hitScanBuffers;
+
+			/** Moves the players in `UpdatePlayer` if `cg_batchPlayerMovement` is on. */
+			std::unique_ptr<PlayerMovementBatch> playerMovement;
+			/** A scratch buffer for the players `UpdatePlayer` moves. */
+			std::vector<Player*> movedPlayers;
+
+			/** The local player's recent inputs. See `ReconcileLocalPlayer`. */
+			std::unique_ptr<PlayerInputHistory> localPlayerHistory;
+			/** The remote players' positions sent by the server. See `AddPlayerSnapshot`. */
+			std::unique_ptr<PlayerSnapshotBuffer> playerSnapshots;
+
 			std::list<std::unique_ptr<Grenade>> grenades;
 			std::unique_ptr<HitTestDebugger> hitTestDebugger;
 
 			std::unordered_map<CellPos, spades::IntVector3, CellPosHash> createdBlocks;
 			std::unordered_set<CellPos, CellPosHash> destroyedBlocks;
 
-			std::multimap<float, IntVector3> damagedBlocksQueue;
-			std::unordered_map<IntVector3, std::multimap<float, IntVector3>::iterator>
-			  damagedBlocksQueueMap;
+			std::unique_ptr<BlockRegenerationWheel> damagedBlocks;
+			/** A scratch buffer for the blocks `damagedBlocks` returned in `Advance`. */
+			std::vector<IntVector3> regeneratedBlocks;
 
 			void ApplyBlockActions();
+			void UpdatePlayerGrid();
+			void RecordLocalPlayerInput(float dt);
+			void ApplyPlayerSnapshots(float dt);
 
 		public:
 			World(const std::shared_ptr<GameProperties>&);
@@ -127,6 +165,25 @@ namespace spades {
 
 			void SetPlayer(int i, std::unique_ptr<Player> p);
 
+			/**
+			 * Returns a superset of the players that pass `Player::RayCastApprox` for the
+			 * specified ray with the default tolerance. Use this to skip the players far from
+			 * a hit-scan ray instead of testing every player slot.
+			 */
+			std::bitset<NumPlayerSlots> GetPlayersNearRay(Vector3 start, Vector3 dir);
+
+			/**
+			 * Must be called when a player was moved by something other than the physics
+			 * update of `Advance` (e.g., a teleport or a position update from the server).
+			 */
+			void InvalidatePlayerGrid() { playerGridStale = true; }
+
+			/**
+			 * Returns the cleared buffers for a hit scan. They're shared by all the hit scans
+			 * of this world, so a hit scan must be done with them before starting another.
+			 */
+			HitScanBuffers& GetHitScanBuffers();
+
 			/**
 			 * Get the object containing data specific to the current game mode.
 			 * Can be `{}` if the game mode is not specified yet.
@@ -165,7 +222,7 @@ namespace spades {
 			size_t GetNumPlayersAlive(int team);
 
 			stmp::optional<int> GetLocalPlayerIndex() { return localPlayerIndex; }
-			void SetLocalPlayerIndex(stmp::optional<int> p) { localPlayerIndex = p; }
+			void SetLocalPlayerIndex(stmp::optional<int> p);
 
 			/** Get the local player. Can be `nullptr`. */
 			stmp::optional<Player&> GetLocalPlayer() {
@@ -174,11 +231,38 @@ namespace spades {
 				return GetPlayer(*GetLocalPlayerIndex());
 			}
 
+			/**
+			 * Moves the local player to the position sent by the server.
+			 *
+			 * The position is applied to the tick `latency` seconds ago, and the local
+			 * player's inputs since then are replayed on top of it, so a correction that
+			 * agrees with the local simulation doesn't move the player back in time.
+			 * Falls back to `Player::RepositionPlayer` if the tick is not in the history.
+			 */
+			void ReconcileLocalPlayer(const Vector3& position, float latency);
+
+			/**
+			 * Moves a remote player to the position sent by the server. Unless
+			 * `cg_smoothRemotePlayers` is off, the position is buffered and the player is
+			 * moved smoothly by `Advance` a little later. Call `MarkPlayerSnapshotArrival`
+			 * before the calls for each packet.
+			 */
+			void AddPlayerSnapshot(Player&, const Vector3& position, const Vector3& front);
+			/** @param age How long ago the packet was received, in seconds. */
+			void MarkPlayerSnapshotArrival(float age = 0.0F);
+			const PlayerSnapshotBuffer& GetPlayerSnapshots() { return *playerSnapshots; }
+
 			/** Can be `nullptr`. */
 			HitTestDebugger* GetHitTestDebugger();
 
 			void SetListener(IWorldListener* newListener) { listener = newListener; }
 			IWorldListener* GetListener() { return listener; }
+
+			/**
+			 * Makes `Advance` add the time spent on each phase to `*timings`. Pass `nullptr`
+			 * to stop measuring.
+			 */
+			void SetAdvanceTimings(AdvanceTimings* timings) { advanceTimings = timings; }
 		};
 	} // namespace client
 } // namespace spades
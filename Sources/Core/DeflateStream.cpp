@@ -115,6 +115,10 @@ namespace spades {
 			SPRaise("State is invalid");
 		}
 
+		// Compress the data still in the buffer
+		if (!buffer.empty())
+			CompressBuffer();
+
 		char outputBuffer[chunkSize];
 
 		zstream.avail_in = 0;
@@ -86,6 +86,14 @@ namespace spades {
 
 	std::uint_fast64_t SampleRandom() { return GetThreadLocalRNG()(); }
 
+	void SeedRandom(std::uint_fast64_t seed) {
+		{
+			std::lock_guard<std::mutex> lock{global_rng_mutex};
+			global_rng.seed(seed);
+		}
+		GetThreadLocalRNG() = LocalRNG();
+	}
+
 	float SampleRandomFloat() {
 		return std::uniform_real_distribution<float>{}(GetThreadLocalRNG());
 	}
@@ -55,6 +55,12 @@ namespace spades {
 	/** Generates a random `bool`. This function is thread-safe. */
 	inline bool SampleRandomBool() { return SampleRandom() & 0x1; }
 
+	/**
+	 * Makes the random numbers generated by the calling thread (and by the threads that
+	 * generate their first random number after this call) reproducible.
+	 */
+	void SeedRandom(std::uint_fast64_t seed);
+
 	/** Get a mutable reference to a random element from a container. */
 	template <class T> inline typename T::reference SampleRandomElement(T& container) {
 		auto begin = std::begin(container);
@@ -915,6 +921,28 @@ namespace spades {
 		vec.resize(vec.size() - 1);
 	}
 
+	/** Counts the number of set bits. */
+	static inline int PopCount64(uint64_t v) {
+#if defined(__POPCNT__) && (defined(__GNUC__) || defined(__clang__))
+		return __builtin_popcountll(v);
+#else
+		// The builtin compiles to a library call unless the target has `popcnt`
+		v = v - ((v >> 1) & 0x5555555555555555ULL);
+		v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+		v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+		return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+#endif
+	}
+
+	/** Returns the index of the least significant set bit. `v` must not be zero. */
+	static inline int CountTrailingZeros64(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(v);
+#else
+		return PopCount64((v & (0 - v)) - 1);
+#endif
+	}
+
 	float SmoothStep(float);
 	float Mix(float a, float b, float frac);
 	Vector2 Mix(const Vector2& a, const Vector2& b, float frac);
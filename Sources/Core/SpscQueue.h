@@ -0,0 +1,88 @@
+/*
+ Copyright (c) 2013 yvt
+
+ This file is part of OpenSpades.
+
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "Debug.h"
+
+namespace spades {
+	/**
+	 * A bounded lock-free FIFO queue for exactly one producer thread and one consumer
+	 * thread.
+	 *
+	 * `TryPush` must only be called by the producer and `TryPop` only by the consumer.
+	 * The capacity must be a power of two.
+	 */
+	template <class T> class SpscQueue {
+		std::unique_ptr<T[]> slots;
+		std::size_t mask;
+
+		// The indices only ever increase. Keep them in separate cache lines so that the
+		// producer and the consumer don't invalidate each other's cache.
+		char padding1[64];
+		/** The next slot to read. Written by the consumer. */
+		std::atomic<std::size_t> head{0};
+		char padding2[64];
+		/** The next slot to write. Written by the producer. */
+		std::atomic<std::size_t> tail{0};
+		char padding3[64];
+
+	public:
+		explicit SpscQueue(std::size_t capacity) : slots{new T[capacity]}, mask{capacity - 1} {
+			SPAssert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+		}
+
+		SpscQueue(const SpscQueue&) = delete;
+		void operator=(const SpscQueue&) = delete;
+
+		/** @return `false` if the queue is full. */
+		bool TryPush(T value) {
+			std::size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) > mask)
+				return false;
+
+			slots[t & mask] = std::move(value);
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		/** @return `false` if the queue is empty. */
+		bool TryPop(T& value) {
+			std::size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+
+			value = std::move(slots[h & mask]);
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		/** Can be called by either thread, but the result might be out of date. */
+		bool IsEmpty() const {
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+	};
+} // namespace spades
@@ -25,6 +25,7 @@
 #include "GLProfiler.h"
 #include "GLRenderer.h"
 #include <Client/GameMap.h>
+#include <Client/GameMapSnapshot.h>
 
 #include <Core/ConcurrentDispatch.h>
 
@@ -32,14 +33,16 @@ namespace spades {
 	namespace draw {
 		class GLAmbientShadowRenderer::UpdateDispatch : public ConcurrentDispatch {
 			GLAmbientShadowRenderer& renderer;
+			Handle<client::GameMapSnapshot> snapshot;
 
 		public:
 			std::atomic<bool> done{false};
-			UpdateDispatch(GLAmbientShadowRenderer& r) : renderer(r) {}
+			UpdateDispatch(GLAmbientShadowRenderer& r, Handle<client::GameMapSnapshot> snapshot)
+			    : renderer(r), snapshot(std::move(snapshot)) {}
 			void Run() override {
 				SPADES_MARK_FUNCTION();
 
-				renderer.UpdateDirtyChunks();
+				renderer.UpdateDirtyChunks(*snapshot);
 
 				done = true;
 			}
@@ -123,33 +126,46 @@ namespace spades {
 		/**
 		 * Evaluate the AO term at the point specified by given world coordinates.
 		 */
-		float GLAmbientShadowRenderer::Evaluate(IntVector3 ipos) {
+		float GLAmbientShadowRenderer::Evaluate(const client::GameMapSnapshot& snapshot,
+		                                        IntVector3 ipos) {
 			SPADES_MARK_FUNCTION_DEBUG();
 
 			float sum = 0.0F;
 			Vector3 pos = MakeVector3(ipos) + 0.5F;
 
-			for (int i = 0; i < NumRays; i++) {
-				Vector3 dir = rays[i];
-
-				unsigned int bits = i & 7;
-				if (bits & 1)
-					dir.x = -dir.x;
-				if (bits & 2)
-					dir.y = -dir.y;
-				if (bits & 4)
-					dir.z = -dir.z;
-
-				IntVector3 hitBlock;
-				float brightness = 1.0F;
-				if (map->CastRay(pos, dir, (float)RayLength, hitBlock)) {
-					float dist = ((MakeVector3(hitBlock) + 0.5F) - pos).GetSquaredLength();
-					brightness = dist * (1.0F / float((RayLength - 1) * (RayLength - 1)));
-					if (brightness > 1.0F)
-						brightness = 1.0F;
+			static_assert(NumRays % client::GameMap::RayPacket::MaxRays == 0,
+			              "NumRays must be a multiple of the ray packet size");
+			for (int i = 0; i < NumRays; i += client::GameMap::RayPacket::MaxRays) {
+				client::GameMap::RayPacket packet;
+				for (int k = 0; k < client::GameMap::RayPacket::MaxRays; k++) {
+					Vector3 dir = rays[i + k];
+
+					unsigned int bits = (i + k) & 7;
+					if (bits & 1)
+						dir.x = -dir.x;
+					if (bits & 2)
+						dir.y = -dir.y;
+					if (bits & 4)
+						dir.z = -dir.z;
+
+					packet.Add(pos, dir, (float)RayLength);
 				}
 
-				sum += brightness;
+				client::GameMap::RayPacketResult packetResult;
+				snapshot.CastRayPacket(packet, packetResult);
+
+				for (int k = 0; k < packet.numRays; k++) {
+					float brightness = 1.0F;
+					if (packetResult.hit[k]) {
+						IntVector3 hitBlock = packetResult.GetHitBlock(k);
+						float dist = ((MakeVector3(hitBlock) + 0.5F) - pos).GetSquaredLength();
+						brightness = dist * (1.0F / float((RayLength - 1) * (RayLength - 1)));
+						if (brightness > 1.0F)
+							brightness = 1.0F;
+					}
+
+					sum += brightness;
+				}
 			}
 
 			sum = std::min(sum * (2.f / (float)NumRays), 1.0f);
@@ -166,6 +182,25 @@ namespace spades {
 			           z + RayLength);
 		}
 
+		void GLAmbientShadowRenderer::GameMapChangesCommitted(const client::GameMapChanges& changes,
+		                                                      client::GameMap* map) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			if (map != this->map.GetPointerOrNull())
+				return;
+
+			if (!changes.IsCompact(RayLength * 2)) {
+				// Invalidating the bounding box would cover too many unaffected voxels
+				for (const IntVector3& v : changes.voxels)
+					GameMapChanged(v.x, v.y, v.z, map);
+				return;
+			}
+
+			const IntVector3& minCorner = changes.minCorner;
+			const IntVector3& maxCorner = changes.maxCorner;
+			Invalidate(minCorner.x - RayLength, minCorner.y - RayLength, minCorner.z - RayLength,
+			           maxCorner.x + RayLength, maxCorner.y + RayLength, maxCorner.z + RayLength);
+		}
+
 		void GLAmbientShadowRenderer::Invalidate(int minX, int minY, int minZ, int maxX, int maxY, int maxZ) {
 			SPADES_MARK_FUNCTION_DEBUG();
 			if (minZ < 0)
@@ -198,6 +233,9 @@ namespace spades {
 						int inMaxY = std::min(maxY - originY, ChunkSize - 1);
 						int inMaxZ = std::min(maxZ - originZ, ChunkSize - 1);
 
+						// Lets the dispatch know the chunk has changed since its snapshot
+						c.invalidatedVersion = map->GetVersion();
+
 						if (!c.dirty) {
 							c.dirtyMinX = inMinX;
 							c.dirtyMinY = inMinY;
@@ -221,7 +259,7 @@ namespace spades {
 
 		int GLAmbientShadowRenderer::GetNumDirtyChunks() {
 			return (int)std::count_if(chunks.begin(), chunks.end(),
-			                          [](const Chunk& c) { return c.dirty; });
+			                          [](const Chunk& c) { return c.dirty.load(); });
 		}
 
 		void GLAmbientShadowRenderer::Update() {
@@ -230,7 +268,8 @@ namespace spades {
 					dispatch->Join();
 					delete dispatch;
 				}
-				dispatch = new UpdateDispatch(*this);
+				// The dispatch works on a snapshot so the map can be modified in the meantime
+				dispatch = new UpdateDispatch(*this, map->CreateSnapshot());
 				dispatch->Start();
 			}
 
@@ -253,7 +292,7 @@ namespace spades {
 			}
 		}
 
-		void GLAmbientShadowRenderer::UpdateDirtyChunks() {
+		void GLAmbientShadowRenderer::UpdateDirtyChunks(const client::GameMapSnapshot& snapshot) {
 			std::array<std::size_t, 256> dirtyChunkIds;
 			std::size_t numDirtyChunks = 0;
 			int nearDirtyChunks = 0;
@@ -307,11 +346,12 @@ namespace spades {
 					std::swap(dirtyChunkIds[idx], dirtyChunkIds[numDirtyChunks - 1]);
 				numDirtyChunks--;
 
-				UpdateChunk(c.cx, c.cy, c.cz);
+				UpdateChunk(snapshot, c.cx, c.cy, c.cz);
 			}
 		}
 
-		void GLAmbientShadowRenderer::UpdateChunk(int cx, int cy, int cz) {
+		void GLAmbientShadowRenderer::UpdateChunk(const client::GameMapSnapshot& snapshot, int cx,
+		                                          int cy, int cz) {
 			Chunk& c = GetChunk(cx, cy, cz);
 			if (!c.dirty)
 				return;
@@ -346,43 +386,43 @@ namespace spades {
 						  z + wOriginZ,
 						};
 
-						if (map->IsSolidWrapped(pos.x, pos.y, pos.z)) {
+						if (snapshot.IsSolidWrapped(pos.x, pos.y, pos.z)) {
 							wData[z][y][x][0] = 0.0;
 							wData[z][y][x][1] = 0.0;
 						} else {
-							wData[z][y][x][0] = Evaluate(pos);
+							wData[z][y][x][0] = Evaluate(snapshot, pos);
 							wData[z][y][x][1] = 1.0;
 						}
 						// bit 0: solids
 						// bit 1: contact (by-surface voxel)
 						wFlags[z][y][x] =
-						  to_b(map->IsSolidWrapped(pos.x, pos.y, pos.z), 0) |
-						  to_b(map->IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y, pos.z) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y + 1, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y + 1, pos.z) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y + 1, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x, pos.y - 1, pos.z) |
-						         map->IsSolidWrapped(pos.x, pos.y - 1, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x, pos.y, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x, pos.y, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x, pos.y + 1, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x, pos.y + 1, pos.z) |
-						         map->IsSolidWrapped(pos.x, pos.y + 1, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y - 1, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y - 1, pos.z) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y - 1, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y, pos.z) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y, pos.z + 1) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y + 1, pos.z - 1) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y + 1, pos.z) |
-						         map->IsSolidWrapped(pos.x + 1, pos.y + 1, pos.z + 1),
+						  to_b(snapshot.IsSolidWrapped(pos.x, pos.y, pos.z), 0) |
+						  to_b(snapshot.IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y + 1, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y + 1, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y + 1, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x - 1, pos.y - 1, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y - 1, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y - 1, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y + 1, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y + 1, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x, pos.y + 1, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y - 1, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y - 1, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y - 1, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y, pos.z + 1) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y + 1, pos.z - 1) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y + 1, pos.z) |
+						         snapshot.IsSolidWrapped(pos.x + 1, pos.y + 1, pos.z + 1),
 						       1);
 					}
 
@@ -478,6 +518,10 @@ namespace spades {
 			}
 
 			c.dirty = false;
+			// Modifications made after the snapshot was taken need another update. `Invalidate`
+			// stores the version before setting `dirty`, so either check catches them.
+			if (c.invalidatedVersion > snapshot.GetVersion())
+				c.dirty = true;
 			c.transferDone = false;
 		}
 	} // namespace draw
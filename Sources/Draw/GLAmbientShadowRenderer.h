@@ -22,6 +22,7 @@
 
 #include <array>
 #include <atomic>
+#include <cstdint>
 #include <vector>
 
 #include "IGLDevice.h"
@@ -32,6 +33,8 @@
 namespace spades {
 	namespace client {
 		class GameMap;
+		class GameMapSnapshot;
+		struct GameMapChanges;
 	}
 	namespace draw {
 		class GLRenderer;
@@ -52,7 +55,9 @@ namespace spades {
 			struct Chunk {
 				int cx, cy, cz;
 				float data[ChunkSize][ChunkSize][ChunkSize][2];
-				bool dirty = true;
+				std::atomic<bool> dirty{true};
+				/** The `GameMap::GetVersion` value when the chunk was last invalidated. */
+				std::atomic<std::uint64_t> invalidatedVersion{0};
 				int dirtyMinX = 0, dirtyMaxX = ChunkSize - 1;
 				int dirtyMinY = 0, dirtyMaxY = ChunkSize - 1;
 				int dirtyMinZ = 0, dirtyMaxZ = ChunkSize - 1;
@@ -84,8 +89,8 @@ namespace spades {
 
 			void Invalidate(int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
 
-			void UpdateChunk(int cx, int cy, int cz);
-			void UpdateDirtyChunks();
+			void UpdateChunk(const client::GameMapSnapshot&, int cx, int cy, int cz);
+			void UpdateDirtyChunks(const client::GameMapSnapshot&);
 			int GetNumDirtyChunks();
 
 			UpdateDispatch* dispatch;
@@ -94,9 +99,10 @@ namespace spades {
 			GLAmbientShadowRenderer(GLRenderer& renderer, client::GameMap& map);
 			~GLAmbientShadowRenderer();
 
-			float Evaluate(IntVector3);
+			float Evaluate(const client::GameMapSnapshot&, IntVector3);
 
 			void GameMapChanged(int x, int y, int z, client::GameMap*);
+			void GameMapChangesCommitted(const client::GameMapChanges&, client::GameMap*);
 
 			void Update();
 
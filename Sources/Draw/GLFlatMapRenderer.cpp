@@ -18,6 +18,8 @@
 
  */
 
+#include <algorithm>
+
 #include "GLFlatMapRenderer.h"
 #include "GLImage.h"
 #include "GLRenderer.h"
@@ -33,10 +35,28 @@ namespace spades {
 
 			chunkRows = m.Height() >> ChunkBits;
 			chunkCols = m.Width() >> ChunkBits;
+
+			// If the map is still being loaded, generate the loaded part only and leave
+			// the rest to `UpdateChunks`
+			int numLoadedChunkRows = m.GetNumLoadedRows() >> ChunkBits;
 			for (int i = 0; i < chunkRows * chunkCols; i++)
-				chunkInvalid.push_back(false);
+				chunkInvalid.push_back(i / chunkCols >= numLoadedChunkRows);
 
-			Handle<Bitmap> bmp(GenerateBitmap(0, 0, m.Width(), m.Height()), false);
+			Handle<Bitmap> bmp;
+			if (numLoadedChunkRows == chunkRows) {
+				bmp = Handle<Bitmap>(GenerateBitmap(0, 0, m.Width(), m.Height()), false);
+			} else {
+				bmp = Handle<Bitmap>::New(m.Width(), m.Height());
+				uint32_t* pixels = bmp->GetPixels();
+				std::fill(pixels, pixels + m.Width() * m.Height(), 0xff000000U);
+				if (numLoadedChunkRows > 0) {
+					Handle<Bitmap> loaded(
+					  GenerateBitmap(0, 0, m.Width(), numLoadedChunkRows << ChunkBits), false);
+					std::copy(loaded->GetPixels(),
+					          loaded->GetPixels() + loaded->GetWidth() * loaded->GetHeight(),
+					          pixels);
+				}
+			}
 			image = renderer.CreateImage(*bmp).Cast<GLImage>();
 
 			image->Bind(IGLDevice::Texture2D);
@@ -100,6 +120,9 @@ namespace spades {
 				int chunkX = ((int)i) % chunkCols;
 				int chunkY = ((int)i) / chunkCols;
 
+				if (!map->AreRowsLoaded(chunkY * ChunkSize, chunkY * ChunkSize + ChunkSize - 1))
+					continue;
+
 				Handle<Bitmap> bmp(GenerateBitmap(chunkX * ChunkSize,
 					chunkY * ChunkSize, ChunkSize, ChunkSize), false);
 				try {
@@ -18,6 +18,8 @@
 
  */
 
+#include <algorithm>
+
 #include "GLMapRenderer.h"
 #include "GLDynamicLightShader.h"
 #include "GLImage.h"
@@ -115,6 +117,38 @@ namespace spades {
 			}
 		}
 
+		void GLMapRenderer::GameMapChangesCommitted(const client::GameMapChanges& changes,
+		                                            client::GameMap* map) {
+			SPADES_MARK_FUNCTION_DEBUG();
+
+			if (changes.IsCompact(GLMapChunk::Size)) {
+				// The box spans at most three chunks along each axis
+				InvalidateChunks(changes.minCorner, changes.maxCorner);
+				return;
+			}
+
+			for (const IntVector3& v : changes.voxels)
+				InvalidateChunks(v, v);
+		}
+
+		void GLMapRenderer::InvalidateChunks(IntVector3 minCorner, IntVector3 maxCorner) {
+			// The meshes of the neighboring chunks depend on the voxels adjacent to them
+			int minX = (minCorner.x - 1) >> GLMapChunk::SizeBits;
+			int minY = (minCorner.y - 1) >> GLMapChunk::SizeBits;
+			int minZ = std::max((minCorner.z - 1) >> GLMapChunk::SizeBits, 0);
+			int maxX = std::min((maxCorner.x + 1) >> GLMapChunk::SizeBits,
+			                    minX + numChunkWidth - 1);
+			int maxY = std::min((maxCorner.y + 1) >> GLMapChunk::SizeBits,
+			                    minY + numChunkHeight - 1);
+			int maxZ = std::min((maxCorner.z + 1) >> GLMapChunk::SizeBits, numChunkDepth - 1);
+
+			for (int cx = minX; cx <= maxX; cx++)
+				for (int cy = minY; cy <= maxY; cy++)
+					for (int cz = minZ; cz <= maxZ; cz++)
+						GetChunk(cx & (numChunkWidth - 1), cy & (numChunkHeight - 1), cz)
+						  ->SetNeedsUpdate();
+		}
+
 		void GLMapRenderer::RealizeChunks(spades::Vector3 eye) {
 			SPADES_MARK_FUNCTION();
 
@@ -123,9 +157,14 @@ namespace spades {
 			for (int i = 0; i < numChunks; i++) {
 				float dist = chunks[i]->DistanceFromEye(eye);
 				chunkInfos[i].distance = dist;
-				if (dist < cullDistance)
-					chunks[i]->SetRealized(true);
-				else if (dist > releaseDistance)
+				if (dist < cullDistance) {
+					// Don't build a mesh from rows that are still being downloaded. The ambient
+					// occlusion computation looks up to two voxels beyond the chunk.
+					int cy = (i / numChunkDepth) % numChunkHeight;
+					if (gameMap->AreRowsLoaded(cy * GLMapChunk::Size - 2,
+					                           (cy + 1) * GLMapChunk::Size + 1))
+						chunks[i]->SetRealized(true);
+				} else if (dist > releaseDistance)
 					chunks[i]->SetRealized(false);
 			}
 		}
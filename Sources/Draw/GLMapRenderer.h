@@ -70,6 +70,9 @@ namespace spades {
 
 			void RealizeChunks(Vector3 eye);
 
+			/** Marks the chunks affected by the voxels in `[minCorner, maxCorner]` as outdated. */
+			void InvalidateChunks(IntVector3 minCorner, IntVector3 maxCorner);
+
 			void DrawColumnDepth(int cx, int cy, int cz, Vector3 eye);
 			void DrawColumnSunlight(int cx, int cy, int cz, Vector3 eye);
 			void DrawColumnDLight(int cx, int cy, int cz, Vector3 eye,
@@ -84,6 +87,7 @@ namespace spades {
 			static void PreloadShaders(GLRenderer&);
 
 			void GameMapChanged(int x, int y, int z, client::GameMap*);
+			void GameMapChangesCommitted(const client::GameMapChanges&, client::GameMap*);
 
 			client::GameMap* GetMap() { return gameMap; }
 
@@ -92,6 +92,11 @@ namespace spades {
 				if (updateBitmap[i] == 0)
 					continue;
 
+				// `GeneratePixel` reads `d` rows ahead. Rows are loaded in the increasing
+				// order, so the remaining ones are processed in a later frame.
+				if (!map->AreRowsLoaded(y, y + d))
+					break;
+
 				size_t bitmapPixelPosBase = i * 32;
 
 				uint32_t pixels[32];
@@ -47,12 +47,21 @@ namespace spades {
 			renderer.RegisterProgram("Shaders/OptimizedVoxelModelShadowMap.program");
 			renderer.RegisterImage("Gfx/AmbientOcclusion.png");
 		}
+		GLOptimizedVoxelModel::Mesh::Mesh(VoxelModel& m) {
+			SPADES_MARK_FUNCTION();
+
+			BuildVertices(&m);
+			PackTexture();
+		}
+
 		GLOptimizedVoxelModel::GLOptimizedVoxelModel(VoxelModel* m, GLRenderer& r)
+		    : GLOptimizedVoxelModel(*m, Mesh(*m), r) {}
+
+		GLOptimizedVoxelModel::GLOptimizedVoxelModel(VoxelModel& m, Mesh&& mesh, GLRenderer& r)
 		    : renderer{r}, device{r.GetGLDevice()} {
 			SPADES_MARK_FUNCTION();
 
-			BuildVertices(m);
-			GenerateTexture();
+			image = renderer.CreateImage(*mesh.atlas).Cast<GLImage>();
 
 			if (r.GetSettings().r_physicalLighting)
 				program = renderer.RegisterProgram("Shaders/OptimizedVoxelModelPhys.program");
@@ -62,6 +71,9 @@ namespace spades {
 			shadowMapProgram = renderer.RegisterProgram("Shaders/OptimizedVoxelModelShadowMap.program");
 			aoImage = renderer.RegisterImage("Gfx/AmbientOcclusion.png").Cast<GLImage>();
 
+			const std::vector<Vertex>& vertices = mesh.vertices;
+			const std::vector<uint32_t>& indices = mesh.indices;
+
 			buffer = device.GenBuffer();
 			device.BindBuffer(IGLDevice::ArrayBuffer, buffer);
 			device.BufferData(IGLDevice::ArrayBuffer,
@@ -75,12 +87,12 @@ namespace spades {
 			                  indices.data(), IGLDevice::StaticDraw);
 			device.BindBuffer(IGLDevice::ArrayBuffer, 0);
 
-			origin = m->GetOrigin();
+			origin = m.GetOrigin();
 			origin -= 0.5F; // (0,0,0) is center of voxel (0,0,0)
 
-			dimensions.x = m->GetWidth();
-			dimensions.y = m->GetHeight();
-			dimensions.z = m->GetDepth();
+			dimensions.x = m.GetWidth();
+			dimensions.y = m.GetHeight();
+			dimensions.z = m.GetDepth();
 
 			Vector3 minPos = {0, 0, 0};
 			Vector3 maxPos = MakeVector3(dimensions);
@@ -96,10 +108,7 @@ namespace spades {
 			boundingBox.min = minPos;
 			boundingBox.max = maxPos;
 
-			// clean up
 			numIndices = (unsigned int)indices.size();
-			std::vector<Vertex>().swap(vertices);
-			std::vector<uint32_t>().swap(indices);
 		}
 		GLOptimizedVoxelModel::~GLOptimizedVoxelModel() {
 			SPADES_MARK_FUNCTION();
@@ -108,7 +117,7 @@ namespace spades {
 			device.DeleteBuffer(buffer);
 		}
 
-		void GLOptimizedVoxelModel::GenerateTexture() {
+		void GLOptimizedVoxelModel::Mesh::PackTexture() {
 			BitmapAtlasGenerator atlasGen;
 			std::map<Bitmap*, int> idx;
 			std::vector<IntVector3> poss;
@@ -118,7 +127,7 @@ namespace spades {
 			}
 
 			BitmapAtlasGenerator::Result result = atlasGen.Pack();
-			Handle<Bitmap> bmp(result.bitmap, false);
+			atlas = Handle<Bitmap>(result.bitmap, false);
 			SPAssert(result.items.size() == bmps.size());
 			for (size_t i = 0; i < bmps.size(); i++)
 				bmps[i]->Release();
@@ -142,12 +151,10 @@ namespace spades {
 			}
 
 			std::vector<uint16_t>().swap(bmpIndex);
-
-			image = renderer.CreateImage(*bmp).Cast<GLImage>();
 		}
 
-		uint8_t GLOptimizedVoxelModel::calcAOID(VoxelModel* m, int x, int y, int z, int ux, int uy,
-		                                        int uz, int vx, int vy, int vz) {
+		uint8_t GLOptimizedVoxelModel::Mesh::calcAOID(VoxelModel* m, int x, int y, int z, int ux,
+		                                              int uy, int uz, int vx, int vy, int vz) {
 			int v = 0;
 			if (m->IsSolid(x - ux, y - uy, z - uz))
 				v |= 1;
@@ -232,10 +239,10 @@ namespace spades {
 			return (x1 - x3) * (y2 - y1) - (x1 - x2) * (y3 - y1);
 		}
 
-		void GLOptimizedVoxelModel::EmitSlice(uint8_t* slice, int usize, int vsize, int sx, int sy,
-		                                      int sz, int ux, int uy, int uz, int vx, int vy,
-		                                      int vz, int mx, int my, int mz, bool flip,
-		                                      VoxelModel* model) {
+		void GLOptimizedVoxelModel::Mesh::EmitSlice(uint8_t* slice, int usize, int vsize, int sx,
+		                                            int sy, int sz, int ux, int uy, int uz, int vx,
+		                                            int vy, int vz, int mx, int my, int mz, bool flip,
+		                                            VoxelModel* model) {
 			SPADES_MARK_FUNCTION();
 			int minU = -1, minV = -1, maxU = -1, maxV = -1;
 
@@ -418,7 +425,7 @@ namespace spades {
 			}
 		}
 
-		void GLOptimizedVoxelModel::BuildVertices(spades::VoxelModel* model) {
+		void GLOptimizedVoxelModel::Mesh::BuildVertices(spades::VoxelModel* model) {
 			SPADES_MARK_FUNCTION();
 
 			SPAssert(vertices.empty());
@@ -24,6 +24,7 @@
 
 #include "GLModel.h"
 #include "IGLDevice.h"
+#include <Core/Bitmap.h>
 #include <Core/VoxelModel.h>
 
 namespace spades {
@@ -46,6 +47,34 @@ namespace spades {
 				uint8_t padding2;
 			};
 
+		public:
+			/**
+			 * The vertices and the texture atlas of a model. Building them doesn't use the
+			 * renderer, so it can be done on any thread.
+			 */
+			class Mesh {
+				friend class GLOptimizedVoxelModel;
+
+				std::vector<Vertex> vertices;
+				std::vector<uint32_t> indices;
+				std::vector<uint16_t> bmpIndex; // bmp id for vertex (not index)
+				std::vector<Bitmap*> bmps;
+				Handle<Bitmap> atlas;
+
+				uint8_t calcAOID(VoxelModel*, int x, int y, int z,
+					int ux, int uy, int uz, int vx, int vy, int vz);
+				// v major
+				void EmitSlice(uint8_t* slice, int usize, int vsize, int sx, int sy, int sz, int ux,
+				               int uy, int uz, int vx, int vy, int vz, int mx, int my, int mz,
+				               bool flip, VoxelModel*);
+				void BuildVertices(VoxelModel*);
+				void PackTexture();
+
+			public:
+				Mesh(VoxelModel&);
+			};
+
+		private:
 			GLRenderer& renderer;
 			// TODO: `*this` might outlive `GLRenderer`. Needs a safeguard!
 			IGLDevice& device;
@@ -57,10 +86,6 @@ namespace spades {
 
 			IGLDevice::UInteger buffer;
 			IGLDevice::UInteger idxBuffer;
-			std::vector<Vertex> vertices;
-			std::vector<uint32_t> indices;
-			std::vector<uint16_t> bmpIndex; // bmp id for vertex (not index)
-			std::vector<Bitmap*> bmps;
 			unsigned int numIndices;
 
 			Vector3 origin;
@@ -69,20 +94,13 @@ namespace spades {
 
 			AABB3 boundingBox;
 
-			uint8_t calcAOID(VoxelModel*, int x, int y, int z,
-				int ux, int uy, int uz, int vx, int vy, int vz);
-			// v major
-			void EmitSlice(uint8_t* slice, int usize, int vsize, int sx, int sy, int sz, int ux,
-			               int uy, int uz, int vx, int vy, int vz, int mx, int my, int mz,
-			               bool flip, VoxelModel*);
-			void BuildVertices(VoxelModel*);
-			void GenerateTexture();
-
 		protected:
 			~GLOptimizedVoxelModel();
 
 		public:
 			GLOptimizedVoxelModel(VoxelModel*, GLRenderer& r);
+			/** Uploads `mesh` built from `VoxelModel`. Must be called on the renderer's thread. */
+			GLOptimizedVoxelModel(VoxelModel&, Mesh&& mesh, GLRenderer& r);
 
 			static void PreloadShaders(GLRenderer&);
 
@@ -20,6 +20,7 @@
 
 #include <cstdarg>
 #include <cstdlib>
+#include <memory>
 
 #include "GLAmbientShadowRenderer.h"
 #include "GLAutoExposureFilter.h"
@@ -281,6 +282,17 @@ namespace spades {
 			return Handle<GLOptimizedVoxelModel>::New(&model, *this).Cast<client::IModel>();
 		}
 
+		std::function<Handle<client::IModel>()>
+		GLRenderer::PrepareModel(spades::VoxelModel& model) {
+			SPADES_MARK_FUNCTION();
+			Handle<VoxelModel> m{model};
+			auto mesh = std::make_shared<GLOptimizedVoxelModel::Mesh>(model);
+			return [this, m, mesh] {
+				return Handle<GLOptimizedVoxelModel>::New(*m, std::move(*mesh), *this)
+				  .Cast<client::IModel>();
+			};
+		}
+
 		void GLRenderer::EnsureInitialized() {
 			SPADES_MARK_FUNCTION_DEBUG();
 			if (modelManager == NULL)
@@ -292,6 +304,8 @@ namespace spades {
 
 			if (newMap)
 				EnsureInitialized();
+			if (newMap.get_pointer() == map)
+				return;
 
 			client::GameMap* oldMap = map;
 
@@ -307,6 +321,7 @@ namespace spades {
 			waterRenderer.reset();
 			delete ambientShadowRenderer;
 			ambientShadowRenderer = NULL;
+			mapLoading = false;
 
 			if (newMap) {
 				SPLog("Creating new renderers...");
@@ -317,16 +332,14 @@ namespace spades {
 				mapRenderer = new GLMapRenderer(newMap.get_pointer(), *this);
 				SPLog("Creating Minimap Renderer");
 				flatMapRenderer = new GLFlatMapRenderer(*this, *newMap);
-				SPLog("Creating Water Renderer");
-				waterRenderer.reset(new GLWaterRenderer(*this, newMap.get_pointer()));
-
-				if (settings.r_radiosity) {
-					SPLog("Creating Ray-traced Ambient Occlusion Renderer");
-					ambientShadowRenderer = new GLAmbientShadowRenderer(*this, *newMap);
-					SPLog("Creating Relective Shadow Maps Renderer");
-					radiosityRenderer = new GLRadiosityRenderer(*this, newMap.get_pointer());
+
+				// The remaining renderers process the whole map at once. If the map is still
+				// being downloaded, they are created by `UpdateLoadingMap` when it's complete.
+				mapLoading = newMap->GetNumLoadedRows() < newMap->Height();
+				if (mapLoading) {
+					SPLog("Map is still being loaded; deferring the creation of other renderers");
 				} else {
-					SPLog("Radiosity is disabled");
+					CreateFullMapRenderers(*newMap);
 				}
 
 				newMap->AddListener(this);
@@ -342,6 +355,40 @@ namespace spades {
 			}
 		}
 
+		void GLRenderer::CreateFullMapRenderers(client::GameMap& newMap) {
+			SPADES_MARK_FUNCTION();
+
+			SPLog("Creating Water Renderer");
+			waterRenderer.reset(new GLWaterRenderer(*this, &newMap));
+
+			if (settings.r_radiosity) {
+				SPLog("Creating Ray-traced Ambient Occlusion Renderer");
+				ambientShadowRenderer = new GLAmbientShadowRenderer(*this, newMap);
+				SPLog("Creating Relective Shadow Maps Renderer");
+				radiosityRenderer = new GLRadiosityRenderer(*this, &newMap);
+			} else {
+				SPLog("Radiosity is disabled");
+			}
+		}
+
+		void GLRenderer::UpdateLoadingMap() {
+			SPADES_MARK_FUNCTION();
+
+			SPAssert(map);
+
+			// Check this first so the last rows are not missed by `UpdateChunks`
+			bool complete = map->GetNumLoadedRows() == map->Height();
+
+			if (flatMapRenderer)
+				flatMapRenderer->UpdateChunks();
+
+			if (complete) {
+				SPLog("Map loading completed; creating remaining renderers...");
+				CreateFullMapRenderers(*map);
+				mapLoading = false;
+			}
+		}
+
 		float GLRenderer::ScreenWidth() {
 			return static_cast<float>(device->ScreenWidth());
 		}
@@ -515,6 +562,30 @@ namespace spades {
 			spriteRenderer->Add(&glImage, center, radius, rotation, drawColorAlphaPremultiplied);
 		}
 
+		void GLRenderer::AddSprites(client::IImage& img, const client::SpriteParam* sprites,
+		                            std::size_t count) {
+			SPADES_MARK_FUNCTION_DEBUG();
+
+			if (count == 0)
+				return;
+
+			GLImage& glImage = dynamic_cast<GLImage&>(img);
+
+			EnsureInitialized();
+			EnsureSceneStarted();
+
+			for (std::size_t i = 0; i < count; i++) {
+				const client::SpriteParam& sprite = sprites[i];
+				if (!SphereFrustrumCull(sprite.center, sprite.radius * 1.5F))
+					continue;
+				spriteRenderer->Add(&glImage, sprite.center, sprite.radius, sprite.rotation,
+				                    sprite.color);
+			}
+
+			legacyColorPremultiply = false;
+			drawColorAlphaPremultiplied = sprites[count - 1].color;
+		}
+
 		void GLRenderer::AddLongSprite(client::IImage& img, spades::Vector3 p1, spades::Vector3 p2,
 		                               float radius) {
 			SPADES_MARK_FUNCTION_DEBUG();
@@ -714,6 +785,8 @@ namespace spades {
 
 			{
 				GLProfiler::Context p(*profiler, "Upload Dynamic Data");
+				if (mapLoading)
+					UpdateLoadingMap();
 				if (mapShadowRenderer)
 					mapShadowRenderer->Update();
 				if (ambientShadowRenderer)
@@ -793,7 +866,9 @@ namespace spades {
 
 						GLFramebufferManager::BufferHandle handle;
 						handle = fbManager->StartPostProcessing();
-						if (settings.ShouldUseFogFilter2()) {
+						// `GLFogFilter2` requires the radiosity renderers, which are not
+						// available until the map is fully loaded
+						if (settings.ShouldUseFogFilter2() && radiosityRenderer) {
 							if (!fogFilter2)
 								fogFilter2.reset(new GLFogFilter2(*this));
 
@@ -878,7 +953,7 @@ namespace spades {
 
 				if (settings.r_fogShadow && mapShadowRenderer) {
 					GLProfiler::Context p(*profiler, "Volumetric Fog");
-					if (settings.ShouldUseFogFilter2()) {
+					if (settings.ShouldUseFogFilter2() && radiosityRenderer) {
 						if (!fogFilter2)
 							fogFilter2.reset(new GLFogFilter2(*this));
 
@@ -1326,6 +1401,22 @@ namespace spades {
 				ambientShadowRenderer->GameMapChanged(x, y, z, map);
 		}
 
+		void GLRenderer::GameMapChangesCommitted(const client::GameMapChanges& changes,
+		                                         client::GameMap* map) {
+			if (mapRenderer)
+				mapRenderer->GameMapChangesCommitted(changes, map);
+			for (const IntVector3& v : changes.voxels) {
+				if (flatMapRenderer)
+					flatMapRenderer->GameMapChanged(v.x, v.y, v.z, *map);
+				if (mapShadowRenderer)
+					mapShadowRenderer->GameMapChanged(v.x, v.y, v.z, map);
+				if (waterRenderer)
+					waterRenderer->GameMapChanged(v.x, v.y, v.z, map);
+			}
+			if (ambientShadowRenderer)
+				ambientShadowRenderer->GameMapChangesCommitted(changes, map);
+		}
+
 		bool GLRenderer::BoxFrustrumCull(const AABB3& box) {
 			if (renderingMirror) {
 				// reflect
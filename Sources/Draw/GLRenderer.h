@@ -105,6 +105,9 @@ namespace spades {
 			GLAmbientShadowRenderer* ambientShadowRenderer;
 			GLRadiosityRenderer* radiosityRenderer;
 
+			/** `true` if `map` is still being loaded and `CreateFullMapRenderers` is pending. */
+			bool mapLoading = false;
+
 			GLCameraBlurFilter* cameraBlur;
 			GLLensDustFilter* lensDustFilter;
 			GLAutoExposureFilter* autoExposureFilter;
@@ -146,6 +149,9 @@ namespace spades {
 			void RenderGhosts();
 
 			void EnsureInitialized();
+
+			void CreateFullMapRenderers(client::GameMap&);
+			void UpdateLoadingMap();
 			void EnsureSceneStarted();
 			void EnsureSceneNotStarted();
 
@@ -169,6 +175,7 @@ namespace spades {
 
 			Handle<client::IImage> CreateImage(Bitmap&) override;
 			Handle<client::IModel> CreateModel(VoxelModel&) override;
+			std::function<Handle<client::IModel>()> PrepareModel(VoxelModel&) override;
 
 			GLProgram* RegisterProgram(const std::string& name);
 			GLShader* RegisterShader(const std::string& name);
@@ -190,6 +197,8 @@ namespace spades {
 			void AddDebugLine(Vector3 a, Vector3 b, Vector4 color) override;
 
 			void AddSprite(client::IImage&, Vector3 center, float radius, float rotation) override;
+			void AddSprites(client::IImage&, const client::SpriteParam* sprites,
+			                std::size_t count) override;
 			void AddLongSprite(client::IImage&, Vector3 p1, Vector3 p2, float radius) override;
 
 			void EndScene() override;
@@ -241,6 +250,8 @@ namespace spades {
 			bool IsRenderingMirror() const { return renderingMirror; }
 
 			void GameMapChanged(int x, int y, int z, client::GameMap*) override;
+			void GameMapChangesCommitted(const client::GameMapChanges&,
+			                             client::GameMap*) override;
 
 			const client::SceneDefinition& GetSceneDef() const { return sceneDef; }
 
@@ -44,6 +44,11 @@ namespace spades {
 			updateMap2.resize(w * h / 32);
 			std::fill(updateMap2.begin(), updateMap2.end(), 0xffffffff);
 
+			if (map->GetNumLoadedRows() < h) {
+				// The rows being loaded are filled by later calls to `Update`
+				std::fill(img->GetRawBitmap(), img->GetRawBitmap() + w * h, 0);
+			}
+
 			Update(true);
 		}
 
@@ -62,10 +67,22 @@ namespace spades {
 			}
 			auto *outPixels = img->GetRawBitmap();
 
+			// `SWRenderer` creates the map renderer after the map is fully loaded
 			auto *mapRenderer = r.mapRenderer.get();
 
+			const int numLoadedRows = map->GetNumLoadedRows();
+
 			int idx = 0;
 			for (int y = 0; y < h; y++) {
+				if (y >= numLoadedRows) {
+					// Defer the rows still being loaded to a later call
+					std::lock_guard<std::mutex> lock(updateInfoLock);
+					for (std::size_t i = idx; i < updateMap.size(); i++)
+						updateMap[i] |= updateMap2[i];
+					needsUpdate = true;
+					break;
+				}
+
 				for (int x = 0; x < w; x += 32) {
 					uint32_t upd = updateMap2[idx];
 					if (upd) {
@@ -73,7 +90,7 @@ namespace spades {
 							if (upd & 1) {
 								auto c = GeneratePixel(x + i, y);
 								outPixels[i] = c;
-								if (!firstTime) {
+								if (!firstTime && mapRenderer) {
 									mapRenderer->UpdateRle(x + i, y);
 									mapRenderer->UpdateRle((x + i + 1) & (w - 1), y);
 									mapRenderer->UpdateRle((x + i - 1) & (w - 1), y);
@@ -109,5 +126,12 @@ namespace spades {
 			needsUpdate = true;
 			updateMap[(x + y * w) >> 5] |= 1 << (x & 31);
 		}
+
+		void SWFlatMapRenderer::SetNeedsUpdate(const client::GameMapChanges &changes) {
+			std::lock_guard<std::mutex> lock(updateInfoLock);
+			needsUpdate = true;
+			for (const IntVector3 &v : changes.voxels)
+				updateMap[(v.x + v.y * w) >> 5] |= 1 << (v.x & 31);
+		}
 	} // namespace draw
 } // namespace spades
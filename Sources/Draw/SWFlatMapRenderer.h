@@ -28,6 +28,7 @@
 namespace spades {
 	namespace client {
 		class GameMap;
+		struct GameMapChanges;
 	}
 	namespace draw {
 		class SWRenderer;
@@ -56,6 +57,7 @@ namespace spades {
 
 			void Update(bool firstTime = false);
 			void SetNeedsUpdate(int x, int y);
+			void SetNeedsUpdate(const client::GameMapChanges &);
 		};
 	} // namespace draw
 } // namespace spades
@@ -185,7 +185,12 @@ namespace spades {
 			if (this->map) {
 				this->map->AddListener(this);
 				flatMapRenderer = std::make_shared<SWFlatMapRenderer>(*this, map);
-				mapRenderer = std::make_shared<SWMapRenderer>(*this, map.get_pointer(), featureLevel);
+
+				// `SWMapRenderer` processes the whole map at once. If the map is still being
+				// downloaded, it's created by `EndScene` when it's complete.
+				if (map->GetNumLoadedRows() == map->Height())
+					mapRenderer =
+					  std::make_shared<SWMapRenderer>(*this, map.get_pointer(), featureLevel);
 			}
 		}
 
@@ -708,11 +713,19 @@ namespace spades {
 			          0x7F7F7F);
 
 			// draw map
-			if (mapRenderer) {
+			if (flatMapRenderer) {
 				// flat map renderer sends 'Update RLE' to map renderer.
 				// rendering map before this leads to the corrupted renderer image.
 				flatMapRenderer->Update();
-				mapRenderer->Render(sceneDef, *fb, depthBuffer.data());
+
+				if (!mapRenderer && map->GetNumLoadedRows() == map->Height()) {
+					// The map has finished loading
+					mapRenderer =
+					  std::make_shared<SWMapRenderer>(*this, map.GetPointerOrNull(), featureLevel);
+				}
+
+				if (mapRenderer)
+					mapRenderer->Render(sceneDef, *fb, depthBuffer.data());
 			}
 
 			// draw models
@@ -1102,5 +1115,13 @@ namespace spades {
 
 			flatMapRenderer->SetNeedsUpdate(x, y);
 		}
+
+		void SWRenderer::GameMapChangesCommitted(const client::GameMapChanges& changes,
+		                                         client::GameMap* map) {
+			if (map != this->map.GetPointerOrNull())
+				return;
+
+			flatMapRenderer->SetNeedsUpdate(changes);
+		}
 	} // namespace draw
 } // namespace spades
\ No newline at end of file
@@ -208,6 +208,8 @@ namespace spades {
 			const Matrix4 &GetViewMatrix() const { return viewMatrix; }
 
 			void GameMapChanged(int x, int y, int z, client::GameMap *) override;
+			void GameMapChangesCommitted(const client::GameMapChanges &,
+			                             client::GameMap *) override;
 
 			const client::SceneDefinition &GetSceneDef() const { return sceneDef; }
 
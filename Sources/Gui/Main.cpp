@@ -177,12 +177,14 @@ namespace {
 	bool g_autoconnect = false;
 	std::string g_autoconnectHostName;
 	spades::ProtocolVersion g_autoconnectProtocolVersion = spades::ProtocolVersion::v075;
+	std::string g_demoFileName;
 
 	bool g_printVersion = false;
 	bool g_printHelp = false;
 
 	void printHelp(char* binaryName) {
-		printf("usage: %s [server_address] [v=protocol_version] [-h|--help] [-v|--version] \n",
+		printf("usage: %s [server_address] [v=protocol_version] [--demo demo_file] [-h|--help] "
+		       "[-v|--version] \n",
 		       binaryName);
 	}
 
@@ -197,6 +199,11 @@ namespace {
 				g_autoconnectHostName = a;
 				return ++i;
 			}
+			if (!strcasecmp(a, "--demo") && i + 1 < argc) {
+				g_autoconnect = true;
+				g_demoFileName = argv[++i];
+				return ++i;
+			}
 			if (std::regex_match(a, v075Regex)) {
 				g_autoconnectProtocolVersion = spades::ProtocolVersion::v075;
 				return ++i;
@@ -222,23 +229,26 @@ namespace {
 namespace spades {
 	std::string g_userResourceDirectory;
 
-	void StartClient(const spades::ServerAddress& addr) {
+	void StartClient(const spades::ServerAddress& addr, const std::string& demoFileName) {
 		class ConcreteRunner : public spades::gui::Runner {
 			spades::ServerAddress addr;
+			std::string demoFileName;
 
 		protected:
 			spades::gui::View* CreateView(spades::client::IRenderer* renderer,
 			                              spades::client::IAudioDevice* audio) override {
 				auto fontManager = Handle<client::FontManager>::New(renderer);
-				auto innerView = Handle<client::Client>::New(renderer, audio, addr, fontManager);
+				auto innerView =
+				  Handle<client::Client>::New(renderer, audio, addr, fontManager, demoFileName);
 				return new spades::gui::ConsoleScreen(renderer, audio, fontManager,
 				                                      std::move(innerView).Cast<gui::View>());
 			}
 
 		public:
-			ConcreteRunner(const spades::ServerAddress& addr) : addr(addr) {}
+			ConcreteRunner(const spades::ServerAddress& addr, const std::string& demoFileName)
+			    : addr(addr), demoFileName(demoFileName) {}
 		};
-		ConcreteRunner runner(addr);
+		ConcreteRunner runner(addr, demoFileName);
 		runner.RunProtected();
 	}
 	void StartMainScreen() {
@@ -601,7 +611,7 @@ int main(int argc, char** argv) {
 			splashWindow.reset();
 
 			spades::ServerAddress host(g_autoconnectHostName, g_autoconnectProtocolVersion);
-			spades::StartClient(host);
+			spades::StartClient(host, g_demoFileName);
 		}
 
 		spades::Settings::GetInstance()->Flush();
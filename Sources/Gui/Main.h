@@ -28,6 +28,7 @@ namespace spades {
 	/** The path to the user resource directory. Can be empty. */
 	extern std::string g_userResourceDirectory;
 
-	void StartClient(const ServerAddress&);
+	/** Connects to the server, or plays the demo (a path in the user resource directory). */
+	void StartClient(const ServerAddress&, const std::string& demoFileName = std::string());
 	void StartMainScreen();
 } // namespace spades
\ No newline at end of file